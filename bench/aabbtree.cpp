@@ -0,0 +1,534 @@
+#include "bench/bench.hpp"
+#include "bench/common.hpp"
+#include "inc/physics/aabb.hpp"
+#include "inc/physics/aabbsimd.hpp"
+#include "inc/physics/quantizedtree.hpp"
+#include "inc/physics/widetree.hpp"
+
+#include <algorithm>
+#include <random>
+#include <stack>
+#include <string>
+
+using namespace phy;
+
+namespace {
+#ifdef PHY_AABB_SOA
+const std::string layout = "soa ";
+#else
+const std::string layout = "aos ";
+#endif
+
+struct CountingCallback : public AABBCallback {
+    size_t count = 0;
+    virtual bool registerCollision(int32_t nodeA, int32_t nodeB) override
+    {
+        count++;
+        return true;
+    }
+};
+
+/**
+ * The traversal AABBTree::findCollisions used before it had an inline
+ * stack, kept here as a reference point.
+ */
+size_t stackTraversal(const std::vector<AABBNode> &nodes, int32_t root, int32_t index)
+{
+    size_t count = 0;
+    const AABB aabb = nodes[index].aabb;
+    std::stack<int32_t> stack;
+    stack.push(root);
+    while (stack.size() > 0) {
+        int32_t top = stack.top();
+        stack.pop();
+
+        if (top == AABBNode::null)
+            continue;
+
+        const AABBNode *node = &nodes[top];
+        if (index != top && node->aabb.overlaps(aabb)) {
+            if (node->isLeaf()) {
+                count++;
+            } else {
+                stack.push(node->leftChild);
+                stack.push(node->rightChild);
+            }
+        }
+    }
+    return count;
+}
+} /* namespace */
+
+BENCHMARK(FindCollisions)
+{
+    for (size_t leaves : {1000, 10000, 100000}) {
+        const auto name = "FindCollisions/" + std::to_string(leaves);
+        auto boxes = bench::uniformBoxes(leaves);
+
+        AABBTree tree;
+        std::vector<int32_t> proxies;
+        for (const auto &box : boxes)
+            proxies.push_back(tree.insertAABB(box));
+
+        // Query every leaf a few times so small trees get stable numbers.
+        const size_t rounds = 1000000 / leaves;
+        const size_t queries = rounds * proxies.size();
+
+        CountingCallback callback;
+        size_t allocs = bench::allocations();
+        bench::Timer timer;
+        for (size_t r = 0; r < rounds; r++) {
+            for (auto proxy : proxies)
+                tree.findCollisions(&callback, proxy);
+        }
+        double seconds = timer.seconds();
+        allocs = bench::allocations() - allocs;
+        bench::doNotOptimize(callback.count);
+
+        bench::report(name, layout + "inline stack queries/sec", queries / seconds, "q/s");
+        bench::report(name, layout + "inline stack allocations/query",
+                      static_cast<double>(allocs) / queries, "allocs");
+
+        // Locate the root for the reference traversal.
+        auto nodes = tree.getNodes();
+        int32_t root = proxies[0];
+        while (nodes[root].parent != AABBNode::null)
+            root = nodes[root].parent;
+
+        size_t count = 0;
+        allocs = bench::allocations();
+        bench::Timer stackTimer;
+        for (size_t r = 0; r < rounds; r++) {
+            for (auto proxy : proxies)
+                count += stackTraversal(nodes, root, proxy);
+        }
+        seconds = stackTimer.seconds();
+        allocs = bench::allocations() - allocs;
+        bench::doNotOptimize(count);
+
+        bench::report(name, "std::stack queries/sec", queries / seconds, "q/s");
+        bench::report(name, "std::stack allocations/query",
+                      static_cast<double>(allocs) / queries, "allocs");
+    }
+}
+
+BENCHMARK(OverlapKernels)
+{
+    const size_t count = 1 << 16;
+    auto boxes = bench::uniformBoxes(count, 20.0f);
+    std::vector<float> lowX, lowY, highX, highY;
+    for (const auto &box : boxes) {
+        lowX.push_back(box.lowVertex.x);
+        lowY.push_back(box.lowVertex.y);
+        highX.push_back(box.highVertex.x);
+        highY.push_back(box.highVertex.y);
+    }
+
+    const size_t rounds = 200;
+    const double tests = static_cast<double>(rounds) * count;
+    const AABB &query = boxes[count / 2];
+
+    size_t hits = 0;
+    bench::Timer scalarTimer;
+    for (size_t r = 0; r < rounds; r++) {
+        for (const auto &box : boxes)
+            hits += box.overlaps(query);
+    }
+    bench::report("OverlapKernels", "AABB::overlaps boxes/sec", tests / scalarTimer.seconds(), "box/s");
+
+    bench::Timer fourTimer;
+    for (size_t r = 0; r < rounds; r++) {
+        for (size_t i = 0; i < count; i += 4)
+            hits += __builtin_popcount(overlaps4(&lowX[i], &lowY[i], &highX[i], &highY[i], query));
+    }
+    bench::report("OverlapKernels", "overlaps4 boxes/sec", tests / fourTimer.seconds(), "box/s");
+
+    bench::Timer eightTimer;
+    for (size_t r = 0; r < rounds; r++) {
+        for (size_t i = 0; i < count; i += 8)
+            hits += __builtin_popcount(overlaps8(&lowX[i], &lowY[i], &highX[i], &highY[i], query));
+    }
+    bench::report("OverlapKernels", "overlaps8 boxes/sec", tests / eightTimer.seconds(), "box/s");
+    bench::doNotOptimize(hits);
+}
+
+BENCHMARK(BulkBuild)
+{
+    for (size_t leaves : {10000, 100000}) {
+        const auto name = "BulkBuild/" + std::to_string(leaves);
+        auto boxes = bench::uniformBoxes(leaves);
+
+        AABBTree incremental;
+        bench::Timer incrementalTimer;
+        for (const auto &box : boxes)
+            incremental.insertAABB(box);
+        double seconds = incrementalTimer.seconds();
+        bench::report(name, "incremental build time", seconds * 1000, "ms");
+        bench::report(name, "incremental tree cost", incremental.getTreeCost(), "area");
+
+        AABBTree built;
+        bench::Timer buildTimer;
+        built.build(boxes);
+        seconds = buildTimer.seconds();
+        bench::report(name, "binned SAH build time", seconds * 1000, "ms");
+        bench::report(name, "binned SAH tree cost", built.getTreeCost(), "area");
+    }
+}
+
+namespace {
+struct PairCounter : public AABBCallback {
+    size_t count = 0;
+    virtual bool registerCollision(int32_t nodeA, int32_t nodeB) override
+    {
+        count++;
+        return true;
+    }
+};
+
+/**
+ * Move every box a little each frame and compare querying every moved
+ * proxy, which reports pairs of moved proxies twice, against
+ * findMovedCollisions().
+ */
+void movedPairs(const std::string &name, std::vector<AABB> boxes, float speed)
+{
+    AABBTree tree(16, 2.0f);
+    std::vector<int32_t> proxies;
+    for (const auto &box : boxes)
+        proxies.push_back(tree.insertAABB(box));
+    PairCounter initial;
+    tree.findMovedCollisions(&initial);
+
+    std::mt19937 gen(99);
+    std::uniform_real_distribution<float> step(-speed, speed);
+    std::vector<int32_t> moved;
+    double querySeconds = 0, traversalSeconds = 0;
+    size_t queryPairs = 0, traversalPairs = 0;
+    const int frames = 120;
+    for (int frame = 0; frame < frames; frame++) {
+        moved.clear();
+        for (size_t i = 0; i < boxes.size(); i++) {
+            Vec2f d(step(gen), step(gen));
+            boxes[i] = AABB(boxes[i].lowVertex + d, boxes[i].highVertex + d);
+            if (tree.updateAABB(proxies[i], boxes[i], d))
+                moved.push_back(proxies[i]);
+        }
+
+        PairCounter queries;
+        bench::Timer queryTimer;
+        for (auto index : moved)
+            tree.findCollisions(&queries, index);
+        querySeconds += queryTimer.seconds();
+        queryPairs += queries.count;
+
+        PairCounter traversal;
+        bench::Timer traversalTimer;
+        tree.findMovedCollisions(&traversal);
+        traversalSeconds += traversalTimer.seconds();
+        traversalPairs += traversal.count;
+    }
+
+    bench::report(name, "per-proxy queries time/frame", querySeconds / frames * 1e6, "us");
+    bench::report(name, "per-proxy queries pairs/frame", queryPairs / frames, "pairs");
+    bench::report(name, "findMovedCollisions time/frame", traversalSeconds / frames * 1e6, "us");
+    bench::report(name, "findMovedCollisions pairs/frame", traversalPairs / frames, "pairs");
+}
+} /* namespace */
+
+BENCHMARK(MovedPairs)
+{
+    // Enemies clumped around the player.
+    movedPairs("MovedPairs/clumped64", bench::uniformBoxes(64, 10.0f, 0.01f), 3.0f);
+    movedPairs("MovedPairs/clumped1000", bench::uniformBoxes(1000, 10.0f, 0.01f), 3.0f);
+    movedPairs("MovedPairs/uniform10000", bench::uniformBoxes(10000), 3.0f);
+    // Only a few bodies leave their fattened AABB each step.
+    movedPairs("MovedPairs/clumped1000slow", bench::uniformBoxes(1000, 10.0f, 0.01f), 1.0f);
+    movedPairs("MovedPairs/uniform10000slow", bench::uniformBoxes(10000), 1.0f);
+}
+
+namespace {
+struct ClosestLeaf : public RayCastCallback {
+    size_t visited = 0;
+    virtual float rayCastCallback(const RayCastInput &input, int32_t index) override
+    {
+        // Pretend the shape is hit halfway through its AABB.
+        visited++;
+        return input.maxFraction * 0.5f;
+    }
+};
+} /* namespace */
+
+BENCHMARK(RayCast)
+{
+    std::mt19937 gen(99);
+    for (size_t leaves : {1000, 10000, 100000}) {
+        const auto name = "RayCast/" + std::to_string(leaves);
+        auto boxes = bench::uniformBoxes(leaves);
+        const float extent = std::sqrt(leaves / 0.002f);
+        AABBTree tree;
+        tree.build(boxes);
+
+        // Rays of a fixed length, like line of sight checks.
+        std::uniform_real_distribution<float> pos(0, extent), angle(0, 2 * M_PI);
+        std::vector<RayCastInput> rays;
+        for (int i = 0; i < 100000; i++) {
+            const Vec2f p1(pos(gen), pos(gen));
+            const float a = angle(gen);
+            rays.push_back({p1, p1 + 200.0f * Vec2f(std::cos(a), std::sin(a)), 1.0f});
+        }
+
+        ClosestLeaf callback;
+        bench::Timer timer;
+        for (const auto &ray : rays)
+            tree.rayCast(&callback, ray);
+        const double seconds = timer.seconds();
+        bench::doNotOptimize(callback.visited);
+
+        bench::report(name, layout + "closest rays/sec", rays.size() / seconds, "rays/s");
+        bench::report(name, layout + "leaves/ray", double(callback.visited) / rays.size(), "leaves");
+    }
+}
+
+BENCHMARK(TreeDrift)
+{
+    // Boxes wander for a few simulated minutes at 60 steps per second.
+    // Every 30 simulated seconds, each leaf is queried once against a
+    // tree that is optimized every step and one that is not.
+    const size_t leaves = 4000;
+    const int stepsPerSecond = 60;
+    const int seconds = 180;
+    const size_t budget = 64;
+    auto boxes = bench::uniformBoxes(leaves);
+    const float extent = std::sqrt(leaves / 0.002f);
+
+    std::mt19937 gen(5);
+    std::uniform_real_distribution<float> speed(-1.0f, 1.0f);
+    std::vector<Vec2f> velocities;
+    for (size_t i = 0; i < leaves; i++)
+        velocities.emplace_back(speed(gen), speed(gen));
+
+    AABBTree plain(leaves, 2.0f), optimized(leaves, 2.0f);
+    std::vector<int32_t> plainLeaves, optimizedLeaves;
+    for (const auto &box : boxes) {
+        plainLeaves.push_back(plain.insertAABB(box));
+        optimizedLeaves.push_back(optimized.insertAABB(box));
+    }
+
+    auto queryTime = [&boxes](const AABBTree &tree) {
+        CountingCallback callback;
+        bench::Timer timer;
+        for (const auto &box : boxes)
+            tree.findCollisions(&callback, box);
+        bench::doNotOptimize(callback.count);
+        return timer.seconds() / boxes.size();
+    };
+
+    double optimizeSeconds = 0.0;
+    for (int step = 1; step <= seconds * stepsPerSecond; step++) {
+        for (size_t i = 0; i < leaves; i++) {
+            // Bounce off the edges so the density stays the same.
+            const Vec2f low = boxes[i].lowVertex + velocities[i];
+            if (low.x < 0 || low.x > extent)
+                velocities[i].x = -velocities[i].x;
+            if (low.y < 0 || low.y > extent)
+                velocities[i].y = -velocities[i].y;
+            boxes[i] = AABB(boxes[i].lowVertex + velocities[i], boxes[i].highVertex + velocities[i]);
+            plain.updateAABB(plainLeaves[i], boxes[i], velocities[i]);
+            optimized.updateAABB(optimizedLeaves[i], boxes[i], velocities[i]);
+        }
+        bench::Timer timer;
+        optimized.optimize(budget);
+        optimizeSeconds += timer.seconds();
+
+        if (step % (30 * stepsPerSecond) != 0)
+            continue;
+        const std::string name = "TreeDrift/" + std::to_string(step / stepsPerSecond) + "s";
+        bench::report(name, layout + "plain query time", queryTime(plain) * 1e9, "ns");
+        bench::report(name, layout + "optimized query time", queryTime(optimized) * 1e9, "ns");
+        bench::report(name, "plain tree cost", plain.getTreeCost(), "units^2");
+        bench::report(name, "optimized tree cost", optimized.getTreeCost(), "units^2");
+    }
+    bench::report("TreeDrift", "optimize time/step",
+                  optimizeSeconds / (seconds * stepsPerSecond) * 1e6, "us");
+}
+
+BENCHMARK(Compact)
+{
+    for (size_t leaves : {10000, 100000}) {
+        const auto name = "Compact/" + std::to_string(leaves);
+        auto boxes = bench::uniformBoxes(2 * leaves);
+
+        // Fill the tree with twice as many leaves, then remove and
+        // reinsert at random so that the free list scatters the nodes.
+        AABBTree tree;
+        std::vector<int32_t> proxies;
+        for (const auto &box : boxes)
+            proxies.push_back(tree.insertAABB(box));
+        std::mt19937 gen(11);
+        std::shuffle(proxies.begin(), proxies.end(), gen);
+        for (size_t i = leaves; i < proxies.size(); i++)
+            tree.destroyAABB(proxies[i]);
+        proxies.resize(leaves);
+        for (size_t i = 0; i < leaves; i++) {
+            tree.destroyAABB(proxies[i]);
+            proxies[i] = tree.insertAABB(boxes[i]);
+        }
+
+        auto queryTime = [&tree, &proxies]() {
+            CountingCallback callback;
+            bench::Timer timer;
+            for (int round = 0; round < 3; round++)
+                for (auto proxy : proxies)
+                    tree.findCollisions(&callback, proxy);
+            bench::doNotOptimize(callback.count);
+            return timer.seconds() / (3 * proxies.size());
+        };
+
+        bench::report(name, layout + "scattered query time", queryTime() * 1e9, "ns");
+        bench::report(name, "scattered capacity", tree.getCapacity(), "nodes");
+        bench::Timer timer;
+        const auto remap = tree.compact();
+        bench::report(name, "compact time", timer.seconds() * 1e3, "ms");
+        for (auto &proxy : proxies)
+            proxy = remap[proxy];
+        bench::report(name, layout + "compacted query time", queryTime() * 1e9, "ns");
+        bench::report(name, "compacted capacity", tree.getCapacity(), "nodes");
+    }
+}
+
+BENCHMARK(Quantized)
+{
+    std::mt19937 gen(23);
+    for (size_t leaves : {10000, 100000, 1000000}) {
+        const auto name = "Quantized/" + std::to_string(leaves);
+        auto boxes = bench::uniformBoxes(leaves);
+        const float extent = std::sqrt(leaves / 0.002f);
+        AABBTree tree;
+        tree.build(boxes);
+        tree.compact();
+        QuantizedAABBTree quantized(tree);
+
+#ifdef PHY_AABB_SOA
+        const size_t nodeBytes = sizeof(AABBLinks) + 4 * sizeof(float);
+#else
+        const size_t nodeBytes = sizeof(AABBNode);
+#endif
+        bench::report(name, layout + "float bytes/leaf",
+                      double(tree.getCapacity() * nodeBytes) / leaves, "bytes");
+        bench::report(name, "quantized bytes/leaf",
+                      double(quantized.getMemoryUsage()) / leaves, "bytes");
+
+        // Areas about the size of a screen, scattered over the world.
+        std::uniform_real_distribution<float> pos(0, extent);
+        std::vector<AABB> queries;
+        for (int i = 0; i < 20000; i++) {
+            const Vec2f low(pos(gen), pos(gen));
+            queries.emplace_back(low, low + Vec2f(40, 30));
+        }
+        CountingCallback floatCount, quantizedCount;
+        bench::Timer floatTimer;
+        for (const auto &query : queries)
+            tree.findCollisions(&floatCount, query);
+        const double floatSeconds = floatTimer.seconds();
+        bench::Timer quantizedTimer;
+        for (const auto &query : queries)
+            quantized.findCollisions(&quantizedCount, query);
+        const double quantizedSeconds = quantizedTimer.seconds();
+
+        bench::report(name, layout + "float queries/sec", queries.size() / floatSeconds, "queries/s");
+        bench::report(name, "quantized queries/sec", queries.size() / quantizedSeconds, "queries/s");
+        bench::report(name, "extra leaves/query",
+                      double(quantizedCount.count - floatCount.count) / queries.size(), "leaves");
+
+        std::uniform_real_distribution<float> angle(0, 2 * M_PI);
+        std::vector<RayCastInput> rays;
+        for (int i = 0; i < 20000; i++) {
+            const Vec2f p1(pos(gen), pos(gen));
+            const float a = angle(gen);
+            rays.push_back({p1, p1 + 200.0f * Vec2f(std::cos(a), std::sin(a)), 1.0f});
+        }
+        ClosestLeaf floatRays, quantizedRays;
+        bench::Timer floatRayTimer;
+        for (const auto &ray : rays)
+            tree.rayCast(&floatRays, ray);
+        const double floatRaySeconds = floatRayTimer.seconds();
+        bench::Timer quantizedRayTimer;
+        for (const auto &ray : rays)
+            quantized.rayCast(&quantizedRays, ray);
+        const double quantizedRaySeconds = quantizedRayTimer.seconds();
+        bench::doNotOptimize(floatRays.visited + quantizedRays.visited);
+
+        bench::report(name, layout + "float rays/sec", rays.size() / floatRaySeconds, "rays/s");
+        bench::report(name, "quantized rays/sec", rays.size() / quantizedRaySeconds, "rays/s");
+    }
+}
+
+BENCHMARK(WideTree)
+{
+    std::mt19937 gen(31);
+    for (size_t leaves : {10000, 100000, 1000000}) {
+        const auto name = "WideTree/" + std::to_string(leaves);
+        auto boxes = bench::uniformBoxes(leaves);
+        const float extent = std::sqrt(leaves / 0.002f);
+        AABBTree tree;
+        tree.build(boxes);
+        tree.compact();
+        WideAABBTree wide(tree);
+
+        std::uniform_real_distribution<float> pos(0, extent);
+        std::vector<AABB> queries;
+        for (int i = 0; i < 20000; i++) {
+            const Vec2f low(pos(gen), pos(gen));
+            queries.emplace_back(low, low + Vec2f(40, 30));
+        }
+        CountingCallback binaryCount, wideCount;
+        bench::Timer binaryTimer;
+        for (const auto &query : queries)
+            tree.findCollisions(&binaryCount, query);
+        const double binarySeconds = binaryTimer.seconds();
+        bench::Timer wideTimer;
+        for (const auto &query : queries)
+            wide.findCollisions(&wideCount, query);
+        const double wideSeconds = wideTimer.seconds();
+        bench::doNotOptimize(binaryCount.count + wideCount.count);
+
+        bench::report(name, layout + "binary queries/sec", queries.size() / binarySeconds, "queries/s");
+        bench::report(name, "wide queries/sec", queries.size() / wideSeconds, "queries/s");
+
+        std::uniform_real_distribution<float> angle(0, 2 * M_PI);
+        std::vector<RayCastInput> rays;
+        for (int i = 0; i < 20000; i++) {
+            const Vec2f p1(pos(gen), pos(gen));
+            const float a = angle(gen);
+            rays.push_back({p1, p1 + 200.0f * Vec2f(std::cos(a), std::sin(a)), 1.0f});
+        }
+        ClosestLeaf binaryRays, wideRays;
+        bench::Timer binaryRayTimer;
+        for (const auto &ray : rays)
+            tree.rayCast(&binaryRays, ray);
+        const double binaryRaySeconds = binaryRayTimer.seconds();
+        bench::Timer wideRayTimer;
+        for (const auto &ray : rays)
+            wide.rayCast(&wideRays, ray);
+        const double wideRaySeconds = wideRayTimer.seconds();
+        bench::doNotOptimize(binaryRays.visited + wideRays.visited);
+
+        bench::report(name, layout + "binary rays/sec", rays.size() / binaryRaySeconds, "rays/s");
+        bench::report(name, "wide rays/sec", rays.size() / wideRaySeconds, "rays/s");
+
+        // Moving every leaf, as the refit path would for dynamic bodies.
+        const auto nodes = tree.getNodes();
+        std::vector<int32_t> proxies;
+        // Free nodes have a height of -1.
+        for (int32_t i = 0; i < static_cast<int32_t>(nodes.size()); i++)
+            if (nodes[i].height == 0)
+                proxies.push_back(i);
+        bench::Timer refitTimer;
+        for (auto proxy : proxies) {
+            const AABB box = tree.getFatAABB(proxy);
+            wide.setLeafAABB(proxy, AABB(box.lowVertex + Vec2f(1, 0), box.highVertex + Vec2f(1, 0)));
+        }
+        wide.refit();
+        bench::report(name, "refit all leaves", refitTimer.seconds() * 1e3, "ms");
+    }
+}
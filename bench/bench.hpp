@@ -0,0 +1,75 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/**
+ * A minimal benchmark runner.
+ *
+ * Benchmarks are registered with the BENCHMARK macro and run by
+ * benchExe. Passing a filter string to benchExe only runs benchmarks
+ * whose name contains it. Numbers are only meaningful in an optimized
+ * build (cmake -DCMAKE_BUILD_TYPE=Release).
+ */
+namespace bench {
+struct Benchmark {
+    const char *name;
+    void (*run)();
+};
+
+std::vector<Benchmark> &registry();
+
+struct Registrar {
+    Registrar(const char *name, void (*run)())
+    {
+        registry().push_back({name, run});
+    }
+};
+
+/**
+ * Total number of calls to the global operator new so far.
+ */
+size_t allocations();
+
+/**
+ * Resident set size of the process in bytes, or 0 if it is unknown.
+ */
+size_t residentBytes();
+
+class Timer {
+    std::chrono::high_resolution_clock::time_point start;
+public:
+    Timer() : start(std::chrono::high_resolution_clock::now()) {}
+
+    /**
+     * Get the number of seconds since this timer was created.
+     */
+    double seconds() const
+    {
+        auto end = std::chrono::high_resolution_clock::now();
+        return std::chrono::duration<double>(end - start).count();
+    }
+};
+
+/**
+ * Print one result row in a consistent format.
+ */
+void report(const std::string &benchmark, const std::string &metric,
+            double value, const std::string &unit);
+
+/**
+ * Keep the optimizer from removing a computation.
+ */
+template <typename T>
+void doNotOptimize(const T &value)
+{
+    asm volatile("" : : "g"(&value) : "memory");
+}
+} /* namespace bench */
+
+#define BENCHMARK(name) \
+    static void bench_##name(); \
+    static bench::Registrar registrar_##name(#name, bench_##name); \
+    static void bench_##name()
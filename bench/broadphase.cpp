@@ -0,0 +1,608 @@
+#include "bench/bench.hpp"
+#include "inc/physics/broadphase.hpp"
+#include "inc/physics/contact.hpp"
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace phy;
+
+namespace {
+std::shared_ptr<Body> makeBox(const Vec2f &position, const Vec2f &velocity)
+{
+    BodySpec spec;
+    spec.bodyType = BodyType::dynamicBody;
+    spec.position = position;
+    spec.linVelocity = velocity;
+    auto body = std::make_shared<Body>(spec);
+    PolygonShape box(1.0f);
+    box.setBox(Vec2f(2.5f, 2.5f));
+    body->addShape(box);
+    return body;
+}
+
+/**
+ * Scatter small dynamic boxes with random velocities at a constant
+ * density, so that the work per body stays the same as the count grows.
+ */
+std::shared_ptr<Body> movingBox(std::mt19937 &gen, float extent)
+{
+    std::uniform_real_distribution<float> pos(0, extent);
+    std::uniform_real_distribution<float> vel(-60, 60);
+    const float x = pos(gen), y = pos(gen);
+    return makeBox(Vec2f(x, y), Vec2f(vel(gen), vel(gen)));
+}
+
+std::vector<std::shared_ptr<Body>> movingBoxes(size_t count)
+{
+    std::mt19937 gen(1234);
+    const float extent = std::sqrt(count / 0.002f);
+
+    std::vector<std::shared_ptr<Body>> bodies;
+    bodies.reserve(count);
+    for (size_t i = 0; i < count; i++)
+        bodies.push_back(movingBox(gen, extent));
+    return bodies;
+}
+} /* namespace */
+
+BENCHMARK(BroadPhaseScaling)
+{
+    const float dt = 1.0f / 60.0f;
+    const int frames = 60;
+    for (size_t count : {100, 1000, 5000, 10000, 20000}) {
+        auto bodies = movingBoxes(count);
+        BroadPhase broadPhase;
+        broadPhase.addNewBodies(bodies);
+        broadPhase.updatePairs();
+        broadPhase.getBodyCollisions();
+
+        size_t pairs = 0;
+        bench::Timer timer;
+        for (int frame = 0; frame < frames; frame++) {
+            for (const auto &body : bodies) {
+                const auto oldPosition = body->getPosition();
+                body->updatePosition(dt);
+                broadPhase.updateBody(body, body->getPosition() - oldPosition);
+            }
+            broadPhase.updatePairs();
+            pairs += broadPhase.getBodyCollisions().size();
+        }
+        const double seconds = timer.seconds() / frames;
+
+        const std::string name = "BroadPhaseScaling/" + std::to_string(count);
+        bench::report(name, "step time", seconds * 1e6, "us");
+        bench::report(name, "step time per body", seconds * 1e9 / count, "ns");
+        bench::report(name, "new pairs/step", pairs / frames, "pairs");
+    }
+}
+
+BENCHMARK(BroadPhaseThreads)
+{
+    const float dt = 1.0f / 60.0f;
+    const int frames = 60;
+    const size_t count = 20000;
+    const size_t hardware = std::max(1u, std::thread::hardware_concurrency());
+    for (size_t threads : {size_t(1), size_t(2), size_t(4), hardware}) {
+        auto bodies = movingBoxes(count);
+        BroadPhase broadPhase(aabbMargin, threads);
+        broadPhase.addNewBodies(bodies);
+        broadPhase.updatePairs();
+
+        bench::Timer timer;
+        for (int frame = 0; frame < frames; frame++) {
+            for (const auto &body : bodies) {
+                const auto oldPosition = body->getPosition();
+                body->updatePosition(dt);
+                broadPhase.updateBody(body, body->getPosition() - oldPosition);
+            }
+            broadPhase.updatePairs();
+            bench::doNotOptimize(broadPhase.getBodyCollisions());
+        }
+        const double seconds = timer.seconds() / frames;
+
+        const std::string name = "BroadPhaseThreads/" + std::to_string(threads);
+        bench::report(name, "step time", seconds * 1e6, "us");
+    }
+}
+
+BENCHMARK(SpawnBatches)
+{
+    // Enemies spawned each frame into a level that is already loaded.
+    const size_t count = 10000;
+    const int frames = 120;
+    for (size_t batch : {1, 16, 256}) {
+        auto bodies = movingBoxes(count);
+        BroadPhase broadPhase;
+        broadPhase.addNewBodies(bodies);
+        broadPhase.updatePairs();
+
+        std::mt19937 gen(42);
+        const float extent = std::sqrt(count / 0.002f);
+        double seconds = 0;
+        for (int frame = 0; frame < frames; frame++) {
+            std::vector<std::shared_ptr<Body>> spawned;
+            for (size_t i = 0; i < batch; i++)
+                spawned.push_back(movingBox(gen, extent));
+            bench::Timer timer;
+            broadPhase.addNewBodies(spawned);
+            seconds += timer.seconds();
+            broadPhase.updatePairs();
+            bodies.insert(bodies.end(), spawned.begin(), spawned.end());
+        }
+
+        const std::string name = "SpawnBatches/" + std::to_string(batch);
+        bench::report(name, "addNewBodies time", seconds / frames * 1e6, "us");
+        bench::report(name, "time per body", seconds / frames / batch * 1e6, "us");
+    }
+}
+
+BENCHMARK(BroadPhaseSoak)
+{
+    // Keep a fixed number of bodies alive while a million are spawned
+    // and destroyed, as in a long session with waves of enemies.
+    const size_t alive = 2000, churn = 500, total = 1000000;
+    const size_t window = total / 5;
+    const float dt = 1.0f / 60.0f;
+    const float extent = std::sqrt(alive / 0.002f);
+    std::mt19937 gen(1234);
+
+    BroadPhase broadPhase;
+    std::deque<std::shared_ptr<Body>> bodies;
+    size_t spawned = 0, frames = 0;
+    double seconds = 0;
+    while (spawned < total) {
+        bench::Timer timer;
+        while (bodies.size() > alive - churn) {
+            broadPhase.deleteBody(bodies.front());
+            bodies.pop_front();
+        }
+        for (size_t i = 0; i < churn; i++) {
+            bodies.push_back(movingBox(gen, extent));
+            broadPhase.addNewBody(bodies.back());
+        }
+        spawned += churn;
+
+        for (const auto &body : bodies) {
+            const auto oldPosition = body->getPosition();
+            body->updatePosition(dt);
+            broadPhase.updateBody(body, body->getPosition() - oldPosition);
+        }
+        broadPhase.updatePairs();
+        bench::doNotOptimize(broadPhase.getBodyCollisions());
+        seconds += timer.seconds();
+        frames++;
+
+        if (spawned % window == 0) {
+            const std::string name = "BroadPhaseSoak/" + std::to_string(spawned / 1000) + "k";
+            bench::report(name, "step time", seconds / frames * 1e6, "us");
+            bench::report(name, "resident memory", bench::residentBytes() / 1024.0, "KiB");
+            seconds = 0;
+            frames = 0;
+        }
+    }
+}
+
+namespace {
+/**
+ * Move every body one step and find the new pairs.
+ *
+ * @return The number of pairs that were found.
+ */
+size_t step(BroadPhaseBase &broadPhase, const std::deque<std::shared_ptr<Body>> &bodies)
+{
+    const float dt = 1.0f / 60.0f;
+    for (const auto &body : bodies) {
+        const auto oldPosition = body->getPosition();
+        body->updatePosition(dt);
+        broadPhase.updateBody(body, body->getPosition() - oldPosition);
+    }
+    broadPhase.updatePairs();
+    return broadPhase.getBodyCollisions().size();
+}
+
+/**
+ * Move every body one step, then find the new pairs and run the
+ * narrowphase on them like World::step().
+ */
+void step(BroadPhaseBase &broadPhase, ContactManager &contacts,
+          const std::deque<std::shared_ptr<Body>> &bodies)
+{
+    const float dt = 1.0f / 60.0f;
+    for (const auto &body : bodies) {
+        const auto oldPosition = body->getPosition();
+        body->updatePosition(dt);
+        broadPhase.updateBody(body, body->getPosition() - oldPosition);
+    }
+    broadPhase.updatePairs();
+    contacts.update();
+}
+
+const BroadPhaseType backends[] = {
+    BroadPhaseType::tree,
+    BroadPhaseType::sweepAndPrune,
+    BroadPhaseType::spatialHash,
+};
+
+const char *backendName(BroadPhaseType type)
+{
+    switch (type) {
+    case BroadPhaseType::sweepAndPrune:
+        return "sweepAndPrune";
+    case BroadPhaseType::spatialHash:
+        return "spatialHash";
+    case BroadPhaseType::tree:
+    default:
+        return "tree";
+    }
+}
+
+/**
+ * Time a scene where the same bodies move for many frames.
+ *
+ * @param spawn Creates the body with the given index.
+ */
+void staticScene(const std::string &scene, size_t count,
+                 const std::function<std::shared_ptr<Body>(std::mt19937 &)> &spawn,
+                 int frames = 120)
+{
+    for (auto type : backends) {
+        std::mt19937 gen(1234);
+        std::deque<std::shared_ptr<Body>> bodies;
+        std::vector<std::shared_ptr<Body>> created;
+        for (size_t i = 0; i < count; i++) {
+            created.push_back(spawn(gen));
+            bodies.push_back(created.back());
+        }
+        auto broadPhase = makeBroadPhase(type);
+        broadPhase->addNewBodies(created);
+        step(*broadPhase, bodies);
+
+        size_t pairs = 0;
+        bench::Timer timer;
+        for (int frame = 0; frame < frames; frame++)
+            pairs += step(*broadPhase, bodies);
+        const double seconds = timer.seconds() / frames;
+
+        const std::string name = "Backends/" + scene + "/" + backendName(type);
+        bench::report(name, "step time", seconds * 1e6, "us");
+        bench::report(name, "pairs/step", pairs / frames, "pairs");
+    }
+}
+} /* namespace */
+
+BENCHMARK(BroadPhaseBackends)
+{
+    const size_t count = 4000;
+
+    // Enemies swarming along the walls of a wide arena.
+    staticScene("corridor", count, [](std::mt19937 &gen) {
+        std::uniform_real_distribution<float> x(0, 20000), y(0, 60), vel(-60, 60);
+        const float px = x(gen), py = y(gen);
+        return makeBox(Vec2f(px, py), Vec2f(vel(gen), vel(gen) * 0.1f));
+    });
+
+    // A few dense groups of enemies chasing players.
+    staticScene("clustered", count, [](std::mt19937 &gen) {
+        std::uniform_int_distribution<int> cluster(0, 7);
+        std::normal_distribution<float> offset(0, 60);
+        std::uniform_real_distribution<float> vel(-30, 30);
+        const int c = cluster(gen);
+        const Vec2f center(500.0f + 400.0f * (c % 4), 500.0f + 400.0f * (c / 4));
+        const float dx = offset(gen), dy = offset(gen);
+        return makeBox(center + Vec2f(dx, dy), Vec2f(vel(gen), vel(gen)));
+    });
+
+    staticScene("uniform", count, [count](std::mt19937 &gen) {
+        return movingBox(gen, std::sqrt(count / 0.002f));
+    });
+
+    // The enemy swarm at its largest: 100k 5x5 boxes.
+    const size_t swarm = 100000;
+    staticScene("swarm100k", swarm, [swarm](std::mt19937 &gen) {
+        return movingBox(gen, std::sqrt(swarm / 0.002f));
+    }, 30);
+
+    // Waves of enemies entering on one side and leaving on the other.
+    const size_t perFrame = 10, frames = 600;
+    for (auto type : backends) {
+        std::mt19937 gen(1234);
+        std::uniform_real_distribution<float> y(0, 2000), speed(200, 400);
+        auto broadPhase = makeBroadPhase(type);
+        std::deque<std::shared_ptr<Body>> bodies;
+
+        size_t pairs = 0;
+        bench::Timer timer;
+        for (size_t frame = 0; frame < frames; frame++) {
+            while (!bodies.empty() && bodies.front()->getPosition().x > 1500) {
+                broadPhase->deleteBody(bodies.front());
+                bodies.pop_front();
+            }
+            for (size_t i = 0; i < perFrame; i++) {
+                const float py = y(gen);
+                bodies.push_back(makeBox(Vec2f(0, py), Vec2f(speed(gen), 0)));
+                broadPhase->addNewBody(bodies.back());
+            }
+            pairs += step(*broadPhase, bodies);
+        }
+        const double seconds = timer.seconds() / frames;
+
+        const std::string name = std::string("Backends/streaming/") + backendName(type);
+        bench::report(name, "step time", seconds * 1e6, "us");
+        bench::report(name, "pairs/step", pairs / frames, "pairs");
+    }
+}
+
+BENCHMARK(ContactEvents)
+{
+    // Dense groups of slowly drifting enemies, where most contacts
+    // last for many frames.
+    const size_t count = 4000;
+    const int frames = 120;
+    std::mt19937 gen(1234);
+    std::uniform_int_distribution<int> cluster(0, 7);
+    std::normal_distribution<float> offset(0, 60);
+    std::uniform_real_distribution<float> vel(-10, 10);
+    std::vector<std::shared_ptr<Body>> created;
+    for (size_t i = 0; i < count; i++) {
+        const int c = cluster(gen);
+        const Vec2f center(500.0f + 400.0f * (c % 4), 500.0f + 400.0f * (c / 4));
+        const float dx = offset(gen), dy = offset(gen);
+        created.push_back(makeBox(center + Vec2f(dx, dy), Vec2f(vel(gen), vel(gen))));
+    }
+    const std::deque<std::shared_ptr<Body>> bodies(created.begin(), created.end());
+
+    BroadPhase broadPhase;
+    ContactManager contacts(broadPhase);
+    broadPhase.addNewBodies(created);
+    step(broadPhase, contacts, bodies);
+    contacts.takeBeganContacts();
+    contacts.takeEndedContacts();
+
+    size_t events = 0, touching = 0;
+    bench::Timer timer;
+    for (int frame = 0; frame < frames; frame++) {
+        step(broadPhase, contacts, bodies);
+        const auto began = contacts.takeBeganContacts().size();
+        events += began + contacts.takeEndedContacts().size();
+        touching += began + contacts.getPersistingContacts().size();
+    }
+    const double seconds = timer.seconds() / frames;
+
+    bench::report("ContactEvents/clustered", "step time", seconds * 1e6, "us");
+    bench::report("ContactEvents/clustered", "touching pairs/step", touching / frames, "pairs");
+    bench::report("ContactEvents/clustered", "began+ended/step", events / frames, "pairs");
+}
+
+BENCHMARK(Narrowphase)
+{
+    // Clusters of rotated boxes and circles, whose AABBs overlap far
+    // more often than the shapes themselves.
+    const size_t count = 4000;
+    const int frames = 120;
+    std::mt19937 gen(4321);
+    std::uniform_int_distribution<int> cluster(0, 7);
+    std::normal_distribution<float> offset(0, 60);
+    std::uniform_real_distribution<float> vel(-10, 10);
+    std::uniform_real_distribution<float> angle(0, M_PI);
+    std::vector<std::shared_ptr<Body>> created;
+    for (size_t i = 0; i < count; i++) {
+        const int c = cluster(gen);
+        BodySpec spec;
+        spec.bodyType = BodyType::dynamicBody;
+        spec.position = Vec2f(500.0f + 400.0f * (c % 4) + offset(gen),
+                              500.0f + 400.0f * (c / 4) + offset(gen));
+        spec.angle = angle(gen);
+        spec.linVelocity = Vec2f(vel(gen), vel(gen));
+        auto body = std::make_shared<Body>(spec);
+        if (i % 2) {
+            body->addShape(CircleShape(1.0f, 2.5f));
+        } else {
+            PolygonShape box(1.0f);
+            box.setBox(Vec2f(4.0f, 1.0f));
+            body->addShape(box);
+        }
+        created.push_back(body);
+    }
+    const std::deque<std::shared_ptr<Body>> bodies(created.begin(), created.end());
+
+    BroadPhase broadPhase;
+    ContactManager contacts(broadPhase);
+    broadPhase.addNewBodies(created);
+    step(broadPhase, contacts, bodies);
+
+    size_t touching = 0;
+    bench::Timer timer;
+    for (int frame = 0; frame < frames; frame++) {
+        step(broadPhase, contacts, bodies);
+        const auto &found = contacts.getContacts();
+        touching += std::count_if(found.begin(), found.end(),
+                                  [](const Contact &contact) { return contact.isTouching(); });
+    }
+    const double seconds = timer.seconds() / frames;
+
+    // What comparing the tight AABBs alone would have reported.
+    size_t aabbPairs = 0;
+    std::vector<AABB> boxes;
+    for (const auto &body : created)
+        boxes.push_back(body->getShapes()[0].lock()->getAABB(body->getTransform()));
+    for (size_t i = 0; i < boxes.size(); i++)
+        for (size_t j = i + 1; j < boxes.size(); j++)
+            aabbPairs += boxes[i].overlaps(boxes[j]);
+
+    bench::report("Narrowphase/clustered", "step time", seconds * 1e6, "us");
+    bench::report("Narrowphase/clustered", "fat pairs/step", contacts.getContacts().size(), "pairs");
+    bench::report("Narrowphase/clustered", "AABB pairs (last step)", aabbPairs, "pairs");
+    bench::report("Narrowphase/clustered", "touching pairs/step", touching / frames, "pairs");
+}
+
+BENCHMARK(ClumpedEnemies)
+{
+    // Enemies swarming around the player, jostling in random directions.
+    const int frames = 240;
+    for (size_t count : {64, 1000}) {
+        std::mt19937 gen(1234);
+        const float extent = std::sqrt(count / 0.02f);
+        std::uniform_real_distribution<float> vel(-120, 120);
+        std::deque<std::shared_ptr<Body>> bodies;
+        for (size_t i = 0; i < count; i++)
+            bodies.push_back(movingBox(gen, extent));
+        BroadPhase broadPhase;
+        broadPhase.addNewBodies({bodies.begin(), bodies.end()});
+        step(broadPhase, bodies);
+
+        size_t pairs = 0;
+        double seconds = 0;
+        for (int frame = 0; frame < frames; frame++) {
+            for (const auto &body : bodies)
+                body->setLinearVelocity(Vec2f(vel(gen), vel(gen)));
+            bench::Timer timer;
+            pairs += step(broadPhase, bodies);
+            seconds += timer.seconds();
+        }
+
+        const std::string name = "ClumpedEnemies/" + std::to_string(count);
+        bench::report(name, "step time", seconds / frames * 1e6, "us");
+        bench::report(name, "new pairs/step", pairs / frames, "pairs");
+    }
+}
+
+BENCHMARK(StaticLevel)
+{
+    // Enemies running over a large tile map whose tiles never move.
+    const int tilesPerSide = 200;
+    const float pitch = 20.0f;
+    const size_t enemies = 2000;
+    const int frames = 120;
+    std::vector<std::shared_ptr<Body>> created;
+    for (int y = 0; y < tilesPerSide; y++) {
+        for (int x = 0; x < tilesPerSide; x++) {
+            BodySpec spec;
+            spec.position = Vec2f(x * pitch, y * pitch);
+            auto tile = std::make_shared<Body>(spec);
+            PolygonShape box(1.0f);
+            box.setBox(Vec2f(pitch / 2, pitch / 2));
+            tile->addShape(box);
+            created.push_back(tile);
+        }
+    }
+    std::mt19937 gen(1234);
+    std::deque<std::shared_ptr<Body>> bodies;
+    for (size_t i = 0; i < enemies; i++) {
+        bodies.push_back(movingBox(gen, tilesPerSide * pitch));
+        created.push_back(bodies.back());
+    }
+
+    BroadPhase broadPhase;
+    broadPhase.addNewBodies(created);
+    step(broadPhase, bodies);
+
+    size_t pairs = 0;
+    bench::Timer timer;
+    for (int frame = 0; frame < frames; frame++)
+        pairs += step(broadPhase, bodies);
+    const double seconds = timer.seconds() / frames;
+
+    const std::string name = "StaticLevel/" + std::to_string(tilesPerSide * tilesPerSide) + "tiles";
+    bench::report(name, "step time", seconds * 1e6, "us");
+    bench::report(name, "new pairs/step", pairs / frames, "pairs");
+}
+
+BENCHMARK(LineOfSight)
+{
+    // Every enemy checks whether it can see the player.
+    for (size_t count : {1000, 10000}) {
+        auto bodies = movingBoxes(count);
+        BroadPhase broadPhase;
+        broadPhase.addNewBodies(bodies);
+        const float extent = std::sqrt(count / 0.002f);
+        const Vec2f player(extent / 2, extent / 2);
+
+        size_t visible = 0;
+        bench::Timer timer;
+        for (const auto &enemy : bodies) {
+            RayCastHit hit;
+            hit.fraction = 1.0f;
+            broadPhase.rayCast([&hit](const RayCastHit &candidate) {
+                hit = candidate;
+                return candidate.fraction;
+            }, {player, enemy->getPosition(), 1.0f});
+            visible += hit.body.lock() == enemy;
+        }
+        double seconds = timer.seconds();
+
+        const std::string name = "LineOfSight/" + std::to_string(count);
+        bench::report(name, "tree rays/sec", count / seconds, "rays/s");
+        bench::report(name, "visible enemies", visible, "bodies");
+
+        // The brute force search this replaces.
+        visible = 0;
+        bench::Timer bruteTimer;
+        for (const auto &enemy : bodies) {
+            RayCastInput ray = {player, enemy->getPosition(), 1.0f};
+            const Body *closest = nullptr;
+            for (const auto &other : bodies) {
+                RayCastOutput output;
+                for (const auto &shape : other->getShapes()) {
+                    if (shape.lock()->rayCast(output, ray, other->getTransform())) {
+                        ray.maxFraction = output.fraction;
+                        closest = other.get();
+                    }
+                }
+            }
+            visible += closest == enemy.get();
+        }
+        seconds = bruteTimer.seconds();
+        bench::report(name, "brute force rays/sec", count / seconds, "rays/s");
+        bench::report(name, "brute force visible enemies", visible, "bodies");
+    }
+}
+
+BENCHMARK(NearbyEnemies)
+{
+    // Each frame an enemy looks for what is around it, which the game
+    // used to do by iterating every enemy.
+    const size_t count = 10000;
+    const size_t queries = 2000;
+    auto bodies = movingBoxes(count);
+    BroadPhase broadPhase;
+    broadPhase.addNewBodies(bodies);
+
+    std::vector<Body *> found;
+    size_t total = 0;
+    bench::Timer areaTimer;
+    for (size_t i = 0; i < queries; i++) {
+        const Vec2f center = bodies[i]->getPosition();
+        broadPhase.query(AABB(center - Vec2f(20, 20), center + Vec2f(20, 20)), found);
+        total += found.size();
+    }
+    double seconds = areaTimer.seconds();
+    const std::string name = "NearbyEnemies/" + std::to_string(count);
+    bench::report(name, "area queries/sec", queries / seconds, "queries/s");
+    bench::report(name, "bodies per area", static_cast<double>(total) / queries, "bodies");
+
+    bench::Timer nearestTimer;
+    for (size_t i = 0; i < queries; i++)
+        broadPhase.nearest(8, bodies[i]->getPosition(), found);
+    seconds = nearestTimer.seconds();
+    bench::report(name, "nearest 8 queries/sec", queries / seconds, "queries/s");
+
+    // The linear scan these replace.
+    std::vector<std::pair<float, Body *>> scan;
+    bench::Timer scanTimer;
+    for (size_t i = 0; i < queries; i++) {
+        const Vec2f center = bodies[i]->getPosition();
+        scan.clear();
+        for (const auto &other : bodies)
+            scan.emplace_back((other->getPosition() - center).length(), other.get());
+        std::partial_sort(scan.begin(), scan.begin() + 8, scan.end());
+    }
+    seconds = scanTimer.seconds();
+    bench::report(name, "linear nearest 8 queries/sec", queries / seconds, "queries/s");
+}
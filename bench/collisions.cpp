@@ -0,0 +1,127 @@
+#include "bench/bench.hpp"
+#include "inc/physics/collisions.hpp"
+#include <cmath>
+#include <random>
+#include <vector>
+
+using namespace phy;
+
+namespace {
+/**
+ * A regular polygon with the given number of vertices.
+ */
+PolygonShape regularPolygon(int count, float radius)
+{
+    std::vector<Vec2f> vertices;
+    for (int i = 0; i < count; i++) {
+        const float angle = 2.0f * M_PI * i / count;
+        vertices.emplace_back(radius * std::cos(angle), radius * std::sin(angle));
+    }
+    PolygonShape polygon(1.0f);
+    polygon.set(vertices);
+    return polygon;
+}
+
+/**
+ * Test pairs of a shape at random offsets and angles, about half of
+ * which overlap, as the broadphase would hand them over.
+ */
+void collideRandomPairs(const std::string &name, const PolygonShape &a, const PolygonShape &b)
+{
+    std::mt19937 gen(99);
+    std::uniform_real_distribution<float> offset(-8, 8);
+    std::uniform_real_distribution<float> angle(0, 2 * M_PI);
+    std::vector<std::pair<Transform, Transform>> transforms;
+    for (int i = 0; i < 4096; i++)
+        transforms.emplace_back(Transform({0, 0}, angle(gen)),
+                                Transform({offset(gen), offset(gen)}, angle(gen)));
+
+    const int rounds = 100;
+    size_t touching = 0;
+    bench::Timer timer;
+    for (int round = 0; round < rounds; round++)
+        for (const auto &pair : transforms)
+            touching += collidePolygons(a, pair.first, b, pair.second).isTouching();
+    const double seconds = timer.seconds();
+    bench::doNotOptimize(touching);
+
+    bench::report(name, "tests/sec", rounds * transforms.size() / seconds, "tests/s");
+    bench::report(name, "touching", double(touching) / (rounds * transforms.size()), "fraction");
+}
+
+/**
+ * Test pairs of a shape that drift and turn a little on every round, as
+ * they would over consecutive steps, so that a cached simplex from the
+ * last round stays close to the answer.
+ */
+template <typename Collide>
+void collideMovingPairs(const std::string &name, const PolygonShape &a, const PolygonShape &b,
+                        Collide collidePair)
+{
+    struct Pair {
+        Vec2f offset, velocity;
+        float angleA, angleB, spin;
+    };
+    std::mt19937 gen(99);
+    std::uniform_real_distribution<float> offset(-8, 8);
+    std::uniform_real_distribution<float> velocity(-0.05f, 0.05f);
+    std::uniform_real_distribution<float> angle(0, 2 * M_PI);
+    std::uniform_real_distribution<float> spin(-0.01f, 0.01f);
+    std::vector<Pair> pairs;
+    for (int i = 0; i < 4096; i++)
+        pairs.push_back({{offset(gen), offset(gen)}, {velocity(gen), velocity(gen)},
+                         angle(gen), angle(gen), spin(gen)});
+    std::vector<SimplexCache> caches(pairs.size(), SimplexCache());
+
+    const int rounds = 100;
+    size_t touching = 0;
+    bench::Timer timer;
+    for (int round = 0; round < rounds; round++) {
+        for (size_t i = 0; i < pairs.size(); i++) {
+            const auto &pair = pairs[i];
+            const Transform transformA({0, 0}, pair.angleA + round * pair.spin);
+            const Transform transformB(pair.offset + float(round) * pair.velocity,
+                                       pair.angleB - round * pair.spin);
+            touching += collidePair(a, transformA, b, transformB, caches[i]).isTouching();
+        }
+    }
+    const double seconds = timer.seconds();
+    bench::doNotOptimize(touching);
+
+    bench::report(name, "tests/sec", rounds * pairs.size() / seconds, "tests/s");
+    bench::report(name, "touching", double(touching) / (rounds * pairs.size()), "fraction");
+}
+} /* namespace */
+
+BENCHMARK(CollidePolygons)
+{
+    PolygonShape box(1.0f);
+    box.setBox(Vec2f(2.5f, 2.5f));
+    collideRandomPairs("CollidePolygons/box-box", box, box);
+
+    const auto octagon = regularPolygon(8, 3.5f);
+    collideRandomPairs("CollidePolygons/8-gon", octagon, octagon);
+}
+
+BENCHMARK(CollideConvex)
+{
+    for (int count : {4, 8, 16, 32, 128}) {
+        const auto polygon = regularPolygon(count, 3.5f);
+        const std::string name = "CollideConvex/" + std::to_string(count) + "-gon/";
+        collideMovingPairs(name + "sat", polygon, polygon,
+                           [](const PolygonShape &a, const Transform &ta,
+                              const PolygonShape &b, const Transform &tb, SimplexCache &) {
+                               return collidePolygons(a, ta, b, tb);
+                           });
+        collideMovingPairs(name + "gjk", polygon, polygon,
+                           [](const PolygonShape &a, const Transform &ta,
+                              const PolygonShape &b, const Transform &tb, SimplexCache &) {
+                               return collideConvex(a, ta, b, tb);
+                           });
+        collideMovingPairs(name + "gjk-cached", polygon, polygon,
+                           [](const PolygonShape &a, const Transform &ta,
+                              const PolygonShape &b, const Transform &tb, SimplexCache &cache) {
+                               return collideConvex(a, ta, b, tb, &cache);
+                           });
+    }
+}
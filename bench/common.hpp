@@ -0,0 +1,32 @@
+#pragma once
+
+#include "inc/physics/aabb.hpp"
+#include <cmath>
+#include <random>
+#include <vector>
+
+namespace bench {
+/**
+ * Generate square AABBs scattered uniformly so that the density of
+ * boxes is the same regardless of how many are requested.
+ *
+ * @param count Number of boxes to create.
+ * @param size Side length of every box.
+ * @param density Expected number of boxes per square unit.
+ */
+inline std::vector<phy::AABB> uniformBoxes(size_t count, float size = 5.0f,
+                                           float density = 0.002f)
+{
+    std::mt19937 gen(1234);
+    float extent = std::sqrt(count / density);
+    std::uniform_real_distribution<float> pos(0, extent);
+
+    std::vector<phy::AABB> boxes;
+    boxes.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        phy::Vec2f low(pos(gen), pos(gen));
+        boxes.emplace_back(low, low + phy::Vec2f(size, size));
+    }
+    return boxes;
+}
+} /* namespace bench */
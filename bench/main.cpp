@@ -0,0 +1,72 @@
+#include "bench/bench.hpp"
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <unistd.h>
+
+static std::atomic<size_t> allocationCount(0);
+
+void *operator new(size_t size)
+{
+    allocationCount++;
+    if (void *ptr = std::malloc(size ? size : 1))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    std::free(ptr);
+}
+
+namespace bench {
+std::vector<Benchmark> &registry()
+{
+    static std::vector<Benchmark> benchmarks;
+    return benchmarks;
+}
+
+size_t allocations()
+{
+    return allocationCount;
+}
+
+size_t residentBytes()
+{
+    std::ifstream statm("/proc/self/statm");
+    size_t pages = 0, resident = 0;
+    if (!(statm >> pages >> resident))
+        return 0;
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+void report(const std::string &benchmark, const std::string &metric,
+            double value, const std::string &unit)
+{
+    std::cout << std::left << std::setw(36) << benchmark
+              << std::setw(40) << metric
+              << std::right << std::setw(16) << std::setprecision(6) << value
+              << " " << unit << std::endl;
+}
+} /* namespace bench */
+
+int main(int argc, char **argv)
+{
+    const char *filter = argc > 1 ? argv[1] : "";
+    for (const auto &benchmark : bench::registry()) {
+        if (!std::strstr(benchmark.name, filter))
+            continue;
+        std::cout << "== " << benchmark.name << std::endl;
+        benchmark.run();
+    }
+    return 0;
+}
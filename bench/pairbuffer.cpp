@@ -0,0 +1,91 @@
+#include "bench/bench.hpp"
+#include "bench/common.hpp"
+#include "inc/physics/aabb.hpp"
+#include "inc/physics/pairbuffer.hpp"
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+using namespace phy;
+
+namespace {
+/// The hash BroadPhase used before the pair buffer, kept for comparison.
+struct XorPairHash {
+    size_t operator()(const std::pair<int32_t, int32_t> &p) const
+    {
+        return p.first ^ p.second;
+    }
+};
+
+struct PairList : public AABBCallback {
+    std::vector<std::pair<int32_t, int32_t>> pairs;
+    virtual bool registerCollision(int32_t nodeA, int32_t nodeB) override
+    {
+        pairs.emplace_back(nodeA, nodeB);
+        return true;
+    }
+};
+
+/**
+ * Feed the pairs of one broadphase step through the old hash set and
+ * the sorted pair buffer, repeating the step to measure steady state.
+ */
+void pairSort(const std::string &name, const std::vector<AABB> &boxes)
+{
+    AABBTree tree(16);
+    std::vector<int32_t> proxies;
+    for (const auto &box : boxes)
+        proxies.push_back(tree.insertAABB(box));
+    // Querying every proxy reports each pair in both orders, as the
+    // broadphase did when every body moved.
+    PairList list;
+    for (auto proxy : proxies)
+        tree.findCollisions(&list, proxy);
+
+    const int frames = 200;
+    std::unordered_set<std::pair<int32_t, int32_t>, XorPairHash> set;
+    size_t setSize = 0;
+    size_t allocations = bench::allocations();
+    bench::Timer setTimer;
+    for (int frame = 0; frame < frames; frame++) {
+        for (const auto &pair : list.pairs)
+            set.insert(pair);
+        setSize = set.size();
+        bench::doNotOptimize(set);
+        set.clear();
+    }
+    const double setSeconds = setTimer.seconds();
+    const size_t setAllocations = bench::allocations() - allocations;
+
+    PairBuffer buffer;
+    size_t bufferSize = 0;
+    allocations = bench::allocations();
+    bench::Timer bufferTimer;
+    for (int frame = 0; frame < frames; frame++) {
+        for (const auto &pair : list.pairs)
+            buffer.add(pair.first, pair.second);
+        buffer.sort();
+        bufferSize = buffer.size();
+        bench::doNotOptimize(buffer);
+        buffer.clear();
+    }
+    const double bufferSeconds = bufferTimer.seconds();
+    const size_t bufferAllocations = bench::allocations() - allocations;
+
+    bench::report(name, "reported pairs", list.pairs.size(), "pairs");
+    bench::report(name, "unordered_set time/step", setSeconds / frames * 1e6, "us");
+    bench::report(name, "unordered_set allocations/step", setAllocations / frames, "");
+    bench::report(name, "unordered_set unique pairs", setSize, "pairs");
+    bench::report(name, "sorted buffer time/step", bufferSeconds / frames * 1e6, "us");
+    bench::report(name, "sorted buffer allocations/step", bufferAllocations / frames, "");
+    bench::report(name, "sorted buffer unique pairs", bufferSize, "pairs");
+}
+} /* namespace */
+
+BENCHMARK(PairSort)
+{
+    pairSort("PairSort/clumped1000", bench::uniformBoxes(1000, 10.0f, 0.01f));
+    pairSort("PairSort/uniform10000", bench::uniformBoxes(10000));
+    pairSort("PairSort/uniform100000", bench::uniformBoxes(100000));
+}
@@ -0,0 +1,146 @@
+#include "bench/bench.hpp"
+#include "inc/physics/world.hpp"
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace phy;
+
+namespace {
+BodySpec boxSpec(BodyType type, const Vec2f &position, const Vec2f &halfSize)
+{
+    BodySpec spec;
+    spec.bodyType = type;
+    spec.position = position;
+    PolygonShape box(1.0f);
+    box.setBox(halfSize);
+    spec.shapes.push_back(std::make_shared<PolygonShape>(box));
+    return spec;
+}
+
+/**
+ * Stack boxes into a row of pyramids on the ground.
+ *
+ * Rows overlap by half of linearSlop, so that every contact is found
+ * after the first step instead of one row per step as the pile falls
+ * onto itself.
+ *
+ * @param tops Receives the top box of each pyramid.
+ * @return The bodies of all pyramids.
+ */
+std::vector<std::weak_ptr<Body>> buildPyramids(World &world, int pyramids, int base,
+                                               float halfSize,
+                                               std::vector<std::weak_ptr<Body>> &tops)
+{
+    const float width = 2.1f * halfSize * (base + 1);
+    world.createBody(boxSpec(BodyType::staticBody, {0, -10},
+                             {0.5f * pyramids * width + 50, 10}));
+    std::vector<BodySpec> specs;
+    for (int pyramid = 0; pyramid < pyramids; pyramid++) {
+        const float center = (pyramid - 0.5f * (pyramids - 1)) * width;
+        for (int row = 0; row < base; row++) {
+            const int count = base - row;
+            const float y = halfSize + row * (2 * halfSize - 0.5f * linearSlop);
+            for (int i = 0; i < count; i++) {
+                const float x = center + (i - 0.5f * (count - 1)) * 2.1f * halfSize;
+                specs.push_back(boxSpec(BodyType::dynamicBody, {x, y}, {halfSize, halfSize}));
+            }
+        }
+    }
+    auto bodies = world.createBodies(specs);
+    const size_t perPyramid = bodies.size() / pyramids;
+    for (int pyramid = 0; pyramid < pyramids; pyramid++)
+        tops.push_back(bodies[(pyramid + 1) * perPyramid - 1]);
+    return bodies;
+}
+} /* namespace */
+
+BENCHMARK(BoxPile)
+{
+    const float dt = 1.0f / 60.0f;
+    const float halfSize = 2.5f;
+    struct Config {
+        int velocityIterations;
+        int positionIterations;
+        bool sleeping;
+        std::string name;
+    };
+    // The first two keep the whole pile awake to time the solver, the
+    // last is the World defaults, where the pile falls asleep once it
+    // has settled.
+    const Config configs[] = {
+        {4, 3, false, "4 iterations"},
+        {8, 3, false, "8 iterations"},
+        {10, 10, true, "defaults, sleeping"},
+    };
+    for (const auto &config : configs) {
+        // 48 pyramids with 20 boxes on the bottom row make 10080 in total.
+        World world({0, -50}, nullptr);
+        world.setVelocityIterations(config.velocityIterations);
+        world.setPositionIterations(config.positionIterations);
+        world.setAllowSleeping(config.sleeping);
+        std::vector<std::weak_ptr<Body>> tops;
+        const auto pile = buildPyramids(world, 48, 20, halfSize, tops);
+        std::vector<float> startHeights;
+        for (const auto &top : tops)
+            startHeights.push_back(top.lock()->getPosition().y);
+
+        // Let the pile settle before timing it.
+        const int settleFrames = 180;
+        float settleTime = 0.0f;
+        float slowestStep = 0.0f;
+        int solvedFrames = 0;
+        for (int frame = 0; frame < settleFrames; frame++) {
+            world.step(dt);
+            settleTime += world.getProfile().step;
+            slowestStep = std::max(slowestStep, world.getProfile().step);
+            if (world.getProfile().contacts > 0)
+                solvedFrames = frame + 1;
+        }
+
+        const int frames = 120;
+        StepProfile total = {};
+        bench::Timer timer;
+        for (int frame = 0; frame < frames; frame++) {
+            world.step(dt);
+            const auto &profile = world.getProfile();
+            total.solveVelocity += profile.solveVelocity;
+            total.solvePosition += profile.solvePosition;
+            total.collide += profile.collide;
+            total.contacts += profile.contacts;
+            total.positionIterations += profile.positionIterations;
+        }
+        const double seconds = timer.seconds() / frames;
+
+        float maxSpeed = 0.0f;
+        size_t awake = 0;
+        for (const auto &body : pile) {
+            maxSpeed = std::max(maxSpeed, std::sqrt(body.lock()->getLinearVelocity().length()));
+            awake += !body.lock()->isAsleep();
+        }
+        float maxSink = 0.0f;
+        for (size_t i = 0; i < tops.size(); i++)
+            maxSink = std::max(maxSink, startHeights[i] - tops[i].lock()->getPosition().y);
+
+        const std::string name = "BoxPile/" + std::to_string(pile.size()) + "/" + config.name;
+        bench::report(name, "settling step time", settleTime / settleFrames, "ms");
+        bench::report(name, "slowest settling step", slowestStep, "ms");
+        bench::report(name, "frames until asleep", solvedFrames, "frames");
+        bench::report(name, "step time", seconds * 1e3, "ms");
+        bench::report(name, "velocity solve", total.solveVelocity / frames, "ms");
+        bench::report(name, "velocity solve per iteration",
+                      total.solveVelocity / frames / config.velocityIterations, "ms");
+        bench::report(name, "position solve", total.solvePosition / frames, "ms");
+        bench::report(name, "position iterations",
+                      double(total.positionIterations) / frames, "iterations");
+        bench::report(name, "collide", total.collide / frames, "ms");
+        bench::report(name, "contacts", double(total.contacts) / frames, "contacts");
+        bench::report(name, "awake bodies", awake, "bodies");
+        // A settled pile barely moves, and the top of each pyramid
+        // sinks by no more than the slop of each row.
+        bench::report(name, "max speed", maxSpeed, "units/s");
+        bench::report(name, "top box sank", maxSink, "units");
+    }
+}
@@ -28,6 +28,22 @@ enum class Commands : char {
     NUM_OF_COMMANDS
 };
 
+/**
+ * Collision filter categories of each kind of body in the game.
+ */
+namespace collisionCategory {
+const uint16_t boundary = 0x0001;
+const uint16_t player = 0x0002;
+const uint16_t projectile = 0x0004;
+const uint16_t enemy = 0x0008;
+const uint16_t spawner = 0x0010;
+} /* namespace collisionCategory */
+
+/**
+ * The player and its projectile share this group so they never collide.
+ */
+const int16_t playerGroup = -1;
+
 class Command {
 public:
     Commands type;
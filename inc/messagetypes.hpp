@@ -115,12 +115,13 @@ struct DestroyBodyMessage : Message {
 };
 
 struct CollisionMessage : Message {
-    std::vector<std::pair<std::weak_ptr<phy::Body>, std::weak_ptr<phy::Body>>> bodies;
+    typedef std::vector<std::pair<std::weak_ptr<phy::Body>, std::weak_ptr<phy::Body>>> BodyPairs;
+    BodyPairs began; ///< Pairs that started touching since the last message
+    BodyPairs ended; ///< Pairs that stopped touching since the last message
 
     CollisionMessage() {}
-    CollisionMessage(std::vector<std::pair<std::weak_ptr<phy::Body>,
-                                           std::weak_ptr<phy::Body>>> collisions)
-        : bodies(collisions) {}
+    CollisionMessage(BodyPairs began_, BodyPairs ended_)
+        : began(std::move(began_)), ended(std::move(ended_)) {}
 
     virtual MessageType getType() const override {
         return MessageType::Collision;
@@ -4,8 +4,25 @@
 #include <ostream>
 #include <vector>
 #include <string>
+#include <cstddef>
+#include <utility>
 
 namespace phy {
+template <typename T, size_t N>
+class GrowableStack;
+class WorkerPool;
+
+/**
+ * A segment from p1 to p2 to cast against shapes or bounding boxes.
+ *
+ * Only hits at p1 + fraction * (p2 - p1) with a fraction in
+ * [0, maxFraction] are found.
+ */
+struct RayCastInput {
+    Vec2f p1, p2;
+    float maxFraction;
+};
+
 class AABB {
 public:
     Vec2f lowVertex, highVertex;
@@ -22,6 +39,10 @@ public:
      */
     Vec2f getSideLengths() const;
     AABB combine(const AABB &b) const;
+    /**
+     * Grow the AABB by the same amount in every direction.
+     */
+    AABB expand(float amount) const;
 
     template <class T, class... Args>
     AABB combine(T first, Args&&... args) const
@@ -41,20 +62,31 @@ public:
      * @return True if the other AABB overlaps with this.
      */
     bool overlaps(const AABB &other) const;
+    /**
+     * Determine if a ray crosses this AABB, using the slab test.
+     *
+     * @param invDirection One over each component of (p2 - p1).
+     * @param entry The fraction of the ray where it enters the AABB,
+     *              which is zero if the ray starts inside.
+     * @return True if the ray enters before maxFraction.
+     */
+    bool intersectsRay(const Vec2f &origin, const Vec2f &invDirection,
+                       float maxFraction, float &entry) const;
+    /**
+     * Get the squared distance from a point to the closest point of
+     * this AABB, which is zero if the point is inside.
+     */
+    float distanceSquared(const Vec2f &point) const;
 };
 
 bool operator==(const AABB &a, const AABB& b);
 std::ostream &operator<<(std::ostream &out, const AABB &aabb);
 
 /**
- * An AABBNode is either:
- *  1) A branch with two valid children. The AABB for this node
- *     must be a fat AABB containing both children.
- *  2) A leaf with the real AABB of a shape in the world.
+ * The links from a node to the rest of an AABBTree.
  */
-class AABBNode {
+class AABBLinks {
 public:
-    AABB aabb;
     static const int32_t null;
     int32_t parent; // Index of the parent node
     int32_t leftChild; // Index of left child (if not a leaf)
@@ -62,16 +94,29 @@ public:
 
     int32_t next; // Index of the next node in the freelist
     int32_t height; // Height of the subtree at this origin
+    bool moved; // True if a leaf in this subtree moved since the last pair search
+    void *userData; // Owner of a leaf's AABB, unused by the tree itself
 
-    AABBNode()
+    AABBLinks()
         : parent(null), leftChild(null), rightChild(null),
-          height(-1) {}
+          height(-1), moved(false), userData(nullptr) {}
     bool isLeaf() const
     {
         return rightChild == null;
     }
 };
 
+/**
+ * An AABBNode is either:
+ *  1) A branch with two valid children. The AABB for this node
+ *     must be a fat AABB containing both children.
+ *  2) A leaf with the fattened AABB of a shape in the world.
+ */
+class AABBNode : public AABBLinks {
+public:
+    AABB aabb;
+};
+
 std::ostream &operator<<(std::ostream &out, const AABBNode &b);
 
 class AABBCallback {
@@ -83,6 +128,30 @@ public:
     virtual bool registerCollision(int32_t nodeA, int32_t nodeB) = 0;
 };
 
+class RayCastCallback {
+public:
+    /**
+     * Callback for when a ray crosses the AABB of a leaf.
+     *
+     * @param input The ray, clipped to the current maxFraction.
+     * @return The new maxFraction of the ray. Return input.maxFraction
+     *         to keep going, a smaller fraction to clip the ray, zero to
+     *         stop, or a negative value to ignore this leaf.
+     */
+    virtual float rayCastCallback(const RayCastInput &input, int32_t index) = 0;
+};
+
+class NearestCallback {
+public:
+    /**
+     * Get the squared distance from the query point to a leaf.
+     *
+     * This must be at least the squared distance to the leaf's AABB.
+     * A negative distance skips the leaf.
+     */
+    virtual float leafDistance(int32_t index) = 0;
+};
+
 
 /**
  * A binary search tree containing all AABB in the world.
@@ -92,21 +161,189 @@ public:
  * reference them.
  */
 class AABBTree {
-    std::vector<AABBNode> nodes;
+#ifdef PHY_AABB_SOA
+    /**
+     * Only the links are kept with each node. The bounds are kept in
+     * separate arrays so that traversals stay in hot cache lines.
+     */
+    using Node = AABBLinks;
+    std::vector<Node> nodes;
+    std::vector<float> lowX, lowY, highX, highY;
+#else
+    using Node = AABBNode;
+    std::vector<Node> nodes;
+#endif
     int32_t root; // Index of root node
     int32_t nextFreeIndex;
+    float margin; ///< Distance that every leaf AABB is fattened by
+    int32_t optimizeCursor; ///< Next node visited by optimize()
+    size_t leafCount;
+    std::vector<int32_t> movedLeaves; ///< Scratch space for findMovedCollisions()
+    /**
+     * Number of nodes a traversal keeps on the call stack before
+     * spilling into a heap buffer. This is far deeper than any
+     * balanced tree we expect to build.
+     */
+    static const size_t traversalStackSize = 256;
+    /**
+     * Number of bins used to evaluate split candidates in build().
+     */
+    static const int sahBins = 16;
+    /**
+     * Subtrees with more leaves than this are built on another thread.
+     */
+    static const size_t parallelBuildSize = 4096;
+    /**
+     * Number of subtree pairs per callback that a parallel pair search
+     * expands to before sharing them out.
+     */
+    static const size_t parallelPairTasks = 8;
+    /**
+     * findMovedCollisions() only descends the tree against itself once
+     * at least this many leaves, and one in movedTraversalRatio of all
+     * leaves, have moved. Fewer moved leaves are cheaper to query one
+     * at a time, since the traversal visits every branch above them.
+     */
+    static const size_t movedTraversalSize = 512;
+    static const size_t movedTraversalRatio = 10;
+    struct BuildEntry;
+    using PairStack = GrowableStack<std::pair<int32_t, int32_t>, traversalStackSize>;
 public:
+    /**
+     * Scale applied to a proxy's displacement when predicting where it
+     * will be next step.
+     */
+    static const float displacementMultiplier;
+
     AABBTree();
-    AABBTree(size_t initialSize);
+    AABBTree(size_t initialSize, float fatMargin = 0.0f);
 
-    int32_t insertAABB(const AABB &box);
-    void updateAABB(int32_t index, const AABB &newAABB);
+    /**
+     * Insert a new leaf for the given AABB.
+     *
+     * The stored AABB is fattened by the margin of the tree.
+     *
+     * @param userData Handle stored with the leaf, see getUserData().
+     */
+    int32_t insertAABB(const AABB &box, void *userData = nullptr);
+    /**
+     * Move a leaf to a new position.
+     *
+     * The leaf is only reinserted if the new AABB has left the fattened
+     * AABB stored in the tree, or the stored AABB has grown too large.
+     *
+     * @param displacement The distance the proxy moved, used to extend
+     *                     the fat AABB in the direction of motion.
+     * @return True iff the leaf had to be reinserted.
+     */
+    bool updateAABB(int32_t index, const AABB &newAABB,
+                    const Vec2f &displacement = Vec2f());
     void destroyAABB(int32_t index);
+    /**
+     * Compute the fat AABB that should be stored for a moved proxy.
+     *
+     * @param fatAABB The stored AABB. It is replaced if the proxy has
+     *                left it or if it has grown far larger than the proxy.
+     * @return True iff fatAABB was replaced.
+     */
+    static bool refatten(AABB &fatAABB, const AABB &newAABB, float margin,
+                         const Vec2f &displacement);
+    /**
+     * Insert many AABB at once.
+     *
+     * The whole tree is rebuilt top-down with a binned surface area
+     * heuristic, which produces a far better tree than inserting each
+     * AABB on its own. Existing leaves keep their indices. Large subtrees
+     * are built in parallel.
+     *
+     * @return The index of the leaf for each AABB, in the same order.
+     */
+    std::vector<int32_t> build(const std::vector<AABB> &boxes);
+    /**
+     * Get the sum of the areas of all branches.
+     *
+     * Lower values mean that queries will visit fewer nodes.
+     */
+    float getTreeCost() const;
+    /**
+     * Get the largest difference between the heights of the two
+     * children of any branch.
+     */
+    int32_t getMaxBalance() const;
+    /**
+     * Lower the cost of the tree within a fixed amount of work.
+     *
+     * Inserting leaves one at a time only keeps the tree balanced, so
+     * its cost drifts upward as leaves move. Each call visits the next
+     * few branches, continuing where the last call stopped, and applies
+     * the tree rotation that most reduces the area of the branch's
+     * children without unbalancing them. Leaves keep their indices and
+     * AABBs.
+     *
+     * @param budget Number of branches to visit.
+     * @return The number of rotations applied.
+     */
+    size_t optimize(size_t budget);
+    /**
+     * Move every node into depth-first order and release unused storage.
+     *
+     * After many insertions and removals the free list scatters the
+     * nodes of a subtree across the whole pool. Compacting puts each
+     * subtree in one contiguous run, left child first, so traversals
+     * walk memory mostly forward. This is meant for level transitions
+     * or quiet frames, as every node is copied.
+     *
+     * @return The new index of every old node, or AABBNode::null for
+     *         nodes that were free. Callers must rewrite any stored
+     *         leaf indices with it.
+     */
+    std::vector<int32_t> compact();
+    /**
+     * Get the number of leaves in the tree.
+     */
+    size_t getLeafCount() const
+    {
+        return leafCount;
+    }
+    /**
+     * Get the index of the root node, or AABBNode::null if empty.
+     */
+    int32_t getRoot() const
+    {
+        return root;
+    }
+    /**
+     * Get the number of nodes that storage has been allocated for.
+     */
+    size_t getCapacity() const
+    {
+        return nodes.size();
+    }
+    /**
+     * Get the handle that was stored with a leaf.
+     *
+     * This lets callers map a leaf back to its owner without a search.
+     */
+    void *getUserData(int32_t index) const
+    {
+        return nodes[index].userData;
+    }
+    void setUserData(int32_t index, void *userData)
+    {
+        nodes[index].userData = userData;
+    }
+    /**
+     * Get the fattened AABB stored for a leaf.
+     */
+    AABB getFatAABB(int32_t index) const
+    {
+        return getBox(index);
+    }
     /**
      * Find any any AABB in the tree that overlap with the
      * one that is given.
-     * @note This prototype should only be used for testing and will
-     *       always return -1 for the first index on callback.
+     * @note The given AABB is not a leaf of this tree, so this
+     *       prototype always returns -1 for the first index on callback.
      */
     void findCollisions(AABBCallback *callback, const AABB &aabb) const;
     /**
@@ -117,6 +354,47 @@ public:
      *       callback.
      */
     void findCollisions(AABBCallback *callback, int32_t index) const;
+    /**
+     * Find every pair of overlapping leaves where at least one of the
+     * leaves was inserted or reinserted since the last call.
+     *
+     * When many leaves have moved, both subtrees are descended together
+     * and subtrees without any moved leaves are skipped. Otherwise each
+     * moved leaf is queried on its own, and pairs of two moved leaves
+     * are only reported by the query of the lower one. Either way each
+     * pair is found exactly once, and the callback always receives the
+     * lower index first. All moved flags are cleared afterwards.
+     */
+    void findMovedCollisions(AABBCallback *callback);
+    /**
+     * Find the same pairs as findMovedCollisions(), sharing the work
+     * between the threads of a pool.
+     *
+     * The top of the traversal is expanded on the calling thread, then
+     * each callback is given a share of the remaining subtree pairs.
+     * Every pair is still found exactly once, by one of the callbacks,
+     * so callbacks must only write to their own state.
+     */
+    void findMovedCollisions(const std::vector<AABBCallback *> &callbacks, WorkerPool &pool);
+    /**
+     * Find every leaf whose AABB is crossed by a ray.
+     *
+     * The nearer child of each branch is visited first, and the ray is
+     * clipped to the fraction returned by the callback, so a search for
+     * the closest hit skips most of the tree.
+     */
+    void rayCast(RayCastCallback *callback, const RayCastInput &input) const;
+    /**
+     * Find the k leaves closest to a point with a best-first search.
+     *
+     * Nodes are visited in order of their distance from the point, so
+     * only the part of the tree around the point is searched.
+     *
+     * @param nearest Up to k (squared distance, leaf) pairs are appended,
+     *                nearest first.
+     */
+    void findNearest(NearestCallback *callback, const Vec2f &point, size_t k,
+                     std::vector<std::pair<float, int32_t>> &nearest) const;
     /**
      * Convert the tree to a string for debugging purposes.
      */
@@ -125,6 +403,9 @@ public:
      * Get the list of nodes for testing purposes.
      */
     std::vector<AABBNode> getNodes() const;
+    /**
+     * Get the fattened AABB stored for a node.
+     */
     const AABB operator[](int i) const;
 private:
     /**
@@ -142,6 +423,18 @@ private:
      * @return The index of the new root.
      */
     int32_t balance(int32_t origin);
+    /**
+     * Swap a child of a branch with a grandchild on the other side, or
+     * two grandchildren, if that reduces the area of the children.
+     *
+     * @return True iff the subtree was rotated.
+     */
+    bool rotate(int32_t index);
+    /**
+     * Recompute the AABB, height and moved flag of a branch from its
+     * children.
+     */
+    void refit(int32_t index);
     /**
      * Find a position for a new AABB inside the internal vector.
      */
@@ -150,6 +443,83 @@ private:
      * Find the correct position in the tree for an allocated node.
      */
     void insertNode(int32_t node);
+    /**
+     * Remove every leaf from the tree and free all branches.
+     *
+     * @param leaves Each leaf index is appended to this list.
+     */
+    void collectLeaves(std::vector<BuildEntry> &leaves);
+    /**
+     * Build a subtree over entries [begin, end) with the binned SAH.
+     *
+     * A subtree with n leaves uses the n - 1 branches starting at
+     * branches[firstBranch], so independent subtrees can be built
+     * concurrently.
+     *
+     * @return The index of the root of the subtree.
+     */
+    int32_t buildSubtree(std::vector<BuildEntry> &entries,
+                         const std::vector<int32_t> &branches,
+                         size_t begin, size_t end, size_t firstBranch,
+                         int parallelDepth);
+    /**
+     * Descend the subtree pairs on the stack, see findMovedCollisions().
+     *
+     * @param stopSize Return early once the stack holds this many pairs.
+     * @return False iff the callback asked to stop.
+     */
+    bool descendMoved(AABBCallback *callback, PairStack &stack, size_t stopSize) const;
+    /**
+     * Replace the list with every leaf whose moved flag is set.
+     *
+     * @return True if so few leaves have moved that they should be
+     *         queried one at a time, see movedTraversalSize.
+     */
+    bool collectMoved(std::vector<int32_t> &leaves) const;
+    /**
+     * Query each of the given moved leaves, see findMovedCollisions().
+     */
+    void queryMoved(AABBCallback *callback, const std::vector<int32_t> &leaves) const;
+    /**
+     * Clear the moved flag of every node.
+     */
+    void clearMoved();
+    /**
+     * Grow the storage for all nodes.
+     */
+    void resizeNodes(size_t size);
+
+#ifdef PHY_AABB_SOA
+    AABB getBox(int32_t index) const
+    {
+        return {{lowX[index], lowY[index]}, {highX[index], highY[index]}};
+    }
+
+    void setBox(int32_t index, const AABB &box)
+    {
+        lowX[index] = box.lowVertex.x;
+        lowY[index] = box.lowVertex.y;
+        highX[index] = box.highVertex.x;
+        highY[index] = box.highVertex.y;
+    }
+#else
+    const AABB &getBox(int32_t index) const
+    {
+        return nodes[index].aabb;
+    }
+
+    void setBox(int32_t index, const AABB &box)
+    {
+        nodes[index].aabb = box;
+    }
+#endif
+    /**
+     * Test which children of a branch overlap the query box.
+     *
+     * @return Bit 0 is set if the left child overlaps,
+     *         bit 1 is set if the right child overlaps.
+     */
+    int overlappingChildren(const Node &node, const AABB &aabb) const;
 };
 
 std::ostream &operator<<(std::ostream &out, AABBTree tree);
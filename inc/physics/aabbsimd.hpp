@@ -0,0 +1,142 @@
+#pragma once
+
+#include "inc/physics/aabb.hpp"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+
+/**
+ * Kernels for testing several AABB against one query box at once.
+ *
+ * The boxes to test are given in structure-of-arrays form. Every kernel
+ * uses the same strict comparisons as AABB::overlaps, so touching boxes
+ * are not considered to overlap.
+ */
+namespace phy {
+/**
+ * Test two boxes against a query box.
+ *
+ * @return Bit i is set iff box i overlaps the query.
+ */
+inline int overlaps2(float lowX0, float lowY0, float highX0, float highY0,
+                     float lowX1, float lowY1, float highX1, float highY1,
+                     const AABB &query)
+{
+#ifdef __SSE2__
+    const __m128 low = _mm_setr_ps(lowX0, lowY0, lowX1, lowY1);
+    const __m128 high = _mm_setr_ps(highX0, highY0, highX1, highY1);
+    const __m128 queryLow = _mm_setr_ps(query.lowVertex.x, query.lowVertex.y,
+                                        query.lowVertex.x, query.lowVertex.y);
+    const __m128 queryHigh = _mm_setr_ps(query.highVertex.x, query.highVertex.y,
+                                         query.highVertex.x, query.highVertex.y);
+    const __m128 hit = _mm_and_ps(_mm_cmplt_ps(low, queryHigh),
+                                  _mm_cmplt_ps(queryLow, high));
+    const int mask = _mm_movemask_ps(hit);
+    return ((mask & 0x3) == 0x3) | (((mask & 0xC) == 0xC) << 1);
+#else
+    const bool first = lowX0 < query.highVertex.x && query.lowVertex.x < highX0 &&
+                       lowY0 < query.highVertex.y && query.lowVertex.y < highY0;
+    const bool second = lowX1 < query.highVertex.x && query.lowVertex.x < highX1 &&
+                        lowY1 < query.highVertex.y && query.lowVertex.y < highY1;
+    return first | (second << 1);
+#endif
+}
+
+/**
+ * Test four consecutive boxes against a query box.
+ *
+ * @return Bit i is set iff box i overlaps the query.
+ */
+inline int overlaps4(const float *lowX, const float *lowY,
+                     const float *highX, const float *highY,
+                     const AABB &query)
+{
+#ifdef __SSE2__
+    __m128 hit = _mm_cmplt_ps(_mm_loadu_ps(lowX), _mm_set1_ps(query.highVertex.x));
+    hit = _mm_and_ps(hit, _mm_cmplt_ps(_mm_set1_ps(query.lowVertex.x), _mm_loadu_ps(highX)));
+    hit = _mm_and_ps(hit, _mm_cmplt_ps(_mm_loadu_ps(lowY), _mm_set1_ps(query.highVertex.y)));
+    hit = _mm_and_ps(hit, _mm_cmplt_ps(_mm_set1_ps(query.lowVertex.y), _mm_loadu_ps(highY)));
+    return _mm_movemask_ps(hit);
+#else
+    int mask = 0;
+    for (int i = 0; i < 4; i++) {
+        bool hit = lowX[i] < query.highVertex.x && query.lowVertex.x < highX[i] &&
+                   lowY[i] < query.highVertex.y && query.lowVertex.y < highY[i];
+        mask |= hit << i;
+    }
+    return mask;
+#endif
+}
+
+/**
+ * Test four consecutive boxes against a ray, like AABB::intersectsRay.
+ *
+ * The min and max operands are ordered so that NaN slab distances are
+ * ignored exactly as in the scalar test.
+ *
+ * @param entry Receives the fraction where the ray enters each box.
+ * @return Bit i is set iff box i is crossed by the ray.
+ */
+inline int intersectsRay4(const float *lowX, const float *lowY,
+                          const float *highX, const float *highY,
+                          const Vec2f &origin, const Vec2f &invDirection,
+                          float maxFraction, float *entry)
+{
+#ifdef __SSE2__
+    const __m128 originX = _mm_set1_ps(origin.x), originY = _mm_set1_ps(origin.y);
+    const __m128 invX = _mm_set1_ps(invDirection.x), invY = _mm_set1_ps(invDirection.y);
+    __m128 low = _mm_setzero_ps();
+    __m128 high = _mm_set1_ps(maxFraction);
+
+    __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(lowX), originX), invX);
+    __m128 t2 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(highX), originX), invX);
+    // max(low, min(t1, t2)) and min(high, max(t1, t2)) as std::min/max order them.
+    low = _mm_max_ps(_mm_min_ps(t2, t1), low);
+    high = _mm_min_ps(_mm_max_ps(t2, t1), high);
+
+    t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(lowY), originY), invY);
+    t2 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(highY), originY), invY);
+    low = _mm_max_ps(_mm_min_ps(t2, t1), low);
+    high = _mm_min_ps(_mm_max_ps(t2, t1), high);
+
+    _mm_storeu_ps(entry, low);
+    return _mm_movemask_ps(_mm_cmple_ps(low, high));
+#else
+    int mask = 0;
+    for (int i = 0; i < 4; i++) {
+        const AABB box({lowX[i], lowY[i]}, {highX[i], highY[i]});
+        mask |= box.intersectsRay(origin, invDirection, maxFraction, entry[i]) << i;
+    }
+    return mask;
+#endif
+}
+
+/**
+ * Test eight consecutive boxes against a query box.
+ *
+ * @return Bit i is set iff box i overlaps the query.
+ */
+inline int overlaps8(const float *lowX, const float *lowY,
+                     const float *highX, const float *highY,
+                     const AABB &query)
+{
+#ifdef __AVX__
+    __m256 hit = _mm256_cmp_ps(_mm256_loadu_ps(lowX),
+                               _mm256_set1_ps(query.highVertex.x), _CMP_LT_OQ);
+    hit = _mm256_and_ps(hit, _mm256_cmp_ps(_mm256_set1_ps(query.lowVertex.x),
+                                           _mm256_loadu_ps(highX), _CMP_LT_OQ));
+    hit = _mm256_and_ps(hit, _mm256_cmp_ps(_mm256_loadu_ps(lowY),
+                                           _mm256_set1_ps(query.highVertex.y), _CMP_LT_OQ));
+    hit = _mm256_and_ps(hit, _mm256_cmp_ps(_mm256_set1_ps(query.lowVertex.y),
+                                           _mm256_loadu_ps(highY), _CMP_LT_OQ));
+    return _mm256_movemask_ps(hit);
+#else
+    return overlaps4(lowX, lowY, highX, highY, query) |
+           (overlaps4(lowX + 4, lowY + 4, highX + 4, highY + 4, query) << 4);
+#endif
+}
+} /* namespace phy */
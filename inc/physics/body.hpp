@@ -23,16 +23,37 @@ enum class BodyType {
 struct ExtraData {
     ExtraData() {
         color = {0, 125, 125, 255};
-        colliding = false;
         expanding = 0;
     }
-    bool colliding;
     SDL_Color color;
     int colorAngle;
     // Projectile only
     int expanding;
 };
 
+/**
+ * Decide which pairs of bodies the broadphase reports.
+ *
+ * Two bodies that share a nonzero group index always collide if the
+ * index is positive and never collide if it is negative. Otherwise
+ * they only collide if each body's category is in the other's mask.
+ */
+struct Filter {
+    Filter()
+        : categoryBits(0x0001), maskBits(0xFFFF), groupIndex(0) {}
+
+    uint16_t categoryBits; ///< The categories this body belongs to
+    uint16_t maskBits; ///< The categories this body can collide with
+    int16_t groupIndex;
+
+    bool shouldCollide(const Filter &other) const
+    {
+        if (groupIndex != 0 && groupIndex == other.groupIndex)
+            return groupIndex > 0;
+        return (maskBits & other.categoryBits) && (other.maskBits & categoryBits);
+    }
+};
+
 struct BodySpec {
     BodySpec()
     {
@@ -40,6 +61,8 @@ struct BodySpec {
         angle = 0.0f;
         angVelocity = 0.0f;
         gravityFactor = 1.0f;
+        friction = 0.2f;
+        restitution = 0.0f;
     }
 
     BodyType bodyType;
@@ -48,18 +71,21 @@ struct BodySpec {
     Vec2f linVelocity;
     float angVelocity;
     float gravityFactor; ///< Scalar factor for the world's gravity on this body
+    float friction; ///< Coulomb friction coefficient, usually in [0, 1]
+    float restitution; ///< How much of the speed of an impact is kept, in [0, 1]
     std::vector<std::shared_ptr<Shape>> shapes;
     ExtraData extra;
+    Filter filter; ///< Applies to every shape of the body
 };
 
-class Body {
+class Body : public std::enable_shared_from_this<Body> {
 private:
     ExtraData extraData;
     std::shared_ptr<World> parentWorld;
     float mass, invMass;
     float inertia, invInertia;
     BodyType bodyType;
-    Vec2f position, centroid;
+    Vec2f position;
     Vec2f linearVelocity;
     float angle;
     float angularVelocity;
@@ -68,8 +94,19 @@ private:
     std::vector<std::shared_ptr<Shape>> shapeList;
     Sweep bodySweep;
     float gravityFactor; ///< This factor must be a positive nonzero value
+    float friction;
+    float restitution;
     Transform transform;
+    Filter filter;
+    std::vector<int32_t> proxies; ///< Broadphase proxy of each shape, in shapeList order
+    std::vector<int32_t> staleProxies; ///< Proxies of destroyed shapes not yet removed
+    bool asleep;
+    float sleepTime; ///< Seconds this body has been nearly still
+    int32_t islandIndex; ///< Scratch space for World::updateSleep()
     friend class World;
+    friend class BroadPhaseBase;
+    friend class ContactManager;
+    friend class ContactSolver;
 public:
     Body(const BodySpec &spec);
     ~Body();
@@ -121,12 +158,32 @@ public:
     void applyLinearImpulse(const Vec2f &impulse, const Vec2f &point);
     void applyAngularImpulse(float impulse);
 
+    BodyType getBodyType() const;
+    const Filter &getFilter() const;
+
     float getMass() const;
+    /**
+     * Get the rotational inertia about the center of mass.
+     */
     float getInertia() const;
+    /**
+     * Get the center of mass in world coordinates.
+     */
     const Vec2f &getCenterMass() const;
+    float getFriction() const;
+    float getRestitution() const;
 
+    /**
+     * Stop simulating this dynamic body until it is woken.
+     *
+     * The world puts bodies to sleep by itself once they and every body
+     * they touch have been nearly still for timeToSleep, and wakes them
+     * when an awake body touches them. Moving the body by hand, such as
+     * setting its velocity or applying a force, wakes it.
+     */
     void setSleep();
-    bool isAsleep();
+    void setAwake();
+    bool isAsleep() const;
 
     std::vector<std::weak_ptr<Shape>> getShapes();
     std::vector<std::weak_ptr<const Shape>> getShapes() const;
@@ -145,6 +202,8 @@ public:
     /**
      * Update this body's position due to accumulated velocity.
      *
+     * The body turns about its center of mass.
+     *
      * @param dt The amount of time in seconds since the last update
      */
     void updatePosition(float dt);
@@ -180,6 +239,10 @@ private:
      *   (2) a shape's mass properties have changed
      */
     void updateMassProperties();
+    /**
+     * Move the body's origin to follow its center of mass and angle.
+     */
+    void synchronizeTransform();
     friend std::ostream& operator<<(std::ostream &out, const Body &body);
 };
 
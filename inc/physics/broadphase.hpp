@@ -2,55 +2,413 @@
 
 #include "inc/physics/body.hpp"
 #include "inc/physics/aabb.hpp"
+#include "inc/physics/pairbuffer.hpp"
+#include "inc/physics/workerpool.hpp"
 
+#include <algorithm>
+#include <functional>
 #include <memory>
 #include <utility>
 #include <vector>
-#include <unordered_set>
 
-// Hash method for an integer pair with commutative properties
-// pair_hash(<a, b>) == pair_hash(<b, a>)
-struct pair_hash {
-    inline std::size_t operator()(const std::pair<int32_t, int32_t> &p) const {
-        return p.first ^ p.second;
-    }
+namespace phy {
+/**
+ * Distance that every proxy in the broadphase is fattened by.
+ *
+ * Larger values reduce the number of tree updates for slowly moving
+ * bodies, but produce more pairs that do not actually overlap.
+ */
+const float aabbMargin = 2.0f;
+
+/**
+ * The spatial structures available to find pairs in a World.
+ */
+enum class BroadPhaseType {
+    tree, ///< A dynamic AABB tree, see BroadPhase
+    sweepAndPrune, ///< Sorted intervals along one axis, see SweepAndPrune
+    spatialHash, ///< A hashed uniform grid, see SpatialHash
 };
 
-namespace phy {
-class BroadPhase : public AABBCallback {
+/**
+ * A shape hit by a ray.
+ */
+struct RayCastHit {
+    std::weak_ptr<Body> body;
+    std::weak_ptr<Shape> shape;
+    Vec2f point; ///< Where the ray hit the shape, in world coordinates
+    Vec2f normal; ///< Surface normal at the hit point
+    float fraction; ///< The hit is at p1 + fraction * (p2 - p1)
+};
+
+/**
+ * The contract shared by every broadphase backend.
+ *
+ * Each shape of a body is given a proxy that stores its fattened AABB.
+ * This class manages the proxies of each body and the pairs that were
+ * found, while a backend only has to store proxies and find the pairs
+ * where at least one proxy has moved.
+ *
+ * Backends only store pairs that pass shouldCollide(), so filtered
+ * pairs never reach the pair cache or the contact events.
+ *
+ * The pairs are only candidates. A ContactManager runs the narrowphase
+ * on them to find which shapes actually touch.
+ */
+class BroadPhaseBase {
+    friend class ContactManager;
+public:
+    typedef std::vector<std::pair<std::weak_ptr<Body>, std::weak_ptr<Body>>> BodyPairs;
 private:
-    AABBTree tree;
-    std::vector<std::pair<std::weak_ptr<const Shape>, int32_t>> shapeMapping;
-    std::vector<std::pair<std::weak_ptr<Body>, int32_t>> bodyMapping;
-    std::unordered_set<std::pair<int32_t, int32_t>, pair_hash> collisions;
-    std::vector<int32_t> moved;
+    std::vector<AABB> shapeAABBs; ///< Tight AABB of the shape of each proxy
+    /// Scratch space for nearest(), kept to avoid allocating per query
+    mutable std::vector<std::pair<float, int32_t>> nearestProxyList;
+protected:
+    PairBuffer collisions; ///< Pairs found by the last update
 public:
-    BroadPhase();
+    virtual ~BroadPhaseBase() = default;
     /**
      * Insert a new body and all of its shapes to the broadphase manager.
      */
     void addNewBody(const std::shared_ptr<Body> body);
+    /**
+     * Insert many bodies at once.
+     */
+    virtual void addNewBodies(const std::vector<std::shared_ptr<Body>> &bodies);
     /**
      * Update the position of a shape.
+     *
+     * Shapes are only searched for new pairs if they have left
+     * their fattened AABB.
+     *
+     * @param displacement The distance the body moved this step.
      */
-    void updateBody(const std::shared_ptr<Body> updatedBody);
+    void updateBody(const std::shared_ptr<Body> updatedBody,
+                    const Vec2f &displacement = Vec2f());
     /**
      * Remove a body from any future broadphase calculations.
+     *
+     * The body's proxies are destroyed and any pending pair that
+     * contains them is dropped.
      */
     void deleteBody(const std::shared_ptr<Body> deletedBody);
+    /**
+     * Find all new pairs of overlapping shapes where at least one
+     * shape has moved since the last update.
+     */
     void updatePairs();
-    virtual bool registerCollision(int32_t nodeA, int32_t nodeB) override;
+    /**
+     * Get the pairs found by the last update.
+     *
+     * Unlike the contact events of a ContactManager, this includes pairs
+     * that were already known and pairs whose shapes do not touch. The
+     * pairs are cleared, so a ContactManager must be updated first.
+     */
+    BodyPairs getBodyCollisions();
+    /**
+     * Report every shape hit by a ray, in no particular order.
+     *
+     * @param callback Given each hit, returns the new maxFraction of the
+     *                 ray like a RayCastCallback. Returning the fraction
+     *                 of the hit finds the closest hit.
+     */
+    void rayCast(const std::function<float(const RayCastHit &)> &callback,
+                 const RayCastInput &input) const;
+    /**
+     * Find every body with a shape whose AABB overlaps an area.
+     *
+     * The queries below clear the list and add each body once. They
+     * reuse its capacity, so querying every step does not allocate.
+     */
+    void query(const AABB &aabb, std::vector<Body *> &bodies) const;
+    /**
+     * Find every body with a shape that contains a point.
+     */
+    void queryPoint(const Vec2f &point, std::vector<Body *> &bodies) const;
+    /**
+     * Find the k bodies closest to a point, nearest first.
+     *
+     * The distance to a body is the distance to the closest AABB of
+     * its shapes, which is zero for bodies that cover the point.
+     */
+    void nearest(size_t k, const Vec2f &point, std::vector<Body *> &bodies) const;
+    /**
+     * Lay the proxies out again for faster searches and release unused
+     * storage. Proxy ids change, but bodies and pending pairs are kept
+     * up to date.
+     *
+     * This copies every proxy, so it is meant for level transitions or
+     * quiet frames. Backends whose storage does not degrade do nothing.
+     *
+     * @return The new id of each old proxy, see remapProxies(), which
+     *         is empty if no proxy was moved.
+     */
+    virtual std::vector<int32_t> compact()
+    {
+        return {};
+    }
+protected:
+    /**
+     * Add the pairs of overlapping proxies where at least one proxy has
+     * moved since the last call to collisions.
+     */
+    virtual void findPairs() = 0;
+    /**
+     * Store a new proxy for the AABB of a shape.
+     *
+     * @return The id of the proxy.
+     */
+    virtual int32_t createProxy(const AABB &aabb, Body *body) = 0;
+    /**
+     * Move a proxy, refattening its AABB if it has left the old one.
+     */
+    virtual void moveProxy(int32_t proxy, const AABB &aabb, const Vec2f &displacement) = 0;
+    /**
+     * Remove a proxy. Its id may be reused by the next createProxy().
+     */
+    virtual void destroyProxy(int32_t proxy) = 0;
+    virtual Body *getProxyBody(int32_t proxy) const = 0;
+    virtual AABB getFatAABB(int32_t proxy) const = 0;
+    /**
+     * Report every proxy whose fattened AABB is crossed by a ray.
+     */
+    virtual void rayCastProxies(RayCastCallback *callback, const RayCastInput &input) const = 0;
+    /**
+     * Report every proxy whose fattened AABB overlaps an area as
+     * registerCollision(-1, proxy), like AABBTree::findCollisions().
+     */
+    virtual void queryProxies(AABBCallback *callback, const AABB &aabb) const = 0;
+    /**
+     * Append the k proxies nearest to a point, like AABBTree::findNearest().
+     */
+    virtual void nearestProxies(NearestCallback *callback, const Vec2f &point, size_t k,
+                                std::vector<std::pair<float, int32_t>> &nearest) const = 0;
+    /**
+     * Record the tight AABB of a proxy's shape.
+     *
+     * Backends that insert proxies without createProxy() must call this.
+     */
+    void setShapeAABB(int32_t proxy, const AABB &aabb);
+    /**
+     * Replace every proxy id p with remap[p] after a backend has moved
+     * its proxies. Destroyed proxies map to AABBNode::null.
+     *
+     * getProxyBody() must already accept the new ids.
+     */
+    void remapProxies(const std::vector<int32_t> &remap);
+    /**
+     * Check whether the shapes of two bodies may form a pair.
+     *
+     * Shapes of the same body and pairs of static bodies never collide,
+     * otherwise the filters of both bodies decide.
+     */
+    static bool shouldCollide(const Body &bodyA, const Body &bodyB)
+    {
+        if (&bodyA == &bodyB)
+            return false;
+        if (bodyA.bodyType == BodyType::staticBody && bodyB.bodyType == BodyType::staticBody)
+            return false;
+        return bodyA.filter.shouldCollide(bodyB.filter);
+    }
+
+    /**
+     * Test a ray against every live proxy in a list, for backends
+     * without a hierarchy to descend.
+     */
+    template <typename Proxy>
+    static void rayCastList(const std::vector<Proxy> &proxies, RayCastCallback *callback,
+                            const RayCastInput &input)
+    {
+        const Vec2f direction = input.p2 - input.p1;
+        const Vec2f invDirection(1.0f / direction.x, 1.0f / direction.y);
+        RayCastInput clipped = input;
+        for (size_t i = 0; i < proxies.size(); i++) {
+            float entry;
+            if (!proxies[i].body ||
+                !proxies[i].aabb.intersectsRay(input.p1, invDirection, clipped.maxFraction, entry))
+                continue;
+            const float fraction = callback->rayCastCallback(clipped, i);
+            if (fraction == 0.0f)
+                return;
+            if (fraction > 0.0f)
+                clipped.maxFraction = std::min(clipped.maxFraction, fraction);
+        }
+    }
+
+    /**
+     * Report every live proxy in a list that overlaps an area.
+     */
+    template <typename Proxy>
+    static void queryList(const std::vector<Proxy> &proxies, AABBCallback *callback,
+                          const AABB &aabb)
+    {
+        for (size_t i = 0; i < proxies.size(); i++)
+            if (proxies[i].body && proxies[i].aabb.overlaps(aabb) &&
+                !callback->registerCollision(-1, i))
+                return;
+    }
+    /**
+     * Append the k live proxies in a list nearest to a point.
+     */
+    template <typename Proxy>
+    static void nearestList(const std::vector<Proxy> &proxies, NearestCallback *callback,
+                            const Vec2f &point, size_t k,
+                            std::vector<std::pair<float, int32_t>> &nearest)
+    {
+        const auto first = nearest.size();
+        for (size_t i = 0; i < proxies.size(); i++) {
+            if (!proxies[i].body)
+                continue;
+            const float distance = callback->leafDistance(i);
+            if (distance >= 0.0f)
+                nearest.emplace_back(distance, i);
+        }
+        const auto end = nearest.begin() + first + std::min(k, nearest.size() - first);
+        std::partial_sort(nearest.begin() + first, end, nearest.end());
+        nearest.erase(end, nearest.end());
+    }
+
+    static std::vector<int32_t> &getProxies(Body &body)
+    {
+        return body.proxies;
+    }
+    static const std::vector<std::shared_ptr<Shape>> &getShapeList(const Body &body)
+    {
+        return body.shapeList;
+    }
+private:
+    /**
+     * Get the shape that a proxy was created for, or null if the shape
+     * was destroyed but its proxy has not been removed yet.
+     */
+    const std::shared_ptr<Shape> *findProxyShape(int32_t proxy) const;
+    /**
+     * Destroy the given proxies and clear the list.
+     */
+    void destroyProxies(std::vector<int32_t> &proxies);
+};
+
+/**
+ * A broadphase backed by dynamic AABB trees.
+ *
+ * Static bodies are kept in a tree of their own that is never queried
+ * against itself, so a large static level costs nothing while only the
+ * dynamic bodies move. Proxy ids interleave both trees: even ids are
+ * leaves of the dynamic tree and odd ids are leaves of the static tree.
+ *
+ * Once enough proxies have moved, the pairs are found on several
+ * threads. Each thread gathers its pairs into its own buffer and the
+ * buffers are sorted together, so the result is identical to finding
+ * the pairs on one thread. The threads are started with the broadphase
+ * and sleep between updates.
+ *
+ * This is a good default for scenes of any shape.
+ */
+class BroadPhase : public BroadPhaseBase {
+private:
+    /**
+     * Gathers the pairs found by one thread.
+     */
+    class PairCollector : public AABBCallback {
+        const BroadPhase *broadPhase;
+    public:
+        PairBuffer pairs;
+        int32_t queryProxy; ///< The proxy being tested against the other tree
+
+        PairCollector(const BroadPhase *owner)
+            : broadPhase(owner), queryProxy(AABBNode::null) {}
+        virtual bool registerCollision(int32_t nodeA, int32_t nodeB) override;
+    };
+
+    /**
+     * Fewer moved proxies than this are not worth starting threads for.
+     */
+    static const size_t parallelPairSize;
+    /**
+     * Number of branches of the dynamic tree that each update visits
+     * to undo the cost drift of incremental insertion.
+     */
+    static const size_t optimizeBudget;
+    /**
+     * Batches with at least one body for every this many leaves already
+     * in a tree rebuild it, smaller batches are inserted into it.
+     */
+    static const size_t bulkBuildRatio;
+
+    AABBTree tree; ///< Leaves of dynamic bodies, user data is the owning Body
+    AABBTree staticTree; ///< Leaves of static bodies, which are not fattened
+    std::vector<int32_t> movedProxies; ///< Dynamic proxies to test against staticTree
+    std::vector<int32_t> movedStaticProxies; ///< Static proxies to test against tree
+    WorkerPool workers; ///< Joined when the broadphase is destroyed
+    std::vector<PairCollector> collectors; ///< One for each thread
+    size_t dynamicLeaves; ///< Number of proxies in tree
+    size_t staticLeaves; ///< Number of proxies in staticTree
+public:
+    BroadPhase();
+    /**
+     * @param threads Number of threads used to find pairs, or zero
+     *                for one per hardware thread.
+     */
+    BroadPhase(float margin, size_t threads = 0);
+    BroadPhase(const BroadPhase &) = delete;
+    BroadPhase &operator=(const BroadPhase &) = delete;
+    /**
+     * Insert many bodies at once.
+     *
+     * A batch that is large next to the bodies already added rebuilds
+     * the trees in one pass, which is much faster and gives a better
+     * tree than adding each body on its own. Smaller batches, like the
+     * enemies spawned in one frame, are inserted like addNewBody().
+     */
+    virtual void addNewBodies(const std::vector<std::shared_ptr<Body>> &bodies) override;
     void printTree(std::ostream &out);
-    std::vector<std::pair<std::weak_ptr<Body>, std::weak_ptr<Body>>>
-    getBodyCollisions();
+    /**
+     * Compact both trees into depth-first order, see AABBTree::compact().
+     */
+    virtual std::vector<int32_t> compact() override;
+protected:
+    virtual void findPairs() override;
+    virtual int32_t createProxy(const AABB &aabb, Body *body) override;
+    virtual void moveProxy(int32_t proxy, const AABB &aabb, const Vec2f &displacement) override;
+    virtual void destroyProxy(int32_t proxy) override;
+    virtual Body *getProxyBody(int32_t proxy) const override;
+    virtual AABB getFatAABB(int32_t proxy) const override;
+    virtual void rayCastProxies(RayCastCallback *callback, const RayCastInput &input) const override;
+    virtual void queryProxies(AABBCallback *callback, const AABB &aabb) const override;
+    virtual void nearestProxies(NearestCallback *callback, const Vec2f &point, size_t k,
+                                std::vector<std::pair<float, int32_t>> &nearest) const override;
 private:
     /**
-     * Attempt to find the position of a shape being managed.
+     * Add the leaves for a batch of AABBs to a tree.
      *
-     * @return A pair:
-     *      the first value denotes whether the shape was found.
-     *      the second value is the result of std::find().
+     * @param leaves The number of leaves in the tree, which is updated.
+     * @return The index of the leaf for each AABB, in the same order.
      */
-    auto findShape(const std::weak_ptr<const Shape> &shape);
+    static std::vector<int32_t> insertBoxes(AABBTree &tree, size_t &leaves,
+                                            const std::vector<AABB> &boxes);
+    static int32_t makeProxy(int32_t node, bool isStatic)
+    {
+        return 2 * node + isStatic;
+    }
+    static bool isStaticProxy(int32_t proxy)
+    {
+        return proxy & 1;
+    }
+    static int32_t getNode(int32_t proxy)
+    {
+        return proxy >> 1;
+    }
+    AABBTree &getTree(int32_t proxy)
+    {
+        return isStaticProxy(proxy) ? staticTree : tree;
+    }
+    const AABBTree &getTree(int32_t proxy) const
+    {
+        return isStaticProxy(proxy) ? staticTree : tree;
+    }
 };
+
+/**
+ * Create an empty broadphase of the given type.
+ */
+std::unique_ptr<BroadPhaseBase> makeBroadPhase(BroadPhaseType type);
 } /* namespace phy */
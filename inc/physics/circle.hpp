@@ -19,6 +19,9 @@ public:
 
     virtual bool testPoint(const Transform &transform, const Vec2f &pos) const override;
     virtual AABB getAABB(const Transform &transform) const override;
+    virtual bool rayCast(RayCastOutput &output, const RayCastInput &input,
+                         const Transform &transform) const override;
+    virtual Vec2f getSupport(const Vec2f &direction) const override;
     virtual MassProperties getMassProps() const override;
     virtual void print(std::ostream &out) const override;
 };
@@ -4,28 +4,140 @@
 #include "inc/physics/circle.hpp"
 #include "inc/physics/polygon.hpp"
 #include "inc/physics/common.hpp"
+#include "inc/physics/distance.hpp"
 
 namespace phy {
+/**
+ * Overlap that is allowed between touching shapes.
+ *
+ * Leaving a little overlap keeps contacts from breaking and forming
+ * again on every step, which would lose their warm starting impulses.
+ */
+const float linearSlop = 0.05f;
+
+/**
+ * How much less two polygons must overlap along a face of B than along
+ * a face of A before B's face becomes the reference face. Without it,
+ * equal faces swap roles as rounding changes from step to step, and
+ * the contact points lose their impulses.
+ */
+const float referenceFaceTolerance = 0.1f * linearSlop;
+
+/**
+ * Most points that a manifold can hold, enough for two edges resting
+ * on each other.
+ */
+const uint8_t maxManifoldPoints = 2;
+
+/**
+ * The features of both shapes that a contact point was made from.
+ *
+ * A point made from the same features in consecutive steps is the same
+ * point, so a solver can start from the impulse that it found for the
+ * point in the last step.
+ */
+struct ContactFeature {
+    enum Type : uint8_t {
+        vertex,
+        face
+    };
+
+    uint8_t indexA; ///< Vertex or face of shape A
+    uint8_t indexB; ///< Vertex or face of shape B
+    uint8_t typeA;
+    uint8_t typeB;
+
+    /**
+     * Pack the features into one value for comparisons.
+     */
+    uint32_t getKey() const
+    {
+        return indexA | indexB << 8 | typeA << 16 | typeB << 24;
+    }
+};
+
+/**
+ * A point where two shapes touch.
+ */
+struct ManifoldPoint {
+    Vec2f point; ///< In world coordinates, inside both shapes
+    float depth; ///< How far the shapes overlap at this point along the normal
+    ContactFeature id;
+    float normalImpulse = 0.0f; ///< Found by the contact solver in the last step
+    float tangentImpulse = 0.0f; ///< Friction impulse from the last step
+};
+
 /**
  * A manifold describes the properties of a collision between two objects.
+ *
+ * Shapes that do not touch give a manifold of type INVALID without any
+ * points.
  */
 struct Manifold {
     enum class Type : char {
         circles,
         polygons,
+        polygonAndCircle,
         INVALID
     };
 
     Manifold()
-        : type(Type::INVALID), depth(1000000) {}
-    Vec2f localNormal;
-    float depth;
+        : depth(0), pointCount(0), type(Type::INVALID) {}
+    Vec2f normal; ///< Unit direction from shape A to shape B, in world coordinates
+    float depth; ///< The deepest overlap of any point along the normal
+    ManifoldPoint points[maxManifoldPoints];
+    uint8_t pointCount;
     Type type;
+
+    bool isTouching() const
+    {
+        return type != Type::INVALID;
+    }
 };
 
+/**
+ * Test any two shapes against each other.
+ *
+ * The normal of the manifold always points from shape A to shape B,
+ * whichever order the specialized test below takes them in. Polygons
+ * with many vertices go through collideConvex() instead of SAT.
+ *
+ * @param cache Kept by the caller for this pair of shapes, see
+ *              collideConvex(). May be null.
+ */
+Manifold collide(const Shape &a, const Transform &transformA,
+                 const Shape &b, const Transform &transformB,
+                 SimplexCache *cache = nullptr);
+
 Manifold collideCircles(const CircleShape &a, const Transform &transformA,
                         const CircleShape &b, const Transform &transformB);
 
+/**
+ * Test two polygons against each other.
+ *
+ * The face with the least overlap is the reference face, and the edge
+ * of the other polygon that faces it the most is clipped against its
+ * sides. That gives two points for edges resting on each other and one
+ * point where only a corner reaches past the reference face.
+ */
 Manifold collidePolygons(const PolygonShape &a, const Transform &transformA,
                          const PolygonShape &b, const Transform &transformB);
+
+/**
+ * Test any two convex shapes against each other with GJK, and with EPA
+ * once they overlap.
+ *
+ * This only walks the vertices of each shape, while SAT tests every
+ * pair of faces, so it is much faster for large polygons. Polygons
+ * still get clipped points from the faces that the normal picks.
+ *
+ * @param cache The simplex from the last step, so that shapes which
+ *              barely moved take one or two GJK iterations. May be null.
+ */
+Manifold collideConvex(const Shape &a, const Transform &transformA,
+                       const Shape &b, const Transform &transformB,
+                       SimplexCache *cache = nullptr);
+
+Manifold collidePolygonAndCircle(const PolygonShape &a, const Transform &transformA,
+                                 const CircleShape &b, const Transform &transformB);
 } /* namespace phy */
@@ -58,8 +58,29 @@ struct Transform {
         translated.y += position.y;
         return translated;
     }
+
+    /**
+     * Undo translate(), taking a point back to local coordinates.
+     */
+    inline Vec2f invTranslate(const Vec2f &point) const
+    {
+        return rotation.invRotate(point - position);
+    }
 };
 
+/**
+ * Get the transform that takes points from the local coordinates of
+ * b to the local coordinates of a, so that shapes can be compared
+ * without moving either of them into the world.
+ */
+inline Transform invMultiply(const Transform &a, const Transform &b)
+{
+    Rotation rotation;
+    rotation.sine = a.rotation.cosine * b.rotation.sine - a.rotation.sine * b.rotation.cosine;
+    rotation.cosine = a.rotation.cosine * b.rotation.cosine + a.rotation.sine * b.rotation.sine;
+    return Transform(a.invTranslate(b.position), rotation);
+}
+
 /**
  * Store the position information for a body for iterative resolution
  * of position and velocity.
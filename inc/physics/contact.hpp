@@ -1,16 +1,131 @@
+#pragma once
+
+#include "inc/physics/broadphase.hpp"
+#include "inc/physics/collisions.hpp"
+#include <cstdint>
 #include <vector>
 
 namespace phy {
-class Contact {
+class Body;
+
+/**
+ * A pair of shapes whose fattened AABBs overlap.
+ *
+ * The ContactManager keeps one contact for each pair in a flat list
+ * that is sorted by key, and the narrowphase updates its manifold on
+ * every update. The shapes only touch if the manifold has points.
+ *
+ * Points that come from the same features as in the last update keep
+ * their impulses, so the contact solver can warm start from them.
+ */
+struct Contact {
+    uint64_t key; ///< The pair of proxies, see PairBuffer::makeKey()
+    Manifold manifold; ///< The result of the last exact test
+    bool began; ///< True if the shapes started touching in the last update
+    SimplexCache cache; ///< Where GJK starts from in the next update
+    Body *bodyA; ///< Body of the first proxy
+    Body *bodyB; ///< Body of the second proxy
 
+    bool isTouching() const
+    {
+        return manifold.isTouching();
+    }
 };
 
-class ContactFinder {
-    std::vector<Contact> contacts;
+/**
+ * The narrowphase, run on the pairs found by a broadphase.
+ *
+ * Every pair whose fattened AABBs overlap is kept across updates as a
+ * Contact. When the tight AABBs of its shapes overlap, the shapes
+ * themselves are tested, see collide(), and the pair is touching while
+ * they overlap. Only the pairs that start or stop touching are
+ * reported, so the number of events scales with how much the scene
+ * changes rather than with the number of contacts.
+ *
+ * Contacts between bodies that are asleep or static keep their manifold
+ * without being tested, since neither body has moved.
+ *
+ * Contacts refer to the broadphase's proxies, so the manager must be
+ * told about proxies before the broadphase destroys or moves them.
+ */
+class ContactManager {
+public:
+    typedef BroadPhaseBase::BodyPairs BodyPairs;
+private:
+    const BroadPhaseBase &broadPhase;
+    std::vector<Contact> contacts; ///< Sorted by key
+    std::vector<Contact> mergedContacts; ///< Scratch space for update()
+    BodyPairs beganContacts;
+    BodyPairs endedContacts;
 public:
-    ContactFinder();
-    void FindAllContacts();
-    void destroyContact();
-    void collide();
+    explicit ContactManager(const BroadPhaseBase &broadPhase_);
+    ContactManager(const ContactManager &) = delete;
+    ContactManager &operator=(const ContactManager &) = delete;
+    /**
+     * Add the pairs found by the last BroadPhaseBase::updatePairs(),
+     * drop the contacts whose fattened AABBs no longer overlap, then
+     * run the narrowphase on every contact.
+     */
+    void update();
+    /**
+     * End the contacts of a body that is about to be deleted from the
+     * broadphase.
+     */
+    void destroyBody(Body &body);
+    /**
+     * End the contacts of proxies that are about to be destroyed, such
+     * as the stale proxies of a body before it is updated.
+     */
+    void destroyProxies(const std::vector<int32_t> &proxies);
+    /**
+     * Follow the proxies to their new ids after the broadphase was
+     * compacted, see BroadPhaseBase::compact().
+     */
+    void remapProxies(const std::vector<int32_t> &remap);
+    /**
+     * Get the contact of every pair, sorted by key.
+     *
+     * Only the contacts whose isTouching() is true have a manifold. The
+     * list is only valid until the next update.
+     */
+    const std::vector<Contact> &getContacts() const
+    {
+        return contacts;
+    }
+    /**
+     * Get the contacts so that a solver can store the impulses of their
+     * points for the next step.
+     */
+    std::vector<Contact> &getContacts()
+    {
+        return contacts;
+    }
+    /**
+     * Get the pairs of bodies whose shapes started touching since the
+     * last call. Each pair of touching shapes is reported once.
+     */
+    BodyPairs takeBeganContacts();
+    /**
+     * Get the pairs of bodies whose shapes stopped touching since the
+     * last call, including pairs that ended because a body was deleted.
+     */
+    BodyPairs takeEndedContacts();
+    /**
+     * Get the pairs of bodies whose shapes were already touching before
+     * the last update and still are.
+     */
+    BodyPairs getPersistingContacts() const;
+private:
+    /**
+     * Append a contact to mergedContacts if its fattened AABBs still
+     * overlap.
+     */
+    void mergeContact(const Contact &contact);
+    /**
+     * Run the exact test on every contact and report the pairs that
+     * started or stopped touching.
+     */
+    void collideContacts();
+    static void addEvent(BodyPairs &events, const Contact &contact);
 };
 } /* namespace phy */
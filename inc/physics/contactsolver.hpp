@@ -0,0 +1,121 @@
+#pragma once
+
+#include "inc/physics/contact.hpp"
+#include <vector>
+
+namespace phy {
+class Body;
+
+/**
+ * Fraction of the overlap that each position iteration removes.
+ */
+const float baumgarte = 0.2f;
+
+/**
+ * Most that one position iteration may move a contact point, so that
+ * deep overlaps are pushed apart over several steps.
+ */
+const float maxLinearCorrection = 1.0f;
+
+/**
+ * Contacts that close slower than this do not bounce, which lets
+ * bodies with restitution come to rest.
+ */
+const float velocityThreshold = 1.0f;
+
+/**
+ * The state of one manifold point while it is being solved.
+ */
+struct ContactConstraintPoint {
+    Vec2f rA; ///< From the center of mass of A to the point
+    Vec2f rB; ///< From the center of mass of B to the point
+    Vec2f localA; ///< The surface of A at the point, in A's local coordinates
+    Vec2f localB; ///< The surface of B at the point, in B's local coordinates
+    float normalImpulse;
+    float tangentImpulse;
+    float normalMass; ///< Inverse of the effective mass along the normal
+    float tangentMass; ///< Inverse of the effective mass along the tangent
+    float velocityBias; ///< Speed along the normal that restitution asks for
+};
+
+/**
+ * A touching contact with the properties of both bodies copied out, so
+ * that the iterations only touch the bodies' velocities.
+ */
+struct ContactConstraint {
+    Body *bodyA;
+    Body *bodyB;
+    Contact *contact; ///< Receives the impulses for the next step
+    Vec2f normal; ///< Unit direction from A to B, in world coordinates
+    Vec2f localNormal; ///< The normal in A's local coordinates
+    float invMassA, invMassB;
+    float invInertiaA, invInertiaB;
+    float friction;
+    float restitution;
+    ContactConstraintPoint points[maxManifoldPoints];
+    uint8_t pointCount;
+};
+
+/**
+ * Resolve the touching contacts of a step with sequential impulses.
+ *
+ * Each velocity iteration applies an impulse at every point in turn to
+ * stop the shapes from closing along the normal, and to resist sliding
+ * with friction up to the normal impulse times the friction coefficient.
+ * The impulses are accumulated and clamped over all iterations rather
+ * than per iteration, and start from the impulses that the points had
+ * in the last step, so stacks settle with only a few iterations.
+ *
+ * Once the bodies have moved, each position iteration pushes apart the
+ * shapes that still overlap by more than linearSlop. That fixes drift
+ * without adding energy, unlike folding the overlap into the velocities.
+ *
+ * The constraints are kept between steps so that solving does not
+ * allocate once the number of contacts settles.
+ */
+class ContactSolver {
+    std::vector<ContactConstraint> constraints;
+public:
+    /**
+     * Set up a constraint for every touching contact with an awake body.
+     *
+     * The contacts must not change until storeImpulses() is called.
+     */
+    void initialize(std::vector<Contact> &contacts);
+    /**
+     * Apply the impulses from the last step.
+     */
+    void warmStart();
+    /**
+     * Run one velocity iteration over every contact.
+     */
+    void solveVelocityConstraints();
+    /**
+     * Save the impulses of every point in its contact for warm starting.
+     */
+    void storeImpulses();
+    /**
+     * Run one position iteration over every contact.
+     *
+     * Only the centers of mass and angles of the bodies are moved,
+     * see Body::synchronizeTransform().
+     *
+     * @return True if no shapes overlap by much more than linearSlop,
+     *         so that further iterations can be skipped.
+     */
+    bool solvePositionConstraints();
+
+    size_t getConstraintCount() const
+    {
+        return constraints.size();
+    }
+private:
+    static void applyImpulse(const ContactConstraint &c, const ContactConstraintPoint &point,
+                             const Vec2f &impulse);
+    /**
+     * Get the velocity of B relative to A at a point.
+     */
+    static Vec2f getRelativeVelocity(const ContactConstraint &c,
+                                     const ContactConstraintPoint &point);
+};
+} /* namespace phy */
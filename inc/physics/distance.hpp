@@ -0,0 +1,65 @@
+#pragma once
+
+#include "inc/physics/shape.hpp"
+#include <cstdint>
+
+namespace phy {
+/**
+ * The simplex that GJK ended with for a pair of shapes, kept between
+ * steps.
+ *
+ * Each vertex is stored as the points of both shapes that formed it, in
+ * the local coordinates of each shape. Shapes rarely move far in one
+ * step, so starting from the last simplex usually finds the answer in
+ * one or two iterations. A zero count starts from scratch.
+ */
+struct SimplexCache {
+    uint8_t count;
+    Vec2f localA[3];
+    Vec2f localB[3];
+};
+
+/**
+ * The closest points of two shapes.
+ */
+struct DistanceOutput {
+    Vec2f pointA; ///< On shape A, in world coordinates
+    Vec2f pointB; ///< On shape B, in world coordinates
+    float distance; ///< Zero if the shapes overlap
+    int iterations; ///< Number of GJK iterations used
+};
+
+/**
+ * How far two overlapping shapes reach into each other.
+ */
+struct PenetrationOutput {
+    Vec2f normal; ///< Unit direction from shape A to shape B
+    float depth; ///< How far B must move along the normal to separate
+    Vec2f pointA; ///< The deepest point of A inside B, in world coordinates
+    Vec2f pointB; ///< The deepest point of B inside A, in world coordinates
+};
+
+/**
+ * Find the closest points of two convex shapes with GJK.
+ *
+ * Only Shape::getSupport() is used, so the cost grows with the number
+ * of vertices rather than with the number of pairs of faces.
+ *
+ * @param cache The simplex to start from, updated with the final one.
+ *              May be null.
+ */
+DistanceOutput distance(const Shape &a, const Transform &transformA,
+                        const Shape &b, const Transform &transformB,
+                        SimplexCache *cache = nullptr);
+
+/**
+ * Find how far two convex shapes overlap, running EPA on the simplex
+ * that GJK ends with when the shapes overlap.
+ *
+ * @param cache See distance().
+ * @return False if the shapes do not overlap.
+ */
+bool penetration(PenetrationOutput &output, const Shape &a, const Transform &transformA,
+                 const Shape &b, const Transform &transformB,
+                 SimplexCache *cache = nullptr);
+} /* namespace phy */
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace phy {
+/**
+ * A LIFO stack that keeps its first N elements in inline storage.
+ *
+ * Deeper stacks spill into a buffer that is shared by every stack of the
+ * same type on the current thread. The buffer keeps its capacity between
+ * uses, so steady-state tree traversals never touch the allocator.
+ */
+template <typename T, size_t N>
+class GrowableStack {
+    T inlineStack[N];
+    std::vector<T> *spill; ///< Storage for elements past N, if any
+    std::vector<T> ownSpill; ///< Used if the shared buffer is already taken
+    bool borrowed; ///< True if spill points to the thread's shared buffer
+    size_t count;
+
+    static std::vector<T> &sharedBuffer()
+    {
+        thread_local std::vector<T> buffer;
+        return buffer;
+    }
+
+    static bool &sharedBufferInUse()
+    {
+        thread_local bool inUse = false;
+        return inUse;
+    }
+
+    void acquireSpill()
+    {
+        if (!sharedBufferInUse()) {
+            sharedBufferInUse() = true;
+            borrowed = true;
+            spill = &sharedBuffer();
+        } else {
+            // A nested traversal on this thread already owns the
+            // shared buffer. This is rare, so just use our own.
+            spill = &ownSpill;
+        }
+    }
+public:
+    GrowableStack()
+        : spill(nullptr), borrowed(false), count(0) {}
+
+    ~GrowableStack()
+    {
+        if (borrowed) {
+            spill->clear();
+            sharedBufferInUse() = false;
+        }
+    }
+
+    GrowableStack(const GrowableStack &) = delete;
+    GrowableStack &operator=(const GrowableStack &) = delete;
+
+    void push(const T &value)
+    {
+        if (count < N) {
+            inlineStack[count++] = value;
+            return;
+        }
+
+        if (!spill)
+            acquireSpill();
+        spill->push_back(value);
+        count++;
+    }
+
+    /**
+     * Remove the top element and return it.
+     *
+     * The stack must not be empty.
+     */
+    T pop()
+    {
+        count--;
+        if (count < N)
+            return inlineStack[count];
+
+        T value = spill->back();
+        spill->pop_back();
+        return value;
+    }
+
+    bool empty() const
+    {
+        return count == 0;
+    }
+
+    size_t size() const
+    {
+        return count;
+    }
+};
+} /* namespace phy */
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace phy {
+/**
+ * A flat list of proxy pairs gathered during one broadphase step.
+ *
+ * Pairs are stored as (min, max) packed into a single 64 bit key, so
+ * (a, b) and (b, a) are the same pair. After all pairs have been added,
+ * sort() radix sorts the keys and removes duplicates, which leaves the
+ * pairs in a deterministic order. Both buffers keep their capacity when
+ * cleared, so a steady-state step does not allocate.
+ */
+class PairBuffer {
+    std::vector<uint64_t> keys;
+    std::vector<uint64_t> scratch; ///< Radix sort ping-pong buffer
+
+    /// Below this size std::sort beats the radix sort's histogram passes.
+    static const size_t radixThreshold;
+public:
+    /**
+     * Pack a pair of proxies into a key ordered by (min, max).
+     */
+    static uint64_t makeKey(int32_t a, int32_t b)
+    {
+        if (b < a)
+            std::swap(a, b);
+        return (static_cast<uint64_t>(static_cast<uint32_t>(a)) << 32)
+               | static_cast<uint32_t>(b);
+    }
+
+    static int32_t first(uint64_t key)
+    {
+        return static_cast<int32_t>(key >> 32);
+    }
+
+    static int32_t second(uint64_t key)
+    {
+        return static_cast<int32_t>(key & 0xffffffffu);
+    }
+
+    void add(int32_t a, int32_t b)
+    {
+        keys.push_back(makeKey(a, b));
+    }
+
+    /**
+     * Add every pair of another buffer, such as one filled on another thread.
+     */
+    void append(const PairBuffer &other)
+    {
+        keys.insert(keys.end(), other.keys.begin(), other.keys.end());
+    }
+
+    /**
+     * Sort the pairs by (min, max) and remove any duplicates.
+     */
+    void sort();
+    /**
+     * Remove every pair that contains one of the given proxies.
+     *
+     * This must be done before the proxies are reused for another shape.
+     */
+    void remove(const std::vector<int32_t> &proxies);
+    /**
+     * Replace every proxy p with remap[p], such as after the proxies
+     * were compacted. The pairs must be sorted again afterwards.
+     */
+    void remap(const std::vector<int32_t> &remap);
+    void clear() { keys.clear(); }
+    bool empty() const { return keys.empty(); }
+    size_t size() const { return keys.size(); }
+    std::pair<int32_t, int32_t> operator[](size_t i) const
+    {
+        return std::make_pair(first(keys[i]), second(keys[i]));
+    }
+    std::vector<uint64_t>::const_iterator begin() const { return keys.begin(); }
+    std::vector<uint64_t>::const_iterator end() const { return keys.end(); }
+};
+} /* namespace phy */
@@ -38,11 +38,19 @@ public:
      * @param angle The orientation of the box in radians.
      */
     void setBox(const Vec2f &length, const Vec2f &center, float angle);
-    const std::vector<Vec2f> getNormals() const;
+    /**
+     * Get the outward unit normal of each edge, in local coordinates.
+     *
+     * Normal i belongs to the edge from vertex i to vertex i + 1.
+     */
+    const std::vector<Vec2f> &getNormals() const;
     std::pair<float, float> projectShape(Vec2f axis) const;
 
     virtual bool testPoint(const Transform &transform, const Vec2f &pos) const override;
     virtual AABB getAABB(const Transform &transform) const override;
+    virtual bool rayCast(RayCastOutput &output, const RayCastInput &input,
+                         const Transform &transform) const override;
+    virtual Vec2f getSupport(const Vec2f &direction) const override;
     virtual MassProperties getMassProps() const override;
     virtual void print(std::ostream &out) const override;
 private:
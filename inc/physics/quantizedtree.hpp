@@ -0,0 +1,102 @@
+#pragma once
+
+#include "inc/physics/aabb.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace phy {
+/**
+ * A read-only, compressed copy of an AABBTree for large static worlds.
+ *
+ * Each node stores its bounds as 16 bit fractions of its parent's box
+ * and a single 32 bit link, so a node takes 12 bytes instead of the
+ * AABBTree's full node. Bounds are rounded outward, so every leaf's
+ * stored box contains the fattened AABB of the source leaf. Queries
+ * may therefore report a few leaves whose AABB only nearly overlaps,
+ * which callers already filter with their exact shape tests.
+ *
+ * Leaves are reported by their index in the source tree, so the same
+ * AABBCallback and RayCastCallback implementations work with both.
+ * The copy must be rebuilt whenever the source tree changes.
+ */
+class QuantizedAABBTree {
+    struct Node {
+        uint16_t low[2]; ///< Lower bound as a fraction of the parent box
+        uint16_t high[2]; ///< Upper bound as a fraction of the parent box
+        /**
+         * Index of the first child, the second directly follows it.
+         * Leaves store the bitwise complement of their source index.
+         */
+        int32_t link;
+
+        bool isLeaf() const
+        {
+            return link < 0;
+        }
+    };
+
+    std::vector<Node> nodes; ///< The root is at index 0 if not empty
+    AABB rootBox; ///< The box that the root's bounds are relative to
+
+    /**
+     * The origin and step size that children of a box are stored in.
+     *
+     * The steps span slightly more than the box, so the last step
+     * always decodes beyond the box's upper bound despite rounding.
+     * This is plain data so that traversal stacks cost nothing to
+     * create.
+     */
+    struct Frame {
+        float low[2];
+        float step[2];
+    };
+
+    static const size_t traversalStackSize = 256;
+    static const float quantizationSteps;
+
+    /**
+     * Get the box of a node from its parent's frame.
+     */
+    static AABB decode(const Node &node, const Frame &parent)
+    {
+        return {{parent.low[0] + node.low[0] * parent.step[0],
+                 parent.low[1] + node.low[1] * parent.step[1]},
+                {parent.low[0] + node.high[0] * parent.step[0],
+                 parent.low[1] + node.high[1] * parent.step[1]}};
+    }
+    static Frame makeFrame(const AABB &box);
+    /**
+     * Store a box relative to its parent's box, rounding outward.
+     */
+    static void encode(Node &node, const AABB &box, const AABB &parent);
+public:
+    QuantizedAABBTree();
+    /**
+     * Compress every leaf and branch reachable from the tree's root.
+     */
+    explicit QuantizedAABBTree(const AABBTree &tree);
+
+    /**
+     * Find every leaf whose stored box overlaps the given AABB, like
+     * AABBTree::findCollisions(). The first index is always -1.
+     */
+    void findCollisions(AABBCallback *callback, const AABB &aabb) const;
+    /**
+     * Find every leaf whose stored box is crossed by a ray, nearer
+     * children first, like AABBTree::rayCast().
+     */
+    void rayCast(RayCastCallback *callback, const RayCastInput &input) const;
+    /**
+     * Get the number of bytes used by the nodes.
+     */
+    size_t getMemoryUsage() const
+    {
+        return nodes.capacity() * sizeof(Node);
+    }
+    size_t getNodeCount() const
+    {
+        return nodes.size();
+    }
+};
+} /* namespace phy */
@@ -19,6 +19,14 @@ struct MassProperties {
     float inertia;
 };
 
+/**
+ * Where a ray hit a shape.
+ */
+struct RayCastOutput {
+    Vec2f normal; ///< Surface normal at the hit, in world coordinates
+    float fraction; ///< The hit is at p1 + fraction * (p2 - p1)
+};
+
 struct ShapeSpec {
     ShapeSpec();
     float friction;
@@ -41,6 +49,23 @@ public:
      * collision detection.
      */
     virtual AABB getAABB(const Transform &transform) const = 0;
+    /**
+     * Cast a ray against this shape.
+     *
+     * Rays that start inside the shape do not hit it.
+     *
+     * @return True iff the ray hits the shape before input.maxFraction.
+     */
+    virtual bool rayCast(RayCastOutput &output, const RayCastInput &input,
+                         const Transform &transform) const = 0;
+    /**
+     * Get the point of this shape that reaches furthest in a direction,
+     * which is all that GJK needs to know about a convex shape.
+     *
+     * @param direction Any nonzero vector in local coordinates.
+     * @return The point in local coordinates.
+     */
+    virtual Vec2f getSupport(const Vec2f &direction) const = 0;
     ShapeType getShapeType() const;
     virtual MassProperties getMassProps() const = 0;
     virtual void print(std::ostream &out) const = 0;
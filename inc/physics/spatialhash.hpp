@@ -0,0 +1,119 @@
+#pragma once
+
+#include "inc/physics/broadphase.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace phy {
+/**
+ * A broadphase that buckets proxies into a uniform grid of square cells.
+ *
+ * Only cells that contain a proxy are stored, in an open addressing hash
+ * table keyed by the cell coordinates, so the world has no bounds.
+ * Inserting, moving and querying a proxy only touches the few cells it
+ * covers, which makes this the fastest backend for swarms of bodies of
+ * about the same size. Proxies much larger than a cell, such as the
+ * walls of the arena, are kept in a separate list instead.
+ */
+class SpatialHash : public BroadPhaseBase {
+private:
+    struct Proxy {
+        AABB aabb; ///< Fattened AABB of the shape
+        Body *body; ///< Owner of the shape, or null if the proxy is free
+        int32_t next; ///< Next free proxy, if this one is free
+        int32_t lowX, lowY, highX, highY; ///< Range of cells covered
+        bool moved; ///< True if the proxy is queued in movedProxies
+        bool large; ///< True if the proxy is in largeProxies, not in cells
+        bool placed; ///< True if the proxy is in a cell or largeProxies
+    };
+
+    static const int inlineProxies = 4;
+
+    /**
+     * A slot of the hash table holding one cell of the grid.
+     *
+     * The first few proxies are stored inline, so visiting a cell
+     * usually costs a single cache miss.
+     */
+    struct Cell {
+        uint64_t key; ///< Packed cell coordinates
+        int32_t count; ///< Number of proxies, or -1 if the slot is empty
+        int32_t overflow; ///< Index into overflow for proxies past the inline ones
+        int32_t proxies[inlineProxies];
+    };
+
+    std::vector<Proxy> proxies;
+    std::vector<Cell> table; ///< Size is always a power of two
+    size_t usedCells; ///< Slots with a key, including cells that became empty
+    std::vector<std::vector<int32_t>> overflow;
+    std::vector<int32_t> freeOverflow;
+    std::vector<int32_t> largeProxies;
+    std::vector<int32_t> movedProxies;
+    std::vector<float> sizes; ///< Scratch space to find the median proxy size
+    int32_t nextFree;
+    size_t liveProxies;
+    size_t sizedProxies; ///< Number of live proxies when the cell size was chosen
+    int tableBits;
+    float cellSize; ///< Zero until the first automatic choice
+    float inverseCellSize;
+    bool autoCellSize;
+    float margin;
+
+    /// Proxies wider than this many cells are kept in largeProxies.
+    static const float largeCells;
+    /// The cell size is chosen again when the number of proxies has
+    /// grown by this factor.
+    static const size_t resizeGrowth;
+public:
+    /**
+     * @param cellSize Side length of every cell. If zero, it is twice
+     *                 the median size of the proxies.
+     */
+    SpatialHash(float cellSize = 0.0f, float margin = aabbMargin);
+    float getCellSize() const { return cellSize; }
+protected:
+    virtual void findPairs() override;
+    virtual int32_t createProxy(const AABB &aabb, Body *body) override;
+    virtual void moveProxy(int32_t proxy, const AABB &aabb, const Vec2f &displacement) override;
+    virtual void destroyProxy(int32_t proxy) override;
+    virtual Body *getProxyBody(int32_t proxy) const override;
+    virtual AABB getFatAABB(int32_t proxy) const override;
+    virtual void rayCastProxies(RayCastCallback *callback, const RayCastInput &input) const override;
+    virtual void queryProxies(AABBCallback *callback, const AABB &aabb) const override;
+    virtual void nearestProxies(NearestCallback *callback, const Vec2f &point, size_t k,
+                                std::vector<std::pair<float, int32_t>> &nearest) const override;
+private:
+    void queueMoved(int32_t index);
+    /**
+     * Add a proxy to every cell it covers, or to the large list.
+     */
+    void place(int32_t index);
+    /**
+     * Remove a proxy from its cells or from the large list.
+     */
+    void unplace(int32_t index);
+    /**
+     * Find the cell with the given coordinates.
+     *
+     * @param create Insert an empty cell if it does not exist yet.
+     * @return The cell, or null if create is false and the cell
+     *         does not exist.
+     */
+    Cell *findCell(int32_t x, int32_t y, bool create);
+    void addToCell(Cell &cell, int32_t index);
+    /**
+     * Remove a proxy from a cell, moving the cell's last proxy into its place.
+     */
+    void removeFromCell(Cell &cell, int32_t index);
+    /**
+     * Set the cell size to twice the median proxy size and rebuild the
+     * grid. Most proxies then cover a single cell, or a few at most.
+     */
+    void resize();
+    /**
+     * Rebuild the hash table, dropping cells that have become empty.
+     */
+    void grow();
+};
+} /* namespace phy */
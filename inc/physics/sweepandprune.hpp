@@ -0,0 +1,76 @@
+#pragma once
+
+#include "inc/physics/broadphase.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace phy {
+/**
+ * A broadphase that keeps every proxy sorted by its lower bound along
+ * one axis and sweeps the sorted list for overlapping intervals.
+ *
+ * Bodies only move a little between steps, so the list stays nearly
+ * sorted and an insertion sort restores the order in close to linear
+ * time. This beats a tree when the scene is spread out along a single
+ * axis. The axis with the largest spread of proxies is chosen
+ * automatically.
+ */
+class SweepAndPrune : public BroadPhaseBase {
+private:
+    struct Proxy {
+        AABB aabb; ///< Fattened AABB of the shape
+        Body *body; ///< Owner of the shape, or null if the proxy is free
+        int32_t next; ///< Next free proxy, if this one is free
+        bool moved; ///< True if the AABB was refattened since the last sweep
+    };
+
+    /**
+     * A proxy's interval on the sweep axis, copied next to the interval
+     * on the other axis so that the sweep only reads contiguous memory.
+     */
+    struct Interval {
+        float low, high;
+        float otherLow, otherHigh;
+        int32_t proxy;
+        bool moved;
+    };
+
+    std::vector<Proxy> proxies;
+    std::vector<Interval> sorted; ///< Live proxies ordered by low on the sweep axis
+    std::vector<int32_t> destroyed; ///< Proxies that are still in the sorted list
+    int32_t nextFree;
+    size_t inserted; ///< Number of unsorted intervals at the end of the list
+    int axis; ///< 0 to sweep along x, 1 to sweep along y
+    float margin;
+
+    /// Above this fraction of new intervals std::sort is used instead
+    /// of an insertion sort.
+    static const float resortFraction;
+    /// The other axis must be this many times wider before switching.
+    static const float axisHysteresis;
+public:
+    SweepAndPrune();
+    SweepAndPrune(float margin);
+protected:
+    virtual void findPairs() override;
+    virtual int32_t createProxy(const AABB &aabb, Body *body) override;
+    virtual void moveProxy(int32_t proxy, const AABB &aabb, const Vec2f &displacement) override;
+    virtual void destroyProxy(int32_t proxy) override;
+    virtual Body *getProxyBody(int32_t proxy) const override;
+    virtual AABB getFatAABB(int32_t proxy) const override;
+    virtual void rayCastProxies(RayCastCallback *callback, const RayCastInput &input) const override;
+    virtual void queryProxies(AABBCallback *callback, const AABB &aabb) const override;
+    virtual void nearestProxies(NearestCallback *callback, const Vec2f &point, size_t k,
+                                std::vector<std::pair<float, int32_t>> &nearest) const override;
+private:
+    /**
+     * Drop the intervals of destroyed proxies and copy the current AABB
+     * of every proxy into its interval.
+     *
+     * @return True iff the sweep axis changed and the list must be resorted.
+     */
+    bool refreshIntervals();
+    void sortIntervals(bool resort);
+};
+} /* namespace phy */
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "inc/physics/aabb.hpp"
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace phy {
+/**
+ * A 4-wide copy of an AABBTree for static geometry and ray queries.
+ *
+ * The binary tree is collapsed so that each node holds up to four
+ * children. Their boxes are kept in structure-of-arrays form, so one
+ * SIMD test checks all four against a query box or ray, and a search
+ * visits about half as many nodes as in the binary tree.
+ *
+ * Leaves are reported by their index in the source tree, so the same
+ * AABBCallback and RayCastCallback implementations work with both.
+ * Leaves may be moved with setLeafAABB() followed by refit(), which
+ * keeps the structure of the tree. Once leaves have moved far, copy
+ * the source tree again.
+ */
+class WideAABBTree {
+public:
+    static const int width = 4;
+private:
+    struct Node {
+        float lowX[width], lowY[width], highX[width], highY[width];
+        /**
+         * Index of each child node. Leaves store the bitwise complement
+         * of their source index.
+         */
+        int32_t children[width];
+        int32_t count; ///< Number of children in use
+    };
+
+    std::vector<Node> nodes; ///< The root is at index 0, parents come before children
+    /// Node and slot that hold each node, for refit(). Unused for the root.
+    std::vector<std::pair<int32_t, int32_t>> parents;
+    /// Node and slot that hold each source leaf, or AABBNode::null
+    std::vector<std::pair<int32_t, int32_t>> leafSlots;
+
+    static const size_t traversalStackSize = 256;
+
+    static void setSlot(Node &node, int slot, const AABB &box);
+    static AABB getSlot(const Node &node, int slot);
+    static AABB getBounds(const Node &node);
+public:
+    WideAABBTree();
+    /**
+     * Collapse every leaf and branch reachable from the tree's root.
+     *
+     * Each node takes the children of its largest branches until it
+     * holds four, which keeps the subtrees it skips as large as
+     * possible.
+     */
+    explicit WideAABBTree(const AABBTree &tree);
+
+    /**
+     * Find every leaf that overlaps the given AABB, like
+     * AABBTree::findCollisions(). The first index is always -1.
+     */
+    void findCollisions(AABBCallback *callback, const AABB &aabb) const;
+    /**
+     * Find every leaf crossed by a ray, nearer children first, like
+     * AABBTree::rayCast().
+     */
+    void rayCast(RayCastCallback *callback, const RayCastInput &input) const;
+    /**
+     * Change the box of a leaf. Branches are only updated by refit().
+     */
+    void setLeafAABB(int32_t leaf, const AABB &box);
+    /**
+     * Recompute the box of every branch from its children.
+     */
+    void refit();
+    size_t getNodeCount() const
+    {
+        return nodes.size();
+    }
+    /**
+     * Get the number of bytes used by the nodes.
+     */
+    size_t getMemoryUsage() const
+    {
+        return nodes.capacity() * sizeof(Node);
+    }
+};
+} /* namespace phy */
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace phy {
+/**
+ * A fixed set of threads that run batches of tasks.
+ *
+ * The threads are started once and sleep between batches, so work that
+ * is shared out on every step does not pay for creating threads. The
+ * thread calling run() works on the batch too.
+ */
+class WorkerPool {
+private:
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake; ///< Signals a new batch or stopping
+    std::condition_variable finished; ///< Signals that busy reached zero
+    const std::function<void(size_t)> *task; ///< The batch being run
+    size_t taskCount;
+    std::atomic<size_t> nextTask; ///< Index of the next task to start
+    size_t batch; ///< Incremented for every batch
+    size_t busy; ///< Threads that have not finished the current batch
+    bool stopping;
+public:
+    /**
+     * @param threadCount Number of threads that run each batch,
+     *                    including the one calling run().
+     */
+    explicit WorkerPool(size_t threadCount);
+    WorkerPool(const WorkerPool &) = delete;
+    WorkerPool &operator=(const WorkerPool &) = delete;
+    /**
+     * Wait for the threads to finish and join them.
+     */
+    ~WorkerPool();
+    /**
+     * Get the number of threads that run each batch, including the one
+     * calling run().
+     */
+    size_t getThreadCount() const
+    {
+        return threads.size() + 1;
+    }
+    /**
+     * Call task(i) once for every i below count, spread over the
+     * threads, and return once every call has returned.
+     *
+     * Each index is run by a single thread, so a task may use state
+     * that belongs to its index without locking.
+     */
+    void run(size_t count, const std::function<void(size_t)> &task);
+private:
+    void workerLoop();
+    /**
+     * Run tasks of the current batch until none are left.
+     */
+    void runTasks();
+};
+} /* namespace phy */
@@ -4,13 +4,43 @@
 #include "inc/physics/body.hpp"
 #include "inc/messagetypes.hpp"
 #include "inc/physics/broadphase.hpp"
+#include "inc/physics/contact.hpp"
+#include "inc/physics/contactsolver.hpp"
 #include <memory>
 #include <vector>
 
 namespace phy {
 
 class Body;
-class Contact;
+
+/**
+ * Seconds that a group of touching bodies must be nearly still before
+ * it is put to sleep.
+ */
+const float timeToSleep = 0.5f;
+
+/**
+ * Speed below which a body counts as still, so that it drifts by less
+ * than linearSlop in a second.
+ */
+const float linearSleepTolerance = linearSlop;
+
+/**
+ * Angular speed below which a body counts as still, 2 degrees a second.
+ */
+const float angularSleepTolerance = 0.035f;
+
+/**
+ * How long the parts of the last step took, in milliseconds.
+ */
+struct StepProfile {
+    float step;
+    float solveVelocity; ///< Setting up the contacts and every velocity iteration
+    float solvePosition; ///< Every position iteration
+    float collide; ///< Updating the broadphase and running the narrowphase
+    uint32_t contacts; ///< Number of touching contacts that were solved
+    uint32_t positionIterations; ///< Position iterations run before the overlap was fixed
+};
 
 /**
  * The world contains all bodies and constraints in the world.
@@ -30,11 +60,21 @@ private:
     std::vector<std::shared_ptr<Body>> bodyList;
     uint8_t velocityIterations; ///< Number of iterations used to resolve velocity of bodies
     uint8_t positionIterations; ///< Number of iterations used to resolve positions of bodies
+    bool allowSleeping;
     uint32_t lastTicks; ///< Number of SDL_GetTicks() for the last iteration
-    BroadPhase broadPhase;
+    std::unique_ptr<BroadPhaseBase> broadPhase;
+    ContactManager contactManager; ///< The narrowphase on broadPhase's pairs
+    ContactSolver contactSolver;
+    StepProfile profile;
     std::pair<bool, uint32_t> lastPause;
+    std::vector<int32_t> islandParents; ///< Scratch space for updateSleep()
+    std::vector<float> islandSleepTimes; ///< Scratch space for updateSleep()
 public:
-    World(const Vec2f &gravity_, ThreadManager *manager);
+    /**
+     * @param broadPhaseType The structure used to find colliding bodies.
+     */
+    World(const Vec2f &gravity_, ThreadManager *manager,
+          BroadPhaseType broadPhaseType = BroadPhaseType::tree);
     /**
      * All objects referenced by the world are ref counted, so
      * they should be automatically destroyed when any other
@@ -49,6 +89,16 @@ public:
      */
     std::weak_ptr<Body> createBody(const BodySpec &spec);
 
+    /**
+     * Create many bodies in one batch.
+     *
+     * This is much faster than calling createBody for each spec when
+     * a level is being loaded.
+     *
+     * @return A pointer to each created body, in the order of the specs.
+     */
+    std::vector<std::weak_ptr<Body>> createBodies(const std::vector<BodySpec> &specs);
+
     /**
      * Remove the reference to the given body.
      *
@@ -67,11 +117,78 @@ public:
     std::vector<std::weak_ptr<const Body>> getBodies() const;
 
     /**
-     * Get the pairs of all colliding bodies.
+     * Get the pairs of bodies that started or stopped touching since
+     * the last call.
      */
     std::unique_ptr<CollisionMessage> getCollisions();
 
+    /**
+     * Get the pairs of bodies that have been touching for more than
+     * one step.
+     */
+    ContactManager::BodyPairs getPersistingContacts() const;
+
+    /**
+     * Find the closest shape hit by the segment from p1 to p2.
+     *
+     * @return True iff any shape was hit.
+     */
+    bool rayCast(const Vec2f &p1, const Vec2f &p2, RayCastHit &hit) const;
+
+    /**
+     * Report every shape hit by the segment from p1 to p2.
+     *
+     * @param callback Given each hit, returns the new maxFraction of the
+     *                 ray. Return 1 to find every hit, the hit's fraction
+     *                 to only find closer hits, or 0 to stop.
+     */
+    void rayCast(const Vec2f &p1, const Vec2f &p2,
+                 const std::function<float(const RayCastHit &)> &callback) const;
+
+    /**
+     * Find every body with a shape whose AABB overlaps an area.
+     *
+     * The queries clear the list and add each body once, reusing its
+     * capacity so that calling them every frame does not allocate.
+     */
+    void queryAABB(const AABB &aabb, std::vector<Body *> &bodies) const;
+    /**
+     * Find every body with a shape that contains a point.
+     */
+    void queryPoint(const Vec2f &point, std::vector<Body *> &bodies) const;
+    /**
+     * Find the k bodies closest to a position, nearest first.
+     */
+    void nearest(size_t k, const Vec2f &position, std::vector<Body *> &bodies) const;
+
+    /**
+     * Compact the broadphase, see BroadPhaseBase::compact(). Call this
+     * between levels or on a quiet frame.
+     */
+    void compact();
+
+    /**
+     * Advance the world by the time since the last step.
+     */
     void step();
+    /**
+     * Advance the world by a fixed amount of time.
+     *
+     * Each step integrates gravity and forces, resolves the touching
+     * contacts with velocityIterations passes of the contact solver,
+     * moves the bodies, and then pushes apart shapes that still overlap
+     * with up to positionIterations passes. The narrowphase then finds
+     * the contacts for the next step. Sleeping bodies are skipped, and
+     * only contacts with an awake body are tested and solved.
+     *
+     * @param dt The time in seconds to advance by.
+     */
+    void step(float dt);
+
+    /**
+     * Get the timings of the last step.
+     */
+    const StepProfile &getProfile() const;
 
     void setGravity(const Vec2f &gravity_);
     Vec2f getGravity() const;
@@ -94,6 +211,13 @@ public:
      */
     void setPositionIterations(uint8_t iterations);
 
+    /**
+     * Let groups of touching bodies that have come to rest sleep, so
+     * that they cost almost nothing until something touches them. This
+     * is on by default, and turning it off wakes every body.
+     */
+    void setAllowSleeping(bool allow);
+
     /**
      *
      *
@@ -107,5 +231,17 @@ public:
     void unpause();
 private:
     float updateTime();
+    /**
+     * Construct a body and its shapes without adding it to the broadphase.
+     */
+    std::shared_ptr<Body> makeBody(const BodySpec &spec);
+    /**
+     * Put to sleep the islands of touching dynamic bodies whose bodies
+     * have all been still for timeToSleep, and wake every other island.
+     *
+     * Static bodies do not join islands, so everything resting on the
+     * ground does not form a single island.
+     */
+    void updateSleep(float dt);
 };
 } /* namespace phy */
@@ -160,6 +160,8 @@ EventHandler::defineBoundaries(Vec2<float> center, float thickness, float sideLe
     spec.bodyType = phy::BodyType::staticBody;
     spec.position = {0, 0};
     spec.gravityFactor = 0;
+    spec.filter.categoryBits = collisionCategory::boundary;
+    spec.filter.maskBits = ~collisionCategory::boundary;
 
     auto shape = phy::PolygonShape(1.0f);
     shape.setBox({sideLength, thickness}, center, 0);
@@ -256,6 +258,7 @@ std::vector<phy::BodySpec> EventHandler::defineEnemies(uint32_t numEnemies) cons
         spec.bodyType = phy::BodyType::dynamicBody;
         spec.position = {pos(gen), pos(gen)};
         spec.gravityFactor = 0;
+        spec.filter.categoryBits = collisionCategory::enemy;
         auto shape = phy::PolygonShape(1.0f);
         shape.setBox(Vec2<float>(5, 5));
         spec.shapes.push_back(std::make_shared<phy::PolygonShape>(shape));
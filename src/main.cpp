@@ -55,12 +55,21 @@ void physics(std::atomic<bool> *quit, ThreadManager *manager)
     while (!(*quit)) {
         auto start = std::chrono::high_resolution_clock::now();
 
+        // Create all pending bodies in one batch so the broadphase
+        // can build its tree in a single pass.
+        std::vector<phy::BodySpec> specs;
+        std::vector<CharacterType> types;
         while (manager->newMessages(buffers::createBody)) {
             auto &&msg = manager->getMessage<CreateBodyMessage>(buffers::createBody);
-            auto bod = world.createBody(msg->bodySpec);
+            specs.push_back(msg->bodySpec);
+            types.push_back(msg->type);
+        }
 
-            manager->sendMessage(buffers::bodyCreated,
-                                 std::make_unique<BodyCreatedMessage>(bod, msg->type));
+        if (!specs.empty()) {
+            auto bodies = world.createBodies(specs);
+            for (size_t i = 0; i < bodies.size(); i++)
+                manager->sendMessage(buffers::bodyCreated,
+                                     std::make_unique<BodyCreatedMessage>(bodies[i], types[i]));
         }
 
         while (manager->newMessages(buffers::destroyBody)) {
@@ -121,16 +130,22 @@ void events(std::atomic<bool> *quit, ThreadManager *manager)
     spec.gravityFactor = 1;
     auto shape = phy::CircleShape(1.0f, 15, {0, 0});
     spec.shapes.push_back(std::make_shared<phy::CircleShape>(shape));
+    spec.filter.groupIndex = playerGroup;
 
-
+    spec.filter.categoryBits = collisionCategory::player;
     manager->sendMessage(buffers::createBody,
                          std::make_unique<CreateBodyMessage>(spec, CharacterType::Player));
+    // Walls do not bounce the projectile back.
+    spec.filter.categoryBits = collisionCategory::projectile;
+    spec.filter.maskBits = ~collisionCategory::boundary;
     manager->sendMessage(buffers::createBody,
                          std::make_unique<CreateBodyMessage>(spec, CharacterType::Projectile));
 
     // Create Spawner
     spec.position = {250, 250};
     spec.gravityFactor = 0;
+    spec.filter = phy::Filter();
+    spec.filter.categoryBits = collisionCategory::spawner;
     auto shape3 = phy::PolygonShape(1.0f);
     shape3.setBox(Vec2<float>(40, 40));
     spec.shapes.clear();
@@ -185,29 +200,12 @@ void events(std::atomic<bool> *quit, ThreadManager *manager)
 
         if (manager->newMessages(buffers::collisions)) {
             auto&& msg = manager->getMessage<CollisionMessage>(buffers::collisions);
-            for (auto bodyPair : msg->bodies) {
+            for (auto bodyPair : msg->began) {
                 // Check if one of the bodies is a boundary
                 auto index = eventHandler.boundaryCollision(bodyPair);
-                if (index == 1 || index == 2) {
-                    std::weak_ptr<phy::Body> body;
-                    if (index == 1)
-                        body = bodyPair.second;
-                    else if (index == 2)
-                        body = bodyPair.first;
-
-                    auto vel = body.lock()->getLinearVelocity();
-                    auto extra = body.lock()->getExtraData();
-                    if (!extra->colliding && body.lock() != eventHandler.getProjectile().lock()) {
-                        extra->colliding = true;
-                        auto cmd = std::make_unique<MoveCommand>(body, Vec2<float>(-2.5 * vel.x, -2.5 * vel.y),
-                                [](std::weak_ptr<phy::Body> body) {
-                                    body.lock()->getExtraData()->colliding = false;
-                                });
-                        manager->sendMessage(buffers::input,
-                                             std::make_unique<InputMessage>(std::move(cmd)));
-                    }
-                } // Check if one of the bodies is the projectile
-                else if (1){
+                // The contact solver keeps bodies out of the walls, so only
+                // check if one of the bodies is the projectile.
+                if (index != 1 && index != 2) {
                     index = eventHandler.projectileCollision(bodyPair);
                     if (index) {
                         std::weak_ptr<phy::Body> enemy;
@@ -245,38 +243,6 @@ void events(std::atomic<bool> *quit, ThreadManager *manager)
                     // TODO: Color Logic
                     }
                 }
-                else {
-                    index = eventHandler.playerCollision(bodyPair);
-                    if (index) {
-                        std::weak_ptr<phy::Body> enemy;
-                        std::weak_ptr<phy::Body> player;
-                        if (index == 1){
-                            player = bodyPair.first;
-                            enemy = bodyPair.second;
-                        } else {
-                            enemy = bodyPair.first;
-                            player = bodyPair.second;
-                        }
-                        auto enemies = eventHandler.getEnemies();
-                        auto search = enemies.find(enemy.lock());
-                        if (search != enemies.end()){
-                            if(player.lock()->getExtraData()->color.a > 10){
-                                std::cout<<"alphaBefore: "<<static_cast< int >( player.lock()->getExtraData()->color.a )<<std::endl;
-                                player.lock()->getExtraData()->color.a -= 5;
-                                std::cout<<"alphaAfter: "<<static_cast< int >( player.lock()->getExtraData()->color.a )<<std::endl;
-                            }
-                        }
-                            // printf("{%d, %d, %d, %d}\n", enemy.lock()->getExtraData()->color.r,
-                            //                              enemy.lock()->getExtraData()->color.g,
-                            //                              enemy.lock()->getExtraData()->color.b,
-                            //                              enemy.lock()->getExtraData()->color.a);
-                            // printf("{%d, %d, %d, %d}\n", player.lock()->getExtraData()->color.r,
-                            //                              player.lock()->getExtraData()->color.g,
-                            //                              player.lock()->getExtraData()->color.b,
-                            //                              player.lock()->getExtraData()->color.a);
-                    // TODO: Color Logic
-                    }
-                }
             }
         }
 
@@ -1,15 +1,23 @@
 #include "inc/physics/aabb.hpp"
+#include "inc/physics/growablestack.hpp"
+#include "inc/physics/aabbsimd.hpp"
+#include "inc/physics/workerpool.hpp"
 #include <iostream>
 #include <iomanip>
 #include <vector>
 #include <strstream>
-#include <stack>
 #include <cmath>
+#include <cstdlib>
+#include <algorithm>
+#include <future>
+#include <thread>
+#include <utility>
 
 namespace phy {
 // Declare the null constant outside the struct
 // to avoid linker errors.
-int32_t const AABBNode::null = -1;
+int32_t const AABBLinks::null = -1;
+float const AABBTree::displacementMultiplier = 2.0f;
 
 Vec2f AABB::getCenter() const
 {
@@ -34,6 +42,12 @@ AABB AABB::combine(const AABB &b) const
             maxValues(highVertex, b.highVertex)};
 }
 
+AABB AABB::expand(float amount) const
+{
+    Vec2f r(amount, amount);
+    return {lowVertex - r, highVertex + r};
+}
+
 bool AABB::contains(const AABB &other) const
 {
     return lowVertex.below(other.lowVertex) && highVertex.above(other.highVertex);
@@ -47,11 +61,31 @@ Vec2f AABB::getSideLengths() const
 
 bool AABB::overlaps(const AABB &other) const
 {
-    auto centerDiff = getCenter() - other.getCenter();
-    auto sides = getSideLengths();
-    auto otherSides = other.getSideLengths();
-    return (abs(centerDiff.x * 2) < (sides.x + otherSides.x)) &&
-           (abs(centerDiff.y * 2) < (sides.y + otherSides.y));
+    return (lowVertex.x < other.highVertex.x) && (other.lowVertex.x < highVertex.x) &&
+           (lowVertex.y < other.highVertex.y) && (other.lowVertex.y < highVertex.y);
+}
+
+bool AABB::intersectsRay(const Vec2f &origin, const Vec2f &invDirection,
+                         float maxFraction, float &entry) const
+{
+    // A zero direction gives infinite slab distances. A ray starting on
+    // the edge of a slab then gives NaN, which every min/max below
+    // ignores since NaN compares false.
+    float low = 0.0f, high = maxFraction;
+    for (int axis = 0; axis < 2; axis++) {
+        const float t1 = (lowVertex(axis) - origin(axis)) * invDirection(axis);
+        const float t2 = (highVertex(axis) - origin(axis)) * invDirection(axis);
+        low = std::max(low, std::min(t1, t2));
+        high = std::min(high, std::max(t1, t2));
+    }
+    entry = low;
+    return low <= high;
+}
+
+float AABB::distanceSquared(const Vec2f &point) const
+{
+    const Vec2f offset = point - maxValues(lowVertex, minValues(point, highVertex));
+    return dot(offset, offset);
 }
 
 bool operator==(const AABB &a, const AABB& b)
@@ -81,73 +115,502 @@ std::ostream &operator<<(std::ostream &out, const AABBNode &b)
 AABBTree::AABBTree()
     : AABBTree(10) {}
 
-AABBTree::AABBTree(size_t initialSize)
-    : nodes(initialSize), nextFreeIndex(0)
+AABBTree::AABBTree(size_t initialSize, float fatMargin)
+    : nextFreeIndex(0), margin(fatMargin), optimizeCursor(0), leafCount(0)
 {
     root = AABBNode::null;
-    for (size_t i = 0; i < nodes.capacity(); i++) {
+    resizeNodes(initialSize);
+    for (size_t i = 0; i < nodes.size(); i++) {
         nodes[i].next = i + 1;
         nodes[i].height = -1;
     }
 
-    nodes[nodes.capacity() - 1].next = AABBNode::null;
+    nodes[nodes.size() - 1].next = AABBNode::null;
+}
+
+void AABBTree::resizeNodes(size_t size)
+{
+    nodes.resize(size);
+#ifdef PHY_AABB_SOA
+    lowX.resize(size);
+    lowY.resize(size);
+    highX.resize(size);
+    highY.resize(size);
+#endif
 }
 
-int32_t AABBTree::insertAABB(const AABB &box)
+int32_t AABBTree::insertAABB(const AABB &box, void *userData)
 {
     int32_t index = allocateNode();
-    // TODO: Fatten the aabb.
-    nodes[index].aabb = box;
+    setBox(index, box.expand(margin));
     nodes[index].height = 0;
+    nodes[index].moved = true;
+    nodes[index].userData = userData;
+    leafCount++;
 
     insertNode(index);
     return index;
 }
 
+struct AABBTree::BuildEntry {
+    int32_t index;
+    Vec2f center;
+};
+
+std::vector<int32_t> AABBTree::build(const std::vector<AABB> &boxes)
+{
+    std::vector<BuildEntry> entries;
+    entries.reserve(boxes.size());
+    collectLeaves(entries);
+
+    std::vector<int32_t> proxies;
+    proxies.reserve(boxes.size());
+    for (const auto &box : boxes) {
+        int32_t index = allocateNode();
+        setBox(index, box.expand(margin));
+        nodes[index].height = 0;
+        nodes[index].moved = true;
+        proxies.push_back(index);
+        entries.push_back({index, getBox(index).getCenter()});
+    }
+    leafCount += boxes.size();
+
+    if (entries.empty())
+        return proxies;
+
+    // Allocate every branch up front so that no thread ever
+    // has to grow the node pool during the build.
+    std::vector<int32_t> branches(entries.size() - 1);
+    for (auto &branch : branches)
+        branch = allocateNode();
+
+    int parallelDepth = 0;
+    for (unsigned threads = std::thread::hardware_concurrency(); threads > 1; threads /= 2)
+        parallelDepth++;
+
+    root = buildSubtree(entries, branches, 0, entries.size(), 0, parallelDepth);
+    nodes[root].parent = AABBNode::null;
+    return proxies;
+}
+
+void AABBTree::collectLeaves(std::vector<BuildEntry> &leaves)
+{
+    if (root == AABBNode::null)
+        return;
+
+    GrowableStack<int32_t, traversalStackSize> stack;
+    stack.push(root);
+    while (!stack.empty()) {
+        int32_t index = stack.pop();
+        if (nodes[index].isLeaf()) {
+            leaves.push_back({index, getBox(index).getCenter()});
+            continue;
+        }
+
+        stack.push(nodes[index].leftChild);
+        stack.push(nodes[index].rightChild);
+        freeNode(index);
+    }
+    root = AABBNode::null;
+}
+
+int32_t AABBTree::buildSubtree(std::vector<BuildEntry> &entries,
+                               const std::vector<int32_t> &branches,
+                               size_t begin, size_t end, size_t firstBranch,
+                               int parallelDepth)
+{
+    const size_t count = end - begin;
+    if (count == 1)
+        return entries[begin].index;
+
+    // Split along the longest axis of the leaf centers.
+    Vec2f lowCenter = entries[begin].center;
+    Vec2f highCenter = lowCenter;
+    for (size_t i = begin + 1; i < end; i++) {
+        lowCenter = minValues(lowCenter, entries[i].center);
+        highCenter = maxValues(highCenter, entries[i].center);
+    }
+    const Vec2f extent = highCenter - lowCenter;
+    const int axis = extent.x >= extent.y ? 0 : 1;
+
+    size_t mid = begin;
+    if (extent(axis) > 0.0f) {
+        struct Bin {
+            AABB box;
+            size_t count = 0;
+        } bins[sahBins];
+
+        const float scale = sahBins / extent(axis);
+        auto binOf = [&](const BuildEntry &entry) {
+            int bin = static_cast<int>((entry.center(axis) - lowCenter(axis)) * scale);
+            return std::min(bin, sahBins - 1);
+        };
+
+        for (size_t i = begin; i < end; i++) {
+            Bin &bin = bins[binOf(entries[i])];
+            const AABB box = getBox(entries[i].index);
+            bin.box = bin.count ? bin.box.combine(box) : box;
+            bin.count++;
+        }
+
+        // Sweep from the right to find the cost of each right half.
+        float rightCost[sahBins];
+        AABB rightBox;
+        size_t rightCount = 0;
+        for (int i = sahBins - 1; i > 0; i--) {
+            if (bins[i].count) {
+                rightBox = rightCount ? rightBox.combine(bins[i].box) : bins[i].box;
+                rightCount += bins[i].count;
+            }
+            rightCost[i] = rightCount ? rightBox.getArea() * rightCount : 0.0f;
+        }
+
+        // Sweep from the left and keep the cheapest split.
+        AABB leftBox;
+        size_t leftCount = 0;
+        int bestSplit = -1;
+        float bestCost = 0.0f;
+        for (int i = 0; i < sahBins - 1; i++) {
+            if (bins[i].count) {
+                leftBox = leftCount ? leftBox.combine(bins[i].box) : bins[i].box;
+                leftCount += bins[i].count;
+            }
+            if (leftCount == 0 || leftCount == count)
+                continue;
+
+            float cost = leftBox.getArea() * leftCount + rightCost[i + 1];
+            if (bestSplit < 0 || cost < bestCost) {
+                bestSplit = i;
+                bestCost = cost;
+            }
+        }
+
+        if (bestSplit >= 0) {
+            auto middle = std::partition(entries.begin() + begin, entries.begin() + end,
+                    [&](const BuildEntry &entry) {
+                        return binOf(entry) <= bestSplit;
+                    });
+            mid = middle - entries.begin();
+        }
+    }
+
+    // All centers are in one bin, just split the leaves in half.
+    if (mid == begin || mid == end) {
+        mid = begin + count / 2;
+        std::nth_element(entries.begin() + begin, entries.begin() + mid, entries.begin() + end,
+                [axis](const BuildEntry &a, const BuildEntry &b) {
+                    return a.center(axis) < b.center(axis);
+                });
+    }
+
+    // The left subtree uses the branches after this one, then the right.
+    const int32_t index = branches[firstBranch];
+    const size_t leftBranch = firstBranch + 1;
+    const size_t rightBranch = leftBranch + (mid - begin - 1);
+
+    int32_t left, right;
+    if (parallelDepth > 0 && count > parallelBuildSize) {
+        auto leftTask = std::async(std::launch::async, [&]() {
+            return buildSubtree(entries, branches, begin, mid, leftBranch, parallelDepth - 1);
+        });
+        right = buildSubtree(entries, branches, mid, end, rightBranch, parallelDepth - 1);
+        left = leftTask.get();
+    } else {
+        left = buildSubtree(entries, branches, begin, mid, leftBranch, 0);
+        right = buildSubtree(entries, branches, mid, end, rightBranch, 0);
+    }
+
+    nodes[index].leftChild = left;
+    nodes[index].rightChild = right;
+    nodes[left].parent = index;
+    nodes[right].parent = index;
+    nodes[index].height = 1 + std::max(nodes[left].height, nodes[right].height);
+    nodes[index].moved = nodes[left].moved || nodes[right].moved;
+    setBox(index, getBox(left).combine(getBox(right)));
+    return index;
+}
+
+float AABBTree::getTreeCost() const
+{
+    float cost = 0.0f;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (nodes[i].height > 0)
+            cost += getBox(i).getArea();
+    }
+    return cost;
+}
+
+int32_t AABBTree::getMaxBalance() const
+{
+    int32_t maxBalance = 0;
+    for (const auto &node : nodes) {
+        if (node.height < 2)
+            continue;
+        const int32_t balance = nodes[node.rightChild].height - nodes[node.leftChild].height;
+        maxBalance = std::max(maxBalance, std::abs(balance));
+    }
+    return maxBalance;
+}
+
+size_t AABBTree::optimize(size_t budget)
+{
+    size_t rotations = 0;
+    // Bound the scan as well, since most of the pool may be leaves or free.
+    for (size_t visited = 0; visited < nodes.size() && budget > 0; visited++) {
+        if (optimizeCursor >= static_cast<int32_t>(nodes.size()))
+            optimizeCursor = 0;
+        const int32_t index = optimizeCursor++;
+        if (nodes[index].height < 2)
+            continue;
+
+        budget--;
+        rotations += rotate(index);
+    }
+    return rotations;
+}
+
+bool AABBTree::rotate(int32_t index)
+{
+    auto sibling = [this](int32_t node) {
+        const Node &parent = nodes[nodes[node].parent];
+        return parent.leftChild == node ? parent.rightChild : parent.leftChild;
+    };
+    auto balanced = [](int32_t heightA, int32_t heightB) {
+        return std::abs(heightA - heightB) <= 1;
+    };
+
+    // Each candidate swaps node a, a child or grandchild of index, with
+    // node b, a grandchild on the other side. Rotations that would
+    // unbalance the tree are skipped, since balance() would undo them
+    // on the next insertion without regard for the area.
+    int32_t bestA = AABBNode::null, bestB = AABBNode::null;
+    float bestGain = 0.0f;
+    auto consider = [&](int32_t a, int32_t b) {
+        const int32_t parentA = nodes[a].parent;
+        const int32_t parentB = nodes[b].parent;
+        const int32_t siblingA = sibling(a);
+        const int32_t siblingB = sibling(b);
+        if (!balanced(nodes[a].height, nodes[siblingB].height))
+            return;
+        const int32_t heightB = 1 + std::max(nodes[a].height, nodes[siblingB].height);
+        float gain = getBox(parentB).getArea() - getBox(a).combine(getBox(siblingB)).getArea();
+
+        if (parentA == index) {
+            if (!balanced(nodes[b].height, heightB))
+                return;
+        } else {
+            if (!balanced(nodes[b].height, nodes[siblingA].height))
+                return;
+            const int32_t heightA = 1 + std::max(nodes[b].height, nodes[siblingA].height);
+            if (!balanced(heightA, heightB))
+                return;
+            gain += getBox(parentA).getArea() - getBox(b).combine(getBox(siblingA)).getArea();
+        }
+        if (gain > bestGain) {
+            bestGain = gain;
+            bestA = a;
+            bestB = b;
+        }
+    };
+
+    const int32_t left = nodes[index].leftChild;
+    const int32_t right = nodes[index].rightChild;
+    const bool leftBranch = !nodes[left].isLeaf();
+    const bool rightBranch = !nodes[right].isLeaf();
+    if (rightBranch) {
+        consider(left, nodes[right].leftChild);
+        consider(left, nodes[right].rightChild);
+    }
+    if (leftBranch) {
+        consider(right, nodes[left].leftChild);
+        consider(right, nodes[left].rightChild);
+    }
+    if (leftBranch && rightBranch) {
+        consider(nodes[left].leftChild, nodes[right].leftChild);
+        consider(nodes[left].leftChild, nodes[right].rightChild);
+    }
+    if (bestA == AABBNode::null)
+        return false;
+
+    const int32_t parentA = nodes[bestA].parent;
+    const int32_t parentB = nodes[bestB].parent;
+    if (nodes[parentA].leftChild == bestA)
+        nodes[parentA].leftChild = bestB;
+    else
+        nodes[parentA].rightChild = bestB;
+    if (nodes[parentB].leftChild == bestB)
+        nodes[parentB].leftChild = bestA;
+    else
+        nodes[parentB].rightChild = bestA;
+    nodes[bestA].parent = parentB;
+    nodes[bestB].parent = parentA;
+
+    // The parent of b is always below the parent of a, or beside it.
+    refit(parentB);
+    if (parentA != index)
+        refit(parentA);
+    refit(index);
+
+    // The leaves under index are unchanged, so only heights can differ above it.
+    for (int32_t ancestor = nodes[index].parent; ancestor != AABBNode::null;
+         ancestor = nodes[ancestor].parent) {
+        const int32_t height = 1 + std::max(nodes[nodes[ancestor].leftChild].height,
+                                            nodes[nodes[ancestor].rightChild].height);
+        if (height == nodes[ancestor].height)
+            break;
+        nodes[ancestor].height = height;
+    }
+    return true;
+}
+
+void AABBTree::refit(int32_t index)
+{
+    const int32_t left = nodes[index].leftChild;
+    const int32_t right = nodes[index].rightChild;
+    setBox(index, getBox(left).combine(getBox(right)));
+    nodes[index].height = 1 + std::max(nodes[left].height, nodes[right].height);
+    nodes[index].moved = nodes[left].moved || nodes[right].moved;
+}
+
+std::vector<int32_t> AABBTree::compact()
+{
+    std::vector<int32_t> remap(nodes.size(), AABBNode::null);
+    std::vector<int32_t> order;
+    if (root != AABBNode::null) {
+        GrowableStack<int32_t, traversalStackSize> stack;
+        stack.push(root);
+        while (!stack.empty()) {
+            const int32_t index = stack.pop();
+            remap[index] = order.size();
+            order.push_back(index);
+            if (!nodes[index].isLeaf()) {
+                stack.push(nodes[index].rightChild);
+                stack.push(nodes[index].leftChild);
+            }
+        }
+    }
+
+    // Keep one free node so that allocateNode() always has a pool to grow.
+    const size_t size = std::max<size_t>(order.size(), 1);
+    std::vector<Node> compacted(size);
+    std::vector<AABB> boxes(order.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        Node node = nodes[order[i]];
+        if (node.parent != AABBNode::null)
+            node.parent = remap[node.parent];
+        if (!node.isLeaf()) {
+            node.leftChild = remap[node.leftChild];
+            node.rightChild = remap[node.rightChild];
+        }
+        node.next = AABBNode::null;
+        compacted[i] = node;
+        boxes[i] = getBox(order[i]);
+    }
+    for (size_t i = order.size(); i < size; i++) {
+        compacted[i].next = i + 1 < size ? i + 1 : AABBNode::null;
+        compacted[i].height = -1;
+    }
+
+    nodes.swap(compacted);
+#ifdef PHY_AABB_SOA
+    for (auto *bounds : {&lowX, &lowY, &highX, &highY}) {
+        bounds->resize(size);
+        bounds->shrink_to_fit();
+    }
+#endif
+    for (size_t i = 0; i < boxes.size(); i++)
+        setBox(i, boxes[i]);
+
+    root = order.empty() ? AABBNode::null : 0;
+    nextFreeIndex = order.size() < size ? order.size() : AABBNode::null;
+    optimizeCursor = 0;
+    return remap;
+}
+
 void AABBTree::destroyAABB(int32_t index)
 {
-    if (index < 0 || index > nodes.capacity())
+    if (index < 0 || index >= nodes.size())
         return;
 
     remove(index);
+    leafCount--;
     // Reinitialize this index,it is a performance loss,
     // but makes testing/bug finding easier.
     nodes[index].height = -1;
     freeNode(index);
 }
 
-void AABBTree::updateAABB(int32_t index, const AABB &newAABB)
+bool AABBTree::updateAABB(int32_t index, const AABB &newAABB, const Vec2f &displacement)
 {
-    if (index < 0 || index > nodes.capacity())
-        return;
+    if (index < 0 || index >= nodes.size())
+        return false;
+
+    AABB fatAABB = getBox(index);
+    if (!refatten(fatAABB, newAABB, margin, displacement))
+        return false;
 
-    // Just remove, update, reinsert the node.
-    // TODO: Find a more efficient way of updating nodes.
     remove(index);
-    nodes[index].aabb = newAABB;
+    setBox(index, fatAABB);
+    nodes[index].moved = true;
     insertNode(index);
+    return true;
+}
+
+bool AABBTree::refatten(AABB &fatAABB, const AABB &newAABB, float margin,
+                        const Vec2f &displacement)
+{
+    // Predict the motion of the proxy by extending the
+    // fat AABB in the direction it is moving.
+    AABB predicted = newAABB.expand(margin);
+    Vec2f d = displacementMultiplier * displacement;
+    if (d.x < 0.0f)
+        predicted.lowVertex.x += d.x;
+    else
+        predicted.highVertex.x += d.x;
+
+    if (d.y < 0.0f)
+        predicted.lowVertex.y += d.y;
+    else
+        predicted.highVertex.y += d.y;
+
+    if (fatAABB.contains(newAABB)) {
+        // The proxy is still inside of its fat AABB, but we do not want
+        // to keep a stale AABB that is far larger than the proxy.
+        AABB hugeAABB = predicted.expand(4.0f * margin);
+        if (hugeAABB.contains(fatAABB))
+            return false;
+    }
+
+    fatAABB = predicted;
+    return true;
 }
 
 int32_t AABBTree::allocateNode()
 {
     // Expand the node pool if necessary
     if (nextFreeIndex == AABBNode::null ||
-        nextFreeIndex >= nodes.capacity()) {
-        auto oldSize = nodes.capacity();
-        nodes.resize(oldSize * 2);
+        nextFreeIndex >= nodes.size()) {
+        auto oldSize = nodes.size();
+        resizeNodes(oldSize * 2);
 
         nodes[oldSize - 1].next = oldSize;
-        for (int32_t i = oldSize; i < nodes.capacity(); i++) {
+        for (int32_t i = oldSize; i < nodes.size(); i++) {
             nodes[i].next = i + 1;
             nodes[i].height = -1;
         }
 
-        nodes[nodes.capacity() - 1].next = AABBNode::null;
+        nodes[nodes.size() - 1].next = AABBNode::null;
         nextFreeIndex = oldSize;
     }
 
     int32_t index = nextFreeIndex;
     nextFreeIndex = nodes[index].next;
+    // Freed branches may be reused as leaves, so never keep stale links.
+    nodes[index].parent = AABBNode::null;
+    nodes[index].leftChild = AABBNode::null;
+    nodes[index].rightChild = AABBNode::null;
+    nodes[index].moved = false;
+    nodes[index].userData = nullptr;
     return index;
 }
 
@@ -159,15 +622,16 @@ void AABBTree::insertNode(int32_t node)
         return;
     }
 
-    auto newAABB = nodes[node].aabb;
+    const AABB newAABB = getBox(node);
     int32_t index = root;
     // Attempt to find the best sibling node.
     while (!nodes[index].isLeaf()) {
         int32_t left = nodes[index].leftChild;
         int32_t right = nodes[index].rightChild;
 
-        float area = nodes[index].aabb.getArea();
-        auto combined = nodes[index].aabb.combine(newAABB);
+        const AABB indexAABB = getBox(index);
+        float area = indexAABB.getArea();
+        auto combined = indexAABB.combine(newAABB);
         float combinedArea = combined.getArea();
 
         float cost = 2 * combinedArea;
@@ -175,11 +639,11 @@ void AABBTree::insertNode(int32_t node)
 
         // Cost of descending into the given child
         auto childCost = [this, &inheritanceCost, &newAABB] (int32_t child) -> float {
-            auto childAABB = newAABB.combine(nodes[child].aabb);
+            auto childAABB = newAABB.combine(getBox(child));
 
             float cost = childAABB.getArea() + inheritanceCost;
             if (!nodes[child].isLeaf()) {
-                float oldArea = nodes[child].aabb.getArea();
+                float oldArea = getBox(child).getArea();
                 cost -= oldArea;
             }
             return cost;
@@ -200,7 +664,7 @@ void AABBTree::insertNode(int32_t node)
     int32_t oldParent = nodes[sibling].parent;
     int32_t newParent = allocateNode();
     nodes[newParent].parent = oldParent;
-    nodes[newParent].aabb = newAABB.combine(nodes[sibling].aabb);
+    setBox(newParent, newAABB.combine(getBox(sibling)));
     nodes[newParent].height = nodes[sibling].height + 1;
 
     // Check if the sibling node was root, update accordingly.
@@ -225,7 +689,8 @@ void AABBTree::insertNode(int32_t node)
         int32_t rightChild = nodes[index].rightChild;
 
         nodes[index].height = 1 + std::max(nodes[leftChild].height, nodes[rightChild].height);
-        nodes[index].aabb = nodes[leftChild].aabb.combine(nodes[rightChild].aabb);
+        nodes[index].moved = nodes[leftChild].moved || nodes[rightChild].moved;
+        setBox(index, getBox(leftChild).combine(getBox(rightChild)));
 
         index = nodes[index].parent;
     }
@@ -233,7 +698,7 @@ void AABBTree::insertNode(int32_t node)
 
 void AABBTree::remove(int32_t index)
 {
-    if (index > nodes.capacity() ||
+    if (index >= nodes.size() ||
         !nodes[index].isLeaf())
         return;
 
@@ -266,8 +731,9 @@ void AABBTree::remove(int32_t index)
             int32_t gpLeft = nodes[gp].leftChild;
             int32_t gpRight = nodes[gp].rightChild;
 
-            nodes[gp].aabb = nodes[gpLeft].aabb.combine(nodes[gpRight].aabb);
+            setBox(gp, getBox(gpLeft).combine(getBox(gpRight)));
             nodes[gp].height = 1 + std::max(nodes[gpLeft].height, nodes[gpRight].height);
+            nodes[gp].moved = nodes[gpLeft].moved || nodes[gpRight].moved;
 
             gp = nodes[gp].parent;
         }
@@ -282,13 +748,13 @@ int32_t AABBTree::balance(int32_t index)
 {
     struct NodePair {
         int32_t index;
-        AABBNode *ptr;
-        NodePair(int32_t index_, std::vector<AABBNode> &nodes)
+        Node *ptr;
+        NodePair(int32_t index_, std::vector<Node> &nodes)
             : index(index_), ptr(&nodes[index]) {}
         operator int32_t() {
             return index;
         }
-        AABBNode *operator()() {
+        Node *operator()() {
             return ptr;
         }
     };
@@ -328,20 +794,24 @@ int32_t AABBTree::balance(int32_t index)
             right()->rightChild = grandLeft;
             input()->rightChild = grandRight;
             grandRight()->parent = input;
-            input()->aabb = left()->aabb.combine(grandRight()->aabb);
-            right()->aabb = input()->aabb.combine(grandLeft()->aabb);
+            setBox(input, getBox(left).combine(getBox(grandRight)));
+            setBox(right, getBox(input).combine(getBox(grandLeft)));
 
             input()->height = 1 + std::max(left()->height, grandRight()->height);
             right()->height = 1 + std::max(input()->height, grandLeft()->height);
+            input()->moved = left()->moved || grandRight()->moved;
+            right()->moved = input()->moved || grandLeft()->moved;
         } else {
             right()->rightChild = grandRight;
             input()->rightChild = grandLeft;
             grandLeft()->parent = input;
-            input()->aabb = left()->aabb.combine(grandLeft()->aabb);
-            right()->aabb = input()->aabb.combine(grandRight()->aabb);
+            setBox(input, getBox(left).combine(getBox(grandLeft)));
+            setBox(right, getBox(input).combine(getBox(grandRight)));
 
             input()->height = 1 + std::max(left()->height, grandLeft()->height);
             right()->height = 1 + std::max(input()->height, grandRight()->height);
+            input()->moved = left()->moved || grandLeft()->moved;
+            right()->moved = input()->moved || grandRight()->moved;
         }
 
         return right;
@@ -369,21 +839,25 @@ int32_t AABBTree::balance(int32_t index)
             input()->leftChild = grandRight;
             grandRight()->parent = input;
 
-            input()->aabb = right()->aabb.combine(grandRight()->aabb);
-            left()->aabb = input()->aabb.combine(grandLeft()->aabb);
+            setBox(input, getBox(right).combine(getBox(grandRight)));
+            setBox(left, getBox(input).combine(getBox(grandLeft)));
 
             input()->height = 1 + std::max(right()->height, grandRight()->height);
             left()->height = 1 + std::max(input()->height, grandLeft()->height);
+            input()->moved = right()->moved || grandRight()->moved;
+            left()->moved = input()->moved || grandLeft()->moved;
         } else {
             left()->rightChild = grandRight;
             input()->leftChild = grandLeft;
             grandLeft()->parent = input;
 
-            input()->aabb = right()->aabb.combine(grandLeft()->aabb);
-            left()->aabb = input()->aabb.combine(grandRight()->aabb);
+            setBox(input, getBox(right).combine(getBox(grandLeft)));
+            setBox(left, getBox(input).combine(getBox(grandRight)));
 
             input()->height = 1 + std::max(right()->height, grandLeft()->height);
             left()->height = 1 + std::max(input()->height, grandRight()->height);
+            input()->moved = right()->moved || grandLeft()->moved;
+            left()->moved = input()->moved || grandRight()->moved;
         }
 
         return left;
@@ -394,7 +868,7 @@ int32_t AABBTree::balance(int32_t index)
 
 void AABBTree::freeNode(int32_t node)
 {
-    if (node == AABBNode::null || node > nodes.capacity())
+    if (node == AABBNode::null || node >= nodes.size())
         return;
 
     nodes[node].next = nextFreeIndex;
@@ -402,58 +876,377 @@ void AABBTree::freeNode(int32_t node)
     nextFreeIndex = node;
 }
 
+int AABBTree::overlappingChildren(const Node &node, const AABB &aabb) const
+{
+#ifdef PHY_AABB_SOA
+    const int32_t l = node.leftChild;
+    const int32_t r = node.rightChild;
+    return overlaps2(lowX[l], lowY[l], highX[l], highY[l],
+                     lowX[r], lowY[r], highX[r], highY[r], aabb);
+#else
+    return getBox(node.leftChild).overlaps(aabb) |
+           (getBox(node.rightChild).overlaps(aabb) << 1);
+#endif
+}
+
 void AABBTree::findCollisions(AABBCallback *callback, const AABB &aabb) const
 {
-    std::stack<int32_t> stack;
+    if (root == AABBNode::null || !getBox(root).overlaps(aabb))
+        return;
+
+    GrowableStack<int32_t, traversalStackSize> stack;
+    stack.push(root);
+    while (!stack.empty()) {
+        int32_t index = stack.pop();
+        const Node *node = &nodes[index];
+
+        if (node->isLeaf()) {
+            if (!callback->registerCollision(-1, index))
+                return;
+            continue;
+        }
+
+        // Only descend into children that can contain an overlap.
+        int children = overlappingChildren(*node, aabb);
+        if (children & 1)
+            stack.push(node->leftChild);
+        if (children & 2)
+            stack.push(node->rightChild);
+    }
+}
+
+void AABBTree::findCollisions(AABBCallback *callback, int32_t index) const
+{
+    if (root == AABBNode::null)
+        return;
+
+    const AABB aabb = getBox(index);
+    GrowableStack<int32_t, traversalStackSize> stack;
     stack.push(root);
-    while (stack.size() > 0) {
-        int32_t index = stack.top();
-        stack.pop();
+    while (!stack.empty()) {
+        int32_t top = stack.pop();
+        const Node *node = &nodes[top];
 
-        if (index == AABBNode::null)
+        if (node->isLeaf()) {
+            if (top != index && !callback->registerCollision(index, top))
+                return;
             continue;
+        }
 
-        const AABBNode *node = &nodes[index];
-        if (node->aabb.overlaps(aabb)) {
-            if (node->isLeaf()) {
-                if (!callback->registerCollision(-1, index))
+        // Only descend into children that can contain an overlap.
+        int children = overlappingChildren(*node, aabb);
+        if (children & 1)
+            stack.push(node->leftChild);
+        if (children & 2)
+            stack.push(node->rightChild);
+    }
+}
+
+void AABBTree::findMovedCollisions(AABBCallback *callback)
+{
+    if (root == AABBNode::null)
+        return;
+
+    if (collectMoved(movedLeaves)) {
+        queryMoved(callback, movedLeaves);
+    } else {
+        PairStack stack;
+        if (nodes[root].moved && !nodes[root].isLeaf())
+            stack.push({root, root});
+        descendMoved(callback, stack, SIZE_MAX);
+    }
+
+    clearMoved();
+}
+
+void AABBTree::findMovedCollisions(const std::vector<AABBCallback *> &callbacks,
+                                   WorkerPool &pool)
+{
+    if (root == AABBNode::null)
+        return;
+
+    const size_t workers = callbacks.size();
+    if (collectMoved(movedLeaves)) {
+        // Each thread queries its share of the moved leaves.
+        auto work = [this, &callbacks, workers](size_t worker) {
+            std::vector<int32_t> share;
+            for (size_t i = worker; i < movedLeaves.size(); i += workers)
+                share.push_back(movedLeaves[i]);
+            queryMoved(callbacks[worker], share);
+        };
+        pool.run(workers, work);
+        clearMoved();
+        return;
+    }
+
+    PairStack stack;
+    if (nodes[root].moved && !nodes[root].isLeaf())
+        stack.push({root, root});
+    // Pairs found while expanding the top of the tree go to the first callback.
+    if (descendMoved(callbacks[0], stack, workers * parallelPairTasks) && !stack.empty()) {
+        std::vector<std::pair<int32_t, int32_t>> tasks;
+        tasks.reserve(stack.size());
+        while (!stack.empty())
+            tasks.push_back(stack.pop());
+
+        // Neighbouring tasks tend to be the same size, so interleave them.
+        auto work = [this, &callbacks, &tasks, workers](size_t worker) {
+            PairStack workerStack;
+            for (size_t i = worker; i < tasks.size(); i += workers) {
+                workerStack.push(tasks[i]);
+                if (!descendMoved(callbacks[worker], workerStack, SIZE_MAX))
                     return;
+            }
+        };
+        pool.run(std::min(workers, tasks.size()), work);
+    }
+
+    clearMoved();
+}
+
+void AABBTree::rayCast(RayCastCallback *callback, const RayCastInput &input) const
+{
+    if (root == AABBNode::null)
+        return;
+
+    const Vec2f origin = input.p1;
+    const Vec2f direction = input.p2 - input.p1;
+    const Vec2f invDirection(1.0f / direction.x, 1.0f / direction.y);
+    RayCastInput clipped = input;
+    float entry;
+    if (!getBox(root).intersectsRay(origin, invDirection, clipped.maxFraction, entry))
+        return;
+
+    // Each entry keeps the fraction where the ray enters its AABB, so
+    // subtrees beyond a clipped ray are dropped without another test.
+    GrowableStack<std::pair<int32_t, float>, traversalStackSize> stack;
+    stack.push({root, entry});
+    while (!stack.empty()) {
+        const auto top = stack.pop();
+        if (top.second > clipped.maxFraction)
+            continue;
+        const Node &node = nodes[top.first];
+
+        if (node.isLeaf()) {
+            const float fraction = callback->rayCastCallback(clipped, top.first);
+            if (fraction == 0.0f)
+                return;
+            if (fraction > 0.0f)
+                clipped.maxFraction = std::min(clipped.maxFraction, fraction);
+            continue;
+        }
+
+        float leftEntry, rightEntry;
+        const bool left = getBox(node.leftChild).intersectsRay(origin, invDirection,
+                                                               clipped.maxFraction, leftEntry);
+        const bool right = getBox(node.rightChild).intersectsRay(origin, invDirection,
+                                                                 clipped.maxFraction, rightEntry);
+        // Push the farther child first so the nearer one is searched first.
+        if (left && right) {
+            if (leftEntry <= rightEntry) {
+                stack.push({node.rightChild, rightEntry});
+                stack.push({node.leftChild, leftEntry});
             } else {
-                stack.push(node->leftChild);
-                stack.push(node->rightChild);
+                stack.push({node.leftChild, leftEntry});
+                stack.push({node.rightChild, rightEntry});
             }
+        } else if (left) {
+            stack.push({node.leftChild, leftEntry});
+        } else if (right) {
+            stack.push({node.rightChild, rightEntry});
         }
     }
 }
 
-void AABBTree::findCollisions(AABBCallback *callback, int32_t index) const
+void AABBTree::findNearest(NearestCallback *callback, const Vec2f &point, size_t k,
+                           std::vector<std::pair<float, int32_t>> &nearest) const
 {
-    const AABB aabb = nodes[index].aabb;
-    std::stack<int32_t> stack;
-    stack.push(root);
-    while (stack.size() > 0) {
-        int32_t top = stack.top();
-        stack.pop();
+    if (root == AABBNode::null || k == 0)
+        return;
+
+    // A leaf is queued by the distance to its AABB first, then queued
+    // again with its exact distance once it reaches the front.
+    struct Entry {
+        float distance;
+        int32_t index;
+        bool exact;
+        bool operator<(const Entry &other) const
+        {
+            return distance > other.distance;
+        }
+    };
+    // Like GrowableStack, borrow a buffer that keeps its capacity
+    // unless a callback is already searching on this thread.
+    thread_local std::vector<Entry> sharedHeap;
+    thread_local bool sharedHeapInUse = false;
+    std::vector<Entry> ownHeap;
+    const bool borrowed = !sharedHeapInUse;
+    std::vector<Entry> &heap = borrowed ? sharedHeap : ownHeap;
+    sharedHeapInUse = true;
+
+    auto push = [&heap](const Entry &entry) {
+        heap.push_back(entry);
+        std::push_heap(heap.begin(), heap.end());
+    };
+    push({getBox(root).distanceSquared(point), root, false});
+    size_t found = 0;
+    while (!heap.empty() && found < k) {
+        std::pop_heap(heap.begin(), heap.end());
+        const Entry top = heap.back();
+        heap.pop_back();
+        const Node &node = nodes[top.index];
+
+        if (top.exact) {
+            nearest.emplace_back(top.distance, top.index);
+            found++;
+        } else if (node.isLeaf()) {
+            const float distance = callback->leafDistance(top.index);
+            if (distance >= 0.0f)
+                push({distance, top.index, true});
+        } else {
+            push({getBox(node.leftChild).distanceSquared(point), node.leftChild, false});
+            push({getBox(node.rightChild).distanceSquared(point), node.rightChild, false});
+        }
+    }
+
+    heap.clear();
+    if (borrowed)
+        sharedHeapInUse = false;
+}
+
+bool AABBTree::descendMoved(AABBCallback *callback, PairStack &stack, size_t stopSize) const
+{
+    // Each entry is either a subtree to test against itself (a == b)
+    // or two disjoint subtrees that overlap and contain a moved leaf.
+    auto pushSelf = [this, &stack](int32_t index) {
+        if (nodes[index].moved && !nodes[index].isLeaf())
+            stack.push({index, index});
+    };
+    // Pairs where neither side moved were reported in an earlier step.
+    auto pushPair = [this, &stack](int32_t a, int32_t b) {
+        if ((nodes[a].moved || nodes[b].moved) && getBox(a).overlaps(getBox(b)))
+            stack.push({a, b});
+    };
+
+    while (!stack.empty() && stack.size() < stopSize) {
+        const auto top = stack.pop();
+        const Node &nodeA = nodes[top.first];
+        const Node &nodeB = nodes[top.second];
+
+        if (top.first == top.second) {
+            pushSelf(nodeA.leftChild);
+            pushSelf(nodeA.rightChild);
+            pushPair(nodeA.leftChild, nodeA.rightChild);
+        } else if (nodeA.isLeaf() && nodeB.isLeaf()) {
+            const int32_t a = std::min(top.first, top.second);
+            const int32_t b = std::max(top.first, top.second);
+            if (!callback->registerCollision(a, b))
+                return false;
+        } else if (nodeA.isLeaf()) {
+            pushPair(top.first, nodeB.leftChild);
+            pushPair(top.first, nodeB.rightChild);
+        } else if (nodeB.isLeaf()) {
+            pushPair(nodeA.leftChild, top.second);
+            pushPair(nodeA.rightChild, top.second);
+        } else {
+            pushPair(nodeA.leftChild, nodeB.leftChild);
+            pushPair(nodeA.leftChild, nodeB.rightChild);
+            pushPair(nodeA.rightChild, nodeB.leftChild);
+            pushPair(nodeA.rightChild, nodeB.rightChild);
+        }
+    }
+    return true;
+}
 
-        if (top == AABBNode::null)
+bool AABBTree::collectMoved(std::vector<int32_t> &leaves) const
+{
+    leaves.clear();
+    if (root == AABBNode::null || !nodes[root].moved)
+        return true;
+
+    GrowableStack<int32_t, traversalStackSize> stack;
+    stack.push(root);
+    while (!stack.empty()) {
+        const int32_t index = stack.pop();
+        const Node &node = nodes[index];
+        if (node.isLeaf()) {
+            leaves.push_back(index);
             continue;
+        }
+
+        if (nodes[node.leftChild].moved)
+            stack.push(node.leftChild);
+        if (nodes[node.rightChild].moved)
+            stack.push(node.rightChild);
+    }
+    return leaves.size() < movedTraversalSize || leaves.size() * movedTraversalRatio < leafCount;
+}
 
-        const AABBNode *node = &nodes[top];
-        if (index != top && node->aabb.overlaps(aabb)) {
-            if (node->isLeaf()) {
-                if (!callback->registerCollision(index, top))
+void AABBTree::queryMoved(AABBCallback *callback, const std::vector<int32_t> &leaves) const
+{
+    GrowableStack<int32_t, traversalStackSize> stack;
+    for (const int32_t index : leaves) {
+        const AABB aabb = getBox(index);
+        stack.push(root);
+        while (!stack.empty()) {
+            const int32_t top = stack.pop();
+            const Node &node = nodes[top];
+
+            if (node.isLeaf()) {
+                // A lower moved leaf already reported the pair.
+                if (top == index || (top < index && node.moved))
+                    continue;
+                if (!callback->registerCollision(std::min(index, top), std::max(index, top)))
                     return;
-            } else {
-                stack.push(node->leftChild);
-                stack.push(node->rightChild);
+                continue;
             }
+
+            int children = overlappingChildren(node, aabb);
+            if (children & 1)
+                stack.push(node.leftChild);
+            if (children & 2)
+                stack.push(node.rightChild);
         }
     }
 }
 
+void AABBTree::clearMoved()
+{
+    if (root == AABBNode::null || !nodes[root].moved)
+        return;
+
+    GrowableStack<int32_t, traversalStackSize> stack;
+    stack.push(root);
+    while (!stack.empty()) {
+        Node &node = nodes[stack.pop()];
+        node.moved = false;
+        if (node.isLeaf())
+            continue;
+
+        if (nodes[node.leftChild].moved)
+            stack.push(node.leftChild);
+        if (nodes[node.rightChild].moved)
+            stack.push(node.rightChild);
+    }
+}
+
 std::vector<AABBNode> AABBTree::getNodes() const
 {
+#ifdef PHY_AABB_SOA
+    std::vector<AABBNode> ret(nodes.size());
+    for (size_t i = 0; i < nodes.size(); i++) {
+        static_cast<AABBLinks &>(ret[i]) = nodes[i];
+        ret[i].aabb = getBox(i);
+    }
+    return ret;
+#else
     return nodes;
+#endif
+}
+
+const AABB AABBTree::operator[](int i) const
+{
+    return getBox(i);
 }
 
 std::string AABBTree::dump() const
@@ -467,8 +1260,9 @@ std::string AABBTree::dump() const
             << "nextFreeIndex: " << nextFreeIndex
             << std::endl;
 
-    for (int i = 0; i < nodes.size(); i++)
-        sstream << "i: " << std::setw(2) << i << " " << nodes[i];
+    auto allNodes = getNodes();
+    for (int i = 0; i < allNodes.size(); i++)
+        sstream << "i: " << std::setw(2) << i << " " << allNodes[i];
     return sstream.str();
 }
 
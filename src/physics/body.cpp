@@ -14,25 +14,28 @@ Body::Body(const BodySpec &spec)
     linearVelocity = spec.linVelocity;
     angularVelocity = spec.angVelocity;
     gravityFactor = spec.gravityFactor;
+    friction = spec.friction;
+    restitution = spec.restitution;
     bodyType = spec.bodyType;
-    if (bodyType == BodyType::staticBody) {
-        mass = 0.0f;
-        invMass = 0.0f;
-    } else {
-        mass = 1.0f;
-        invMass = 1.0f;
-    }
-
-    inertia = 0.0f;
-    invInertia = 0.0f;
     torque = 0.0f;
+    asleep = false;
+    sleepTime = 0.0f;
+    islandIndex = 0;
     extraData = spec.extra;
+    filter = spec.filter;
+    transform = Transform(position, angle);
+    bodySweep.center = position;
+    bodySweep.angle = angle;
+    updateMassProperties();
+    bodySweep.center0 = bodySweep.center;
+    bodySweep.angle0 = angle;
 }
 
 Body::~Body() = default;
 
 std::weak_ptr<PolygonShape> Body::addShape(const PolygonShape &shape)
 {
+    setAwake();
     auto ptr = std::make_shared<PolygonShape>(shape);
     shapeList.push_back(ptr);
     updateMassProperties();
@@ -41,6 +44,7 @@ std::weak_ptr<PolygonShape> Body::addShape(const PolygonShape &shape)
 
 std::weak_ptr<CircleShape> Body::addShape(const CircleShape &shape)
 {
+    setAwake();
     auto ptr = std::make_shared<CircleShape>(shape);
     shapeList.push_back(ptr);
     updateMassProperties();
@@ -49,9 +53,18 @@ std::weak_ptr<CircleShape> Body::addShape(const CircleShape &shape)
 
 void Body::destroyShape(const std::weak_ptr<Shape> &shape)
 {
+    setAwake();
     auto result = std::find(std::begin(shapeList), std::end(shapeList), shape.lock());
-    if (result != std::end(shapeList))
+    if (result != std::end(shapeList)) {
+        // Keep the remaining proxies lined up with their shapes. The
+        // broadphase destroys the old proxy on the next update.
+        auto offset = std::distance(std::begin(shapeList), result);
+        if (offset < static_cast<ptrdiff_t>(proxies.size())) {
+            staleProxies.push_back(proxies[offset]);
+            proxies.erase(std::begin(proxies) + offset);
+        }
         shapeList.erase(result);
+    }
 }
 
 const Vec2f& Body::getPosition() const
@@ -61,11 +74,12 @@ const Vec2f& Body::getPosition() const
 
 float Body::getRotation() const
 {
-    return bodySweep.angle;
+    return angle;
 }
 
 void Body::setLinearVelocity(const Vec2f &velocity)
 {
+    setAwake();
     Vec2f newVelocity;
     if (abs(velocity.x) > 40)
         newVelocity.x = velocity.x < 0 ? -40 : 40;
@@ -87,6 +101,7 @@ const Vec2f &Body::getLinearVelocity() const
 
 void Body::setAngularVelocity(float velocity)
 {
+    setAwake();
     angularVelocity = velocity;
 }
 
@@ -97,29 +112,43 @@ float Body::getAngularVelocity()
 
 void Body::applyForce(const Vec2f &force_, const Vec2f &point)
 {
+    setAwake();
     force += force_;
     torque += cross((point - bodySweep.center), force);
 }
 
 void Body::applyTorque(float torque_)
 {
+    setAwake();
     torque += torque_;
 }
 
 void Body::applyLinearImpulse(const Vec2f &impulse, const Vec2f &point)
 {
     if (bodyType != BodyType::dynamicBody)
-        return
+        return;
 
-    linearVelocity += impulse;
-    angularVelocity += cross((point - bodySweep.center), impulse);
+    setAwake();
+    linearVelocity += invMass * impulse;
+    angularVelocity += invInertia * cross((point - bodySweep.center), impulse);
 }
 
 void Body::applyAngularImpulse(float impulse)
 {
+    setAwake();
     angularVelocity += invInertia * impulse;
 }
 
+BodyType Body::getBodyType() const
+{
+    return bodyType;
+}
+
+const Filter &Body::getFilter() const
+{
+    return filter;
+}
+
 float Body::getMass() const
 {
     return mass;
@@ -132,16 +161,42 @@ float Body::getInertia() const
 
 const Vec2f &Body::getCenterMass() const
 {
-    return centroid;
+    return bodySweep.center;
+}
+
+float Body::getFriction() const
+{
+    return friction;
+}
+
+float Body::getRestitution() const
+{
+    return restitution;
 }
 
 void Body::setSleep()
 {
+    if (bodyType != BodyType::dynamicBody || asleep)
+        return;
+
+    asleep = true;
+    linearVelocity.zeroOut();
+    angularVelocity = 0.0f;
+    clearForces();
+}
+
+void Body::setAwake()
+{
+    if (!asleep)
+        return;
+
+    asleep = false;
+    sleepTime = 0.0f;
 }
 
-bool Body::isAsleep()
+bool Body::isAsleep() const
 {
-    return true;
+    return asleep;
 }
 
 std::vector<std::weak_ptr<Shape>> Body::getShapes()
@@ -168,18 +223,26 @@ void Body::updateVelocity(float dt, Vec2f gravity)
 {
     if (bodyType == BodyType::dynamicBody) {
         linearVelocity += (gravity * gravityFactor + force * invMass) * dt;
-        angularVelocity = invInertia * torque * dt;
+        angularVelocity += invInertia * torque * dt;
         // TODO: Apply damping
     }
 }
 
 void Body::updatePosition(float dt)
 {
-    Vec2f translation = linearVelocity * dt;
-    float rotation = angularVelocity * dt;
-    position += translation;
-    angle += rotation;
-    transform = Transform(position, angle);
+    bodySweep.center0 = bodySweep.center;
+    bodySweep.angle0 = bodySweep.angle;
+    bodySweep.center += linearVelocity * dt;
+    bodySweep.angle += angularVelocity * dt;
+    synchronizeTransform();
+}
+
+void Body::synchronizeTransform()
+{
+    angle = bodySweep.angle;
+    transform = Transform(Vec2f(), angle);
+    transform.position = bodySweep.center - transform.rotation.rotate(bodySweep.localCenter);
+    position = transform.position;
 }
 
 void Body::clearForces()
@@ -194,18 +257,50 @@ void Body::updateMassProperties()
     invMass = 0.0f;
     inertia = 0.0f;
     invInertia = 0.0f;
-    bodySweep.center.zeroOut();
 
+    const Vec2f oldCenter = bodySweep.center;
     Vec2f localCenter;
-    // Sum the mass of all shapes
-    // Calculate the center of mass
-    // Center the inertia
-    // Update velocity
+    if (bodyType == BodyType::dynamicBody) {
+        // Sum the mass of all shapes
+        for (const auto &shape : shapeList) {
+            const MassProperties props = shape->getMassProps();
+            mass += props.mass;
+            localCenter += props.mass * props.centroid;
+            inertia += props.inertia;
+        }
+
+        // Calculate the center of mass
+        if (mass > 0.0f) {
+            invMass = 1.0f / mass;
+            localCenter *= invMass;
+        } else {
+            // Shapes without density still let the body move.
+            mass = 1.0f;
+            invMass = 1.0f;
+        }
+
+        // Center the inertia
+        inertia -= mass * localCenter.length();
+        if (inertia > 0.0f)
+            invInertia = 1.0f / inertia;
+        else
+            inertia = 0.0f;
+    }
+
+    bodySweep.localCenter = localCenter;
+    bodySweep.center = transform.translate(localCenter);
+
+    // Update velocity, so that the point at the old center keeps moving
+    // as it did.
+    linearVelocity += cross(bodySweep.center - oldCenter, -angularVelocity);
 }
 
 void Body::setPosition(Vec2f pos)
 {
+    setAwake();
     position = pos;
+    transform = Transform(position, angle);
+    bodySweep.center = transform.translate(bodySweep.localCenter);
 }
 
 ExtraData *Body::getExtraData()
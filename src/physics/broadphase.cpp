@@ -1,86 +1,238 @@
 #include "inc/physics/broadphase.hpp"
+#include "inc/physics/spatialhash.hpp"
+#include "inc/physics/sweepandprune.hpp"
 #include <iostream>
 #include <algorithm>
+#include <thread>
 
 namespace phy {
-BroadPhase::BroadPhase() : tree(10) {}
-
-auto BroadPhase::findShape(const std::weak_ptr<const Shape> &shape)
+void BroadPhaseBase::addNewBody(const std::shared_ptr<Body> body)
 {
-    auto pos = std::find_if(std::begin(shapeMapping), std::end(shapeMapping),
-            [shape](auto item) {
-                return !item.first.owner_before(shape) && !shape.owner_before(item.first);
-            });
-    if (pos != std::end(shapeMapping))
-        return std::make_pair(true, pos);
-    else
-        return std::make_pair(false, pos);
+    const auto transform = body->getTransform();
+    for (const auto &shape : body->shapeList) {
+        const auto aabb = shape->getAABB(transform);
+        body->proxies.push_back(createProxy(aabb, body.get()));
+        setShapeAABB(body->proxies.back(), aabb);
+    }
 }
 
-void BroadPhase::addNewBody(const std::shared_ptr<Body> body)
+void BroadPhaseBase::addNewBodies(const std::vector<std::shared_ptr<Body>> &bodies)
 {
-    const auto transform = body->getTransform();
-    for (auto shape : body->getShapes()) {
-        const auto aabb = shape.lock()->getAABB(transform);
-        const auto index = tree.insertAABB(aabb);
-
-        shapeMapping.emplace_back(shape, index);
-        bodyMapping.emplace_back(body, index);
-    }
+    for (const auto &body : bodies)
+        addNewBody(body);
 }
 
-void BroadPhase::updateBody(const std::shared_ptr<Body> updatedBody)
+void BroadPhaseBase::updateBody(const std::shared_ptr<Body> updatedBody,
+                                const Vec2f &displacement)
 {
+    destroyProxies(updatedBody->staleProxies);
+
     const auto transform = updatedBody->getTransform();
-    for (auto shape : updatedBody->getShapes()) {
-        const auto aabb = shape.lock()->getAABB(transform);
-        auto pos = findShape(shape);
+    auto &proxies = updatedBody->proxies;
+    for (size_t i = 0; i < updatedBody->shapeList.size(); i++) {
+        const auto aabb = updatedBody->shapeList[i]->getAABB(transform);
         // If the shape is already known, update it.
-        if (pos.first) {
-            tree.updateAABB(pos.second->second, aabb);
-            moved.push_back(pos.second->second);
+        if (i < proxies.size())
+            moveProxy(proxies[i], aabb, displacement);
         // Insert the shape's AABB otherwise.
-        } else {
-            auto index = tree.insertAABB(aabb);
-
-            shapeMapping.emplace_back(shape, index);
-            bodyMapping.emplace_back(updatedBody, index);
-        }
+        else
+            proxies.push_back(createProxy(aabb, updatedBody.get()));
+        setShapeAABB(proxies[i], aabb);
     }
 }
 
-void BroadPhase::deleteBody(const std::shared_ptr<Body> deletedBody)
+void BroadPhaseBase::deleteBody(const std::shared_ptr<Body> deletedBody)
+{
+    destroyProxies(deletedBody->staleProxies);
+    destroyProxies(deletedBody->proxies);
+}
+
+void BroadPhaseBase::destroyProxies(std::vector<int32_t> &proxies)
+{
+    if (proxies.empty())
+        return;
+
+    // Pending pairs would otherwise refer to whichever
+    // shape is given the recycled proxy next.
+    collisions.remove(proxies);
+    for (auto proxy : proxies)
+        destroyProxy(proxy);
+    proxies.clear();
+}
+
+void BroadPhaseBase::setShapeAABB(int32_t proxy, const AABB &aabb)
+{
+    if (static_cast<size_t>(proxy) >= shapeAABBs.size())
+        shapeAABBs.resize(proxy + 1);
+    shapeAABBs[proxy] = aabb;
+}
+
+void BroadPhaseBase::remapProxies(const std::vector<int32_t> &remap)
 {
-    for (auto shape : deletedBody->getShapes()) {
-        auto find = findShape(shape);
-        if (find.first)
-            shapeMapping.erase(find.second);
+    std::vector<AABB> remappedAABBs;
+    std::vector<Body *> bodies;
+    for (size_t proxy = 0; proxy < remap.size(); proxy++) {
+        if (remap[proxy] == AABBNode::null)
+            continue;
+        if (static_cast<size_t>(remap[proxy]) >= remappedAABBs.size())
+            remappedAABBs.resize(remap[proxy] + 1);
+        if (proxy < shapeAABBs.size())
+            remappedAABBs[remap[proxy]] = shapeAABBs[proxy];
+        bodies.push_back(getProxyBody(remap[proxy]));
     }
+    shapeAABBs.swap(remappedAABBs);
+
+    // A body with several shapes is found once for each of them.
+    std::sort(bodies.begin(), bodies.end());
+    bodies.erase(std::unique(bodies.begin(), bodies.end()), bodies.end());
+    for (Body *body : bodies) {
+        for (auto &proxy : body->proxies)
+            proxy = remap[proxy];
+        for (auto &proxy : body->staleProxies)
+            proxy = remap[proxy];
+    }
+
+    collisions.remap(remap);
+    collisions.sort();
+}
+
+void BroadPhaseBase::updatePairs()
+{
+    collisions.clear();
+    findPairs();
+    collisions.sort();
 }
 
-void BroadPhase::updatePairs()
+void BroadPhaseBase::rayCast(const std::function<float(const RayCastHit &)> &callback,
+                             const RayCastInput &input) const
 {
-    for (auto index : moved) {
-        tree.findCollisions(this, index);
+    // Run the exact test against the shape of each proxy the ray crosses.
+    struct ShapeRayCast : public RayCastCallback {
+        const BroadPhaseBase *broadPhase;
+        const std::function<float(const RayCastHit &)> *callback;
+
+        virtual float rayCastCallback(const RayCastInput &input, int32_t proxy) override
+        {
+            Body *body = broadPhase->getProxyBody(proxy);
+            const auto *shape = broadPhase->findProxyShape(proxy);
+
+            RayCastOutput output;
+            if (!shape || !(*shape)->rayCast(output, input, body->getTransform()))
+                return -1.0f;
+            const Vec2f point = input.p1 + output.fraction * (input.p2 - input.p1);
+            return (*callback)({body->shared_from_this(), *shape, point,
+                                output.normal, output.fraction});
+        }
+    } shapeRayCast;
+    shapeRayCast.broadPhase = this;
+    shapeRayCast.callback = &callback;
+    rayCastProxies(&shapeRayCast, input);
+}
+
+void BroadPhaseBase::query(const AABB &aabb, std::vector<Body *> &bodies) const
+{
+    // Drop the proxies whose fattened AABB overlaps but the shape's does not.
+    struct BodyQuery : public AABBCallback {
+        const BroadPhaseBase *broadPhase;
+        std::vector<Body *> *bodies;
+        AABB aabb;
+
+        virtual bool registerCollision(int32_t, int32_t proxy) override
+        {
+            if (broadPhase->shapeAABBs[proxy].overlaps(aabb))
+                bodies->push_back(broadPhase->getProxyBody(proxy));
+            return true;
+        }
+    } bodyQuery;
+    bodyQuery.broadPhase = this;
+    bodyQuery.bodies = &bodies;
+    bodyQuery.aabb = aabb;
+
+    bodies.clear();
+    queryProxies(&bodyQuery, aabb);
+    std::sort(bodies.begin(), bodies.end());
+    bodies.erase(std::unique(bodies.begin(), bodies.end()), bodies.end());
+}
+
+void BroadPhaseBase::queryPoint(const Vec2f &point, std::vector<Body *> &bodies) const
+{
+    struct PointQuery : public AABBCallback {
+        const BroadPhaseBase *broadPhase;
+        std::vector<Body *> *bodies;
+        Vec2f point;
+
+        virtual bool registerCollision(int32_t, int32_t proxy) override
+        {
+            Body *body = broadPhase->getProxyBody(proxy);
+            const auto *shape = broadPhase->findProxyShape(proxy);
+            if (shape && (*shape)->testPoint(body->getTransform(), point))
+                bodies->push_back(body);
+            return true;
+        }
+    } pointQuery;
+    pointQuery.broadPhase = this;
+    pointQuery.bodies = &bodies;
+    pointQuery.point = point;
+
+    bodies.clear();
+    queryProxies(&pointQuery, AABB(point, point));
+    std::sort(bodies.begin(), bodies.end());
+    bodies.erase(std::unique(bodies.begin(), bodies.end()), bodies.end());
+}
+
+void BroadPhaseBase::nearest(size_t k, const Vec2f &point, std::vector<Body *> &bodies) const
+{
+    struct ShapeDistance : public NearestCallback {
+        const BroadPhaseBase *broadPhase;
+        Vec2f point;
+
+        virtual float leafDistance(int32_t proxy) override
+        {
+            return broadPhase->shapeAABBs[proxy].distanceSquared(point);
+        }
+    } shapeDistance;
+    shapeDistance.broadPhase = this;
+    shapeDistance.point = point;
+
+    bodies.clear();
+    // Each shape of a body is a proxy of its own, so ask for more
+    // proxies until k distinct bodies are found or none are left.
+    for (size_t wanted = k; bodies.size() < k; wanted *= 2) {
+        nearestProxyList.clear();
+        nearestProxies(&shapeDistance, point, wanted, nearestProxyList);
+
+        bodies.clear();
+        for (const auto &proxy : nearestProxyList) {
+            Body *body = getProxyBody(proxy.second);
+            if (std::find(bodies.begin(), bodies.end(), body) == bodies.end())
+                bodies.push_back(body);
+            if (bodies.size() == k)
+                break;
+        }
+        if (nearestProxyList.size() < wanted)
+            break;
     }
+}
 
-    moved.clear();
+const std::shared_ptr<Shape> *BroadPhaseBase::findProxyShape(int32_t proxy) const
+{
+    const Body *body = getProxyBody(proxy);
+    const auto &proxies = body->proxies;
+    const auto found = std::find(proxies.begin(), proxies.end(), proxy);
+    if (found == proxies.end())
+        return nullptr;
+    return &body->shapeList[found - proxies.begin()];
 }
 
-std::vector<std::pair<std::weak_ptr<Body>, std::weak_ptr<Body>>>
-BroadPhase::getBodyCollisions()
+BroadPhaseBase::BodyPairs BroadPhaseBase::getBodyCollisions()
 {
-    std::vector<std::pair<std::weak_ptr<Body>, std::weak_ptr<Body>>> ret;
-    for (const auto &p : collisions) {
-        auto body1 = std::find_if(std::begin(bodyMapping), std::end(bodyMapping),
-                [p](auto item) {
-                    return p.first == item.second;
-                });
-        auto body2 = std::find_if(std::begin(bodyMapping), std::end(bodyMapping),
-                [p](auto item) {
-                    return p.second == item.second;
-                });
-        ret.emplace_back(body1->first, body2->first);
+    BodyPairs ret;
+    ret.reserve(collisions.size());
+    for (size_t i = 0; i < collisions.size(); i++) {
+        const auto p = collisions[i];
+        auto body1 = getProxyBody(p.first);
+        auto body2 = getProxyBody(p.second);
+        ret.emplace_back(body1->shared_from_this(), body2->shared_from_this());
     }
 
     collisions.clear();
@@ -88,14 +240,299 @@ BroadPhase::getBodyCollisions()
     return ret;
 }
 
-bool BroadPhase::registerCollision(int32_t nodeA, int32_t nodeB)
+size_t const BroadPhase::parallelPairSize = 2048;
+size_t const BroadPhase::optimizeBudget = 64;
+size_t const BroadPhase::bulkBuildRatio = 8;
+
+BroadPhase::BroadPhase() : BroadPhase(aabbMargin) {}
+
+BroadPhase::BroadPhase(float margin, size_t threads)
+    : tree(10, margin), staticTree(10),
+      workers(threads ? threads : std::max(1u, std::thread::hardware_concurrency())),
+      dynamicLeaves(0), staticLeaves(0)
 {
-    collisions.insert(std::make_pair(nodeA, nodeB));
+    collectors.assign(workers.getThreadCount(), PairCollector(this));
+}
+
+void BroadPhase::addNewBodies(const std::vector<std::shared_ptr<Body>> &bodies)
+{
+    std::vector<AABB> boxes, staticBoxes;
+    for (const auto &body : bodies) {
+        const auto transform = body->getTransform();
+        auto &list = body->getBodyType() == BodyType::staticBody ? staticBoxes : boxes;
+        for (const auto &shape : getShapeList(*body))
+            list.push_back(shape->getAABB(transform));
+    }
+
+    const auto nodes = insertBoxes(tree, dynamicLeaves, boxes);
+    const auto staticNodes = insertBoxes(staticTree, staticLeaves, staticBoxes);
+    auto node = std::begin(nodes);
+    auto staticNode = std::begin(staticNodes);
+    for (const auto &body : bodies) {
+        const bool isStatic = body->getBodyType() == BodyType::staticBody;
+        auto &next = isStatic ? staticNode : node;
+        for (size_t i = 0; i < getShapeList(*body).size(); i++) {
+            const int32_t proxy = makeProxy(*next, isStatic);
+            getTree(proxy).setUserData(*next, body.get());
+            setShapeAABB(proxy, isStatic ? staticBoxes[next - std::begin(staticNodes)]
+                                         : boxes[next - std::begin(nodes)]);
+            getProxies(*body).push_back(proxy);
+            (isStatic ? movedStaticProxies : movedProxies).push_back(proxy);
+            next++;
+        }
+    }
+}
+
+std::vector<int32_t> BroadPhase::insertBoxes(AABBTree &tree, size_t &leaves,
+                                             const std::vector<AABB> &boxes)
+{
+    std::vector<int32_t> nodes;
+    if (boxes.empty())
+        return nodes;
+
+    // A rebuild costs as much as the whole tree, so a few bodies spawned
+    // into a large level are cheaper to insert one by one.
+    if (boxes.size() * bulkBuildRatio < leaves) {
+        nodes.reserve(boxes.size());
+        for (const auto &box : boxes)
+            nodes.push_back(tree.insertAABB(box));
+    } else {
+        nodes = tree.build(boxes);
+    }
+    leaves += boxes.size();
+    return nodes;
+}
+
+int32_t BroadPhase::createProxy(const AABB &aabb, Body *body)
+{
+    if (body->getBodyType() == BodyType::staticBody) {
+        const int32_t proxy = makeProxy(staticTree.insertAABB(aabb, body), true);
+        movedStaticProxies.push_back(proxy);
+        staticLeaves++;
+        return proxy;
+    }
+    const int32_t proxy = makeProxy(tree.insertAABB(aabb, body), false);
+    movedProxies.push_back(proxy);
+    dynamicLeaves++;
+    return proxy;
+}
+
+void BroadPhase::moveProxy(int32_t proxy, const AABB &aabb, const Vec2f &displacement)
+{
+    if (getTree(proxy).updateAABB(getNode(proxy), aabb, displacement))
+        (isStaticProxy(proxy) ? movedStaticProxies : movedProxies).push_back(proxy);
+}
+
+void BroadPhase::destroyProxy(int32_t proxy)
+{
+    auto &moved = isStaticProxy(proxy) ? movedStaticProxies : movedProxies;
+    moved.erase(std::remove(moved.begin(), moved.end(), proxy), moved.end());
+    getTree(proxy).destroyAABB(getNode(proxy));
+    (isStaticProxy(proxy) ? staticLeaves : dynamicLeaves)--;
+}
+
+Body *BroadPhase::getProxyBody(int32_t proxy) const
+{
+    return static_cast<Body *>(getTree(proxy).getUserData(getNode(proxy)));
+}
+
+AABB BroadPhase::getFatAABB(int32_t proxy) const
+{
+    return getTree(proxy).getFatAABB(getNode(proxy));
+}
+
+void BroadPhase::rayCastProxies(RayCastCallback *callback, const RayCastInput &input) const
+{
+    // Carry the clipped ray over from the static tree to the dynamic one.
+    struct TreeRayCast : public RayCastCallback {
+        RayCastCallback *callback;
+        float maxFraction;
+        bool isStatic;
+        bool stopped;
+
+        virtual float rayCastCallback(const RayCastInput &input, int32_t node) override
+        {
+            const float fraction = callback->rayCastCallback(input, makeProxy(node, isStatic));
+            if (fraction == 0.0f)
+                stopped = true;
+            else if (fraction > 0.0f)
+                maxFraction = std::min(maxFraction, fraction);
+            return fraction;
+        }
+    } treeRayCast;
+    treeRayCast.callback = callback;
+    treeRayCast.maxFraction = input.maxFraction;
+    treeRayCast.isStatic = true;
+    treeRayCast.stopped = false;
+    staticTree.rayCast(&treeRayCast, input);
+    if (treeRayCast.stopped)
+        return;
+
+    RayCastInput clipped = input;
+    clipped.maxFraction = treeRayCast.maxFraction;
+    treeRayCast.isStatic = false;
+    tree.rayCast(&treeRayCast, clipped);
+}
+
+void BroadPhase::queryProxies(AABBCallback *callback, const AABB &aabb) const
+{
+    // Report the leaves of both trees as proxies.
+    struct TreeQuery : public AABBCallback {
+        AABBCallback *callback;
+        bool isStatic;
+        bool stopped;
+
+        virtual bool registerCollision(int32_t, int32_t node) override
+        {
+            stopped = !callback->registerCollision(-1, makeProxy(node, isStatic));
+            return !stopped;
+        }
+    } treeQuery;
+    treeQuery.callback = callback;
+    treeQuery.isStatic = true;
+    treeQuery.stopped = false;
+    staticTree.findCollisions(&treeQuery, aabb);
+    if (treeQuery.stopped)
+        return;
+
+    treeQuery.isStatic = false;
+    tree.findCollisions(&treeQuery, aabb);
+}
+
+void BroadPhase::nearestProxies(NearestCallback *callback, const Vec2f &point, size_t k,
+                                std::vector<std::pair<float, int32_t>> &nearest) const
+{
+    struct TreeNearest : public NearestCallback {
+        NearestCallback *callback;
+        bool isStatic;
+
+        virtual float leafDistance(int32_t node) override
+        {
+            return callback->leafDistance(makeProxy(node, isStatic));
+        }
+    } treeNearest;
+    treeNearest.callback = callback;
+
+    // Take the k nearest of each tree, then keep the k nearest of both.
+    const auto first = nearest.size();
+    treeNearest.isStatic = true;
+    staticTree.findNearest(&treeNearest, point, k, nearest);
+    const auto middle = nearest.size();
+    treeNearest.isStatic = false;
+    tree.findNearest(&treeNearest, point, k, nearest);
+    for (size_t i = first; i < nearest.size(); i++)
+        nearest[i].second = makeProxy(nearest[i].second, i < middle);
+
+    std::inplace_merge(nearest.begin() + first, nearest.begin() + middle, nearest.end(),
+                       [](const std::pair<float, int32_t> &a, const std::pair<float, int32_t> &b) {
+                           return a.first < b.first;
+                       });
+    if (nearest.size() - first > k)
+        nearest.resize(first + k);
+}
+
+void BroadPhase::findPairs()
+{
+    // A proxy may have moved several times since the last update.
+    auto unique = [](std::vector<int32_t> &proxies) {
+        std::sort(proxies.begin(), proxies.end());
+        proxies.erase(std::unique(proxies.begin(), proxies.end()), proxies.end());
+    };
+    unique(movedProxies);
+    unique(movedStaticProxies);
+
+    const size_t moved = movedProxies.size() + movedStaticProxies.size();
+    const size_t threads = moved >= parallelPairSize ? collectors.size() : 1;
+    std::vector<AABBCallback *> callbacks;
+    for (size_t i = 0; i < threads; i++)
+        callbacks.push_back(&collectors[i]);
+    if (threads > 1)
+        tree.findMovedCollisions(callbacks, workers);
+    else
+        tree.findMovedCollisions(callbacks[0]);
+
+    // Static proxies are never tested against each other.
+    auto query = [this, threads](size_t thread) {
+        PairCollector &collector = collectors[thread];
+        for (size_t i = thread; i < movedProxies.size(); i += threads) {
+            collector.queryProxy = movedProxies[i];
+            staticTree.findCollisions(&collector, getFatAABB(movedProxies[i]));
+        }
+        for (size_t i = thread; i < movedStaticProxies.size(); i += threads) {
+            collector.queryProxy = movedStaticProxies[i];
+            tree.findCollisions(&collector, getFatAABB(movedStaticProxies[i]));
+        }
+    };
+    workers.run(threads, query);
+
+    for (size_t i = 0; i < threads; i++) {
+        collisions.append(collectors[i].pairs);
+        collectors[i].pairs.clear();
+    }
+    movedProxies.clear();
+    movedStaticProxies.clear();
+
+    // The static tree is built once and barely changes.
+    tree.optimize(optimizeBudget);
+}
+
+bool BroadPhase::PairCollector::registerCollision(int32_t nodeA, int32_t nodeB)
+{
+    int32_t proxyA, proxyB;
+    if (nodeA == AABBNode::null) {
+        // queryProxy against a leaf of the other tree.
+        proxyA = queryProxy;
+        proxyB = makeProxy(nodeB, !isStaticProxy(queryProxy));
+    } else {
+        proxyA = makeProxy(nodeA, false);
+        proxyB = makeProxy(nodeB, false);
+    }
+    if (shouldCollide(*broadPhase->getProxyBody(proxyA), *broadPhase->getProxyBody(proxyB)))
+        pairs.add(proxyA, proxyB);
     return true;
 }
 
+std::vector<int32_t> BroadPhase::compact()
+{
+    const auto nodeRemap = tree.compact();
+    const auto staticNodeRemap = staticTree.compact();
+
+    std::vector<int32_t> remap(2 * std::max(nodeRemap.size(), staticNodeRemap.size()),
+                               AABBNode::null);
+    // Only leaves are proxies, and each leaf stores its body.
+    auto isLeaf = [](const AABBTree &tree, int32_t node) {
+        return node != AABBNode::null && tree.getUserData(node) != nullptr;
+    };
+    for (size_t node = 0; node < nodeRemap.size(); node++)
+        if (isLeaf(tree, nodeRemap[node]))
+            remap[makeProxy(node, false)] = makeProxy(nodeRemap[node], false);
+    for (size_t node = 0; node < staticNodeRemap.size(); node++)
+        if (isLeaf(staticTree, staticNodeRemap[node]))
+            remap[makeProxy(node, true)] = makeProxy(staticNodeRemap[node], true);
+
+    for (auto &proxy : movedProxies)
+        proxy = remap[proxy];
+    for (auto &proxy : movedStaticProxies)
+        proxy = remap[proxy];
+    remapProxies(remap);
+    return remap;
+}
+
 void BroadPhase::printTree(std::ostream &out)
 {
-    out << tree;
+    out << tree << staticTree;
+}
+
+std::unique_ptr<BroadPhaseBase> makeBroadPhase(BroadPhaseType type)
+{
+    switch (type) {
+    case BroadPhaseType::sweepAndPrune:
+        return std::make_unique<SweepAndPrune>();
+    case BroadPhaseType::spatialHash:
+        return std::make_unique<SpatialHash>();
+    case BroadPhaseType::tree:
+    default:
+        return std::make_unique<BroadPhase>();
+    }
 }
 } /* namespace phy */
@@ -2,19 +2,13 @@
 
 namespace phy {
 CircleShape::CircleShape()
-    : density(0.0), radius(0.0)
-{
-    shapeType = ShapeType::circle;
-}
+    : Shape(ShapeType::circle), density(0.0), radius(0.0) {}
 
 CircleShape::CircleShape(float dens, float rad)
-    : density(dens), radius(rad), pos({0, 0}) {}
+    : Shape(ShapeType::circle), density(dens), radius(rad), pos({0, 0}) {}
 
 CircleShape::CircleShape(float dens, float rad, Vec2f position)
-    : density(dens), radius(rad), pos(position)
-{
-    shapeType = ShapeType::circle;
-}
+    : Shape(ShapeType::circle), density(dens), radius(rad), pos(position) {}
 
 CircleShape::CircleShape(const CircleShape &other)
 {
@@ -39,19 +33,52 @@ int CircleShape::updateRadius(int minR, int maxR, int expand)
 
 bool CircleShape::testPoint(const Transform &transform, const Vec2f &pos) const
 {
-    Vec2f center = transform.position + transform.rotation.rotate(pos);
+    Vec2f center = transform.position + transform.rotation.rotate(this->pos);
     Vec2f distance = pos - center;
     return distance.length() <= radius * radius;
 }
 
 AABB CircleShape::getAABB(const Transform &transform) const
 {
+    const Vec2f center = transform.translate(pos);
     AABB aabb;
-    aabb.lowVertex.setVec(pos.x - radius, pos.y - radius);
-    aabb.highVertex.setVec(pos.x + radius, pos.y + radius);
+    aabb.lowVertex.setVec(center.x - radius, center.y - radius);
+    aabb.highVertex.setVec(center.x + radius, center.y + radius);
     return aabb;
 }
 
+bool CircleShape::rayCast(RayCastOutput &output, const RayCastInput &input,
+                          const Transform &transform) const
+{
+    // Solve |p1 + t * d - center|^2 = radius^2 for the smaller root.
+    const Vec2f center = transform.translate(pos);
+    const Vec2f s = input.p1 - center;
+    const float b = dot(s, s) - radius * radius;
+    if (b < 0.0f)
+        return false;
+
+    const Vec2f d = input.p2 - input.p1;
+    const float c = dot(s, d);
+    const float dd = dot(d, d);
+    const float sigma = c * c - dd * b;
+    if (sigma < 0.0f || dd == 0.0f)
+        return false;
+
+    const float a = -(c + std::sqrt(sigma));
+    if (a < 0.0f || a > input.maxFraction * dd)
+        return false;
+
+    output.fraction = a / dd;
+    output.normal = (s + output.fraction * d).normalize();
+    return true;
+}
+
+Vec2f CircleShape::getSupport(const Vec2f &direction) const
+{
+    const float length = std::sqrt(direction.length());
+    return pos + (radius / length) * direction;
+}
+
 MassProperties CircleShape::getMassProps() const
 {
     MassProperties data;
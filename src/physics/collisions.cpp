@@ -1,7 +1,58 @@
 #include "inc/physics/collisions.hpp"
-#include <iostream>
+#include <algorithm>
+#include <limits>
 
 namespace phy {
+namespace {
+/**
+ * Polygon pairs with more pairs of faces than this are tested with
+ * GJK and EPA by collide() rather than SAT. SAT is still faster for two
+ * octagons, and GJK with a cached simplex wins from two 16-gons on.
+ */
+const size_t maxSatFacePairs = 128;
+
+/**
+ * Swap the roles of shapes A and B in a manifold.
+ */
+void flip(Manifold &manifold)
+{
+    manifold.normal = -manifold.normal;
+    for (uint8_t i = 0; i < manifold.pointCount; i++) {
+        auto &id = manifold.points[i].id;
+        std::swap(id.indexA, id.indexB);
+        std::swap(id.typeA, id.typeB);
+    }
+}
+} /* namespace */
+
+Manifold collide(const Shape &a, const Transform &transformA,
+                 const Shape &b, const Transform &transformB,
+                 SimplexCache *cache)
+{
+    const auto typeA = a.getShapeType();
+    const auto typeB = b.getShapeType();
+    if (typeA == ShapeType::circle && typeB == ShapeType::circle)
+        return collideCircles(static_cast<const CircleShape &>(a), transformA,
+                              static_cast<const CircleShape &>(b), transformB);
+    if (typeA == ShapeType::polygon && typeB == ShapeType::polygon) {
+        const auto &polyA = static_cast<const PolygonShape &>(a);
+        const auto &polyB = static_cast<const PolygonShape &>(b);
+        if (polyA.vertices.size() * polyB.vertices.size() > maxSatFacePairs)
+            return collideConvex(a, transformA, b, transformB, cache);
+        return collidePolygons(polyA, transformA, polyB, transformB);
+    }
+    if (typeA == ShapeType::polygon && typeB == ShapeType::circle)
+        return collidePolygonAndCircle(static_cast<const PolygonShape &>(a), transformA,
+                                       static_cast<const CircleShape &>(b), transformB);
+    if (typeA == ShapeType::circle && typeB == ShapeType::polygon) {
+        auto manifold = collidePolygonAndCircle(static_cast<const PolygonShape &>(b), transformB,
+                                                static_cast<const CircleShape &>(a), transformA);
+        flip(manifold);
+        return manifold;
+    }
+    return Manifold();
+}
+
 Manifold collideCircles(const CircleShape &a, const Transform &transformA,
                         const CircleShape &b, const Transform &transformB)
 {
@@ -16,61 +67,331 @@ Manifold collideCircles(const CircleShape &a, const Transform &transformA,
         return manifold;
 
     manifold.type = Manifold::Type::circles;
-    // TODO: Find MTV
+    // Concentric circles can be pushed apart in any direction.
+    const float length = std::sqrt(distSquared);
+    manifold.normal = length > 0.0f ? (1.0f / length) * distance : Vec2f(1, 0);
+    manifold.depth = radius - length;
+    // Halfway between the surfaces of both circles.
+    auto &point = manifold.points[0];
+    point.point = posA + (a.radius - 0.5f * manifold.depth) * manifold.normal;
+    point.depth = manifold.depth;
+    point.id = {0, 0, ContactFeature::vertex, ContactFeature::vertex};
+    manifold.pointCount = 1;
     return manifold;
 }
 
+namespace {
+/**
+ * Find how far polygon b lies outside of one face of polygon a.
+ *
+ * The face is moved into b's local coordinates rather than moving
+ * every vertex of b, so neither polygon is copied.
+ *
+ * @param relative Takes points from a's local coordinates to b's.
+ * @return The distance from the face to the nearest vertex of b,
+ *         which is negative if the polygons overlap.
+ */
+float findSeparation(const PolygonShape &a, size_t face, const PolygonShape &b,
+                     const Transform &relative)
+{
+    const Vec2f normal = relative.rotation.rotate(a.getNormals()[face]);
+    const Vec2f vertex = relative.translate(a.vertices[face]);
+
+    float separation = std::numeric_limits<float>::max();
+    for (const auto &other : b.vertices)
+        separation = std::min(separation, dot(normal, other - vertex));
+    return separation;
+}
+
+/**
+ * Find the face of polygon a that polygon b lies furthest outside of.
+ *
+ * @param face Set to the index of the face.
+ * @return The separation along that face, see findSeparation().
+ */
+float findMaxSeparation(size_t &face, const PolygonShape &a, const PolygonShape &b,
+                        const Transform &relative)
+{
+    float maxSeparation = -std::numeric_limits<float>::max();
+    for (size_t i = 0; i < a.vertices.size(); i++) {
+        const float separation = findSeparation(a, i, b, relative);
+        if (separation > maxSeparation) {
+            maxSeparation = separation;
+            face = i;
+        }
+    }
+    return maxSeparation;
+}
+
+/**
+ * An end of the incident edge while it is being clipped.
+ */
+struct ClipVertex {
+    Vec2f point;
+    ContactFeature id; ///< Shape A is the reference polygon
+};
+
+/**
+ * Find the edge of the incident polygon whose normal points the most
+ * against the reference face's normal.
+ *
+ * @param normal The reference face's normal in world coordinates.
+ */
+void findIncidentEdge(ClipVertex edge[2], const PolygonShape &incident,
+                      const Transform &transform, const Vec2f &normal, uint8_t referenceFace)
+{
+    const auto &normals = incident.getNormals();
+    const Vec2f local = transform.rotation.invRotate(normal);
+    size_t face = 0;
+    float minDot = dot(local, normals[0]);
+    for (size_t i = 1; i < normals.size(); i++) {
+        const float d = dot(local, normals[i]);
+        if (d < minDot) {
+            minDot = d;
+            face = i;
+        }
+    }
+
+    const size_t next = face + 1 < incident.vertices.size() ? face + 1 : 0;
+    edge[0].point = transform.translate(incident.vertices[face]);
+    edge[0].id = {referenceFace, static_cast<uint8_t>(face),
+                  ContactFeature::face, ContactFeature::vertex};
+    edge[1].point = transform.translate(incident.vertices[next]);
+    edge[1].id = {referenceFace, static_cast<uint8_t>(next),
+                  ContactFeature::face, ContactFeature::vertex};
+}
+
+/**
+ * Clip a segment to the half plane where dot(normal, x) <= offset, as
+ * one step of Sutherland-Hodgman clipping.
+ *
+ * A point made by the clip comes from the reference vertex that bounds
+ * the side plane and the incident edge.
+ *
+ * @return The number of points left, which is 2 unless the segment was
+ *         entirely outside.
+ */
+size_t clipSegment(ClipVertex out[2], const ClipVertex in[2], const Vec2f &normal,
+                   float offset, uint8_t referenceVertex)
+{
+    size_t count = 0;
+    const float distance0 = dot(normal, in[0].point) - offset;
+    const float distance1 = dot(normal, in[1].point) - offset;
+
+    if (distance0 <= 0.0f)
+        out[count++] = in[0];
+    if (distance1 <= 0.0f)
+        out[count++] = in[1];
+
+    if (distance0 * distance1 < 0.0f) {
+        const float t = distance0 / (distance0 - distance1);
+        out[count].point = in[0].point + t * (in[1].point - in[0].point);
+        out[count].id = {referenceVertex, in[0].id.indexB,
+                         ContactFeature::vertex, ContactFeature::face};
+        count++;
+    }
+    return count;
+}
+
+/**
+ * Clip the incident polygon's edge against a face of the reference
+ * polygon and keep the points that reach past that face.
+ *
+ * @param flipped True if the reference polygon is shape B.
+ * @return The manifold, which has no points if none reach the face.
+ */
+Manifold clipToFace(const PolygonShape &reference, const Transform &referenceTransform, size_t face,
+                    const PolygonShape &incident, const Transform &incidentTransform, bool flipped)
+{
+    Manifold manifold;
+
+    const size_t next = face + 1 < reference.vertices.size() ? face + 1 : 0;
+    const Vec2f v1 = referenceTransform.translate(reference.vertices[face]);
+    const Vec2f v2 = referenceTransform.translate(reference.vertices[next]);
+    const Vec2f normal = referenceTransform.rotation.rotate(reference.getNormals()[face]);
+    const Vec2f tangent = cross(normal, -1.0f);
+
+    ClipVertex incidentEdge[2];
+    findIncidentEdge(incidentEdge, incident, incidentTransform, normal, face);
+
+    // Clip the incident edge to the sides of the reference face.
+    ClipVertex clipped1[2], clipped2[2];
+    if (clipSegment(clipped1, incidentEdge, -tangent, -dot(tangent, v1), face) < 2)
+        return manifold;
+    if (clipSegment(clipped2, clipped1, tangent, dot(tangent, v2), next) < 2)
+        return manifold;
+
+    // Keep the points that reach past the reference face.
+    const float frontOffset = dot(normal, v1);
+    for (const auto &clip : clipped2) {
+        const float separation = dot(normal, clip.point) - frontOffset;
+        if (separation > 0.0f)
+            continue;
+        auto &point = manifold.points[manifold.pointCount++];
+        point.point = clip.point;
+        point.depth = -separation;
+        point.id = clip.id;
+        manifold.depth = std::max(manifold.depth, point.depth);
+    }
+    if (manifold.pointCount == 0)
+        return manifold;
+
+    manifold.type = Manifold::Type::polygons;
+    manifold.normal = normal;
+    if (flipped)
+        flip(manifold);
+    return manifold;
+}
+
+/**
+ * Find the face of a polygon whose normal points the most along a
+ * direction.
+ *
+ * @param direction In world coordinates.
+ * @param alignment Set to the dot product of that face's normal and
+ *                  the direction.
+ */
+size_t findAlignedFace(float &alignment, const PolygonShape &polygon,
+                       const Transform &transform, const Vec2f &direction)
+{
+    const auto &normals = polygon.getNormals();
+    const Vec2f local = transform.rotation.invRotate(direction);
+    size_t face = 0;
+    alignment = dot(local, normals[0]);
+    for (size_t i = 1; i < normals.size(); i++) {
+        const float d = dot(local, normals[i]);
+        if (d > alignment) {
+            alignment = d;
+            face = i;
+        }
+    }
+    return face;
+}
+
+} /* namespace */
+
 Manifold collidePolygons(const PolygonShape &a, const Transform &transformA,
                          const PolygonShape &b, const Transform &transformB)
+{
+    // Touching faces with no overlap still count as a collision.
+    size_t faceA = 0, faceB = 0;
+    const float separationA = findMaxSeparation(faceA, a, b, invMultiply(transformB, transformA));
+    if (separationA > 0.0f)
+        return Manifold();
+    const float separationB = findMaxSeparation(faceB, b, a, invMultiply(transformA, transformB));
+    if (separationB > 0.0f)
+        return Manifold();
+
+    // The face with the least overlap is the reference face. A is
+    // preferred unless B is clearly better, so that the result does not
+    // flicker between both when the faces are equal.
+    if (separationB > separationA + referenceFaceTolerance)
+        return clipToFace(b, transformB, faceB, a, transformA, true);
+    return clipToFace(a, transformA, faceA, b, transformB, false);
+}
+
+Manifold collideConvex(const Shape &a, const Transform &transformA,
+                       const Shape &b, const Transform &transformB,
+                       SimplexCache *cache)
 {
     Manifold manifold;
-    auto polyA = PolygonShape(a, transformA);
-    auto axesA = polyA.getNormals();
-    auto polyB = PolygonShape(b, transformB);
-    auto axesB = polyB.getNormals();
-
-    auto overlaps = [](const auto &p1, const auto &p2) -> bool {
-        return !(p1.first > p2.second || p2.first > p1.second);
-    };
-    auto getOverlap = [](const auto &p1, const auto &p2) {
-        return std::min(p1.second - p2.first, p2.second - p1.first);
-    };
-
-    for (auto axis : axesA) {
-        auto normalized = axis.normalize();
-        auto p1 = polyA.projectShape(normalized);
-        auto p2 = polyB.projectShape(normalized);
-
-        if (!overlaps(p1, p2)) {
+    PenetrationOutput penetration;
+    if (!phy::penetration(penetration, a, transformA, b, transformB, cache))
+        return manifold;
+
+    const bool polygonA = a.getShapeType() == ShapeType::polygon;
+    const bool polygonB = b.getShapeType() == ShapeType::polygon;
+    if (polygonA && polygonB) {
+        // The faces most aligned with the normal are the ones that
+        // SAT would pick, without testing every pair of faces.
+        const auto &polyA = static_cast<const PolygonShape &>(a);
+        const auto &polyB = static_cast<const PolygonShape &>(b);
+        float alignmentA, alignmentB;
+        const size_t faceA = findAlignedFace(alignmentA, polyA, transformA, penetration.normal);
+        const size_t faceB = findAlignedFace(alignmentB, polyB, transformB, -penetration.normal);
+        // Choose between them like collidePolygons().
+        const float separationA = findSeparation(polyA, faceA, polyB,
+                                                 invMultiply(transformB, transformA));
+        const float separationB = findSeparation(polyB, faceB, polyA,
+                                                 invMultiply(transformA, transformB));
+        if (separationB > separationA + referenceFaceTolerance)
+            manifold = clipToFace(polyB, transformB, faceB, polyA, transformA, true);
+        else
+            manifold = clipToFace(polyA, transformA, faceA, polyB, transformB, false);
+        if (manifold.isTouching())
             return manifold;
-        } else {
-            auto depth = getOverlap(p1, p2);
-            std::cout << "Axis: " << normalized << "Pen depth: " << depth << std::endl;
-            if (depth < manifold.depth) {
-                manifold.localNormal = normalized;
-                manifold.depth = depth;
-            }
-        }
     }
 
-    for (auto axis : axesB) {
-        auto normalized = axis.normalize();
-        auto p1 = polyA.projectShape(normalized);
-        auto p2 = polyB.projectShape(normalized);
+    // Fall back to one point halfway between the deepest points.
+    manifold.type = polygonA && polygonB ? Manifold::Type::polygons
+                    : polygonA || polygonB ? Manifold::Type::polygonAndCircle
+                    : Manifold::Type::circles;
+    manifold.normal = penetration.normal;
+    manifold.depth = penetration.depth;
+    auto &point = manifold.points[0];
+    point.point = 0.5f * (penetration.pointA + penetration.pointB);
+    point.depth = penetration.depth;
+    point.id = {0, 0, ContactFeature::vertex, ContactFeature::vertex};
+    manifold.pointCount = 1;
+    return manifold;
+}
 
-        if (!overlaps(p1, p2)) {
+Manifold collidePolygonAndCircle(const PolygonShape &a, const Transform &transformA,
+                                 const CircleShape &b, const Transform &transformB)
+{
+    Manifold manifold;
+    const auto &vertices = a.vertices;
+    const auto &normals = a.getNormals();
+    // Work in the polygon's frame, where its normals are known.
+    const Vec2f center = transformA.invTranslate(transformB.translate(b.pos));
+
+    // Find the face that the center is furthest outside of.
+    size_t face = 0;
+    float separation = dot(normals[0], center - vertices[0]);
+    for (size_t i = 1; i < vertices.size(); i++) {
+        const float s = dot(normals[i], center - vertices[i]);
+        if (s > separation) {
+            separation = s;
+            face = i;
+        }
+    }
+    if (separation > b.radius)
+        return manifold;
+
+    Vec2f normal, point;
+    // The circle touches the inside of a face unless it is nearest to a vertex.
+    ContactFeature id = {static_cast<uint8_t>(face), 0,
+                         ContactFeature::face, ContactFeature::vertex};
+    if (separation <= 0.0f) {
+        // The center is inside, push it out through the nearest face.
+        normal = normals[face];
+        point = center - separation * normal;
+        manifold.depth = b.radius - separation;
+    } else {
+        // Otherwise the closest point of the polygon is on that face.
+        const size_t next = (face + 1) % vertices.size();
+        const Vec2f v1 = vertices[face];
+        const Vec2f v2 = vertices[next];
+        const Vec2f edge = v2 - v1;
+        const float t = std::min(std::max(dot(center - v1, edge) / edge.length(), 0.0f), 1.0f);
+        point = v1 + t * edge;
+        const Vec2f offset = center - point;
+        const float distSquared = offset.length();
+        if (distSquared > b.radius * b.radius)
             return manifold;
-        } else {
-            auto depth = getOverlap(p1, p2);
-            std::cout << "Axis: " << normalized << "Pen depth: " << depth << std::endl;
-            if (depth < manifold.depth) {
-                manifold.localNormal = normalized;
-                manifold.depth = depth;
-            }
+        const float distance = std::sqrt(distSquared);
+        normal = distance > 0.0f ? (1.0f / distance) * offset : normals[face];
+        manifold.depth = b.radius - distance;
+        if (t == 0.0f || t == 1.0f) {
+            id.indexA = t == 0.0f ? face : next;
+            id.typeA = ContactFeature::vertex;
         }
     }
 
-    manifold.type = Manifold::Type::polygons;
+    manifold.type = Manifold::Type::polygonAndCircle;
+    manifold.normal = transformA.rotation.rotate(normal);
+    manifold.points[0] = {transformA.translate(point), manifold.depth, id};
+    manifold.pointCount = 1;
     return manifold;
 }
 } /*namespace phy */
@@ -0,0 +1,184 @@
+#include "inc/physics/contact.hpp"
+#include "inc/physics/body.hpp"
+#include <algorithm>
+
+namespace phy {
+namespace {
+/**
+ * Give the points of a new manifold the impulses of the points in the
+ * old manifold that were made from the same features.
+ */
+void keepImpulses(Manifold &manifold, const Manifold &oldManifold)
+{
+    for (uint8_t i = 0; i < manifold.pointCount; i++) {
+        auto &point = manifold.points[i];
+        const uint32_t key = point.id.getKey();
+        for (uint8_t j = 0; j < oldManifold.pointCount; j++) {
+            if (oldManifold.points[j].id.getKey() == key) {
+                point.normalImpulse = oldManifold.points[j].normalImpulse;
+                point.tangentImpulse = oldManifold.points[j].tangentImpulse;
+                break;
+            }
+        }
+    }
+}
+
+bool isResting(const Body &body)
+{
+    return body.isAsleep() || body.getBodyType() == BodyType::staticBody;
+}
+} /* namespace */
+
+ContactManager::ContactManager(const BroadPhaseBase &broadPhase_)
+    : broadPhase(broadPhase_) {}
+
+void ContactManager::update()
+{
+    const auto &collisions = broadPhase.collisions;
+    auto newContact = [this](uint64_t key) {
+        Contact contact = {key, Manifold(), false};
+        contact.bodyA = broadPhase.getProxyBody(PairBuffer::first(key));
+        contact.bodyB = broadPhase.getProxyBody(PairBuffer::second(key));
+        return contact;
+    };
+
+    // Both lists are sorted by key, so they can be merged in one pass.
+    mergedContacts.clear();
+    auto found = collisions.begin();
+    for (const auto &contact : contacts) {
+        for (; found != collisions.end() && *found < contact.key; found++)
+            mergeContact(newContact(*found));
+        if (found != collisions.end() && *found == contact.key)
+            found++;
+        mergeContact(contact);
+    }
+    for (; found != collisions.end(); found++)
+        mergeContact(newContact(*found));
+    contacts.swap(mergedContacts);
+
+    collideContacts();
+}
+
+void ContactManager::mergeContact(const Contact &contact)
+{
+    const int32_t a = PairBuffer::first(contact.key);
+    const int32_t b = PairBuffer::second(contact.key);
+    // Fat AABBs only change when a proxy leaves its old one,
+    // after which the backend will find the pair again.
+    if (!broadPhase.getFatAABB(a).overlaps(broadPhase.getFatAABB(b))) {
+        if (contact.isTouching())
+            addEvent(endedContacts, contact);
+        return;
+    }
+    mergedContacts.push_back(contact);
+}
+
+void ContactManager::collideContacts()
+{
+    const auto &shapeAABBs = broadPhase.shapeAABBs;
+    for (auto &contact : contacts) {
+        // Neither body has moved, so the manifold still holds.
+        if (isResting(*contact.bodyA) && isResting(*contact.bodyB)) {
+            contact.began = false;
+            continue;
+        }
+
+        const int32_t a = PairBuffer::first(contact.key);
+        const int32_t b = PairBuffer::second(contact.key);
+        const bool wasTouching = contact.isTouching();
+
+        // Most pairs are only near each other, which the tight AABBs
+        // rule out before the shapes are tested.
+        const Manifold oldManifold = contact.manifold;
+        contact.manifold = Manifold();
+        if (shapeAABBs[a].overlaps(shapeAABBs[b])) {
+            const auto *shapeA = broadPhase.findProxyShape(a);
+            const auto *shapeB = broadPhase.findProxyShape(b);
+            if (shapeA && shapeB) {
+                contact.manifold = collide(**shapeA, contact.bodyA->getTransform(),
+                                           **shapeB, contact.bodyB->getTransform(),
+                                           &contact.cache);
+                keepImpulses(contact.manifold, oldManifold);
+            }
+        }
+
+        const bool touching = contact.isTouching();
+        if (touching && !wasTouching)
+            addEvent(beganContacts, contact);
+        else if (!touching && wasTouching)
+            addEvent(endedContacts, contact);
+        contact.began = touching && !wasTouching;
+    }
+}
+
+void ContactManager::destroyBody(Body &body)
+{
+    destroyProxies(body.staleProxies);
+    destroyProxies(body.proxies);
+}
+
+void ContactManager::destroyProxies(const std::vector<int32_t> &proxies)
+{
+    if (proxies.empty())
+        return;
+
+    auto destroyed = [&proxies](const Contact &contact) {
+        return std::find(proxies.begin(), proxies.end(), PairBuffer::first(contact.key)) != proxies.end()
+               || std::find(proxies.begin(), proxies.end(), PairBuffer::second(contact.key)) != proxies.end();
+    };
+    auto removed = std::stable_partition(contacts.begin(), contacts.end(),
+                                         [&destroyed](const Contact &contact) {
+                                             return !destroyed(contact);
+                                         });
+    // Whatever rested on the destroyed shapes has to fall.
+    for (auto contact = removed; contact != contacts.end(); contact++) {
+        if (contact->isTouching()) {
+            addEvent(endedContacts, *contact);
+            contact->bodyA->setAwake();
+            contact->bodyB->setAwake();
+        }
+    }
+    contacts.erase(removed, contacts.end());
+}
+
+void ContactManager::remapProxies(const std::vector<int32_t> &remap)
+{
+    if (remap.empty())
+        return;
+
+    for (auto &contact : contacts)
+        contact.key = PairBuffer::makeKey(remap[PairBuffer::first(contact.key)],
+                                          remap[PairBuffer::second(contact.key)]);
+    std::sort(contacts.begin(), contacts.end(), [](const Contact &a, const Contact &b) {
+        return a.key < b.key;
+    });
+}
+
+void ContactManager::addEvent(BodyPairs &events, const Contact &contact)
+{
+    events.emplace_back(contact.bodyA->shared_from_this(), contact.bodyB->shared_from_this());
+}
+
+ContactManager::BodyPairs ContactManager::takeBeganContacts()
+{
+    BodyPairs ret;
+    ret.swap(beganContacts);
+    return ret;
+}
+
+ContactManager::BodyPairs ContactManager::takeEndedContacts()
+{
+    BodyPairs ret;
+    ret.swap(endedContacts);
+    return ret;
+}
+
+ContactManager::BodyPairs ContactManager::getPersistingContacts() const
+{
+    BodyPairs ret;
+    for (const auto &contact : contacts)
+        if (contact.isTouching() && !contact.began)
+            addEvent(ret, contact);
+    return ret;
+}
+} /* namespace phy */
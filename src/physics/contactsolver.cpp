@@ -0,0 +1,199 @@
+#include "inc/physics/contactsolver.hpp"
+#include "inc/physics/body.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace phy {
+namespace {
+/**
+ * Cross product of an angular velocity with a vector.
+ */
+inline Vec2f crossScalar(float s, const Vec2f &v)
+{
+    return Vec2f(-s * v.y, s * v.x);
+}
+
+/**
+ * Get the inverse of the mass that an impulse along a direction at a
+ * point feels, or zero if neither body can move.
+ */
+inline float effectiveMass(const ContactConstraint &c, const Vec2f &rA, const Vec2f &rB,
+                           const Vec2f &direction)
+{
+    const float rnA = cross(rA, direction);
+    const float rnB = cross(rB, direction);
+    const float k = c.invMassA + c.invMassB + c.invInertiaA * rnA * rnA + c.invInertiaB * rnB * rnB;
+    return k > 0.0f ? 1.0f / k : 0.0f;
+}
+
+/**
+ * Get the transform of a body whose center of mass has moved.
+ */
+inline Transform sweepTransform(const Sweep &sweep)
+{
+    Transform transform(Vec2f(), sweep.angle);
+    transform.position = sweep.center - transform.rotation.rotate(sweep.localCenter);
+    return transform;
+}
+} /* namespace */
+
+void ContactSolver::applyImpulse(const ContactConstraint &c, const ContactConstraintPoint &point,
+                                 const Vec2f &impulse)
+{
+    Body &a = *c.bodyA;
+    Body &b = *c.bodyB;
+    a.linearVelocity -= c.invMassA * impulse;
+    a.angularVelocity -= c.invInertiaA * cross(point.rA, impulse);
+    b.linearVelocity += c.invMassB * impulse;
+    b.angularVelocity += c.invInertiaB * cross(point.rB, impulse);
+}
+
+Vec2f ContactSolver::getRelativeVelocity(const ContactConstraint &c,
+                                         const ContactConstraintPoint &point)
+{
+    const Body &a = *c.bodyA;
+    const Body &b = *c.bodyB;
+    return b.linearVelocity + crossScalar(b.angularVelocity, point.rB) -
+           a.linearVelocity - crossScalar(a.angularVelocity, point.rA);
+}
+
+void ContactSolver::initialize(std::vector<Contact> &contacts)
+{
+    constraints.clear();
+    for (auto &contact : contacts) {
+        if (!contact.isTouching())
+            continue;
+        const Manifold &manifold = contact.manifold;
+        Body &a = *contact.bodyA;
+        Body &b = *contact.bodyB;
+        // Sleeping islands are not solved until something wakes them.
+        if ((a.asleep || a.bodyType == BodyType::staticBody)
+            && (b.asleep || b.bodyType == BodyType::staticBody))
+            continue;
+
+        ContactConstraint c;
+        c.bodyA = &a;
+        c.bodyB = &b;
+        c.contact = &contact;
+        c.normal = manifold.normal;
+        c.localNormal = a.transform.rotation.invRotate(manifold.normal);
+        c.invMassA = a.invMass;
+        c.invMassB = b.invMass;
+        c.invInertiaA = a.invInertia;
+        c.invInertiaB = b.invInertia;
+        c.friction = std::sqrt(a.friction * b.friction);
+        c.restitution = std::max(a.restitution, b.restitution);
+        c.pointCount = manifold.pointCount;
+
+        const Vec2f tangent = cross(c.normal, 1.0f);
+        for (uint8_t i = 0; i < manifold.pointCount; i++) {
+            const ManifoldPoint &manifoldPoint = manifold.points[i];
+            ContactConstraintPoint &point = c.points[i];
+            point.rA = manifoldPoint.point - a.bodySweep.center;
+            point.rB = manifoldPoint.point - b.bodySweep.center;
+            point.normalImpulse = manifoldPoint.normalImpulse;
+            point.tangentImpulse = manifoldPoint.tangentImpulse;
+            point.normalMass = effectiveMass(c, point.rA, point.rB, c.normal);
+            point.tangentMass = effectiveMass(c, point.rA, point.rB, tangent);
+
+            // The surfaces of both shapes are half of the depth on
+            // either side of the point.
+            const Vec2f halfDepth = 0.5f * manifoldPoint.depth * c.normal;
+            point.localA = a.transform.invTranslate(manifoldPoint.point + halfDepth);
+            point.localB = b.transform.invTranslate(manifoldPoint.point - halfDepth);
+
+            point.velocityBias = 0.0f;
+            const float closing = dot(c.normal, getRelativeVelocity(c, point));
+            if (closing < -velocityThreshold)
+                point.velocityBias = -c.restitution * closing;
+        }
+        constraints.push_back(c);
+    }
+}
+
+void ContactSolver::warmStart()
+{
+    for (const auto &c : constraints) {
+        const Vec2f tangent = cross(c.normal, 1.0f);
+        for (uint8_t i = 0; i < c.pointCount; i++) {
+            const auto &point = c.points[i];
+            applyImpulse(c, point, point.normalImpulse * c.normal + point.tangentImpulse * tangent);
+        }
+    }
+}
+
+void ContactSolver::solveVelocityConstraints()
+{
+    for (auto &c : constraints) {
+        const Vec2f tangent = cross(c.normal, 1.0f);
+
+        // Friction first, since the normal impulses matter more and
+        // should be the last word.
+        for (uint8_t i = 0; i < c.pointCount; i++) {
+            auto &point = c.points[i];
+            const float speed = dot(tangent, getRelativeVelocity(c, point));
+            const float maxFriction = c.friction * point.normalImpulse;
+            const float impulse = std::min(std::max(point.tangentImpulse - point.tangentMass * speed,
+                                                    -maxFriction), maxFriction);
+            const float change = impulse - point.tangentImpulse;
+            point.tangentImpulse = impulse;
+            applyImpulse(c, point, change * tangent);
+        }
+
+        // The total impulse may only push the shapes apart.
+        for (uint8_t i = 0; i < c.pointCount; i++) {
+            auto &point = c.points[i];
+            const float speed = dot(c.normal, getRelativeVelocity(c, point));
+            const float impulse = std::max(point.normalImpulse -
+                                           point.normalMass * (speed - point.velocityBias), 0.0f);
+            const float change = impulse - point.normalImpulse;
+            point.normalImpulse = impulse;
+            applyImpulse(c, point, change * c.normal);
+        }
+    }
+}
+
+void ContactSolver::storeImpulses()
+{
+    for (const auto &c : constraints) {
+        for (uint8_t i = 0; i < c.pointCount; i++) {
+            c.contact->manifold.points[i].normalImpulse = c.points[i].normalImpulse;
+            c.contact->manifold.points[i].tangentImpulse = c.points[i].tangentImpulse;
+        }
+    }
+}
+
+bool ContactSolver::solvePositionConstraints()
+{
+    float minSeparation = 0.0f;
+    for (const auto &c : constraints) {
+        Sweep &sweepA = c.bodyA->bodySweep;
+        Sweep &sweepB = c.bodyB->bodySweep;
+        for (uint8_t i = 0; i < c.pointCount; i++) {
+            const auto &point = c.points[i];
+            const Transform transformA = sweepTransform(sweepA);
+            const Transform transformB = sweepTransform(sweepB);
+            const Vec2f normal = transformA.rotation.rotate(c.localNormal);
+            const Vec2f surfaceA = transformA.translate(point.localA);
+            const Vec2f surfaceB = transformB.translate(point.localB);
+            const float separation = dot(normal, surfaceB - surfaceA);
+            minSeparation = std::min(minSeparation, separation);
+
+            // Push along the normal through the middle of both surfaces.
+            const Vec2f middle = 0.5f * (surfaceA + surfaceB);
+            const Vec2f rA = middle - sweepA.center;
+            const Vec2f rB = middle - sweepB.center;
+            const float correction = std::min(std::max(baumgarte * (separation + linearSlop),
+                                                       -maxLinearCorrection), 0.0f);
+            const float impulse = -correction * effectiveMass(c, rA, rB, normal);
+            const Vec2f p = impulse * normal;
+
+            sweepA.center -= c.invMassA * p;
+            sweepA.angle -= c.invInertiaA * cross(rA, p);
+            sweepB.center += c.invMassB * p;
+            sweepB.angle += c.invInertiaB * cross(rB, p);
+        }
+    }
+    return minSeparation >= -3.0f * linearSlop;
+}
+} /* namespace phy */
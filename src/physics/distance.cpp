@@ -0,0 +1,402 @@
+#include "inc/physics/distance.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace phy {
+namespace {
+const int maxDistanceIterations = 20;
+const int maxPenetrationIterations = 32;
+/**
+ * Shapes closer than this are treated as touching, and GJK and EPA
+ * stop once a new vertex gains less than this.
+ */
+const float linearTolerance = 1e-4f;
+
+/**
+ * A point of the Minkowski difference B - A, with the points of both
+ * shapes that formed it.
+ */
+struct SimplexVertex {
+    Vec2f pointA;
+    Vec2f pointB;
+    Vec2f w; ///< pointB - pointA
+    float a; ///< Barycentric coordinate of the closest point
+};
+
+/**
+ * The shapes and transforms that GJK and EPA are searching.
+ */
+struct ShapePair {
+    const Shape &a;
+    const Transform &transformA;
+    const Shape &b;
+    const Transform &transformB;
+
+    /**
+     * Get the vertex of B - A furthest along a direction.
+     */
+    SimplexVertex support(const Vec2f &direction) const
+    {
+        SimplexVertex vertex;
+        vertex.pointA = transformA.translate(a.getSupport(transformA.rotation.invRotate(-direction)));
+        vertex.pointB = transformB.translate(b.getSupport(transformB.rotation.invRotate(direction)));
+        vertex.w = vertex.pointB - vertex.pointA;
+        vertex.a = 1.0f;
+        return vertex;
+    }
+};
+
+/**
+ * Get a vector perpendicular to a segment that points towards the
+ * origin.
+ */
+Vec2f perpendicularToOrigin(const Vec2f &w1, const Vec2f &w2)
+{
+    const Vec2f edge = w2 - w1;
+    if (cross(edge, -w1) > 0.0f)
+        return Vec2f(-edge.y, edge.x);
+    return Vec2f(edge.y, -edge.x);
+}
+
+struct Simplex {
+    SimplexVertex v[3];
+    int count;
+
+    void readCache(const SimplexCache &cache, const ShapePair &shapes)
+    {
+        count = cache.count;
+        for (int i = 0; i < count; i++) {
+            v[i].pointA = shapes.transformA.translate(cache.localA[i]);
+            v[i].pointB = shapes.transformB.translate(cache.localB[i]);
+            v[i].w = v[i].pointB - v[i].pointA;
+            v[i].a = 1.0f;
+        }
+
+        // The shapes may have turned enough to flatten the old triangle.
+        if (count == 3) {
+            const Vec2f e12 = v[1].w - v[0].w;
+            const Vec2f e13 = v[2].w - v[0].w;
+            if (std::abs(cross(e12, e13)) <= 1e-6f * (e12.length() + e13.length()))
+                count = 1;
+        }
+    }
+
+    void writeCache(SimplexCache &cache, const ShapePair &shapes) const
+    {
+        cache.count = count;
+        for (int i = 0; i < count; i++) {
+            cache.localA[i] = shapes.transformA.invTranslate(v[i].pointA);
+            cache.localB[i] = shapes.transformB.invTranslate(v[i].pointB);
+        }
+    }
+
+    Vec2f getClosestPoint() const
+    {
+        switch (count) {
+        case 1:
+            return v[0].w;
+        case 2:
+            return v[0].a * v[0].w + v[1].a * v[1].w;
+        default:
+            return Vec2f();
+        }
+    }
+
+    Vec2f getSearchDirection() const
+    {
+        if (count == 1)
+            return -v[0].w;
+        // More precise than negating the closest point.
+        return perpendicularToOrigin(v[0].w, v[1].w);
+    }
+
+    void getWitnessPoints(Vec2f &pointA, Vec2f &pointB) const
+    {
+        pointA = Vec2f();
+        pointB = Vec2f();
+        for (int i = 0; i < count; i++) {
+            pointA += v[i].a * v[i].pointA;
+            pointB += v[i].a * v[i].pointB;
+        }
+        if (count == 3)
+            pointB = pointA;
+    }
+
+    /**
+     * Reduce a segment to the part closest to the origin.
+     */
+    void solve2()
+    {
+        const Vec2f w1 = v[0].w;
+        const Vec2f w2 = v[1].w;
+        const Vec2f e12 = w2 - w1;
+
+        const float d12_2 = -dot(w1, e12);
+        if (d12_2 <= 0.0f) {
+            v[0].a = 1.0f;
+            count = 1;
+            return;
+        }
+        const float d12_1 = dot(w2, e12);
+        if (d12_1 <= 0.0f) {
+            v[0] = v[1];
+            v[0].a = 1.0f;
+            count = 1;
+            return;
+        }
+
+        const float inverse = 1.0f / (d12_1 + d12_2);
+        v[0].a = d12_1 * inverse;
+        v[1].a = d12_2 * inverse;
+        count = 2;
+    }
+
+    /**
+     * Reduce a triangle to the part closest to the origin, by testing
+     * which vertex, edge or interior region contains the origin.
+     */
+    void solve3()
+    {
+        const Vec2f w1 = v[0].w;
+        const Vec2f w2 = v[1].w;
+        const Vec2f w3 = v[2].w;
+
+        const Vec2f e12 = w2 - w1;
+        const float d12_1 = dot(w2, e12);
+        const float d12_2 = -dot(w1, e12);
+        const Vec2f e13 = w3 - w1;
+        const float d13_1 = dot(w3, e13);
+        const float d13_2 = -dot(w1, e13);
+        const Vec2f e23 = w3 - w2;
+        const float d23_1 = dot(w3, e23);
+        const float d23_2 = -dot(w2, e23);
+
+        const float n123 = cross(e12, e13);
+        const float d123_1 = n123 * cross(w2, w3);
+        const float d123_2 = n123 * cross(w3, w1);
+        const float d123_3 = n123 * cross(w1, w2);
+
+        if (d12_2 <= 0.0f && d13_2 <= 0.0f) {
+            v[0].a = 1.0f;
+            count = 1;
+        } else if (d12_1 > 0.0f && d12_2 > 0.0f && d123_3 <= 0.0f) {
+            const float inverse = 1.0f / (d12_1 + d12_2);
+            v[0].a = d12_1 * inverse;
+            v[1].a = d12_2 * inverse;
+            count = 2;
+        } else if (d13_1 > 0.0f && d13_2 > 0.0f && d123_2 <= 0.0f) {
+            const float inverse = 1.0f / (d13_1 + d13_2);
+            v[0].a = d13_1 * inverse;
+            v[2].a = d13_2 * inverse;
+            v[1] = v[2];
+            count = 2;
+        } else if (d12_1 <= 0.0f && d23_2 <= 0.0f) {
+            v[0] = v[1];
+            v[0].a = 1.0f;
+            count = 1;
+        } else if (d13_1 <= 0.0f && d23_1 <= 0.0f) {
+            v[0] = v[2];
+            v[0].a = 1.0f;
+            count = 1;
+        } else if (d23_1 > 0.0f && d23_2 > 0.0f && d123_1 <= 0.0f) {
+            const float inverse = 1.0f / (d23_1 + d23_2);
+            v[1].a = d23_1 * inverse;
+            v[2].a = d23_2 * inverse;
+            v[0] = v[2];
+            count = 2;
+        } else {
+            const float inverse = 1.0f / (d123_1 + d123_2 + d123_3);
+            v[0].a = d123_1 * inverse;
+            v[1].a = d123_2 * inverse;
+            v[2].a = d123_3 * inverse;
+            count = 3;
+        }
+    }
+};
+
+/**
+ * Check if a vertex of a counterclockwise polygon bends clockwise, or
+ * lies on the line through its neighbours.
+ */
+bool isReflex(const SimplexVertex polygon[], int count, int i)
+{
+    const Vec2f &previous = polygon[(i + count - 1) % count].w;
+    const Vec2f &next = polygon[(i + 1) % count].w;
+    return cross(polygon[i].w - previous, next - polygon[i].w) <= 0.0f;
+}
+
+/**
+ * Run GJK until the simplex holds the point of B - A closest to the
+ * origin, or encloses the origin.
+ *
+ * @return The number of iterations.
+ */
+int runDistance(Simplex &simplex, const ShapePair &shapes, const SimplexCache *cache)
+{
+    if (cache && cache->count > 0) {
+        simplex.readCache(*cache, shapes);
+    } else {
+        Vec2f direction = shapes.transformA.position - shapes.transformB.position;
+        if (direction.length() == 0.0f)
+            direction = Vec2f(1, 0);
+        simplex.v[0] = shapes.support(direction);
+        simplex.count = 1;
+    }
+
+    int iteration = 0;
+    while (iteration < maxDistanceIterations) {
+        if (simplex.count == 2)
+            simplex.solve2();
+        else if (simplex.count == 3)
+            simplex.solve3();
+        if (simplex.count == 3)
+            break;
+
+        const Vec2f direction = simplex.getSearchDirection();
+        const float length = std::sqrt(direction.length());
+        // The origin is on the simplex, so the shapes touch.
+        if (length < linearTolerance)
+            break;
+
+        const SimplexVertex vertex = shapes.support(direction);
+        iteration++;
+        // Stop once the new vertex brings the simplex no closer.
+        if (dot(vertex.w - simplex.v[0].w, direction) <= linearTolerance * length)
+            break;
+        simplex.v[simplex.count++] = vertex;
+    }
+    return iteration;
+}
+} /* namespace */
+
+DistanceOutput distance(const Shape &a, const Transform &transformA,
+                        const Shape &b, const Transform &transformB,
+                        SimplexCache *cache)
+{
+    const ShapePair shapes = {a, transformA, b, transformB};
+    Simplex simplex;
+    DistanceOutput output;
+    output.iterations = runDistance(simplex, shapes, cache);
+    if (cache)
+        simplex.writeCache(*cache, shapes);
+
+    simplex.getWitnessPoints(output.pointA, output.pointB);
+    output.distance = std::sqrt(simplex.getClosestPoint().length());
+    if (output.distance < linearTolerance) {
+        output.distance = 0.0f;
+        output.pointB = output.pointA;
+    }
+    return output;
+}
+
+bool penetration(PenetrationOutput &output, const Shape &a, const Transform &transformA,
+                 const Shape &b, const Transform &transformB,
+                 SimplexCache *cache)
+{
+    const ShapePair shapes = {a, transformA, b, transformB};
+    Simplex simplex;
+    runDistance(simplex, shapes, cache);
+    if (cache)
+        simplex.writeCache(*cache, shapes);
+    if (simplex.getClosestPoint().length() >= linearTolerance * linearTolerance)
+        return false;
+
+    // EPA grows a polygon inside B - A around the origin. Its edge
+    // closest to the origin ends up on the boundary of B - A.
+    const int maxVertices = 3 + maxPenetrationIterations;
+    SimplexVertex polytope[maxVertices];
+    int count = simplex.count;
+    std::copy(simplex.v, simplex.v + count, polytope);
+
+    // GJK stops as soon as the origin is on the simplex, which may
+    // then be a point or a segment.
+    while (count < 3) {
+        Vec2f direction = count == 1 ? Vec2f(1, 0)
+                                     : Vec2f(polytope[1].w.y - polytope[0].w.y,
+                                             polytope[0].w.x - polytope[1].w.x);
+        SimplexVertex vertex = shapes.support(direction);
+        if (dot(vertex.w - polytope[0].w, direction) <= linearTolerance) {
+            direction = -direction;
+            vertex = shapes.support(direction);
+            // B - A is flat, so the shapes only touch.
+            if (dot(vertex.w - polytope[0].w, direction) <= linearTolerance) {
+                const Vec2f normal = direction.normalize();
+                output.normal = -normal;
+                output.depth = 0.0f;
+                output.pointA = polytope[0].pointA;
+                output.pointB = polytope[0].pointB;
+                return true;
+            }
+        }
+        polytope[count++] = vertex;
+    }
+    if (cross(polytope[1].w - polytope[0].w, polytope[2].w - polytope[0].w) < 0.0f)
+        std::swap(polytope[1], polytope[2]);
+
+    int edge = 0;
+    Vec2f normal;
+    float depth = 0.0f;
+    for (int iteration = 0; ; iteration++) {
+        // Find the edge closest to the origin. The polygon is
+        // counterclockwise, so (e.y, -e.x) points out of it.
+        depth = std::numeric_limits<float>::max();
+        for (int i = 0; i < count; i++) {
+            const Vec2f e = polytope[i + 1 < count ? i + 1 : 0].w - polytope[i].w;
+            const float length = std::sqrt(e.length());
+            if (length == 0.0f)
+                continue;
+            const Vec2f n = (1.0f / length) * Vec2f(e.y, -e.x);
+            const float d = dot(n, polytope[i].w);
+            if (d < depth) {
+                depth = d;
+                normal = n;
+                edge = i;
+            }
+        }
+
+        if (iteration == maxPenetrationIterations || count == maxVertices)
+            break;
+        const SimplexVertex vertex = shapes.support(normal);
+        if (dot(vertex.w, normal) - depth <= linearTolerance)
+            break;
+        int inserted = edge + 1;
+        std::copy_backward(polytope + inserted, polytope + count, polytope + count + 1);
+        polytope[inserted] = vertex;
+        count++;
+
+        // Vertices from the cache are not support points any more, so
+        // the new vertex can hide its neighbours. Dropping them keeps
+        // the polygon convex, and it still encloses the origin.
+        while (count > 3) {
+            const int previous = (inserted + count - 1) % count;
+            if (!isReflex(polytope, count, previous))
+                break;
+            std::copy(polytope + previous + 1, polytope + count, polytope + previous);
+            count--;
+            if (previous < inserted)
+                inserted--;
+        }
+        while (count > 3) {
+            const int next = (inserted + 1) % count;
+            if (!isReflex(polytope, count, next))
+                break;
+            std::copy(polytope + next + 1, polytope + count, polytope + next);
+            count--;
+            if (next < inserted)
+                inserted--;
+        }
+    }
+
+    // Interpolate the points of both shapes along the closest edge.
+    const SimplexVertex &v1 = polytope[edge];
+    const SimplexVertex &v2 = polytope[edge + 1 < count ? edge + 1 : 0];
+    const Vec2f e = v2.w - v1.w;
+    const float t = std::min(std::max(dot(depth * normal - v1.w, e) / e.length(), 0.0f), 1.0f);
+    output.normal = -normal;
+    output.depth = std::max(depth, 0.0f);
+    output.pointA = v1.pointA + t * (v2.pointA - v1.pointA);
+    output.pointB = v1.pointB + t * (v2.pointB - v1.pointB);
+    return true;
+}
+} /* namespace phy */
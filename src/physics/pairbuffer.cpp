@@ -0,0 +1,63 @@
+#include "inc/physics/pairbuffer.hpp"
+
+#include <algorithm>
+
+namespace phy {
+const size_t PairBuffer::radixThreshold = 64;
+
+void PairBuffer::sort()
+{
+    if (keys.size() < radixThreshold) {
+        std::sort(keys.begin(), keys.end());
+    } else {
+        // Least significant digit radix sort, one byte per pass.
+        // All eight histograms are built in a single read of the keys.
+        size_t counts[8][256] = {};
+        for (auto key : keys)
+            for (int digit = 0; digit < 8; digit++)
+                counts[digit][(key >> (digit * 8)) & 0xff]++;
+
+        scratch.resize(keys.size());
+        for (int digit = 0; digit < 8; digit++) {
+            // Proxy ids are small, so most high bytes are equal across
+            // every key and their pass would not change the order.
+            const uint64_t sample = (keys.front() >> (digit * 8)) & 0xff;
+            if (counts[digit][sample] == keys.size())
+                continue;
+
+            size_t offsets[256];
+            size_t total = 0;
+            for (int bucket = 0; bucket < 256; bucket++) {
+                offsets[bucket] = total;
+                total += counts[digit][bucket];
+            }
+            for (auto key : keys)
+                scratch[offsets[(key >> (digit * 8)) & 0xff]++] = key;
+            keys.swap(scratch);
+        }
+    }
+
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+}
+
+void PairBuffer::remove(const std::vector<int32_t> &proxies)
+{
+    if (keys.empty() || proxies.empty())
+        return;
+
+    auto contains = [&proxies](int32_t proxy) {
+        return std::find(proxies.begin(), proxies.end(), proxy) != proxies.end();
+    };
+    keys.erase(std::remove_if(keys.begin(), keys.end(),
+                              [&contains](uint64_t key) {
+                                  return contains(first(key)) || contains(second(key));
+                              }),
+               keys.end());
+}
+
+void PairBuffer::remap(const std::vector<int32_t> &remap)
+{
+    for (auto &key : keys)
+        key = makeKey(remap[first(key)], remap[second(key)]);
+}
+} /* namespace phy */
@@ -1,7 +1,6 @@
 #include "inc/physics/polygon.hpp"
 #include <iostream>
 #include <algorithm>
-#include <stack>
 
 namespace phy {
 PolygonShape::PolygonShape(float dens)
@@ -55,61 +54,46 @@ float PolygonShape::calculateArea() const
     float area = 0.0f;
     for (int i = 0; i < n; i++) {
         int j = (i + 1) % n;
-        area += cross(vertices[j], vertices[i]);
+        area += cross(vertices[i], vertices[j]);
     }
 
     return area / 2.0f;
 }
 
 /**
- * Use Graham Scan to find the convex hull of the given points.
+ * Use Andrew's monotone chain to find the convex hull of the given points.
  *
  * @param vertices Vector of points with at least 3 elements.
+ * @return The hull in counterclockwise order, without collinear points.
  */
 static std::vector<Vec2f> convexHull(std::vector<Vec2f> vertices)
 {
-    std::stack<Vec2f> hull;
-
     auto ccw = [](Vec2f p1, Vec2f p2, Vec2f p3) {
         return (p2.x - p1.x)*(p3.y - p1.y) - (p2.y - p1.y)*(p3.x - p1.x);
     };
 
-    // Find the element with the minimum x coordinate and swap to beginning
-    auto minimum = std::min_element(std::begin(vertices), std::end(vertices),
+    std::sort(std::begin(vertices), std::end(vertices),
             [](Vec2f p1, Vec2f p2) {
                 return (p1.x < p2.x) || (p1.x == p2.x && p1.y < p2.y);
             });
-    std::iter_swap(std::begin(vertices), minimum);
-
-    // Sort the points by polar angle with vertices[0]
-    // The sign of the cross product will tell us if a is to the left of/right of b
-    std::sort(std::begin(vertices) + 1, std::end(vertices),
-            [] (const Vec2f &a, const Vec2f &b) -> bool{
-                return cross(a, b) > 0;
-            });
-
-    hull.push(vertices[0]);
-    hull.push(vertices[1]);
-    hull.push(vertices[2]);
 
-    for (size_t i = 3; i < vertices.size(); i++) {
-        Vec2f top = hull.top();
-        hull.pop();
-        while (ccw(hull.top(), top, vertices[i]) <= 0) {
-            top = hull.top();
-            hull.pop();
-        }
-        hull.push(top);
-        hull.push(vertices[i]);
+    // Build the lower hull from left to right, then the upper hull back.
+    std::vector<Vec2f> hull(2 * vertices.size());
+    size_t k = 0;
+    for (size_t i = 0; i < vertices.size(); i++) {
+        while (k >= 2 && ccw(hull[k - 2], hull[k - 1], vertices[i]) <= 0)
+            k--;
+        hull[k++] = vertices[i];
     }
-
-    // Return a vector instead of a stack for easier use by the shape
-    std::vector<Vec2f> ret;
-    while (!hull.empty()) {
-        ret.push_back(hull.top());
-        hull.pop();
+    for (size_t i = vertices.size() - 1, lower = k + 1; i > 0; i--) {
+        while (k >= lower && ccw(hull[k - 2], hull[k - 1], vertices[i - 1]) <= 0)
+            k--;
+        hull[k++] = vertices[i - 1];
     }
-    return ret;
+
+    // The last point is the first one again.
+    hull.resize(k - 1);
+    return hull;
 }
 
 void PolygonShape::set(const std::vector<Vec2f> &vertices_)
@@ -132,8 +116,7 @@ std::vector<Vec2f> PolygonShape::calculateNormals() const
         int i2 = (i + 1) % vertices.size();
 
         Vec2f edge = vertices[i2] - vertices[i];
-        newNormals.emplace_back(cross(edge, 1.0f));
-        newNormals[i].normalize();
+        newNormals.push_back(cross(edge, 1.0f).normalize());
     }
 
     return newNormals;
@@ -193,7 +176,44 @@ AABB PolygonShape::getAABB(const Transform &transform) const
     return {lower, higher};
 }
 
-const std::vector<Vec2f> PolygonShape::getNormals() const
+bool PolygonShape::rayCast(RayCastOutput &output, const RayCastInput &input,
+                           const Transform &transform) const
+{
+    // Clip the ray against the half plane of every edge in local space.
+    const Vec2f p1 = transform.rotation.invRotate(input.p1 - transform.position);
+    const Vec2f p2 = transform.rotation.invRotate(input.p2 - transform.position);
+    const Vec2f d = p2 - p1;
+
+    float lower = 0.0f, upper = input.maxFraction;
+    int index = -1;
+    for (size_t i = 0; i < vertices.size(); i++) {
+        const float numerator = dot(normals[i], vertices[i] - p1);
+        const float denominator = dot(normals[i], d);
+        if (denominator == 0.0f) {
+            // Parallel to this edge and outside of it.
+            if (numerator < 0.0f)
+                return false;
+        } else if (denominator < 0.0f && numerator < lower * denominator) {
+            // Entering the half plane.
+            lower = numerator / denominator;
+            index = i;
+        } else if (denominator > 0.0f && numerator < upper * denominator) {
+            // Leaving the half plane.
+            upper = numerator / denominator;
+        }
+
+        if (upper < lower)
+            return false;
+    }
+
+    if (index < 0)
+        return false;
+    output.fraction = lower;
+    output.normal = transform.rotation.rotate(normals[index]);
+    return true;
+}
+
+const std::vector<Vec2f> &PolygonShape::getNormals() const
 {
     return normals;
 }
@@ -212,13 +232,43 @@ std::pair<float, float> PolygonShape::projectShape(Vec2f axis) const
     return std::make_pair(min, max);
 }
 
+Vec2f PolygonShape::getSupport(const Vec2f &direction) const
+{
+    size_t best = 0;
+    float bestProjection = dot(direction, vertices[0]);
+    for (size_t i = 1; i < vertices.size(); i++) {
+        const float projection = dot(direction, vertices[i]);
+        if (projection > bestProjection) {
+            bestProjection = projection;
+            best = i;
+        }
+    }
+    return vertices[best];
+}
+
 MassProperties PolygonShape::getMassProps() const
 {
-    MassProperties props;
+    MassProperties props = {0.0f, Vec2f(), 0.0f};
+    if (vertices.size() < 3)
+        return props;
     props.centroid = calculateCentroid();
     props.mass = density * calculateArea();
-    // Sum the moment of inertia for each triangle in the polygon
-    props.inertia = 0;
+
+    // Sum the moment of inertia for each triangle in the polygon, with
+    // one corner at the first vertex to keep the terms small.
+    const Vec2f reference = vertices[0];
+    float inertia = 0.0f;
+    for (size_t i = 0; i < vertices.size(); i++) {
+        const Vec2f e1 = vertices[i] - reference;
+        const Vec2f e2 = vertices[(i + 1) % vertices.size()] - reference;
+        const float intX2 = e1.x * e1.x + e2.x * e1.x + e2.x * e2.x;
+        const float intY2 = e1.y * e1.y + e2.y * e1.y + e2.y * e2.y;
+        inertia += (0.25f / 3.0f) * cross(e1, e2) * (intX2 + intY2);
+    }
+
+    // Move it from the reference to the body origin.
+    const Vec2f offset = props.centroid - reference;
+    props.inertia = density * inertia + props.mass * (props.centroid.length() - offset.length());
     return props;
 }
 
@@ -0,0 +1,177 @@
+#include "inc/physics/quantizedtree.hpp"
+#include "inc/physics/growablestack.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+namespace phy {
+const float QuantizedAABBTree::quantizationSteps = 65535.0f;
+
+QuantizedAABBTree::QuantizedAABBTree() {}
+
+QuantizedAABBTree::QuantizedAABBTree(const AABBTree &tree)
+{
+    if (tree.getRoot() == AABBNode::null)
+        return;
+
+    // Children are encoded against their parent's decoded box, which
+    // is what a traversal sees, so the outward rounding holds all the
+    // way down.
+    const auto source = tree.getNodes();
+    rootBox = source[tree.getRoot()].aabb;
+    struct Entry {
+        int32_t source;
+        int32_t node;
+        AABB parent;
+    };
+    std::vector<Entry> stack = {{tree.getRoot(), 0, rootBox}};
+    nodes.resize(1);
+    while (!stack.empty()) {
+        const Entry entry = stack.back();
+        stack.pop_back();
+        const AABBNode &sourceNode = source[entry.source];
+
+        encode(nodes[entry.node], sourceNode.aabb, entry.parent);
+        if (sourceNode.isLeaf()) {
+            nodes[entry.node].link = ~entry.source;
+            continue;
+        }
+
+        const int32_t child = nodes.size();
+        nodes[entry.node].link = child;
+        nodes.resize(nodes.size() + 2);
+        const AABB box = decode(nodes[entry.node], makeFrame(entry.parent));
+        stack.push_back({sourceNode.rightChild, child + 1, box});
+        stack.push_back({sourceNode.leftChild, child, box});
+    }
+    nodes.shrink_to_fit();
+}
+
+QuantizedAABBTree::Frame QuantizedAABBTree::makeFrame(const AABB &box)
+{
+    const float scale = 1.0f / (quantizationSteps - 1.0f);
+    return {{box.lowVertex.x, box.lowVertex.y},
+            {(box.highVertex.x - box.lowVertex.x) * scale,
+             (box.highVertex.y - box.lowVertex.y) * scale}};
+}
+
+void QuantizedAABBTree::encode(Node &node, const AABB &box, const AABB &parent)
+{
+    const Frame frame = makeFrame(parent);
+    for (int axis = 0; axis < 2; axis++) {
+        const float step = frame.step[axis];
+        float lowStep = 0.0f, highStep = quantizationSteps;
+        if (step > 0.0f) {
+            lowStep = std::floor((box.lowVertex(axis) - frame.low[axis]) / step);
+            highStep = std::ceil((box.highVertex(axis) - frame.low[axis]) / step);
+        }
+        node.low[axis] = static_cast<uint16_t>(std::max(0.0f, std::min(lowStep, quantizationSteps)));
+        node.high[axis] = static_cast<uint16_t>(std::max(0.0f, std::min(highStep, quantizationSteps)));
+
+        // Rounding while decoding may still land just inside the box.
+        while (node.low[axis] > 0 &&
+               decode(node, frame).lowVertex(axis) > box.lowVertex(axis))
+            node.low[axis]--;
+        while (node.high[axis] < quantizationSteps &&
+               decode(node, frame).highVertex(axis) < box.highVertex(axis))
+            node.high[axis]++;
+    }
+}
+
+void QuantizedAABBTree::findCollisions(AABBCallback *callback, const AABB &aabb) const
+{
+    if (nodes.empty())
+        return;
+
+    const AABB root = decode(nodes[0], makeFrame(rootBox));
+    if (!root.overlaps(aabb))
+        return;
+
+    // Each entry carries the frame of its node's decoded box, which its
+    // children are stored relative to.
+    struct Entry {
+        int32_t node;
+        Frame frame;
+    };
+    GrowableStack<Entry, traversalStackSize> stack;
+    stack.push({0, makeFrame(root)});
+    while (!stack.empty()) {
+        const Entry top = stack.pop();
+        const Node &node = nodes[top.node];
+
+        if (node.isLeaf()) {
+            if (!callback->registerCollision(-1, ~node.link))
+                return;
+            continue;
+        }
+
+        for (int32_t child = node.link; child < node.link + 2; child++) {
+            const AABB box = decode(nodes[child], top.frame);
+            if (box.overlaps(aabb))
+                stack.push({child, makeFrame(box)});
+        }
+    }
+}
+
+void QuantizedAABBTree::rayCast(RayCastCallback *callback, const RayCastInput &input) const
+{
+    if (nodes.empty())
+        return;
+
+    const Vec2f origin = input.p1;
+    const Vec2f direction = input.p2 - input.p1;
+    const Vec2f invDirection(1.0f / direction.x, 1.0f / direction.y);
+    RayCastInput clipped = input;
+    float entry;
+    const AABB root = decode(nodes[0], makeFrame(rootBox));
+    if (!root.intersectsRay(origin, invDirection, clipped.maxFraction, entry))
+        return;
+
+    struct Entry {
+        int32_t node;
+        float entry;
+        Frame frame;
+    };
+    GrowableStack<Entry, traversalStackSize> stack;
+    stack.push({0, entry, makeFrame(root)});
+    while (!stack.empty()) {
+        const Entry top = stack.pop();
+        if (top.entry > clipped.maxFraction)
+            continue;
+        const Node &node = nodes[top.node];
+
+        if (node.isLeaf()) {
+            const float fraction = callback->rayCastCallback(clipped, ~node.link);
+            if (fraction == 0.0f)
+                return;
+            if (fraction > 0.0f)
+                clipped.maxFraction = std::min(clipped.maxFraction, fraction);
+            continue;
+        }
+
+        const int32_t left = node.link, right = node.link + 1;
+        const AABB leftBox = decode(nodes[left], top.frame);
+        const AABB rightBox = decode(nodes[right], top.frame);
+        float leftEntry, rightEntry;
+        const bool hitLeft = leftBox.intersectsRay(origin, invDirection,
+                                                   clipped.maxFraction, leftEntry);
+        const bool hitRight = rightBox.intersectsRay(origin, invDirection,
+                                                     clipped.maxFraction, rightEntry);
+        // Push the farther child first so the nearer one is searched first.
+        if (hitLeft && hitRight) {
+            if (leftEntry <= rightEntry) {
+                stack.push({right, rightEntry, makeFrame(rightBox)});
+                stack.push({left, leftEntry, makeFrame(leftBox)});
+            } else {
+                stack.push({left, leftEntry, makeFrame(leftBox)});
+                stack.push({right, rightEntry, makeFrame(rightBox)});
+            }
+        } else if (hitLeft) {
+            stack.push({left, leftEntry, makeFrame(leftBox)});
+        } else if (hitRight) {
+            stack.push({right, rightEntry, makeFrame(rightBox)});
+        }
+    }
+}
+} /* namespace phy */
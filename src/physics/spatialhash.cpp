@@ -0,0 +1,363 @@
+#include "inc/physics/spatialhash.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace phy {
+const int SpatialHash::inlineProxies;
+const float SpatialHash::largeCells = 4.0f;
+const size_t SpatialHash::resizeGrowth = 2;
+
+namespace {
+uint64_t packCell(int32_t x, int32_t y)
+{
+    return (static_cast<uint64_t>(static_cast<uint32_t>(x)) << 32) | static_cast<uint32_t>(y);
+}
+
+// Fibonacci hashing spreads neighboring cells over the whole table.
+size_t hashCell(uint64_t key, int bits)
+{
+    return (key * 0x9E3779B97F4A7C15ull) >> (64 - bits);
+}
+} /* namespace */
+
+SpatialHash::SpatialHash(float cellSize, float margin)
+    : usedCells(0), nextFree(AABBLinks::null), liveProxies(0), sizedProxies(0), tableBits(0),
+      cellSize(0.0f), inverseCellSize(0.0f), autoCellSize(cellSize <= 0.0f), margin(margin)
+{
+    if (!autoCellSize) {
+        this->cellSize = cellSize;
+        inverseCellSize = 1.0f / cellSize;
+    }
+}
+
+int32_t SpatialHash::createProxy(const AABB &aabb, Body *body)
+{
+    int32_t index;
+    if (nextFree != AABBLinks::null) {
+        index = nextFree;
+        nextFree = proxies[index].next;
+    } else {
+        index = proxies.size();
+        proxies.push_back(Proxy());
+    }
+
+    Proxy &proxy = proxies[index];
+    proxy.aabb = aabb.expand(margin);
+    proxy.body = body;
+    proxy.next = AABBLinks::null;
+    proxy.placed = false;
+    liveProxies++;
+
+    // Until the first proxies have been seen there is no cell size
+    // to place this one with.
+    if (cellSize > 0.0f)
+        place(index);
+    queueMoved(index);
+    return index;
+}
+
+void SpatialHash::moveProxy(int32_t index, const AABB &aabb, const Vec2f &displacement)
+{
+    Proxy &proxy = proxies[index];
+    if (!AABBTree::refatten(proxy.aabb, aabb, margin, displacement))
+        return;
+
+    if (proxy.placed) {
+        // Most moves stay within the same cells.
+        const Vec2f low = proxy.aabb.lowVertex * inverseCellSize;
+        const Vec2f high = proxy.aabb.highVertex * inverseCellSize;
+        const Vec2f size = high - low;
+        const bool large = size.x > largeCells || size.y > largeCells;
+        if (large || proxy.large ||
+            proxy.lowX != static_cast<int32_t>(std::floor(low.x)) ||
+            proxy.lowY != static_cast<int32_t>(std::floor(low.y)) ||
+            proxy.highX != static_cast<int32_t>(std::floor(high.x)) ||
+            proxy.highY != static_cast<int32_t>(std::floor(high.y))) {
+            unplace(index);
+            place(index);
+        }
+    }
+    queueMoved(index);
+}
+
+void SpatialHash::destroyProxy(int32_t index)
+{
+    Proxy &proxy = proxies[index];
+    if (proxy.placed)
+        unplace(index);
+
+    // The proxy may still be queued as moved, which is
+    // skipped once its body has been cleared.
+    proxy.body = nullptr;
+    proxy.next = nextFree;
+    nextFree = index;
+    liveProxies--;
+}
+
+Body *SpatialHash::getProxyBody(int32_t index) const
+{
+    return proxies[index].body;
+}
+
+AABB SpatialHash::getFatAABB(int32_t index) const
+{
+    return proxies[index].aabb;
+}
+
+void SpatialHash::rayCastProxies(RayCastCallback *callback, const RayCastInput &input) const
+{
+    // Rays are rare next to pair searches, so skip walking the grid.
+    rayCastList(proxies, callback, input);
+}
+
+void SpatialHash::queryProxies(AABBCallback *callback, const AABB &aabb) const
+{
+    queryList(proxies, callback, aabb);
+}
+
+void SpatialHash::nearestProxies(NearestCallback *callback, const Vec2f &point, size_t k,
+                                 std::vector<std::pair<float, int32_t>> &nearest) const
+{
+    nearestList(proxies, callback, point, k, nearest);
+}
+
+void SpatialHash::queueMoved(int32_t index)
+{
+    if (!proxies[index].moved) {
+        proxies[index].moved = true;
+        movedProxies.push_back(index);
+    }
+}
+
+void SpatialHash::place(int32_t index)
+{
+    Proxy &proxy = proxies[index];
+    const Vec2f low = proxy.aabb.lowVertex * inverseCellSize;
+    const Vec2f high = proxy.aabb.highVertex * inverseCellSize;
+    proxy.placed = true;
+
+    const Vec2f size = high - low;
+    proxy.large = size.x > largeCells || size.y > largeCells;
+    if (proxy.large) {
+        largeProxies.push_back(index);
+        return;
+    }
+
+    proxy.lowX = static_cast<int32_t>(std::floor(low.x));
+    proxy.lowY = static_cast<int32_t>(std::floor(low.y));
+    proxy.highX = static_cast<int32_t>(std::floor(high.x));
+    proxy.highY = static_cast<int32_t>(std::floor(high.y));
+    for (int32_t y = proxy.lowY; y <= proxy.highY; y++)
+        for (int32_t x = proxy.lowX; x <= proxy.highX; x++)
+            addToCell(*findCell(x, y, true), index);
+}
+
+void SpatialHash::unplace(int32_t index)
+{
+    Proxy &proxy = proxies[index];
+    proxy.placed = false;
+
+    if (proxy.large) {
+        largeProxies.erase(std::find(largeProxies.begin(), largeProxies.end(), index));
+        return;
+    }
+
+    for (int32_t y = proxy.lowY; y <= proxy.highY; y++)
+        for (int32_t x = proxy.lowX; x <= proxy.highX; x++)
+            removeFromCell(*findCell(x, y, false), index);
+}
+
+void SpatialHash::addToCell(Cell &cell, int32_t index)
+{
+    if (cell.count < inlineProxies) {
+        cell.proxies[cell.count++] = index;
+        return;
+    }
+
+    if (cell.overflow == AABBLinks::null) {
+        if (freeOverflow.empty()) {
+            cell.overflow = overflow.size();
+            overflow.emplace_back();
+        } else {
+            cell.overflow = freeOverflow.back();
+            freeOverflow.pop_back();
+        }
+    }
+    overflow[cell.overflow].push_back(index);
+    cell.count++;
+}
+
+void SpatialHash::removeFromCell(Cell &cell, int32_t index)
+{
+    int32_t last;
+    if (cell.count > inlineProxies) {
+        last = overflow[cell.overflow].back();
+        overflow[cell.overflow].pop_back();
+    } else {
+        last = cell.proxies[cell.count - 1];
+    }
+    cell.count--;
+
+    if (last != index) {
+        int32_t *pos = std::find(cell.proxies, cell.proxies + inlineProxies, index);
+        if (pos == cell.proxies + inlineProxies) {
+            auto &extra = overflow[cell.overflow];
+            pos = &*std::find(extra.begin(), extra.end(), index);
+        }
+        *pos = last;
+    }
+
+    if (cell.count <= inlineProxies && cell.overflow != AABBLinks::null) {
+        freeOverflow.push_back(cell.overflow);
+        cell.overflow = AABBLinks::null;
+    }
+}
+
+SpatialHash::Cell *SpatialHash::findCell(int32_t x, int32_t y, bool create)
+{
+    // Keep the table at most half full so that probes stay short.
+    if (create && 2 * (usedCells + 1) > table.size())
+        grow();
+    else if (table.empty())
+        return nullptr;
+
+    const uint64_t key = packCell(x, y);
+    const size_t mask = table.size() - 1;
+    size_t i = hashCell(key, tableBits);
+    while (true) {
+        Cell &cell = table[i];
+        if (cell.count < 0) {
+            if (!create)
+                return nullptr;
+            cell.key = key;
+            cell.count = 0;
+            cell.overflow = AABBLinks::null;
+            usedCells++;
+            return &cell;
+        }
+        if (cell.key == key)
+            return &cell;
+        i = (i + 1) & mask;
+    }
+}
+
+void SpatialHash::grow()
+{
+    std::vector<Cell> oldTable;
+    oldTable.swap(table);
+
+    // Cells that were emptied by moving proxies are dropped here,
+    // so the table only grows with the number of occupied cells.
+    usedCells = 0;
+    for (const auto &cell : oldTable)
+        if (cell.count > 0)
+            usedCells++;
+
+    tableBits = 6;
+    while ((size_t(1) << tableBits) < 4 * (usedCells + 1))
+        tableBits++;
+    Cell empty;
+    empty.count = -1;
+    table.assign(size_t(1) << tableBits, empty);
+
+    const size_t mask = table.size() - 1;
+    for (const auto &cell : oldTable) {
+        if (cell.count <= 0)
+            continue;
+        size_t i = hashCell(cell.key, tableBits);
+        while (table[i].count >= 0)
+            i = (i + 1) & mask;
+        table[i] = cell;
+    }
+}
+
+void SpatialHash::resize()
+{
+    sizes.clear();
+    for (const auto &proxy : proxies) {
+        if (proxy.body) {
+            const Vec2f size = proxy.aabb.getSideLengths();
+            sizes.push_back(std::max(size.x, size.y));
+        }
+    }
+    auto median = sizes.begin() + sizes.size() / 2;
+    std::nth_element(sizes.begin(), median, sizes.end());
+    cellSize = std::max(2.0f * *median, 1.0f);
+    inverseCellSize = 1.0f / cellSize;
+    sizedProxies = liveProxies;
+
+    table.clear();
+    usedCells = 0;
+    overflow.clear();
+    freeOverflow.clear();
+    largeProxies.clear();
+    tableBits = 0;
+    for (size_t i = 0; i < proxies.size(); i++) {
+        proxies[i].placed = false;
+        if (proxies[i].body)
+            place(i);
+    }
+}
+
+void SpatialHash::findPairs()
+{
+    if (autoCellSize && liveProxies > 0 &&
+        (cellSize == 0.0f || liveProxies >= resizeGrowth * sizedProxies))
+        resize();
+
+    for (auto index : movedProxies) {
+        const Proxy &proxy = proxies[index];
+        if (!proxy.body)
+            continue;
+
+        if (proxy.large) {
+            // Large proxies are rare, so simply test them against everything.
+            const int32_t proxyCount = proxies.size();
+            for (int32_t other = 0; other < proxyCount; other++) {
+                const Proxy &otherProxy = proxies[other];
+                if (other == index || !otherProxy.body)
+                    continue;
+                // A pair of moved large proxies is found from the lower index.
+                if (otherProxy.large && otherProxy.moved && other < index)
+                    continue;
+                if (proxy.aabb.overlaps(otherProxy.aabb) &&
+                    shouldCollide(*proxy.body, *otherProxy.body))
+                    collisions.add(index, other);
+            }
+            continue;
+        }
+
+        for (int32_t y = proxy.lowY; y <= proxy.highY; y++) {
+            for (int32_t x = proxy.lowX; x <= proxy.highX; x++) {
+                const Cell &cell = *findCell(x, y, false);
+                for (int32_t i = 0; i < cell.count; i++) {
+                    const int32_t other = i < inlineProxies ? cell.proxies[i]
+                                          : overflow[cell.overflow][i - inlineProxies];
+                    const Proxy &otherProxy = proxies[other];
+                    // A pair of moved proxies is found from the lower index.
+                    if (other == index || (otherProxy.moved && other < index))
+                        continue;
+                    // Proxies that share several cells are only tested in
+                    // the first cell that both of them cover.
+                    if (x != std::max(proxy.lowX, otherProxy.lowX) ||
+                        y != std::max(proxy.lowY, otherProxy.lowY))
+                        continue;
+                    if (proxy.aabb.overlaps(otherProxy.aabb) &&
+                        shouldCollide(*proxy.body, *otherProxy.body))
+                        collisions.add(index, other);
+                }
+            }
+        }
+
+        // Moved large proxies have already been tested against this one.
+        for (auto other : largeProxies)
+            if (!proxies[other].moved && proxy.aabb.overlaps(proxies[other].aabb) &&
+                shouldCollide(*proxy.body, *proxies[other].body))
+                collisions.add(index, other);
+    }
+
+    for (auto index : movedProxies)
+        proxies[index].moved = false;
+    movedProxies.clear();
+}
+} /* namespace phy */
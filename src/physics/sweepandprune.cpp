@@ -0,0 +1,189 @@
+#include "inc/physics/sweepandprune.hpp"
+#include <algorithm>
+#include <utility>
+
+namespace phy {
+const float SweepAndPrune::resortFraction = 0.1f;
+const float SweepAndPrune::axisHysteresis = 4.0f;
+
+SweepAndPrune::SweepAndPrune() : SweepAndPrune(aabbMargin) {}
+
+SweepAndPrune::SweepAndPrune(float margin)
+    : nextFree(AABBLinks::null), inserted(0), axis(0), margin(margin) {}
+
+int32_t SweepAndPrune::createProxy(const AABB &aabb, Body *body)
+{
+    int32_t index;
+    if (nextFree != AABBLinks::null) {
+        index = nextFree;
+        nextFree = proxies[index].next;
+    } else {
+        index = proxies.size();
+        proxies.emplace_back();
+    }
+
+    Proxy &proxy = proxies[index];
+    proxy.aabb = aabb.expand(margin);
+    proxy.body = body;
+    proxy.next = AABBLinks::null;
+    proxy.moved = true;
+
+    // The interval is filled in and sorted by the next sweep.
+    Interval interval;
+    interval.proxy = index;
+    sorted.push_back(interval);
+    inserted++;
+    return index;
+}
+
+void SweepAndPrune::moveProxy(int32_t proxy, const AABB &aabb, const Vec2f &displacement)
+{
+    if (AABBTree::refatten(proxies[proxy].aabb, aabb, margin, displacement))
+        proxies[proxy].moved = true;
+}
+
+void SweepAndPrune::destroyProxy(int32_t proxy)
+{
+    // The proxy is only freed once its interval has been removed,
+    // so that an id is never in the sorted list twice.
+    proxies[proxy].body = nullptr;
+    destroyed.push_back(proxy);
+}
+
+Body *SweepAndPrune::getProxyBody(int32_t proxy) const
+{
+    return proxies[proxy].body;
+}
+
+AABB SweepAndPrune::getFatAABB(int32_t proxy) const
+{
+    return proxies[proxy].aabb;
+}
+
+void SweepAndPrune::rayCastProxies(RayCastCallback *callback, const RayCastInput &input) const
+{
+    rayCastList(proxies, callback, input);
+}
+
+void SweepAndPrune::queryProxies(AABBCallback *callback, const AABB &aabb) const
+{
+    queryList(proxies, callback, aabb);
+}
+
+void SweepAndPrune::nearestProxies(NearestCallback *callback, const Vec2f &point, size_t k,
+                                   std::vector<std::pair<float, int32_t>> &nearest) const
+{
+    nearestList(proxies, callback, point, k, nearest);
+}
+
+bool SweepAndPrune::refreshIntervals()
+{
+    if (!destroyed.empty()) {
+        sorted.erase(std::remove_if(sorted.begin(), sorted.end(),
+                                    [this](const Interval &interval) {
+                                        return proxies[interval.proxy].body == nullptr;
+                                    }),
+                     sorted.end());
+        inserted = std::min(inserted, sorted.size());
+
+        for (auto index : destroyed) {
+            proxies[index].next = nextFree;
+            nextFree = index;
+        }
+        destroyed.clear();
+    }
+
+    // Track the spread of the proxy centers along each axis.
+    double sum[2] = {0, 0}, sumSquares[2] = {0, 0};
+    for (auto &interval : sorted) {
+        Proxy &proxy = proxies[interval.proxy];
+        const AABB &aabb = proxy.aabb;
+        interval.moved = proxy.moved;
+        proxy.moved = false;
+
+        if (axis == 0) {
+            interval.low = aabb.lowVertex.x;
+            interval.high = aabb.highVertex.x;
+            interval.otherLow = aabb.lowVertex.y;
+            interval.otherHigh = aabb.highVertex.y;
+        } else {
+            interval.low = aabb.lowVertex.y;
+            interval.high = aabb.highVertex.y;
+            interval.otherLow = aabb.lowVertex.x;
+            interval.otherHigh = aabb.highVertex.x;
+        }
+
+        const double center = interval.low + interval.high;
+        const double otherCenter = interval.otherLow + interval.otherHigh;
+        sum[0] += center;
+        sumSquares[0] += center * center;
+        sum[1] += otherCenter;
+        sumSquares[1] += otherCenter * otherCenter;
+    }
+
+    if (sorted.empty())
+        return false;
+
+    const double count = sorted.size();
+    const double variance = sumSquares[0] / count - (sum[0] / count) * (sum[0] / count);
+    const double otherVariance = sumSquares[1] / count - (sum[1] / count) * (sum[1] / count);
+    if (otherVariance <= axisHysteresis * variance)
+        return false;
+
+    // Most proxies are spread along the other axis, so fewer
+    // intervals will overlap if we sweep along it instead.
+    axis = 1 - axis;
+    for (auto &interval : sorted) {
+        std::swap(interval.low, interval.otherLow);
+        std::swap(interval.high, interval.otherHigh);
+    }
+    return true;
+}
+
+void SweepAndPrune::sortIntervals(bool resort)
+{
+    auto lower = [](const Interval &a, const Interval &b) {
+        return a.low < b.low;
+    };
+
+    if (resort || inserted > resortFraction * sorted.size()) {
+        std::sort(sorted.begin(), sorted.end(), lower);
+    } else {
+        // Proxies move only a little between steps, so every interval
+        // is already close to its place in the list.
+        for (size_t i = 1; i < sorted.size(); i++) {
+            if (!lower(sorted[i], sorted[i - 1]))
+                continue;
+
+            const Interval interval = sorted[i];
+            size_t j = i;
+            do {
+                sorted[j] = sorted[j - 1];
+                j--;
+            } while (j > 0 && lower(interval, sorted[j - 1]));
+            sorted[j] = interval;
+        }
+    }
+    inserted = 0;
+}
+
+void SweepAndPrune::findPairs()
+{
+    const bool resort = refreshIntervals();
+    sortIntervals(resort);
+
+    const size_t count = sorted.size();
+    for (size_t i = 0; i < count; i++) {
+        const Interval &a = sorted[i];
+        // Every later interval starts after this one does, so stop
+        // at the first one that starts after this one ends.
+        for (size_t j = i + 1; j < count && sorted[j].low < a.high; j++) {
+            const Interval &b = sorted[j];
+            if ((a.moved || b.moved) && a.low < b.high &&
+                a.otherLow < b.otherHigh && b.otherLow < a.otherHigh &&
+                shouldCollide(*proxies[a.proxy].body, *proxies[b.proxy].body))
+                collisions.add(a.proxy, b.proxy);
+        }
+    }
+}
+} /* namespace phy */
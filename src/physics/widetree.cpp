@@ -0,0 +1,195 @@
+#include "inc/physics/widetree.hpp"
+#include "inc/physics/aabbsimd.hpp"
+#include "inc/physics/growablestack.hpp"
+
+#include <algorithm>
+#include <limits>
+
+namespace phy {
+WideAABBTree::WideAABBTree() {}
+
+WideAABBTree::WideAABBTree(const AABBTree &tree)
+{
+    const int32_t root = tree.getRoot();
+    if (root == AABBNode::null)
+        return;
+
+    const auto source = tree.getNodes();
+    leafSlots.assign(source.size(), {AABBNode::null, AABBNode::null});
+    nodes.emplace_back();
+    parents.emplace_back(AABBNode::null, AABBNode::null);
+
+    // Each entry is a source branch, or the root leaf, and the wide
+    // node that its children are collapsed into.
+    std::vector<std::pair<int32_t, int32_t>> stack = {{root, 0}};
+    while (!stack.empty()) {
+        const auto entry = stack.back();
+        stack.pop_back();
+
+        std::vector<int32_t> children;
+        if (source[entry.first].isLeaf()) {
+            children.push_back(entry.first);
+        } else {
+            children.push_back(source[entry.first].leftChild);
+            children.push_back(source[entry.first].rightChild);
+        }
+        // Open the largest branch until the node is full.
+        while (children.size() < static_cast<size_t>(width)) {
+            auto largest = children.end();
+            for (auto child = children.begin(); child != children.end(); child++) {
+                if (source[*child].isLeaf())
+                    continue;
+                if (largest == children.end() ||
+                    source[*child].aabb.getArea() > source[*largest].aabb.getArea())
+                    largest = child;
+            }
+            if (largest == children.end())
+                break;
+            const int32_t branch = *largest;
+            *largest = source[branch].leftChild;
+            children.push_back(source[branch].rightChild);
+        }
+
+        nodes[entry.second].count = children.size();
+        for (int slot = 0; slot < width; slot++) {
+            if (slot >= static_cast<int>(children.size())) {
+                // Empty slots can never overlap anything.
+                const float inf = std::numeric_limits<float>::infinity();
+                setSlot(nodes[entry.second], slot, AABB({inf, inf}, {-inf, -inf}));
+                nodes[entry.second].children[slot] = AABBNode::null;
+                continue;
+            }
+
+            const int32_t child = children[slot];
+            setSlot(nodes[entry.second], slot, source[child].aabb);
+            if (source[child].isLeaf()) {
+                nodes[entry.second].children[slot] = ~child;
+                leafSlots[child] = {entry.second, slot};
+            } else {
+                const int32_t node = nodes.size();
+                nodes[entry.second].children[slot] = node;
+                nodes.emplace_back();
+                parents.emplace_back(entry.second, slot);
+                stack.emplace_back(child, node);
+            }
+        }
+    }
+    nodes.shrink_to_fit();
+}
+
+void WideAABBTree::setSlot(Node &node, int slot, const AABB &box)
+{
+    node.lowX[slot] = box.lowVertex.x;
+    node.lowY[slot] = box.lowVertex.y;
+    node.highX[slot] = box.highVertex.x;
+    node.highY[slot] = box.highVertex.y;
+}
+
+AABB WideAABBTree::getSlot(const Node &node, int slot)
+{
+    return {{node.lowX[slot], node.lowY[slot]}, {node.highX[slot], node.highY[slot]}};
+}
+
+AABB WideAABBTree::getBounds(const Node &node)
+{
+    AABB bounds = getSlot(node, 0);
+    for (int slot = 1; slot < node.count; slot++)
+        bounds = bounds.combine(getSlot(node, slot));
+    return bounds;
+}
+
+void WideAABBTree::setLeafAABB(int32_t leaf, const AABB &box)
+{
+    const auto slot = leafSlots[leaf];
+    setSlot(nodes[slot.first], slot.second, box);
+}
+
+void WideAABBTree::refit()
+{
+    if (nodes.empty())
+        return;
+
+    // Children always come after their parent, so one backward pass
+    // updates every branch after all of its children.
+    for (size_t i = nodes.size() - 1; i > 0; i--)
+        setSlot(nodes[parents[i].first], parents[i].second, getBounds(nodes[i]));
+}
+
+void WideAABBTree::findCollisions(AABBCallback *callback, const AABB &aabb) const
+{
+    if (nodes.empty())
+        return;
+
+    GrowableStack<int32_t, traversalStackSize> stack;
+    stack.push(0);
+    while (!stack.empty()) {
+        const Node &node = nodes[stack.pop()];
+        int mask = overlaps4(node.lowX, node.lowY, node.highX, node.highY, aabb);
+        mask &= (1 << node.count) - 1;
+        for (int slot = 0; mask; slot++, mask >>= 1) {
+            if (!(mask & 1))
+                continue;
+            const int32_t child = node.children[slot];
+            if (child >= 0)
+                stack.push(child);
+            else if (!callback->registerCollision(-1, ~child))
+                return;
+        }
+    }
+}
+
+void WideAABBTree::rayCast(RayCastCallback *callback, const RayCastInput &input) const
+{
+    if (nodes.empty())
+        return;
+
+    const Vec2f origin = input.p1;
+    const Vec2f direction = input.p2 - input.p1;
+    const Vec2f invDirection(1.0f / direction.x, 1.0f / direction.y);
+    RayCastInput clipped = input;
+
+    // Entries are child links, so a leaf is only reported once the
+    // nearer subtrees have been searched and the ray clipped.
+    struct Entry {
+        int32_t child;
+        float entry;
+    };
+    GrowableStack<Entry, traversalStackSize> stack;
+    stack.push({0, 0.0f});
+    while (!stack.empty()) {
+        const Entry top = stack.pop();
+        if (top.entry > clipped.maxFraction)
+            continue;
+
+        if (top.child < 0) {
+            const float fraction = callback->rayCastCallback(clipped, ~top.child);
+            if (fraction == 0.0f)
+                return;
+            if (fraction > 0.0f)
+                clipped.maxFraction = std::min(clipped.maxFraction, fraction);
+            continue;
+        }
+
+        const Node &node = nodes[top.child];
+        float entries[width];
+        int mask = intersectsRay4(node.lowX, node.lowY, node.highX, node.highY,
+                                  origin, invDirection, clipped.maxFraction, entries);
+        mask &= (1 << node.count) - 1;
+
+        // Push the farthest hit first so the nearest is searched first.
+        Entry hits[width];
+        int count = 0;
+        for (int slot = 0; slot < width; slot++) {
+            if (!(mask & (1 << slot)))
+                continue;
+            Entry hit = {node.children[slot], entries[slot]};
+            int i = count++;
+            for (; i > 0 && hits[i - 1].entry < hit.entry; i--)
+                hits[i] = hits[i - 1];
+            hits[i] = hit;
+        }
+        for (int i = 0; i < count; i++)
+            stack.push(hits[i]);
+    }
+}
+} /* namespace phy */
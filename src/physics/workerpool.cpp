@@ -0,0 +1,72 @@
+#include "inc/physics/workerpool.hpp"
+
+namespace phy {
+WorkerPool::WorkerPool(size_t threadCount)
+    : task(nullptr), taskCount(0), nextTask(0), batch(0), busy(0), stopping(false)
+{
+    for (size_t i = 1; i < threadCount; i++)
+        threads.emplace_back(&WorkerPool::workerLoop, this);
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto &thread : threads)
+        thread.join();
+}
+
+void WorkerPool::run(size_t count, const std::function<void(size_t)> &task_)
+{
+    // Waking the threads is not worth it for a single task.
+    if (threads.empty() || count <= 1) {
+        for (size_t i = 0; i < count; i++)
+            task_(i);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        task = &task_;
+        taskCount = count;
+        nextTask = 0;
+        busy = threads.size();
+        batch++;
+    }
+    wake.notify_all();
+    runTasks();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [this]() { return busy == 0; });
+    task = nullptr;
+}
+
+void WorkerPool::workerLoop()
+{
+    size_t lastBatch = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this, lastBatch]() { return stopping || batch != lastBatch; });
+            if (stopping)
+                return;
+            lastBatch = batch;
+        }
+        runTasks();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--busy == 0)
+                finished.notify_one();
+        }
+    }
+}
+
+void WorkerPool::runTasks()
+{
+    for (size_t i = nextTask++; i < taskCount; i = nextTask++)
+        (*task)(i);
+}
+} /* namespace phy */
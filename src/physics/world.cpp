@@ -4,22 +4,43 @@
 #include "inc/threadmanager.hpp"
 
 #include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
 #include <iostream>
 
 namespace phy {
 
-World::World(const Vec2f &gravity_, ThreadManager *manager)
+World::World(const Vec2f &gravity_, ThreadManager *manager, BroadPhaseType broadPhaseType)
     : gravity(gravity_), threadManager(manager), velocityIterations(10), positionIterations(10),
-      lastTicks(SDL_GetTicks()) {}
+      allowSleeping(true), lastTicks(SDL_GetTicks()), broadPhase(makeBroadPhase(broadPhaseType)),
+      contactManager(*broadPhase), profile() {}
 
 World::~World() = default;
 
 std::weak_ptr<Body> World::createBody(const BodySpec &spec)
+{
+    auto bodyPtr = makeBody(spec);
+    broadPhase->addNewBody(bodyPtr);
+    return bodyPtr;
+}
+
+std::vector<std::weak_ptr<Body>> World::createBodies(const std::vector<BodySpec> &specs)
+{
+    std::vector<std::shared_ptr<Body>> created;
+    created.reserve(specs.size());
+    for (const auto &spec : specs)
+        created.push_back(makeBody(spec));
+
+    broadPhase->addNewBodies(created);
+    return std::vector<std::weak_ptr<Body>>(created.begin(), created.end());
+}
+
+std::shared_ptr<Body> World::makeBody(const BodySpec &spec)
 {
     // TODO: Provide custom allocator to improve cache locality in vector and improve performance.
     auto bodyPtr = std::make_shared<Body>(spec);
     bodyList.push_back(bodyPtr);
-    broadPhase.addNewBody(bodyPtr);
     for (auto shape : spec.shapes) {
         auto shapeType = shape->getShapeType();
         if (shapeType == ShapeType::circle) {
@@ -36,7 +57,8 @@ void World::destroyBody(const std::weak_ptr<Body> &body)
 {
     auto result = std::find(std::begin(bodyList), std::end(bodyList), body.lock());
     if (result != std::end(bodyList)) {
-        broadPhase.deleteBody(body.lock());
+        contactManager.destroyBody(**result);
+        broadPhase->deleteBody(*result);
         bodyList.erase(result);
     }
 }
@@ -48,7 +70,50 @@ std::vector<std::weak_ptr<const Body>> World::getBodies() const
 
 std::unique_ptr<CollisionMessage> World::getCollisions()
 {
-    return std::make_unique<CollisionMessage>(broadPhase.getBodyCollisions());
+    return std::make_unique<CollisionMessage>(contactManager.takeBeganContacts(),
+                                              contactManager.takeEndedContacts());
+}
+
+ContactManager::BodyPairs World::getPersistingContacts() const
+{
+    return contactManager.getPersistingContacts();
+}
+
+bool World::rayCast(const Vec2f &p1, const Vec2f &p2, RayCastHit &hit) const
+{
+    bool found = false;
+    rayCast(p1, p2, [&hit, &found](const RayCastHit &candidate) {
+        hit = candidate;
+        found = true;
+        return candidate.fraction;
+    });
+    return found;
+}
+
+void World::rayCast(const Vec2f &p1, const Vec2f &p2,
+                    const std::function<float(const RayCastHit &)> &callback) const
+{
+    broadPhase->rayCast(callback, {p1, p2, 1.0f});
+}
+
+void World::queryAABB(const AABB &aabb, std::vector<Body *> &bodies) const
+{
+    broadPhase->query(aabb, bodies);
+}
+
+void World::queryPoint(const Vec2f &point, std::vector<Body *> &bodies) const
+{
+    broadPhase->queryPoint(point, bodies);
+}
+
+void World::nearest(size_t k, const Vec2f &position, std::vector<Body *> &bodies) const
+{
+    broadPhase->nearest(k, position, bodies);
+}
+
+void World::compact()
+{
+    contactManager.remapProxies(broadPhase->compact());
 }
 
 float World::updateTime()
@@ -59,24 +124,74 @@ float World::updateTime()
     return dt;
 }
 
+namespace {
+float millisecondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * Find the root of an island in a union-find forest, halving the path
+ * on the way.
+ */
+int32_t findIsland(std::vector<int32_t> &parents, int32_t index)
+{
+    while (parents[index] != index) {
+        parents[index] = parents[parents[index]];
+        index = parents[index];
+    }
+    return index;
+}
+} /* namespace */
+
 void World::step()
 {
     if (lastPause.first)
         return;
 
-    const float dt = updateTime();
+    step(updateTime());
+}
+
+void World::step(float dt)
+{
+    const auto stepStart = std::chrono::steady_clock::now();
 
-    // TODO: Update all contacts
     // Integrate velocities
-    for (const auto body : bodyList)
-        body->updateVelocity(dt, gravity);
+    for (const auto &body : bodyList)
+        if (!body->asleep)
+            body->updateVelocity(dt, gravity);
+
+    // Resolve velocity constraints
+    auto start = std::chrono::steady_clock::now();
+    contactSolver.initialize(contactManager.getContacts());
+    contactSolver.warmStart();
+    for (uint8_t i = 0; i < velocityIterations; i++)
+        contactSolver.solveVelocityConstraints();
+    contactSolver.storeImpulses();
+    profile.solveVelocity = millisecondsSince(start);
+    profile.contacts = contactSolver.getConstraintCount();
 
-    // TODO: Resolve velocity constraints
     // Integrate positions
-    for (const auto body : bodyList) {
-        if (!body->getExtraData()->colliding) {
+    for (const auto &body : bodyList)
+        if (!body->asleep)
             body->updatePosition(dt);
-            broadPhase.updateBody(body);
+
+    // Push apart the shapes that still overlap
+    start = std::chrono::steady_clock::now();
+    profile.positionIterations = 0;
+    while (profile.positionIterations < positionIterations) {
+        profile.positionIterations++;
+        if (contactSolver.solvePositionConstraints())
+            break;
+    }
+    profile.solvePosition = millisecondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    for (const auto &body : bodyList) {
+        if (!body->asleep) {
+            body->synchronizeTransform();
+            contactManager.destroyProxies(body->staleProxies);
+            broadPhase->updateBody(body, body->bodySweep.center - body->bodySweep.center0);
         }
         auto expand = &body->getExtraData()->expanding;
         if (*expand) {
@@ -85,11 +200,71 @@ void World::step()
         }
     }
 
-    broadPhase.updatePairs();
+    // Find new pairs, then run the narrowphase on every pair so that
+    // only shapes that actually touch are reported and solved in the
+    // next step.
+    broadPhase->updatePairs();
+    contactManager.update();
+    profile.collide = millisecondsSince(start);
+
+    if (allowSleeping)
+        updateSleep(dt);
 
     // Clear forces
     for (const auto &body : bodyList)
        body->clearForces();
+    profile.step = millisecondsSince(stepStart);
+}
+
+void World::updateSleep(float dt)
+{
+    const float linearTolerance = linearSleepTolerance * linearSleepTolerance;
+    islandParents.resize(bodyList.size());
+    for (size_t i = 0; i < bodyList.size(); i++) {
+        Body &body = *bodyList[i];
+        body.islandIndex = i;
+        islandParents[i] = i;
+        if (body.bodyType != BodyType::dynamicBody || body.asleep)
+            continue;
+        if (body.linearVelocity.length() > linearTolerance
+            || std::abs(body.angularVelocity) > angularSleepTolerance)
+            body.sleepTime = 0.0f;
+        else
+            body.sleepTime += dt;
+    }
+
+    for (const auto &contact : contactManager.getContacts()) {
+        const Body &a = *contact.bodyA;
+        const Body &b = *contact.bodyB;
+        if (contact.isTouching() && a.bodyType == BodyType::dynamicBody
+            && b.bodyType == BodyType::dynamicBody)
+            islandParents[findIsland(islandParents, a.islandIndex)] =
+                findIsland(islandParents, b.islandIndex);
+    }
+
+    // An island can sleep once the body that moved last has been still
+    // for long enough. Sleeping bodies do not hold it back, so an island
+    // that is asleep stays asleep until an awake body joins it.
+    islandSleepTimes.assign(bodyList.size(), std::numeric_limits<float>::max());
+    for (const auto &body : bodyList) {
+        if (body->bodyType != BodyType::dynamicBody || body->asleep)
+            continue;
+        float &islandTime = islandSleepTimes[findIsland(islandParents, body->islandIndex)];
+        islandTime = std::min(islandTime, body->sleepTime);
+    }
+    for (const auto &body : bodyList) {
+        if (body->bodyType != BodyType::dynamicBody)
+            continue;
+        if (islandSleepTimes[findIsland(islandParents, body->islandIndex)] >= timeToSleep)
+            body->setSleep();
+        else
+            body->setAwake();
+    }
+}
+
+const StepProfile &World::getProfile() const
+{
+    return profile;
 }
 
 void World::setGravity(const Vec2f &gravity_)
@@ -112,6 +287,14 @@ void World::setPositionIterations(uint8_t iterations)
     positionIterations = iterations;
 }
 
+void World::setAllowSleeping(bool allow)
+{
+    allowSleeping = allow;
+    if (!allow)
+        for (const auto &body : bodyList)
+            body->setAwake();
+}
+
 std::unique_ptr<RenderMessage> World::getObjects()
 {
     using Polygons = RenderMessage::ShapeList<PolygonShape>;
@@ -1,7 +1,11 @@
+#include <algorithm>
 #include <cstdlib>
 #include <iostream>
+#include <random>
+#include <set>
 #include "gtest/gtest.h"
 #include "inc/physics/aabb.hpp"
+#include "inc/physics/aabbsimd.hpp"
 
 using namespace phy;
 using namespace std;
@@ -206,3 +210,485 @@ TEST_F(AABBTreeTest, ShouldSupportFindCollisionsOne)
     this->tree.findCollisions(&callback, aabb);
     EXPECT_EQ(1, callback.count);
 }
+
+TEST(FatAABBTreeTest, ShouldFattenInsertedAABB)
+{
+    AABBTree tree(10, 1.0f);
+    AABB box({0, 0}, {1, 1});
+    auto index = tree.insertAABB(box);
+    EXPECT_EQ(AABB({-1, -1}, {2, 2}), tree[index]);
+}
+
+TEST(FatAABBTreeTest, ShouldNotReinsertInsideFatAABB)
+{
+    AABBTree tree(10, 1.0f);
+    tree.insertAABB(AABB({5, 5}, {6, 6}));
+    auto index = tree.insertAABB(AABB({0, 0}, {1, 1}));
+    auto before = tree.getNodes();
+
+    EXPECT_FALSE(tree.updateAABB(index, AABB({0.5, 0.5}, {1.5, 1.5})));
+    auto after = tree.getNodes();
+    EXPECT_EQ(before[index].aabb, after[index].aabb);
+    EXPECT_EQ(before[index].parent, after[index].parent);
+}
+
+TEST(FatAABBTreeTest, ShouldReinsertOutsideFatAABB)
+{
+    AABBTree tree(10, 1.0f);
+    tree.insertAABB(AABB({5, 5}, {6, 6}));
+    auto index = tree.insertAABB(AABB({0, 0}, {1, 1}));
+
+    auto newAABB = AABB({3, 0}, {4, 1});
+    EXPECT_TRUE(tree.updateAABB(index, newAABB));
+    EXPECT_TRUE(tree[index].contains(newAABB));
+}
+
+TEST(FatAABBTreeTest, ShouldExtendInDirectionOfMotion)
+{
+    AABBTree tree(10, 1.0f);
+    auto index = tree.insertAABB(AABB({0, 0}, {1, 1}));
+
+    EXPECT_TRUE(tree.updateAABB(index, AABB({3, 0}, {4, 1}), Vec2f(3, -1)));
+    auto extra = AABBTree::displacementMultiplier;
+    EXPECT_EQ(AABB({2, -1 - extra}, {5 + 3 * extra, 2}), tree[index]);
+}
+
+TEST_F(AABBTest, ShouldNotOverlapWhenDisjoint)
+{
+    AABB a = {{0, 0}, {1, 1}};
+    AABB b = {{5, 0}, {6, 1}};
+    EXPECT_FALSE(a.overlaps(b));
+    EXPECT_FALSE(b.overlaps(a));
+}
+
+TEST(AABBSimdTest, ShouldMatchScalarOverlaps)
+{
+    srand(time(nullptr));
+    auto random = [] { return static_cast<float>(rand() % 100); };
+    auto randomBox = [&random] {
+        Vec2f low(random(), random());
+        return AABB(low, low + Vec2f(1 + rand() % 30, 1 + rand() % 30));
+    };
+
+    for (int trial = 0; trial < 100; trial++) {
+        AABB query = randomBox();
+        AABB boxes[8];
+        float lowX[8], lowY[8], highX[8], highY[8];
+        int expected = 0;
+        for (int i = 0; i < 8; i++) {
+            boxes[i] = randomBox();
+            lowX[i] = boxes[i].lowVertex.x;
+            lowY[i] = boxes[i].lowVertex.y;
+            highX[i] = boxes[i].highVertex.x;
+            highY[i] = boxes[i].highVertex.y;
+            expected |= boxes[i].overlaps(query) << i;
+        }
+
+        EXPECT_EQ(expected & 0x3, overlaps2(lowX[0], lowY[0], highX[0], highY[0],
+                                            lowX[1], lowY[1], highX[1], highY[1], query));
+        EXPECT_EQ(expected & 0xF, overlaps4(lowX, lowY, highX, highY, query));
+        EXPECT_EQ(expected, overlaps8(lowX, lowY, highX, highY, query));
+    }
+}
+
+TEST(AABBSimdTest, ShouldMatchScalarRayTests)
+{
+    float lowX[4] = {1, 5, 0, 2}, lowY[4] = {1, 0, 3, 2};
+    float highX[4] = {3, 6, 4, 2}, highY[4] = {3, 1, 4, 8};
+    // Diagonal, axis aligned and zero rays, some starting on box edges.
+    const RayCastInput rays[] = {{Vec2f(0, 0), Vec2f(10, 10), 1.0f},
+                                 {Vec2f(0, 2), Vec2f(10, 2), 0.5f},
+                                 {Vec2f(2, -5), Vec2f(2, 10), 1.0f},
+                                 {Vec2f(1, 0), Vec2f(1, 10), 1.0f},
+                                 {Vec2f(2, 2), Vec2f(2, 2), 1.0f}};
+    for (const auto &ray : rays) {
+        const Vec2f direction = ray.p2 - ray.p1;
+        const Vec2f invDirection(1.0f / direction.x, 1.0f / direction.y);
+        int expected = 0;
+        float expectedEntry[4], entry[4];
+        for (int i = 0; i < 4; i++) {
+            const AABB box({lowX[i], lowY[i]}, {highX[i], highY[i]});
+            expected |= box.intersectsRay(ray.p1, invDirection, ray.maxFraction,
+                                          expectedEntry[i]) << i;
+        }
+
+        EXPECT_EQ(expected, intersectsRay4(lowX, lowY, highX, highY, ray.p1,
+                                           invDirection, ray.maxFraction, entry));
+        for (int i = 0; i < 4; i++) {
+            if (expected & (1 << i)) {
+                EXPECT_FLOAT_EQ(expectedEntry[i], entry[i]);
+            }
+        }
+    }
+}
+
+/* Check that every branch reachable from the root tightly contains its
+ * children and return the number of leaves. */
+static int validateTree(const std::vector<AABBNode> &nodes, int32_t leaf)
+{
+    int32_t root = leaf;
+    while (nodes[root].parent != AABBNode::null)
+        root = nodes[root].parent;
+
+    int leaves = 0;
+    std::vector<int32_t> stack = {root};
+    while (!stack.empty()) {
+        int32_t index = stack.back();
+        stack.pop_back();
+        const auto &node = nodes[index];
+        if (node.isLeaf()) {
+            EXPECT_EQ(0, node.height);
+            leaves++;
+            continue;
+        }
+
+        const auto &left = nodes[node.leftChild];
+        const auto &right = nodes[node.rightChild];
+        EXPECT_EQ(index, left.parent);
+        EXPECT_EQ(index, right.parent);
+        EXPECT_EQ(left.aabb.combine(right.aabb), node.aabb);
+        EXPECT_EQ(1 + std::max(left.height, right.height), node.height);
+        EXPECT_EQ(left.moved || right.moved, node.moved);
+        stack.push_back(node.leftChild);
+        stack.push_back(node.rightChild);
+    }
+    return leaves;
+}
+
+static std::vector<AABB> randomBoxes(int count)
+{
+    std::vector<AABB> boxes;
+    for (int i = 0; i < count; i++) {
+        Vec2f low(rand() % 1000, rand() % 1000);
+        boxes.emplace_back(low, low + Vec2f(1 + rand() % 20, 1 + rand() % 20));
+    }
+    return boxes;
+}
+
+TEST_F(AABBTreeTest, ShouldBuildFromManyAABB)
+{
+    auto boxes = randomBoxes(1000);
+    auto proxies = this->tree.build(boxes);
+    ASSERT_EQ(boxes.size(), proxies.size());
+
+    auto nodes = this->tree.getNodes();
+    EXPECT_EQ(1000, validateTree(nodes, proxies[0]));
+    for (size_t i = 0; i < boxes.size(); i++) {
+        EXPECT_TRUE(nodes[proxies[i]].isLeaf());
+        EXPECT_EQ(boxes[i], nodes[proxies[i]].aabb);
+    }
+
+    auto query = AABB({200, 200}, {400, 300});
+    int expected = 0;
+    for (const auto &box : boxes)
+        expected += box.overlaps(query);
+
+    TestCallback callback(true);
+    this->tree.findCollisions(&callback, query);
+    EXPECT_EQ(expected, callback.count);
+}
+
+TEST_F(AABBTreeTest, ShouldBuildIntoExistingTree)
+{
+    auto first = this->tree.insertAABB(AABB({0, 0}, {1, 1}));
+    auto second = this->tree.insertAABB(AABB({5, 5}, {6, 6}));
+    auto proxies = this->tree.build(randomBoxes(100));
+
+    auto nodes = this->tree.getNodes();
+    EXPECT_EQ(102, validateTree(nodes, proxies[0]));
+    EXPECT_EQ(AABB({0, 0}, {1, 1}), nodes[first].aabb);
+    EXPECT_EQ(AABB({5, 5}, {6, 6}), nodes[second].aabb);
+}
+
+TEST_F(AABBTreeTest, ShouldBuildCheaperTreeThanInsertion)
+{
+    auto boxes = randomBoxes(2000);
+    AABBTree incremental;
+    for (const auto &box : boxes)
+        incremental.insertAABB(box);
+
+    this->tree.build(boxes);
+    EXPECT_LT(this->tree.getTreeCost(), incremental.getTreeCost());
+}
+
+struct PairCallback : public AABBCallback {
+    std::vector<std::pair<int32_t, int32_t>> pairs;
+    virtual bool registerCollision(int32_t nodeA, int32_t nodeB) override
+    {
+        pairs.emplace_back(nodeA, nodeB);
+        return true;
+    }
+};
+
+/**
+ * Move every stride-th of count boxes and compare the moved pairs
+ * against a query for each moved box.
+ */
+static void checkMovedPairs(int count, int stride)
+{
+    AABBTree fatTree(10, 1.0f);
+    auto boxes = randomBoxes(count);
+    std::vector<int32_t> proxies;
+    for (const auto &box : boxes)
+        proxies.push_back(fatTree.insertAABB(box));
+
+    PairCallback initial;
+    fatTree.findMovedCollisions(&initial);
+
+    // Move boxes far enough to leave their fat AABB.
+    std::vector<int32_t> moved;
+    for (size_t i = 0; i < proxies.size(); i += stride) {
+        Vec2f offset(rand() % 30, rand() % 30);
+        AABB box(boxes[i].lowVertex + offset, boxes[i].highVertex + offset);
+        if (fatTree.updateAABB(proxies[i], box))
+            moved.push_back(proxies[i]);
+    }
+    EXPECT_EQ(count, validateTree(fatTree.getNodes(), proxies[0]));
+
+    // The reference is a query for every moved proxy.
+    PairCallback queries;
+    for (auto index : moved)
+        fatTree.findCollisions(&queries, index);
+    std::set<std::pair<int32_t, int32_t>> expected;
+    for (const auto &p : queries.pairs)
+        expected.emplace(std::min(p.first, p.second), std::max(p.first, p.second));
+
+    PairCallback traversal;
+    fatTree.findMovedCollisions(&traversal);
+    std::set<std::pair<int32_t, int32_t>> found(traversal.pairs.begin(), traversal.pairs.end());
+    EXPECT_EQ(expected.size(), traversal.pairs.size());
+    EXPECT_EQ(expected, found);
+    for (const auto &p : traversal.pairs)
+        EXPECT_LT(p.first, p.second);
+
+    // Nothing moved since the last search.
+    PairCallback again;
+    fatTree.findMovedCollisions(&again);
+    EXPECT_EQ(0u, again.pairs.size());
+}
+
+TEST_F(AABBTreeTest, ShouldFindMovedPairsOnce)
+{
+    // Few enough to query each moved leaf on its own.
+    checkMovedPairs(300, 7);
+    // Enough to descend the tree against itself.
+    checkMovedPairs(3000, 2);
+}
+
+TEST_F(AABBTreeTest, ShouldFindAllPairsAfterInsertion)
+{
+    auto boxes = randomBoxes(200);
+    for (const auto &box : boxes)
+        this->tree.insertAABB(box);
+
+    int expected = 0;
+    for (size_t i = 0; i < boxes.size(); i++) {
+        for (size_t j = i + 1; j < boxes.size(); j++)
+            expected += boxes[i].overlaps(boxes[j]);
+    }
+
+    PairCallback callback;
+    this->tree.findMovedCollisions(&callback);
+    EXPECT_EQ(expected, callback.pairs.size());
+}
+
+TEST_F(AABBTest, ShouldIntersectRays)
+{
+    AABB box = {{1, 1}, {3, 3}};
+    Vec2f origin(0, 2);
+    Vec2f invDirection(1.0f / 4, 1.0f / 0.0f);
+    float entry;
+    EXPECT_TRUE(box.intersectsRay(origin, invDirection, 1.0f, entry));
+    EXPECT_FLOAT_EQ(0.25f, entry);
+    EXPECT_FALSE(box.intersectsRay(origin, invDirection, 0.2f, entry));
+    // Parallel to the box, but outside of it.
+    EXPECT_FALSE(box.intersectsRay(Vec2f(0, 4), invDirection, 1.0f, entry));
+}
+
+struct RayCallback : public RayCastCallback {
+    std::vector<int32_t> leaves;
+    float clipTo;
+    RayCallback(float clip)
+        : clipTo(clip) {}
+    virtual float rayCastCallback(const RayCastInput &input, int32_t index) override
+    {
+        leaves.push_back(index);
+        return clipTo < 0 ? input.maxFraction : clipTo;
+    }
+};
+
+TEST_F(AABBTreeTest, ShouldRayCastLeaves)
+{
+    // A row of boxes along the x axis and one off to the side.
+    std::vector<int32_t> row;
+    for (int i = 0; i < 10; i++)
+        row.push_back(this->tree.insertAABB(AABB({i * 10.0f, 0}, {i * 10.0f + 5, 5})));
+    this->tree.insertAABB(AABB({0, 50}, {5, 55}));
+
+    RayCallback all(-1);
+    this->tree.rayCast(&all, {Vec2f(-10, 2), Vec2f(200, 2), 1.0f});
+    std::set<int32_t> found(all.leaves.begin(), all.leaves.end());
+    EXPECT_EQ(std::set<int32_t>(row.begin(), row.end()), found);
+    // The nearer child is always searched first.
+    EXPECT_EQ(row, all.leaves);
+
+    // Clipping the ray at the first leaf skips every leaf behind it.
+    RayCallback nearest(0.06f);
+    this->tree.rayCast(&nearest, {Vec2f(-10, 2), Vec2f(200, 2), 1.0f});
+    ASSERT_EQ(1u, nearest.leaves.size());
+    EXPECT_EQ(row[0], nearest.leaves[0]);
+}
+
+TEST_F(AABBTest, ShouldMeasureDistanceToPoints)
+{
+    AABB box = {{1, 1}, {3, 3}};
+    EXPECT_FLOAT_EQ(0.0f, box.distanceSquared(Vec2f(2, 2)));
+    EXPECT_FLOAT_EQ(1.0f, box.distanceSquared(Vec2f(2, 4)));
+    EXPECT_FLOAT_EQ(2.0f, box.distanceSquared(Vec2f(0, 0)));
+}
+
+struct NearestLeaves : public NearestCallback {
+    const AABBTree *tree;
+    Vec2f point;
+    int32_t skipped;
+    virtual float leafDistance(int32_t index) override
+    {
+        return index == skipped ? -1.0f : tree->getFatAABB(index).distanceSquared(point);
+    }
+};
+
+TEST_F(AABBTreeTest, ShouldFindNearestLeaves)
+{
+    std::mt19937 gen(3);
+    std::uniform_real_distribution<float> position(-100, 100);
+    std::vector<int32_t> leaves;
+    for (int i = 0; i < 200; i++) {
+        const Vec2f low(position(gen), position(gen));
+        leaves.push_back(this->tree.insertAABB(AABB(low, low + Vec2f(2, 2))));
+    }
+
+    NearestLeaves callback;
+    callback.tree = &this->tree;
+    callback.point = Vec2f(10, -20);
+    callback.skipped = leaves[0];
+
+    // Compare against the distance to every leaf.
+    std::vector<std::pair<float, int32_t>> expected;
+    for (auto leaf : leaves)
+        if (leaf != callback.skipped)
+            expected.emplace_back(callback.leafDistance(leaf), leaf);
+    std::sort(expected.begin(), expected.end());
+    expected.resize(5);
+
+    std::vector<std::pair<float, int32_t>> nearest;
+    this->tree.findNearest(&callback, callback.point, 5, nearest);
+    ASSERT_EQ(5u, nearest.size());
+    for (size_t i = 0; i < nearest.size(); i++)
+        EXPECT_FLOAT_EQ(expected[i].first, nearest[i].first);
+
+    // Asking for more leaves than there are returns every leaf.
+    nearest.clear();
+    this->tree.findNearest(&callback, callback.point, 1000, nearest);
+    EXPECT_EQ(leaves.size() - 1, nearest.size());
+}
+
+TEST_F(AABBTreeTest, ShouldLowerCostWhenOptimized)
+{
+    // Leaves drifting across the world leave an incremental tree
+    // balanced but with a far larger cost than needed.
+    AABBTree fatTree(10, 1.0f);
+    auto boxes = randomBoxes(1000);
+    std::vector<int32_t> leaves;
+    for (const auto &box : boxes)
+        leaves.push_back(fatTree.insertAABB(box));
+    for (int frame = 0; frame < 20; frame++) {
+        for (size_t i = 0; i < boxes.size(); i++) {
+            const Vec2f offset(((i * 7) % 11) - 5.0f, ((i * 3) % 13) - 6.0f);
+            boxes[i] = AABB(boxes[i].lowVertex + offset, boxes[i].highVertex + offset);
+            fatTree.updateAABB(leaves[i], boxes[i], offset);
+        }
+    }
+
+    const float cost = fatTree.getTreeCost();
+    size_t rotations = 0;
+    for (int i = 0; i < 100; i++)
+        rotations += fatTree.optimize(100);
+    EXPECT_GT(rotations, 0u);
+    EXPECT_LT(fatTree.getTreeCost(), cost);
+
+    auto nodes = fatTree.getNodes();
+    EXPECT_EQ(1000, validateTree(nodes, leaves[0]));
+    for (size_t i = 0; i < leaves.size(); i++)
+        EXPECT_TRUE(fatTree.getFatAABB(leaves[i]).contains(boxes[i]));
+}
+
+TEST_F(AABBTreeTest, ShouldMeasureBalance)
+{
+    EXPECT_EQ(0, this->tree.getMaxBalance());
+
+    // Three boxes close together and one far away. The build splits the
+    // far box off first, so the root has a leaf on one side and a
+    // subtree of height 2 on the other.
+    std::vector<AABB> boxes;
+    for (float x : {0.0f, 2.0f, 4.0f, 100.0f})
+        boxes.push_back({{x, 0}, {x + 1, 1}});
+    this->tree.build(boxes);
+    ASSERT_EQ(3, this->tree.getNodes()[this->tree.getRoot()].height);
+    EXPECT_EQ(2, this->tree.getMaxBalance());
+
+    // Two evenly spaced pairs give both children of the root height 1.
+    AABBTree even;
+    even.build({{{0, 0}, {1, 1}}, {{2, 0}, {3, 1}}, {{100, 0}, {101, 1}}, {{102, 0}, {103, 1}}});
+    ASSERT_EQ(2, even.getNodes()[even.getRoot()].height);
+    EXPECT_EQ(0, even.getMaxBalance());
+}
+
+TEST_F(AABBTreeTest, ShouldCompactIntoDepthFirstOrder)
+{
+    auto boxes = randomBoxes(500);
+    std::vector<int32_t> leaves;
+    for (const auto &box : boxes)
+        leaves.push_back(this->tree.insertAABB(box));
+    // Free every other leaf so the pool is full of holes.
+    for (size_t i = 0; i < leaves.size(); i += 2)
+        this->tree.destroyAABB(leaves[i]);
+
+    const size_t oldCapacity = this->tree.getCapacity();
+    const auto remap = this->tree.compact();
+    ASSERT_EQ(oldCapacity, remap.size());
+    EXPECT_EQ(2 * 250u - 1, this->tree.getCapacity());
+
+    auto nodes = this->tree.getNodes();
+    EXPECT_EQ(AABBNode::null, nodes[0].parent);
+    EXPECT_EQ(250, validateTree(nodes, 0));
+    for (size_t i = 0; i < leaves.size(); i++) {
+        if (i % 2 == 0) {
+            EXPECT_EQ(AABBNode::null, remap[leaves[i]]);
+            continue;
+        }
+        EXPECT_TRUE(nodes[remap[leaves[i]]].isLeaf());
+        EXPECT_EQ(boxes[i], nodes[remap[leaves[i]]].aabb);
+    }
+    // The left child of every branch directly follows it.
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (!nodes[i].isLeaf()) {
+            EXPECT_EQ(static_cast<int32_t>(i + 1), nodes[i].leftChild);
+        }
+    }
+
+    // The tree can still grow afterwards.
+    for (const auto &box : randomBoxes(10))
+        this->tree.insertAABB(box);
+    EXPECT_EQ(260, validateTree(this->tree.getNodes(), 0));
+}
+
+TEST_F(AABBTreeTest, ShouldCompactEmptyTree)
+{
+    auto leaf = this->tree.insertAABB(AABB({0, 0}, {1, 1}));
+    this->tree.destroyAABB(leaf);
+    this->tree.compact();
+    EXPECT_EQ(1u, this->tree.getCapacity());
+
+    leaf = this->tree.insertAABB(AABB({0, 0}, {1, 1}));
+    EXPECT_EQ(1, validateTree(this->tree.getNodes(), leaf));
+}
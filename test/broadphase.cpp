@@ -1,26 +1,615 @@
 #include "inc/physics/broadphase.hpp"
+#include "inc/physics/contact.hpp"
+#include "inc/physics/spatialhash.hpp"
+#include "inc/physics/sweepandprune.hpp"
 
+#include <algorithm>
 #include <iostream>
+#include <random>
+#include <set>
 #include "gtest/gtest.h"
 
 using namespace phy;
 using namespace std;
 
+template <typename T>
 class BroadPhaseTest : public ::testing::Test {
-    BroadPhase bp;
+protected:
+    T bp;
+    ContactManager contacts;
+
+    BroadPhaseTest() : contacts(bp) {}
+
+    /**
+     * Find the new pairs and run the narrowphase on them, like World::step().
+     */
+    void update()
+    {
+        bp.updatePairs();
+        contacts.update();
+    }
+
+    /**
+     * Make a dynamic body with a single 2x2 box centered on a position.
+     */
+    static shared_ptr<Body> makeBox(const Vec2f &position, const Filter &filter = Filter(),
+                                    BodyType type = BodyType::dynamicBody)
+    {
+        BodySpec spec;
+        spec.bodyType = type;
+        spec.position = position;
+        spec.filter = filter;
+        auto body = make_shared<Body>(spec);
+        PolygonShape box(1.0f);
+        box.setBox(Vec2f(1, 1));
+        body->addShape(box);
+        return body;
+    }
+
+    static bool samePair(const pair<weak_ptr<Body>, weak_ptr<Body>> &found,
+                         const shared_ptr<Body> &a, const shared_ptr<Body> &b)
+    {
+        auto first = found.first.lock(), second = found.second.lock();
+        return (first == a && second == b) || (first == b && second == a);
+    }
 };
 
-TEST_F(BroadPhaseTest, ShouldSupportInsertion)
+typedef ::testing::Types<BroadPhase, SweepAndPrune, SpatialHash> BroadPhaseTypes;
+TYPED_TEST_CASE(BroadPhaseTest, BroadPhaseTypes);
+
+TYPED_TEST(BroadPhaseTest, ShouldSupportInsertion)
+{
+    auto a = this->makeBox(Vec2f(0, 0));
+    auto b = this->makeBox(Vec2f(1, 1));
+    auto c = this->makeBox(Vec2f(100, 100));
+    this->bp.addNewBody(a);
+    this->bp.addNewBodies({b, c});
+    this->bp.updatePairs();
+
+    auto pairs = this->bp.getBodyCollisions();
+    ASSERT_EQ(1u, pairs.size());
+    EXPECT_TRUE(this->samePair(pairs[0], a, b));
+}
+
+TYPED_TEST(BroadPhaseTest, ShouldPairSmallBatchesWithExistingBodies)
+{
+    vector<shared_ptr<Body>> bodies;
+    for (int i = 0; i < 40; i++)
+        bodies.push_back(this->makeBox(Vec2f(10.0f * i, 0)));
+    this->bp.addNewBodies(bodies);
+    this->bp.updatePairs();
+    EXPECT_TRUE(this->bp.getBodyCollisions().empty());
+
+    // Too few bodies to rebuild the tree, so they are inserted into it.
+    auto a = this->makeBox(Vec2f(101, 0));
+    auto wall = this->makeBox(Vec2f(200, 1), Filter(), BodyType::staticBody);
+    this->bp.addNewBodies({a, wall});
+    this->bp.updatePairs();
+    auto pairs = this->bp.getBodyCollisions();
+    ASSERT_EQ(2u, pairs.size());
+    for (const auto &found : pairs)
+        EXPECT_TRUE(this->samePair(found, a, bodies[10]) ||
+                    this->samePair(found, wall, bodies[20]));
+}
+
+TYPED_TEST(BroadPhaseTest, ShouldSupportUpdating)
+{
+    auto a = this->makeBox(Vec2f(0, 0));
+    auto b = this->makeBox(Vec2f(50, 0));
+    this->bp.addNewBodies({a, b});
+    this->bp.updatePairs();
+    EXPECT_TRUE(this->bp.getBodyCollisions().empty());
+
+    b->setLinearVelocity(Vec2f(-49, 0));
+    b->updatePosition(1.0f);
+    this->bp.updateBody(b, Vec2f(-49, 0));
+    this->bp.updatePairs();
+
+    auto pairs = this->bp.getBodyCollisions();
+    ASSERT_EQ(1u, pairs.size());
+    EXPECT_TRUE(this->samePair(pairs[0], a, b));
+}
+
+TYPED_TEST(BroadPhaseTest, ShouldSupportDeletion)
+{
+    auto a = this->makeBox(Vec2f(0, 0));
+    auto b = this->makeBox(Vec2f(1, 0));
+    this->bp.addNewBodies({a, b});
+    this->bp.deleteBody(b);
+    this->bp.updatePairs();
+
+    EXPECT_TRUE(this->bp.getBodyCollisions().empty());
+}
+
+TYPED_TEST(BroadPhaseTest, ShouldDropPendingPairsOfDeletedBodies)
+{
+    auto a = this->makeBox(Vec2f(0, 0));
+    auto b = this->makeBox(Vec2f(1, 0));
+    this->bp.addNewBodies({a, b});
+    this->bp.updatePairs();
+    this->bp.deleteBody(b);
+    // The new body is given the deleted body's proxy, so a stale
+    // pending pair would now be reported against it.
+    auto c = this->makeBox(Vec2f(100, 0));
+    this->bp.addNewBody(c);
+
+    EXPECT_TRUE(this->bp.getBodyCollisions().empty());
+}
+
+TYPED_TEST(BroadPhaseTest, ShouldRemoveDestroyedShapes)
+{
+    auto a = this->makeBox(Vec2f(0, 0));
+    auto b = this->makeBox(Vec2f(50, 0));
+    PolygonShape reach(1.0f);
+    reach.setBox(Vec2f(1, 1), Vec2f(-49, 0), 0.0f);
+    auto shape = b->addShape(reach);
+    this->bp.addNewBodies({a, b});
+    this->bp.updatePairs();
+    ASSERT_EQ(1u, this->bp.getBodyCollisions().size());
+
+    b->destroyShape(shape);
+    this->bp.updateBody(b);
+    // Reinsert the other body so that it searches for pairs again.
+    this->bp.deleteBody(a);
+    this->bp.addNewBody(a);
+    this->bp.updatePairs();
+
+    EXPECT_TRUE(this->bp.getBodyCollisions().empty());
+}
+
+TYPED_TEST(BroadPhaseTest, ShouldReportContactTransitions)
+{
+    auto a = this->makeBox(Vec2f(0, 0));
+    // The fattened AABBs overlap, but the boxes do not touch yet.
+    auto b = this->makeBox(Vec2f(3, 0));
+    this->bp.addNewBodies({a, b});
+    this->update();
+    EXPECT_TRUE(this->contacts.takeBeganContacts().empty());
+
+    // Moving within the fattened AABB is not reported by the backend.
+    b->setLinearVelocity(Vec2f(-1.5f, 0));
+    b->updatePosition(1.0f);
+    this->bp.updateBody(b);
+    this->update();
+    auto began = this->contacts.takeBeganContacts();
+    ASSERT_EQ(1u, began.size());
+    EXPECT_TRUE(this->samePair(began[0], a, b));
+    EXPECT_TRUE(this->contacts.getPersistingContacts().empty());
+
+    this->update();
+    EXPECT_TRUE(this->contacts.takeBeganContacts().empty());
+    EXPECT_TRUE(this->contacts.takeEndedContacts().empty());
+    EXPECT_EQ(1u, this->contacts.getPersistingContacts().size());
+
+    b->setLinearVelocity(Vec2f(48.5f, 0));
+    b->updatePosition(1.0f);
+    this->bp.updateBody(b, Vec2f(48.5f, 0));
+    this->update();
+    auto ended = this->contacts.takeEndedContacts();
+    ASSERT_EQ(1u, ended.size());
+    EXPECT_TRUE(this->samePair(ended[0], a, b));
+    EXPECT_TRUE(this->contacts.getPersistingContacts().empty());
+}
+
+TYPED_TEST(BroadPhaseTest, ShouldOnlyReportTouchingShapes)
+{
+    auto makeCircle = [](const Vec2f &position) {
+        BodySpec spec;
+        spec.bodyType = BodyType::dynamicBody;
+        spec.position = position;
+        auto body = make_shared<Body>(spec);
+        body->addShape(CircleShape(1.0f, 1.0f));
+        return body;
+    };
+    auto a = this->makeBox(Vec2f(0, 0));
+    // The AABBs overlap at the corner of the box, but the circle does not.
+    auto b = makeCircle(Vec2f(1.8f, 1.8f));
+    this->bp.addNewBodies({a, b});
+    this->update();
+    EXPECT_TRUE(this->contacts.takeBeganContacts().empty());
+    ASSERT_EQ(1u, this->contacts.getContacts().size());
+    EXPECT_FALSE(this->contacts.getContacts()[0].isTouching());
+
+    b->setLinearVelocity(Vec2f(-0.5f, -0.5f));
+    b->updatePosition(1.0f);
+    this->bp.updateBody(b);
+    this->update();
+    auto began = this->contacts.takeBeganContacts();
+    ASSERT_EQ(1u, began.size());
+    EXPECT_TRUE(this->samePair(began[0], a, b));
+
+    const auto &contact = this->contacts.getContacts()[0];
+    ASSERT_TRUE(contact.isTouching());
+    EXPECT_EQ(Manifold::Type::polygonAndCircle, contact.manifold.type);
+    EXPECT_EQ(1, contact.manifold.pointCount);
+    EXPECT_NEAR(1.0f - sqrtf(2) * 0.3f, contact.manifold.depth, 1e-5f);
+}
+
+TYPED_TEST(BroadPhaseTest, ShouldEndContactsOfDeletedBodies)
+{
+    auto a = this->makeBox(Vec2f(0, 0));
+    auto b = this->makeBox(Vec2f(1, 0));
+    this->bp.addNewBodies({a, b});
+    this->update();
+    ASSERT_EQ(1u, this->contacts.takeBeganContacts().size());
+
+    this->contacts.destroyBody(*b);
+    this->bp.deleteBody(b);
+    auto ended = this->contacts.takeEndedContacts();
+    ASSERT_EQ(1u, ended.size());
+    EXPECT_TRUE(this->samePair(ended[0], a, b));
+}
+
+TYPED_TEST(BroadPhaseTest, ShouldFilterPairs)
+{
+    Filter player, projectile, wall;
+    player.categoryBits = 0x2;
+    player.groupIndex = -1;
+    projectile.categoryBits = 0x4;
+    projectile.maskBits = 0xFFFF & ~0x8;
+    projectile.groupIndex = -1;
+    wall.categoryBits = 0x8;
+
+    auto a = this->makeBox(Vec2f(0, 0), player);
+    auto b = this->makeBox(Vec2f(1, 0), projectile);
+    auto c = this->makeBox(Vec2f(1, 1), wall, BodyType::staticBody);
+    auto d = this->makeBox(Vec2f(0, 1), wall, BodyType::staticBody);
+    this->bp.addNewBodies({a, b, c, d});
+    this->bp.updatePairs();
+
+    // Only the player and the walls may collide.
+    auto pairs = this->bp.getBodyCollisions();
+    ASSERT_EQ(2u, pairs.size());
+    for (const auto &found : pairs)
+        EXPECT_TRUE(this->samePair(found, a, c) || this->samePair(found, a, d));
+
+    // A positive group overrides the masks.
+    Filter friendly = projectile;
+    friendly.groupIndex = 1;
+    Filter friendlyWall = wall;
+    friendlyWall.groupIndex = 1;
+    EXPECT_TRUE(friendly.shouldCollide(friendlyWall));
+    EXPECT_FALSE(projectile.shouldCollide(wall));
+}
+
+TYPED_TEST(BroadPhaseTest, ShouldPairStaticWithDynamicBodies)
+{
+    auto wall = this->makeBox(Vec2f(0, 0), Filter(), BodyType::staticBody);
+    auto floor = this->makeBox(Vec2f(1, 0), Filter(), BodyType::staticBody);
+    auto a = this->makeBox(Vec2f(50, 0));
+    this->bp.addNewBodies({wall, floor, a});
+    this->bp.updatePairs();
+    EXPECT_TRUE(this->bp.getBodyCollisions().empty());
+
+    a->setLinearVelocity(Vec2f(-48, 0));
+    a->updatePosition(1.0f);
+    this->bp.updateBody(a, Vec2f(-48, 0));
+    this->bp.updatePairs();
+    // The static bodies overlap, but are never paired.
+    auto pairs = this->bp.getBodyCollisions();
+    ASSERT_EQ(2u, pairs.size());
+    for (const auto &found : pairs)
+        EXPECT_TRUE(this->samePair(found, wall, a) || this->samePair(found, floor, a));
+
+    // A static body added later is tested against the dynamic ones.
+    auto b = this->makeBox(Vec2f(3, 1), Filter(), BodyType::staticBody);
+    this->bp.addNewBody(b);
+    this->bp.updatePairs();
+    pairs = this->bp.getBodyCollisions();
+    ASSERT_EQ(1u, pairs.size());
+    EXPECT_TRUE(this->samePair(pairs[0], b, a));
+}
+
+TYPED_TEST(BroadPhaseTest, ShouldRayCastShapes)
+{
+    auto wall = this->makeBox(Vec2f(20, 0), Filter(), BodyType::staticBody);
+    auto a = this->makeBox(Vec2f(10, 0));
+    auto b = this->makeBox(Vec2f(10, 5));
+    this->bp.addNewBodies({wall, a, b});
+
+    vector<RayCastHit> hits;
+    auto all = [&hits](const RayCastHit &hit) {
+        hits.push_back(hit);
+        return 1.0f;
+    };
+    this->bp.rayCast(all, {Vec2f(0, 0), Vec2f(30, 0), 1.0f});
+    ASSERT_EQ(2u, hits.size());
+
+    RayCastHit nearest;
+    nearest.fraction = 2.0f;
+    this->bp.rayCast([&nearest](const RayCastHit &hit) {
+        nearest = hit;
+        return hit.fraction;
+    }, {Vec2f(0, 0), Vec2f(30, 0), 1.0f});
+    EXPECT_EQ(a, nearest.body.lock());
+    EXPECT_FLOAT_EQ(0.3f, nearest.fraction);
+    EXPECT_FLOAT_EQ(9.0f, nearest.point.x);
+    EXPECT_FLOAT_EQ(-1.0f, nearest.normal.x);
+
+    // The fattened AABB of b is crossed, but its box is not.
+    hits.clear();
+    this->bp.rayCast(all, {Vec2f(0, 3.5f), Vec2f(30, 3.5f), 1.0f});
+    EXPECT_TRUE(hits.empty());
+}
+
+TYPED_TEST(BroadPhaseTest, ShouldQueryAreas)
+{
+    auto wall = this->makeBox(Vec2f(0, 0), Filter(), BodyType::staticBody);
+    auto a = this->makeBox(Vec2f(5, 0));
+    auto b = this->makeBox(Vec2f(50, 0));
+    this->bp.addNewBodies({wall, a, b});
+
+    vector<Body *> bodies;
+    this->bp.query(AABB({-2, -2}, {5, 2}), bodies);
+    vector<Body *> expected = {wall.get(), a.get()};
+    sort(expected.begin(), expected.end());
+    EXPECT_EQ(expected, bodies);
+
+    // Only the fattened AABB of b reaches this far.
+    this->bp.query(AABB({46, -2}, {48.5f, 2}), bodies);
+    EXPECT_TRUE(bodies.empty());
+}
+
+TYPED_TEST(BroadPhaseTest, ShouldQueryPoints)
+{
+    auto a = this->makeBox(Vec2f(0, 0));
+    auto b = this->makeBox(Vec2f(1.5f, 0));
+    auto circle = make_shared<Body>(BodySpec());
+    circle->addShape(CircleShape(1.0f, 1.0f, Vec2f(10, 0)));
+    this->bp.addNewBodies({a, b, circle});
+
+    vector<Body *> bodies;
+    this->bp.queryPoint(Vec2f(0.8f, 0.5f), bodies);
+    EXPECT_EQ(2u, bodies.size());
+    this->bp.queryPoint(Vec2f(-0.8f, 0.5f), bodies);
+    ASSERT_EQ(1u, bodies.size());
+    EXPECT_EQ(a.get(), bodies[0]);
+
+    // Inside the circle's AABB, but outside of the circle.
+    this->bp.queryPoint(Vec2f(10.9f, 0.9f), bodies);
+    EXPECT_TRUE(bodies.empty());
+    this->bp.queryPoint(Vec2f(10.5f, 0.5f), bodies);
+    ASSERT_EQ(1u, bodies.size());
+    EXPECT_EQ(circle.get(), bodies[0]);
+}
+
+TYPED_TEST(BroadPhaseTest, ShouldSkipDestroyedShapesInQueries)
+{
+    auto a = this->makeBox(Vec2f(0, 0));
+    this->bp.addNewBody(a);
+    // The proxy stays in the broadphase until the body is next updated.
+    a->destroyShape(a->getShapes()[0]);
+
+    vector<Body *> bodies;
+    this->bp.queryPoint(Vec2f(0, 0), bodies);
+    EXPECT_TRUE(bodies.empty());
+    vector<RayCastHit> hits;
+    this->bp.rayCast([&hits](const RayCastHit &hit) {
+        hits.push_back(hit);
+        return 1.0f;
+    }, {Vec2f(-5, 0), Vec2f(5, 0), 1.0f});
+    EXPECT_TRUE(hits.empty());
+}
+
+TYPED_TEST(BroadPhaseTest, ShouldFindNearestBodies)
 {
+    auto wall = this->makeBox(Vec2f(-10, 0), Filter(), BodyType::staticBody);
+    auto a = this->makeBox(Vec2f(4, 0));
+    auto b = this->makeBox(Vec2f(0, 20));
+    auto c = this->makeBox(Vec2f(30, 0));
+    // A body with two shapes is still only found once.
+    auto d = make_shared<Body>(BodySpec());
+    PolygonShape box(1.0f);
+    box.setBox(Vec2f(1, 1), Vec2f(0, 7), 0.0f);
+    d->addShape(box);
+    box.setBox(Vec2f(1, 1), Vec2f(0, 9), 0.0f);
+    d->addShape(box);
+    this->bp.addNewBodies({wall, a, b, c, d});
 
+    vector<Body *> bodies;
+    this->bp.nearest(3, Vec2f(0, 0), bodies);
+    vector<Body *> expected = {a.get(), d.get(), wall.get()};
+    EXPECT_EQ(expected, bodies);
+
+    this->bp.nearest(10, Vec2f(0, 0), bodies);
+    EXPECT_EQ(5u, bodies.size());
+    this->bp.nearest(0, Vec2f(0, 0), bodies);
+    EXPECT_TRUE(bodies.empty());
 }
 
-TEST_F(BroadPhaseTest, ShouldSupportUpdating)
+TYPED_TEST(BroadPhaseTest, ShouldKeepPairsWhenCompacted)
 {
+    vector<shared_ptr<Body>> bodies;
+    for (int i = 0; i < 20; i++)
+        bodies.push_back(this->makeBox(Vec2f(10.0f * i, 0)));
+    auto a = this->makeBox(Vec2f(0, 1));
+    auto wall = this->makeBox(Vec2f(0, -0.5f), Filter(), BodyType::staticBody);
+    this->bp.addNewBodies(bodies);
+    this->bp.addNewBody(a);
+    this->bp.addNewBody(wall);
+    for (size_t i = 1; i < bodies.size(); i += 2)
+        this->bp.deleteBody(bodies[i]);
+    this->update();
+    this->contacts.takeBeganContacts();
+
+    this->contacts.remapProxies(this->bp.compact());
+    vector<Body *> found;
+    this->bp.queryPoint(Vec2f(0, 0.25f), found);
+    EXPECT_EQ(3u, found.size());
+    this->update();
+    EXPECT_TRUE(this->contacts.takeBeganContacts().empty());
+    EXPECT_EQ(3u, this->contacts.getPersistingContacts().size());
 
+    // Moving a away ends its contacts with the proxies' new ids.
+    a->setLinearVelocity(Vec2f(5, 49));
+    a->updatePosition(1.0f);
+    this->bp.updateBody(a, Vec2f(5, 49));
+    this->update();
+    auto ended = this->contacts.takeEndedContacts();
+    ASSERT_EQ(2u, ended.size());
+    EXPECT_TRUE(this->samePair(ended[0], a, bodies[0]) || this->samePair(ended[0], a, wall));
+
+    auto b = this->makeBox(Vec2f(40, 1));
+    this->bp.addNewBody(b);
+    this->update();
+    auto began = this->contacts.takeBeganContacts();
+    ASSERT_EQ(1u, began.size());
+    EXPECT_TRUE(this->samePair(began[0], b, bodies[4]));
 }
 
-TEST_F(BroadPhaseTest, ShouldSupportDeletion)
+/**
+ * Every backend must find exactly the same pairs as the tree.
+ *
+ * @param spread Scale of the area the bodies are placed in.
+ */
+template <typename T>
+static void expectSamePairsAsTree(const Vec2f &spread)
 {
+    // A body can only be in one broadphase, so each gets its own copies.
+    std::mt19937 gen(7);
+    std::uniform_real_distribution<float> pos(0, 200);
+    std::uniform_real_distribution<float> vel(-5, 5);
+    vector<shared_ptr<Body>> treeBodies, sapBodies;
+    for (int i = 0; i < 300; i++) {
+        BodySpec spec;
+        PolygonShape box(1.0f);
+        // A few bodies are far larger than the rest, like walls.
+        if (i % 100 == 0)
+            box.setBox(Vec2f(200, 3));
+        else
+            box.setBox(Vec2f(2, 2));
+        spec.bodyType = BodyType::dynamicBody;
+        spec.position = Vec2f(pos(gen) * spread.x, pos(gen) * spread.y);
+        spec.linVelocity = Vec2f(vel(gen), vel(gen));
+        treeBodies.push_back(make_shared<Body>(spec));
+        treeBodies.back()->addShape(box);
+        sapBodies.push_back(make_shared<Body>(spec));
+        sapBodies.back()->addShape(box);
+    }
+
+    BroadPhase tree;
+    T sap;
+    tree.addNewBodies(treeBodies);
+    sap.addNewBodies(sapBodies);
+    // Compare pairs by the index of each body.
+    auto asSet = [](const vector<pair<weak_ptr<Body>, weak_ptr<Body>>> &pairs,
+                    const vector<shared_ptr<Body>> &bodies) {
+        set<pair<long, long>> found;
+        for (const auto &p : pairs) {
+            long a = find(bodies.begin(), bodies.end(), p.first.lock()) - bodies.begin();
+            long b = find(bodies.begin(), bodies.end(), p.second.lock()) - bodies.begin();
+            found.emplace(min(a, b), max(a, b));
+        }
+        return found;
+    };
+    auto step = [](BroadPhaseBase &broadPhase, const shared_ptr<Body> &body) {
+        const auto oldPosition = body->getPosition();
+        body->updatePosition(1.0f);
+        broadPhase.updateBody(body, body->getPosition() - oldPosition);
+    };
+
+    for (size_t frame = 0; frame < 20; frame++) {
+        for (size_t i = 0; i < treeBodies.size(); i++) {
+            step(tree, treeBodies[i]);
+            step(sap, sapBodies[i]);
+        }
+        // Churn some bodies to exercise proxy recycling.
+        tree.deleteBody(treeBodies[frame]);
+        sap.deleteBody(sapBodies[frame]);
+        tree.addNewBody(treeBodies[frame]);
+        sap.addNewBody(sapBodies[frame]);
+
+        tree.updatePairs();
+        sap.updatePairs();
+        auto expected = asSet(tree.getBodyCollisions(), treeBodies);
+        auto actual = asSet(sap.getBodyCollisions(), sapBodies);
+        EXPECT_FALSE(expected.empty());
+        EXPECT_EQ(expected, actual);
+    }
+}
+
+TEST(SweepAndPruneTest, ShouldMatchTree)
+{
+    expectSamePairsAsTree<SweepAndPrune>(Vec2f(4, 1));
+}
+
+TEST(SweepAndPruneTest, ShouldMatchTreeAfterSwitchingAxis)
+{
+    expectSamePairsAsTree<SweepAndPrune>(Vec2f(1, 4));
+}
+
+TEST(SpatialHashTest, ShouldMatchTree)
+{
+    expectSamePairsAsTree<SpatialHash>(Vec2f(4, 1));
+}
+
+TEST(SpatialHashTest, ShouldDeriveCellSizeFromProxies)
+{
+    SpatialHash grid;
+    BodySpec spec;
+    spec.bodyType = BodyType::dynamicBody;
+    auto body = make_shared<Body>(spec);
+    PolygonShape box(1.0f);
+    box.setBox(Vec2f(3, 3));
+    body->addShape(box);
+    grid.addNewBody(body);
+    grid.updatePairs();
+
+    // The 6x6 box is fattened by the margin on every side.
+    EXPECT_FLOAT_EQ(2.0f * (6.0f + 2.0f * aabbMargin), grid.getCellSize());
+}
+
+TEST(BroadPhaseThreadsTest, ShouldMatchSerialPairs)
+{
+    // Enough bodies move every step to find the pairs on several threads.
+    std::mt19937 gen(11);
+    std::uniform_real_distribution<float> pos(0, 1000);
+    std::uniform_real_distribution<float> vel(-40, 40);
+    vector<shared_ptr<Body>> serialBodies, parallelBodies;
+    for (int i = 0; i < 4000; i++) {
+        BodySpec spec;
+        spec.bodyType = i % 10 ? BodyType::dynamicBody : BodyType::staticBody;
+        spec.position = Vec2f(pos(gen), pos(gen));
+        spec.linVelocity = Vec2f(vel(gen), vel(gen));
+        PolygonShape box(1.0f);
+        box.setBox(Vec2f(4, 4));
+        serialBodies.push_back(make_shared<Body>(spec));
+        serialBodies.back()->addShape(box);
+        parallelBodies.push_back(make_shared<Body>(spec));
+        parallelBodies.back()->addShape(box);
+    }
+
+    BroadPhase serial(aabbMargin, 1);
+    BroadPhase parallel(aabbMargin, 4);
+    serial.addNewBodies(serialBodies);
+    parallel.addNewBodies(parallelBodies);
+    // Compare pairs by the index of each body, in the order they are reported.
+    auto asIndices = [](const vector<pair<weak_ptr<Body>, weak_ptr<Body>>> &pairs,
+                        const vector<shared_ptr<Body>> &bodies) {
+        vector<pair<long, long>> found;
+        for (const auto &p : pairs) {
+            long a = find(bodies.begin(), bodies.end(), p.first.lock()) - bodies.begin();
+            long b = find(bodies.begin(), bodies.end(), p.second.lock()) - bodies.begin();
+            found.emplace_back(a, b);
+        }
+        return found;
+    };
 
+    for (size_t frame = 0; frame < 5; frame++) {
+        for (size_t i = 0; i < serialBodies.size(); i++) {
+            for (auto body : {serialBodies[i], parallelBodies[i]}) {
+                if (body->getBodyType() == BodyType::staticBody)
+                    continue;
+                const auto oldPosition = body->getPosition();
+                body->updatePosition(1.0f);
+                (body == serialBodies[i] ? serial : parallel)
+                    .updateBody(body, body->getPosition() - oldPosition);
+            }
+        }
+        serial.updatePairs();
+        parallel.updatePairs();
+        auto expected = asIndices(serial.getBodyCollisions(), serialBodies);
+        EXPECT_FALSE(expected.empty());
+        EXPECT_EQ(expected, asIndices(parallel.getBodyCollisions(), parallelBodies));
+    }
 }
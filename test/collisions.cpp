@@ -2,6 +2,7 @@
 
 #include "inc/physics/collisions.hpp"
 #include "inc/physics/common.hpp"
+#include <set>
 
 using namespace phy;
 using namespace std;
@@ -46,7 +47,7 @@ TEST(CollidePolygonTest, ShouldFindCollisions)
 
     EXPECT_EQ(Manifold::Type::polygons, manifold.type);
     EXPECT_EQ(depth, manifold.depth);
-    EXPECT_EQ(axis, manifold.localNormal);
+    EXPECT_EQ(axis, manifold.normal);
 }
 
 TEST(CollidePolygonTest, ShoudFindNonCollisions)
@@ -62,3 +63,228 @@ TEST(CollidePolygonTest, ShoudFindNonCollisions)
                                     polyB, transformB);
     EXPECT_EQ(Manifold::Type::INVALID, manifold.type);
 }
+
+TEST(CollideCircleTest, ShouldFindMinimumTranslation)
+{
+    auto circleA = CircleShape(0, 10);
+    Transform transformA({{0, 0}, 0});
+    auto circleB = CircleShape(0, 5, {2, 0});
+    Transform transformB({{10, 0}, 0});
+
+    auto manifold = collideCircles(circleA, transformA,
+                                   circleB, transformB);
+    ASSERT_EQ(1, manifold.pointCount);
+    EXPECT_FLOAT_EQ(3.0f, manifold.depth);
+    EXPECT_EQ(Vec2f(1, 0), manifold.normal);
+    EXPECT_FLOAT_EQ(8.5f, manifold.points[0].point.x);
+    EXPECT_FLOAT_EQ(0.0f, manifold.points[0].point.y);
+}
+
+TEST(CollidePolygonTest, ShouldPointNormalFromAToB)
+{
+    auto polyA = PolygonShape(5);
+    polyA.setBox({25, 25});
+    Transform transformA({{95, 50}, 0});
+    auto polyB = PolygonShape(5);
+    polyB.setBox({25, 25});
+    Transform transformB({{50, 50}, 0});
+
+    auto manifold = collidePolygons(polyA, transformA,
+                                    polyB, transformB);
+    ASSERT_EQ(Manifold::Type::polygons, manifold.type);
+    EXPECT_EQ(Vec2f(-1, 0), manifold.normal);
+    // The edge of B that rests against A is clipped to A's face.
+    ASSERT_EQ(2, manifold.pointCount);
+    for (int i = 0; i < manifold.pointCount; i++) {
+        EXPECT_FLOAT_EQ(75.0f, manifold.points[i].point.x);
+        EXPECT_FLOAT_EQ(5.0f, manifold.points[i].depth);
+    }
+}
+
+TEST(CollidePolygonTest, ShouldClipIncidentEdges)
+{
+    auto ground = PolygonShape(1);
+    ground.setBox({50, 5});
+    Transform groundTransform({{0, 0}, 0});
+    auto box = PolygonShape(1);
+    box.setBox({2, 2});
+
+    // A box resting on the ground, slightly tilted.
+    Transform boxTransform({{10, 6.8f}, 0.05f});
+    auto manifold = collidePolygons(ground, groundTransform, box, boxTransform);
+    ASSERT_EQ(2, manifold.pointCount);
+    EXPECT_NEAR(0.0f, manifold.normal.x, 1e-5f);
+    EXPECT_NEAR(1.0f, manifold.normal.y, 1e-5f);
+    // The lower corner reaches deeper.
+    EXPECT_GT(std::max(manifold.points[0].depth, manifold.points[1].depth), 0.1f);
+    EXPECT_FLOAT_EQ(std::max(manifold.points[0].depth, manifold.points[1].depth), manifold.depth);
+    for (int i = 0; i < manifold.pointCount; i++)
+        EXPECT_LE(manifold.points[i].point.y, 5.0f);
+    EXPECT_NE(manifold.points[0].id.getKey(), manifold.points[1].id.getKey());
+
+    // The same corners give the same ids after moving a little.
+    Transform movedTransform({{10.5f, 6.85f}, 0.04f});
+    auto moved = collidePolygons(ground, groundTransform, box, movedTransform);
+    ASSERT_EQ(2, moved.pointCount);
+    EXPECT_EQ(manifold.points[0].id.getKey(), moved.points[0].id.getKey());
+    EXPECT_EQ(manifold.points[1].id.getKey(), moved.points[1].id.getKey());
+
+    // Swapping the shapes swaps the features and the normal.
+    auto swapped = collidePolygons(box, boxTransform, ground, groundTransform);
+    ASSERT_EQ(2, swapped.pointCount);
+    EXPECT_NEAR(-1.0f, swapped.normal.y, 1e-5f);
+    for (int i = 0; i < 2; i++) {
+        EXPECT_EQ(manifold.points[i].id.indexA, swapped.points[i].id.indexB);
+        EXPECT_EQ(manifold.points[i].id.typeA, swapped.points[i].id.typeB);
+    }
+
+    // Hanging over the end, one point comes from clipping the side.
+    Transform overhangTransform({{50, 6.9f}, 0});
+    auto overhang = collidePolygons(ground, groundTransform, box, overhangTransform);
+    ASSERT_EQ(2, overhang.pointCount);
+    bool clipped = false;
+    for (int i = 0; i < overhang.pointCount; i++) {
+        if (overhang.points[i].id.typeA == ContactFeature::vertex) {
+            clipped = true;
+            EXPECT_FLOAT_EQ(50.0f, overhang.points[i].point.x);
+        }
+    }
+    EXPECT_TRUE(clipped);
+}
+
+TEST(CollidePolygonTest, ShouldKeepTheReferenceFaceOfStackedBoxes)
+{
+    // Two equal boxes stacked on each other overlap about as much along
+    // the top face of the lower box as along the bottom face of the
+    // upper one. Tilting the upper box either way makes one of them
+    // overlap slightly less.
+    auto box = PolygonShape(1);
+    box.setBox({1, 1});
+    Transform lower({{0, 0}, 0});
+    auto first = collidePolygons(box, lower, box, Transform({{0.3f, 1.98f}, 0}));
+    ASSERT_EQ(2, first.pointCount);
+    std::set<uint32_t> keys = {first.points[0].id.getKey(), first.points[1].id.getKey()};
+
+    for (int i = 0; i < 20; i++) {
+        const float tilt = (i % 2 ? 0.002f : -0.002f) * (i % 5 + 1);
+        auto manifold = collidePolygons(box, lower, box, Transform({{0.3f, 1.98f}, tilt}));
+        ASSERT_EQ(2, manifold.pointCount);
+        // The lower box's face stays the reference face, so the normal
+        // does not follow the upper box and the points keep their ids.
+        EXPECT_EQ(0.0f, manifold.normal.x) << tilt;
+        EXPECT_EQ(1.0f, manifold.normal.y) << tilt;
+        EXPECT_EQ(keys, std::set<uint32_t>({manifold.points[0].id.getKey(),
+                                            manifold.points[1].id.getKey()}));
+    }
+}
+
+TEST(CollidePolygonTest, ShouldCollideRotatedHulls)
+{
+    // Given out of order, set() keeps the hull counterclockwise.
+    auto diamond = PolygonShape(1);
+    diamond.set({{0, 5}, {0, -5}, {5, 0}, {-5, 0}, {1, 1}});
+    ASSERT_EQ(4u, diamond.vertices.size());
+    for (const auto &normal : diamond.getNormals())
+        EXPECT_NEAR(1.0f, normal.length(), 1e-5f);
+    EXPECT_TRUE(diamond.testPoint({{0, 0}, 0}, {1, 1}));
+
+    // Turned a quarter of a turn, the diamond's corner faces the box.
+    auto box = PolygonShape(1);
+    box.setBox({5, 5});
+    Transform boxTransform({{0, 0}, 0});
+    Transform diamondTransform({{9, 0}, static_cast<float>(M_PI / 2)});
+    auto manifold = collidePolygons(box, boxTransform, diamond, diamondTransform);
+    ASSERT_EQ(Manifold::Type::polygons, manifold.type);
+    EXPECT_NEAR(1.0f, manifold.depth, 1e-5f);
+    EXPECT_NEAR(1.0f, manifold.normal.x, 1e-5f);
+    EXPECT_NEAR(4.0f, manifold.points[0].point.x, 1e-5f);
+    EXPECT_NEAR(0.0f, manifold.points[0].point.y, 1e-5f);
+
+    // Close to the box's corner, but outside of the diamond's face.
+    diamondTransform = Transform({{9, 9}, 0});
+    EXPECT_FALSE(collidePolygons(box, boxTransform, diamond, diamondTransform).isTouching());
+    EXPECT_FALSE(collidePolygons(diamond, diamondTransform, box, boxTransform).isTouching());
+}
+
+TEST(CollidePolygonCircleTest, ShouldFindFaceAndVertexContacts)
+{
+    auto box = PolygonShape(1);
+    box.setBox({10, 10});
+    Transform boxTransform({{0, 0}, 0});
+    auto circle = CircleShape(1, 5);
+
+    // Against the right face.
+    auto manifold = collidePolygonAndCircle(box, boxTransform, circle, {{13, 2}, 0});
+    ASSERT_EQ(Manifold::Type::polygonAndCircle, manifold.type);
+    EXPECT_FLOAT_EQ(2.0f, manifold.depth);
+    EXPECT_EQ(Vec2f(1, 0), manifold.normal);
+    EXPECT_EQ(Vec2f(10, 2), manifold.points[0].point);
+
+    // Against the top right corner.
+    manifold = collidePolygonAndCircle(box, boxTransform, circle, {{13, 14}, 0});
+    ASSERT_TRUE(manifold.isTouching());
+    EXPECT_FLOAT_EQ(0.0f, manifold.depth);
+    EXPECT_NEAR(0.6f, manifold.normal.x, 1e-5f);
+    EXPECT_NEAR(0.8f, manifold.normal.y, 1e-5f);
+    EXPECT_EQ(Vec2f(10, 10), manifold.points[0].point);
+
+    EXPECT_EQ(ContactFeature::vertex, manifold.points[0].id.typeA);
+    EXPECT_EQ(2, manifold.points[0].id.indexA);
+
+    // Missing the corner, although the AABBs overlap.
+    manifold = collidePolygonAndCircle(box, boxTransform, circle, {{14, 14}, 0});
+    EXPECT_FALSE(manifold.isTouching());
+
+    // The center inside the box is pushed out of the nearest face.
+    manifold = collidePolygonAndCircle(box, boxTransform, circle, {{0, -8}, 0});
+    ASSERT_TRUE(manifold.isTouching());
+    EXPECT_FLOAT_EQ(7.0f, manifold.depth);
+    EXPECT_EQ(Vec2f(0, -1), manifold.normal);
+}
+
+TEST(CollideTest, ShouldDispatchOnShapeTypes)
+{
+    auto box = PolygonShape(1);
+    box.setBox({10, 10});
+    auto circle = CircleShape(1, 5);
+    Transform boxTransform({{0, 0}, 0});
+    Transform circleTransform({{13, 0}, 0});
+
+    auto boxFirst = collide(box, boxTransform, circle, circleTransform);
+    auto circleFirst = collide(circle, circleTransform, box, boxTransform);
+    ASSERT_TRUE(boxFirst.isTouching());
+    ASSERT_TRUE(circleFirst.isTouching());
+    EXPECT_EQ(Vec2f(1, 0), boxFirst.normal);
+    EXPECT_EQ(Vec2f(-1, 0), circleFirst.normal);
+    EXPECT_FLOAT_EQ(boxFirst.depth, circleFirst.depth);
+    EXPECT_TRUE(collide(box, boxTransform, box, {{15, 0}, 0}).isTouching());
+    EXPECT_FALSE(collide(circle, circleTransform, circle, {{30, 0}, 0}).isTouching());
+}
+
+TEST(RayCastTest, ShouldHitCircles)
+{
+    auto circle = CircleShape(1, 10, {5, 0});
+    Transform transform({{50, 50}, 0});
+    RayCastOutput output;
+    ASSERT_TRUE(circle.rayCast(output, {{0, 50}, {100, 50}, 1.0f}, transform));
+    EXPECT_FLOAT_EQ(0.45f, output.fraction);
+    EXPECT_FLOAT_EQ(-1.0f, output.normal.x);
+    EXPECT_FALSE(circle.rayCast(output, {{0, 50}, {100, 50}, 0.4f}, transform));
+    EXPECT_FALSE(circle.rayCast(output, {{0, 70}, {100, 70}, 1.0f}, transform));
+    // Rays starting inside do not hit.
+    EXPECT_FALSE(circle.rayCast(output, {{55, 50}, {100, 50}, 1.0f}, transform));
+}
+
+TEST(RayCastTest, ShouldHitPolygons)
+{
+    auto poly = PolygonShape(1);
+    poly.setBox({10, 10});
+    Transform transform({{50, 50}, static_cast<float>(M_PI / 4)});
+    RayCastOutput output;
+    ASSERT_TRUE(poly.rayCast(output, {{50, 0}, {50, 100}, 1.0f}, transform));
+    // The corner of the rotated box points down the ray.
+    EXPECT_NEAR(0.5f - 0.1f * sqrtf(2), output.fraction, 1e-5f);
+    EXPECT_NEAR(0.0f, output.normal.x + output.normal.y, 1e-5f);
+    EXPECT_FALSE(poly.rayCast(output, {{0, 0}, {0, 100}, 1.0f}, transform));
+    EXPECT_FALSE(poly.rayCast(output, {{50, 50}, {50, 100}, 1.0f}, transform));
+}
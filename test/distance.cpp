@@ -0,0 +1,143 @@
+#include "gtest/gtest.h"
+
+#include "inc/physics/collisions.hpp"
+#include "inc/physics/distance.hpp"
+#include <cmath>
+
+using namespace phy;
+using namespace std;
+
+namespace {
+PolygonShape regularPolygon(size_t count, float radius)
+{
+    std::vector<Vec2f> vertices;
+    for (size_t i = 0; i < count; i++) {
+        const float angle = 2.0f * static_cast<float>(M_PI) * i / count;
+        vertices.push_back({radius * std::cos(angle), radius * std::sin(angle)});
+    }
+    auto polygon = PolygonShape(1);
+    polygon.set(vertices);
+    return polygon;
+}
+} /* namespace */
+
+TEST(DistanceTest, ShouldFindClosestPointsOfCircles)
+{
+    auto circle = CircleShape(1, 5);
+    auto output = distance(circle, {{0, 0}, 0}, circle, {{20, 0}, 0});
+    EXPECT_NEAR(10.0f, output.distance, 1e-4f);
+    EXPECT_NEAR(5.0f, output.pointA.x, 1e-4f);
+    EXPECT_NEAR(15.0f, output.pointB.x, 1e-4f);
+
+    output = distance(circle, {{0, 0}, 0}, circle, {{6, 0}, 0});
+    EXPECT_EQ(0.0f, output.distance);
+}
+
+TEST(DistanceTest, ShouldFindClosestPointsOfPolygons)
+{
+    auto box = PolygonShape(1);
+    box.setBox({5, 5});
+
+    // Face to face, the closest points may be anywhere on the overlap
+    // of both faces.
+    auto output = distance(box, {{0, 0}, 0}, box, {{20, 3}, 0});
+    EXPECT_NEAR(10.0f, output.distance, 1e-4f);
+    EXPECT_NEAR(5.0f, output.pointA.x, 1e-4f);
+    EXPECT_NEAR(15.0f, output.pointB.x, 1e-4f);
+    EXPECT_NEAR(output.pointA.y, output.pointB.y, 1e-4f);
+
+    // Corner to corner.
+    output = distance(box, {{0, 0}, 0}, box, {{13, 14}, 0});
+    EXPECT_NEAR(5.0f, output.distance, 1e-4f);
+    EXPECT_NEAR(5.0f, output.pointA.x, 1e-4f);
+    EXPECT_NEAR(5.0f, output.pointA.y, 1e-4f);
+    EXPECT_NEAR(8.0f, output.pointB.x, 1e-4f);
+    EXPECT_NEAR(9.0f, output.pointB.y, 1e-4f);
+
+    auto circle = CircleShape(1, 2);
+    output = distance(box, {{0, 0}, 0}, circle, {{0, -10}, 0});
+    EXPECT_NEAR(3.0f, output.distance, 1e-4f);
+    EXPECT_NEAR(-5.0f, output.pointA.y, 1e-4f);
+}
+
+TEST(PenetrationTest, ShouldFindDepthAndNormal)
+{
+    auto box = PolygonShape(1);
+    box.setBox({5, 5});
+    PenetrationOutput output;
+
+    ASSERT_TRUE(penetration(output, box, {{0, 0}, 0}, box, {{8, 1}, 0}));
+    EXPECT_NEAR(2.0f, output.depth, 1e-4f);
+    EXPECT_NEAR(1.0f, output.normal.x, 1e-4f);
+    EXPECT_NEAR(0.0f, output.normal.y, 1e-4f);
+    EXPECT_NEAR(5.0f, output.pointA.x, 1e-4f);
+    EXPECT_NEAR(3.0f, output.pointB.x, 1e-4f);
+
+    // Concentric shapes still get pushed apart.
+    auto circle = CircleShape(1, 3);
+    ASSERT_TRUE(penetration(output, box, {{0, 0}, 0}, circle, {{0, 0}, 0}));
+    EXPECT_NEAR(8.0f, output.depth, 1e-2f);
+    EXPECT_NEAR(1.0f, output.normal.length(), 1e-4f);
+
+    EXPECT_FALSE(penetration(output, box, {{0, 0}, 0}, box, {{11, 0}, 0}));
+}
+
+TEST(PenetrationTest, ShouldMatchSeparatingAxes)
+{
+    auto polyA = regularPolygon(12, 10);
+    auto polyB = regularPolygon(7, 6);
+    Transform transformA({{0, 0}, 0.3f});
+    for (int i = 0; i < 64; i++) {
+        const float angle = 2.0f * static_cast<float>(M_PI) * i / 64;
+        Transform transformB({{12.0f * std::cos(angle), 12.0f * std::sin(angle)}, 0.1f * i});
+
+        auto sat = collidePolygons(polyA, transformA, polyB, transformB);
+        PenetrationOutput output;
+        ASSERT_EQ(sat.isTouching(), penetration(output, polyA, transformA, polyB, transformB));
+        if (!sat.isTouching())
+            continue;
+        // SAT measures along face normals only, which EPA also ends on
+        // for polygons. SAT keeps a face of A over a face of B that is
+        // within referenceFaceTolerance, so the normals may differ a
+        // little where two nearly parallel faces tie.
+        EXPECT_NEAR(sat.depth, output.depth, referenceFaceTolerance);
+        EXPECT_GT(dot(sat.normal, output.normal), 0.99f);
+
+        auto convex = collideConvex(polyA, transformA, polyB, transformB);
+        ASSERT_TRUE(convex.isTouching());
+        EXPECT_EQ(sat.pointCount, convex.pointCount);
+        EXPECT_NEAR(sat.depth, convex.depth, 1e-3f);
+    }
+}
+
+TEST(SimplexCacheTest, ShouldConvergeFromLastStep)
+{
+    auto polyA = regularPolygon(64, 10);
+    auto polyB = regularPolygon(64, 10);
+    SimplexCache cache = {};
+
+    // Moving into each other while turning.
+    int coldIterations = 0, warmIterations = 0;
+    for (int i = 0; i < 40; i++) {
+        Transform transformA({{0, 0}, 0.01f * i});
+        Transform transformB({{25.0f - 0.2f * i, 1}, -0.02f * i});
+
+        const auto cold = distance(polyA, transformA, polyB, transformB);
+        const auto warm = distance(polyA, transformA, polyB, transformB, &cache);
+        EXPECT_NEAR(cold.distance, warm.distance, 1e-3f);
+        coldIterations += cold.iterations;
+        warmIterations += warm.iterations;
+    }
+    // One or two iterations a step, more only when the closest features
+    // change.
+    EXPECT_LE(warmIterations, 2 * 40);
+    EXPECT_LT(2 * warmIterations, coldIterations);
+
+    // A pair that still overlaps is found without iterating.
+    Transform transformB({{15, 1}, 0});
+    distance(polyA, {{0, 0}, 0}, polyB, transformB, &cache);
+    ASSERT_EQ(3, cache.count);
+    const auto output = distance(polyA, {{0, 0}, 0}, polyB, transformB, &cache);
+    EXPECT_EQ(0.0f, output.distance);
+    EXPECT_EQ(0, output.iterations);
+}
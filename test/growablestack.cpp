@@ -0,0 +1,48 @@
+#include "gtest/gtest.h"
+#include "inc/physics/growablestack.hpp"
+
+using namespace phy;
+
+TEST(GrowableStackTest, ShouldPopInReverseOrder)
+{
+    GrowableStack<int, 4> stack;
+    for (int i = 0; i < 3; i++)
+        stack.push(i);
+
+    EXPECT_EQ(3u, stack.size());
+    EXPECT_EQ(2, stack.pop());
+    EXPECT_EQ(1, stack.pop());
+    EXPECT_EQ(0, stack.pop());
+    EXPECT_TRUE(stack.empty());
+}
+
+TEST(GrowableStackTest, ShouldSpillPastInlineStorage)
+{
+    GrowableStack<int, 4> stack;
+    for (int i = 0; i < 100; i++)
+        stack.push(i);
+
+    EXPECT_EQ(100u, stack.size());
+    for (int i = 99; i >= 0; i--)
+        EXPECT_EQ(i, stack.pop());
+    EXPECT_TRUE(stack.empty());
+}
+
+TEST(GrowableStackTest, ShouldSupportNestedSpilling)
+{
+    GrowableStack<int, 2> outer;
+    for (int i = 0; i < 10; i++)
+        outer.push(i);
+
+    {
+        // The inner stack cannot use the shared buffer held by outer.
+        GrowableStack<int, 2> inner;
+        for (int i = 0; i < 10; i++)
+            inner.push(i * 10);
+        for (int i = 9; i >= 0; i--)
+            EXPECT_EQ(i * 10, inner.pop());
+    }
+
+    for (int i = 9; i >= 0; i--)
+        EXPECT_EQ(i, outer.pop());
+}
@@ -0,0 +1,77 @@
+#include "gtest/gtest.h"
+#include "inc/physics/pairbuffer.hpp"
+
+#include <algorithm>
+#include <random>
+#include <set>
+
+using namespace phy;
+
+TEST(PairBufferTest, ShouldCanonicalizePairs)
+{
+    PairBuffer pairs;
+    pairs.add(7, 3);
+    pairs.add(3, 7);
+    pairs.sort();
+
+    ASSERT_EQ(1u, pairs.size());
+    EXPECT_EQ(std::make_pair(3, 7), pairs[0]);
+}
+
+TEST(PairBufferTest, ShouldSortAndRemoveDuplicates)
+{
+    // Enough pairs to take the radix sort path.
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<int32_t> proxy(0, 5000);
+    std::set<std::pair<int32_t, int32_t>> expected;
+    PairBuffer pairs;
+    for (int i = 0; i < 2000; i++) {
+        const int32_t a = proxy(gen), b = proxy(gen);
+        pairs.add(a, b);
+        pairs.add(b, a);
+        expected.insert(std::make_pair(std::min(a, b), std::max(a, b)));
+    }
+    pairs.sort();
+
+    ASSERT_EQ(expected.size(), pairs.size());
+    size_t i = 0;
+    for (const auto &pair : expected)
+        EXPECT_EQ(pair, pairs[i++]);
+}
+
+TEST(PairBufferTest, ShouldBeEmptyAfterClear)
+{
+    PairBuffer pairs;
+    pairs.add(1, 2);
+    pairs.clear();
+    pairs.sort();
+
+    EXPECT_TRUE(pairs.empty());
+}
+
+TEST(PairBufferTest, ShouldRemovePairsOfProxies)
+{
+    PairBuffer pairs;
+    pairs.add(1, 2);
+    pairs.add(3, 2);
+    pairs.add(3, 4);
+    pairs.add(5, 1);
+    pairs.sort();
+    pairs.remove({2, 5});
+
+    ASSERT_EQ(1u, pairs.size());
+    EXPECT_EQ(std::make_pair(3, 4), pairs[0]);
+}
+
+TEST(PairBufferTest, ShouldRemapProxies)
+{
+    PairBuffer pairs;
+    pairs.add(0, 1);
+    pairs.add(1, 2);
+    pairs.remap({2, 0, 1});
+    pairs.sort();
+
+    ASSERT_EQ(2u, pairs.size());
+    EXPECT_EQ(std::make_pair(0, 1), pairs[0]);
+    EXPECT_EQ(std::make_pair(0, 2), pairs[1]);
+}
@@ -0,0 +1,97 @@
+#include "gtest/gtest.h"
+#include "inc/physics/quantizedtree.hpp"
+#include "test/treecallbacks.hpp"
+
+#include <algorithm>
+#include <random>
+#include <set>
+#include <vector>
+
+using namespace phy;
+
+namespace {
+/**
+ * Fill a tree with small boxes at awkward, non-round coordinates.
+ */
+std::vector<int32_t> fillTree(AABBTree &tree, size_t count)
+{
+    std::mt19937 gen(17);
+    std::uniform_real_distribution<float> position(-1000.0f, 1000.0f), size(0.1f, 7.3f);
+    std::vector<int32_t> leaves;
+    for (size_t i = 0; i < count; i++) {
+        const Vec2f low(position(gen), position(gen));
+        leaves.push_back(tree.insertAABB(AABB(low, low + Vec2f(size(gen), size(gen)))));
+    }
+    return leaves;
+}
+} /* namespace */
+
+TEST(QuantizedAABBTreeTest, ShouldFindEveryOverlappingLeaf)
+{
+    AABBTree tree;
+    auto leaves = fillTree(tree, 2000);
+    QuantizedAABBTree quantized(tree);
+    EXPECT_EQ(2 * leaves.size() - 1, quantized.getNodeCount());
+
+    // Bounds are rounded outward, so each leaf at least finds itself.
+    for (auto leaf : leaves) {
+        LeafSet found;
+        quantized.findCollisions(&found, tree.getFatAABB(leaf));
+        EXPECT_EQ(1u, found.leaves.count(leaf));
+    }
+
+    std::mt19937 gen(3);
+    std::uniform_real_distribution<float> position(-1000.0f, 1000.0f);
+    for (int i = 0; i < 100; i++) {
+        const Vec2f low(position(gen), position(gen));
+        const AABB query(low, low + Vec2f(50, 30));
+        LeafSet exact, found;
+        tree.findCollisions(&exact, query);
+        quantized.findCollisions(&found, query);
+        EXPECT_TRUE(std::includes(found.leaves.begin(), found.leaves.end(),
+                                  exact.leaves.begin(), exact.leaves.end()));
+        // Outward rounding only adds leaves that nearly overlap.
+        for (auto leaf : found.leaves)
+            EXPECT_TRUE(tree.getFatAABB(leaf).expand(1.0f).overlaps(query));
+    }
+}
+
+TEST(QuantizedAABBTreeTest, ShouldRayCastLikeTheSourceTree)
+{
+    AABBTree tree;
+    fillTree(tree, 2000);
+    QuantizedAABBTree quantized(tree);
+
+    const RayCastInput ray = {Vec2f(-1000, -900), Vec2f(1000, 950), 1.0f};
+    RayLeaves exact, found;
+    tree.rayCast(&exact, ray);
+    quantized.rayCast(&found, ray);
+    std::set<int32_t> exactSet(exact.leaves.begin(), exact.leaves.end());
+    std::set<int32_t> foundSet(found.leaves.begin(), found.leaves.end());
+    EXPECT_FALSE(exactSet.empty());
+    EXPECT_TRUE(std::includes(foundSet.begin(), foundSet.end(),
+                              exactSet.begin(), exactSet.end()));
+}
+
+TEST(QuantizedAABBTreeTest, ShouldUseLessMemoryThanTheSourceTree)
+{
+    AABBTree tree;
+    auto leaves = fillTree(tree, 1000);
+    tree.compact();
+    QuantizedAABBTree quantized(tree);
+    EXPECT_LE(2 * quantized.getMemoryUsage(), tree.getCapacity() * sizeof(AABBNode));
+}
+
+TEST(QuantizedAABBTreeTest, ShouldHandleEmptyAndSingleLeafTrees)
+{
+    AABBTree tree;
+    QuantizedAABBTree empty(tree);
+    LeafSet found;
+    empty.findCollisions(&found, AABB({-1, -1}, {1, 1}));
+    EXPECT_TRUE(found.leaves.empty());
+
+    auto leaf = tree.insertAABB(AABB({0, 0}, {1, 1}));
+    QuantizedAABBTree single(tree);
+    single.findCollisions(&found, AABB({0.5f, 0.5f}, {2, 2}));
+    EXPECT_EQ(std::set<int32_t>({leaf}), found.leaves);
+}
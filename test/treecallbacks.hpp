@@ -0,0 +1,37 @@
+#pragma once
+
+#include "gtest/gtest.h"
+#include "inc/physics/aabb.hpp"
+
+#include <set>
+#include <vector>
+
+namespace phy {
+/**
+ * Collect the leaves that a tree reports for an AABB query.
+ */
+struct LeafSet : public AABBCallback {
+    std::set<int32_t> leaves;
+    virtual bool registerCollision(int32_t nodeA, int32_t nodeB) override
+    {
+        EXPECT_EQ(-1, nodeA);
+        leaves.insert(nodeB);
+        return true;
+    }
+};
+
+/**
+ * Collect the leaves that a ray reaches, in the order they are reported.
+ */
+struct RayLeaves : public RayCastCallback {
+    std::vector<int32_t> leaves;
+    float clipTo; ///< Fraction to clip the ray to on every hit, or < 0 to keep it
+    explicit RayLeaves(float clip = -1.0f)
+        : clipTo(clip) {}
+    virtual float rayCastCallback(const RayCastInput &input, int32_t index) override
+    {
+        leaves.push_back(index);
+        return clipTo < 0 ? input.maxFraction : clipTo;
+    }
+};
+} /* namespace phy */
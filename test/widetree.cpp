@@ -0,0 +1,109 @@
+#include "gtest/gtest.h"
+#include "inc/physics/widetree.hpp"
+#include "test/treecallbacks.hpp"
+
+#include <random>
+#include <set>
+#include <vector>
+
+using namespace phy;
+
+namespace {
+std::vector<AABB> scatteredBoxes(size_t count, std::mt19937 &gen)
+{
+    std::uniform_real_distribution<float> position(-500.0f, 500.0f), size(0.5f, 10.0f);
+    std::vector<AABB> boxes;
+    for (size_t i = 0; i < count; i++) {
+        const Vec2f low(position(gen), position(gen));
+        boxes.emplace_back(low, low + Vec2f(size(gen), size(gen)));
+    }
+    return boxes;
+}
+
+void expectSameQueries(const AABBTree &tree, const WideAABBTree &wide, std::mt19937 &gen)
+{
+    for (const auto &query : scatteredBoxes(100, gen)) {
+        const AABB area(query.lowVertex, query.highVertex + Vec2f(30, 30));
+        LeafSet expected, found;
+        tree.findCollisions(&expected, area);
+        wide.findCollisions(&found, area);
+        EXPECT_EQ(expected.leaves, found.leaves);
+    }
+}
+} /* namespace */
+
+TEST(WideAABBTreeTest, ShouldFindTheSameLeaves)
+{
+    std::mt19937 gen(8);
+    AABBTree tree;
+    for (const auto &box : scatteredBoxes(1000, gen))
+        tree.insertAABB(box);
+    WideAABBTree wide(tree);
+    // Four children per node need about a third as many nodes.
+    EXPECT_LT(wide.getNodeCount(), 1000u / 2);
+
+    expectSameQueries(tree, wide, gen);
+}
+
+TEST(WideAABBTreeTest, ShouldRayCastNearestFirst)
+{
+    AABBTree tree;
+    std::vector<int32_t> row;
+    for (int i = 0; i < 20; i++)
+        row.push_back(tree.insertAABB(AABB({i * 10.0f, 0}, {i * 10.0f + 5, 5})));
+    tree.insertAABB(AABB({0, 50}, {5, 55}));
+    WideAABBTree wide(tree);
+
+    RayLeaves all(-1);
+    wide.rayCast(&all, {Vec2f(-10, 2), Vec2f(300, 2), 1.0f});
+    EXPECT_EQ(row, all.leaves);
+
+    // Clipping at the first leaf skips every leaf behind it.
+    RayLeaves nearest(0.04f);
+    wide.rayCast(&nearest, {Vec2f(-10, 2), Vec2f(300, 2), 1.0f});
+    ASSERT_EQ(1u, nearest.leaves.size());
+    EXPECT_EQ(row[0], nearest.leaves[0]);
+}
+
+TEST(WideAABBTreeTest, ShouldRefitMovedLeaves)
+{
+    std::mt19937 gen(9);
+    AABBTree tree;
+    auto boxes = scatteredBoxes(500, gen);
+    std::vector<int32_t> leaves;
+    for (const auto &box : boxes)
+        leaves.push_back(tree.insertAABB(box));
+    WideAABBTree wide(tree);
+
+    // Move every leaf in both trees. The binary tree reinserts them.
+    std::uniform_real_distribution<float> offset(-20.0f, 20.0f);
+    for (size_t i = 0; i < leaves.size(); i++) {
+        const Vec2f d(offset(gen), offset(gen));
+        const AABB moved(boxes[i].lowVertex + d, boxes[i].highVertex + d);
+        tree.destroyAABB(leaves[i]);
+        const int32_t leaf = tree.insertAABB(moved);
+        ASSERT_EQ(leaves[i], leaf);
+        wide.setLeafAABB(leaf, moved);
+    }
+    wide.refit();
+
+    expectSameQueries(tree, wide, gen);
+}
+
+TEST(WideAABBTreeTest, ShouldHandleEmptyAndSingleLeafTrees)
+{
+    AABBTree tree;
+    WideAABBTree empty(tree);
+    LeafSet found;
+    empty.findCollisions(&found, AABB({-1, -1}, {1, 1}));
+    EXPECT_TRUE(found.leaves.empty());
+    empty.refit();
+    empty.findCollisions(&found, AABB({-1, -1}, {1, 1}));
+    EXPECT_TRUE(found.leaves.empty());
+
+    auto leaf = tree.insertAABB(AABB({0, 0}, {1, 1}));
+    WideAABBTree single(tree);
+    single.findCollisions(&found, AABB({0.5f, 0.5f}, {2, 2}));
+    EXPECT_EQ(std::set<int32_t>({leaf}), found.leaves);
+    single.refit();
+}
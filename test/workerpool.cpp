@@ -0,0 +1,50 @@
+#include "gtest/gtest.h"
+#include "inc/physics/workerpool.hpp"
+
+#include <atomic>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+using namespace phy;
+
+TEST(WorkerPoolTest, ShouldRunEveryTaskOnce)
+{
+    WorkerPool pool(4);
+    EXPECT_EQ(4u, pool.getThreadCount());
+
+    for (size_t count : {0, 1, 3, 100}) {
+        std::vector<std::atomic<int>> runs(count);
+        for (auto &run : runs)
+            run = 0;
+        pool.run(count, [&runs](size_t i) { runs[i]++; });
+        for (const auto &run : runs)
+            EXPECT_EQ(1, run);
+    }
+}
+
+TEST(WorkerPoolTest, ShouldReuseItsThreads)
+{
+    WorkerPool pool(3);
+    std::mutex mutex;
+    std::set<std::thread::id> ids;
+    for (int batch = 0; batch < 50; batch++) {
+        pool.run(8, [&](size_t) {
+            std::lock_guard<std::mutex> lock(mutex);
+            ids.insert(std::this_thread::get_id());
+        });
+    }
+    // The threads of the pool and the calling thread, whichever took part.
+    EXPECT_LE(ids.size(), 3u);
+    EXPECT_EQ(1u, ids.count(std::this_thread::get_id()));
+}
+
+TEST(WorkerPoolTest, ShouldRunOnTheCallingThreadAlone)
+{
+    WorkerPool pool(1);
+    EXPECT_EQ(1u, pool.getThreadCount());
+    int sum = 0;
+    pool.run(10, [&sum](size_t i) { sum += i; });
+    EXPECT_EQ(45, sum);
+}
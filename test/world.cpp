@@ -0,0 +1,198 @@
+#include "gtest/gtest.h"
+
+#include "inc/physics/world.hpp"
+#include <cmath>
+
+using namespace phy;
+using namespace std;
+
+namespace {
+const float timeStep = 1.0f / 60.0f;
+
+BodySpec boxSpec(BodyType type, const Vec2f &position, const Vec2f &halfSize)
+{
+    BodySpec spec;
+    spec.bodyType = type;
+    spec.position = position;
+    auto box = PolygonShape(1);
+    box.setBox(halfSize);
+    spec.shapes.push_back(make_shared<PolygonShape>(box));
+    return spec;
+}
+
+shared_ptr<Body> addGround(World &world)
+{
+    return world.createBody(boxSpec(BodyType::staticBody, {0, -5}, {200, 5})).lock();
+}
+} /* namespace */
+
+TEST(BodyTest, ShouldComputeMassProperties)
+{
+    auto body = Body(boxSpec(BodyType::dynamicBody, {10, 0}, {5, 10}));
+    auto box = PolygonShape(1);
+    box.setBox({5, 10});
+    body.addShape(box);
+    EXPECT_FLOAT_EQ(200.0f, body.getMass());
+    EXPECT_NEAR(200.0f * (100 + 400) / 12, body.getInertia(), 1e-2f);
+    EXPECT_EQ(Vec2f(10, 0), body.getCenterMass());
+
+    // A second box to the right moves the center of mass between both.
+    auto offset = PolygonShape(1);
+    offset.setBox({5, 10}, {10, 0}, 0);
+    body.addShape(offset);
+    EXPECT_FLOAT_EQ(400.0f, body.getMass());
+    EXPECT_NEAR(15.0f, body.getCenterMass().x, 1e-4f);
+    EXPECT_NEAR(2 * 200.0f * (100 + 400) / 12 + 400.0f * 25, body.getInertia(), 1e-1f);
+
+    auto circle = Body(BodySpec());
+    circle.addShape(CircleShape(1, 2));
+    EXPECT_EQ(0.0f, circle.getMass());
+}
+
+TEST(WorldTest, ShouldRestBoxOnGround)
+{
+    World world({0, -50}, nullptr);
+    addGround(world);
+    auto box = world.createBody(boxSpec(BodyType::dynamicBody, {0, 20}, {5, 5})).lock();
+
+    for (int i = 0; i < 180; i++)
+        world.step(timeStep);
+
+    EXPECT_NEAR(5.0f, box->getPosition().y, 2 * linearSlop);
+    EXPECT_NEAR(0.0f, box->getPosition().x, 1e-3f);
+    EXPECT_NEAR(0.0f, box->getLinearVelocity().y, 0.1f);
+    EXPECT_NEAR(0.0f, box->getRotation(), 1e-3f);
+    // The box has come to rest, so it sleeps and its contact is no
+    // longer solved.
+    EXPECT_TRUE(box->isAsleep());
+    EXPECT_EQ(0u, world.getProfile().contacts);
+}
+
+TEST(WorldTest, ShouldWakeSleepingBodies)
+{
+    World world({0, -50}, nullptr);
+    addGround(world);
+    auto lower = world.createBody(boxSpec(BodyType::dynamicBody, {0, 5}, {5, 5})).lock();
+    auto upper = world.createBody(boxSpec(BodyType::dynamicBody, {0, 15}, {5, 5})).lock();
+    auto aside = world.createBody(boxSpec(BodyType::dynamicBody, {50, 5}, {5, 5})).lock();
+    for (int i = 0; i < 60; i++)
+        world.step(timeStep);
+    EXPECT_TRUE(lower->isAsleep());
+    EXPECT_TRUE(upper->isAsleep());
+    EXPECT_TRUE(aside->isAsleep());
+
+    // A box falling onto the stack wakes both boxes, but not the box
+    // that only shares the ground with them.
+    auto falling = world.createBody(boxSpec(BodyType::dynamicBody, {0, 30}, {5, 5})).lock();
+    bool woken = false;
+    for (int i = 0; i < 30 && !woken; i++) {
+        world.step(timeStep);
+        woken = !lower->isAsleep() && !upper->isAsleep();
+    }
+    EXPECT_TRUE(woken);
+    EXPECT_TRUE(aside->isAsleep());
+
+    // Setting the velocity wakes a body.
+    aside->setLinearVelocity({10, 0});
+    EXPECT_FALSE(aside->isAsleep());
+    world.step(timeStep);
+    EXPECT_GT(aside->getPosition().x, 50.0f);
+
+    // Whatever rested on a deleted body falls.
+    for (int i = 0; i < 120; i++)
+        world.step(timeStep);
+    ASSERT_TRUE(upper->isAsleep());
+    world.destroyBody(lower);
+    EXPECT_FALSE(upper->isAsleep());
+    const float height = upper->getPosition().y;
+    for (int i = 0; i < 20; i++)
+        world.step(timeStep);
+    EXPECT_LT(upper->getPosition().y, height - 1.0f);
+}
+
+TEST(WorldTest, ShouldStayAwakeWhenSleepingIsOff)
+{
+    World world({0, -50}, nullptr);
+    addGround(world);
+    auto box = world.createBody(boxSpec(BodyType::dynamicBody, {0, 5}, {5, 5})).lock();
+    for (int i = 0; i < 60; i++)
+        world.step(timeStep);
+    EXPECT_TRUE(box->isAsleep());
+
+    world.setAllowSleeping(false);
+    EXPECT_FALSE(box->isAsleep());
+    for (int i = 0; i < 60; i++)
+        world.step(timeStep);
+    EXPECT_FALSE(box->isAsleep());
+    EXPECT_EQ(1u, world.getProfile().contacts);
+}
+
+TEST(WorldTest, ShouldStackBoxes)
+{
+    World world({0, -50}, nullptr);
+    addGround(world);
+    const int count = 10;
+    vector<shared_ptr<Body>> boxes;
+    for (int i = 0; i < count; i++)
+        boxes.push_back(world.createBody(boxSpec(BodyType::dynamicBody,
+                                                 {0, 5.0f + 10.5f * i}, {5, 5})).lock());
+
+    for (int i = 0; i < 300; i++)
+        world.step(timeStep);
+
+    // Warm starting carries the weight of the stack between steps, so
+    // the boxes neither sink into each other nor topple.
+    for (int i = 0; i < count; i++) {
+        EXPECT_NEAR(5.0f + 10.0f * i, boxes[i]->getPosition().y, 0.2f * (i + 1));
+        EXPECT_NEAR(0.0f, boxes[i]->getPosition().x, 0.1f);
+        EXPECT_NEAR(0.0f, boxes[i]->getLinearVelocity().y, 0.5f);
+    }
+    EXPECT_LE(world.getProfile().positionIterations, 3u);
+}
+
+TEST(WorldTest, ShouldApplyFriction)
+{
+    World world({0, -50}, nullptr);
+    addGround(world);
+    auto spec = boxSpec(BodyType::dynamicBody, {0, 5}, {5, 5});
+    spec.linVelocity = {20, 0};
+    spec.friction = 0.5f;
+    auto rough = world.createBody(spec).lock();
+    spec.position = {0, 50};
+    spec.friction = 0.0f;
+    auto smooth = world.createBody(spec).lock();
+
+    for (int i = 0; i < 120; i++)
+        world.step(timeStep);
+
+    // The ground's friction of 0.2 and 0.5 give a deceleration of
+    // sqrt(0.1) * 50, which stops the box within a second.
+    EXPECT_NEAR(0.0f, rough->getLinearVelocity().x, 1e-3f);
+    EXPECT_NEAR(20.0f * 20.0f / (2 * std::sqrt(0.1f) * 50), rough->getPosition().x, 1.0f);
+    EXPECT_NEAR(20.0f, smooth->getLinearVelocity().x, 1e-3f);
+}
+
+TEST(WorldTest, ShouldBounceWithRestitution)
+{
+    World world({0, -50}, nullptr);
+    addGround(world);
+    BodySpec spec;
+    spec.bodyType = BodyType::dynamicBody;
+    spec.position = {0, 20};
+    spec.restitution = 1.0f;
+    spec.shapes.push_back(make_shared<CircleShape>(1, 5));
+    auto ball = world.createBody(spec).lock();
+
+    float highest = 0.0f;
+    bool bounced = false;
+    for (int i = 0; i < 120; i++) {
+        world.step(timeStep);
+        bounced = bounced || ball->getLinearVelocity().y > 0.0f;
+        if (bounced)
+            highest = std::max(highest, ball->getPosition().y);
+    }
+    EXPECT_TRUE(bounced);
+    // Most of the drop height comes back.
+    EXPECT_GT(highest, 17.0f);
+    EXPECT_LT(highest, 21.0f);
+}